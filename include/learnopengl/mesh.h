@@ -7,7 +7,16 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/Cache.h>
+#include <rg/DrawCalls.h>
+#include <rg/GLHandle.h>
+#include <rg/LodSelection.h>
+#include <rg/Meshlets.h>
+#include <rg/TextureArrays.h>
+#include <rg/TriangleBVH.h>
 
+#include <cstddef>
 #include <string>
 #include <vector>
 using namespace std;
@@ -31,6 +40,47 @@ struct Texture {
     unsigned int id;
     string type;
     string path;
+    // keeps the texture alive while any mesh or model refers to it
+    rg::SharedTexture handle;
+    // where the texture lives once the model moved to texture arrays (Model::UseTextureArrays)
+    unsigned int array = 0;
+    int layer = -1;
+};
+
+// The TEXTURE_ARRAYS shader variants read the layer of each material texture from the integer
+// vertex attributes starting here, one per texture type in the order below. Meshes set them as
+// constant attributes before each draw, instanced draws could stream them per instance.
+const GLuint MaterialLayerAttribute = 9;
+enum MaterialLayerSlot {
+    DiffuseLayer,
+    SpecularLayer,
+    NormalLayer,
+    HeightLayer,
+    EmissiveLayer,
+    MaterialLayerCount
+};
+
+// a level of detail of a mesh, its own range of the element buffer over the shared vertex buffer
+struct MeshLod {
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+    // simplification error relative to the diagonal of the mesh bounds, 0 for the full mesh
+    float error = 0.0f;
+};
+
+// a part of a merged mesh (rg::StaticBatch) that is culled on its own
+struct MeshRange {
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+    // bounds of the part's vertices, in the space of the mesh
+    rg::AABB bounds;
+    // what the part was made from, the instance index for static batches
+    int source = -1;
+    // levels of detail of the part, level 0 is the range itself, empty when its mesh had none
+    std::vector<MeshLod> lods;
+    // the part's meshlets in Mesh::meshlets, they split up level 0
+    unsigned int firstMeshlet = 0;
+    unsigned int meshletCount = 0;
 };
 
 class Mesh {
@@ -40,21 +90,246 @@ public:
     vector<unsigned int> indices;
     vector<Texture>      textures;
 
-    unsigned int VAO;
+    rg::GLVertexArray VAO;
+    // kept when the CPU copy of the indices is released
+    unsigned int indexCount = 0;
     std::string glslIdentifierPrefix;
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // object space bounds of the vertices
+    rg::AABB bounds;
+    // triangle BVH for ray queries, empty until BuildBVH()
+    rg::TriangleBVH bvh;
+    // binds the texture arrays once the textures moved there
+    rg::TextureArrayPool *texturePool = nullptr;
+    // parts of a merged mesh, empty for meshes loaded from a file
+    vector<MeshRange> ranges;
+    // level 0 is the full mesh, empty until Model::GenerateLods()
+    vector<MeshLod> lods;
+    // CPU copy of the coarser levels' indices, they follow indices in the element buffer
+    vector<unsigned int> lodIndices;
+    // clusters of the full mesh's triangles, each one a range of indices, empty until
+    // Model::GenerateMeshlets()
+    vector<rg::geometry::Meshlet> meshlets;
+    // constructor, upload = false leaves the GL objects to a later Upload() so a loader can
+    // build many meshes first and create their buffers together
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool upload = true)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        indexCount = this->indices.size();
+
+        for (const Vertex &vertex : this->vertices)
+            bounds.Expand(vertex.Position);
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        if (upload)
+            setupMesh();
     }
 
+    // meshes own their GL objects, they can only be moved
+    Mesh(Mesh &&) = default;
+    Mesh &operator=(Mesh &&) = default;
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+
     // render the mesh
     void Draw(Shader &shader)
+    {
+        BindTextures(shader);
+
+        // draw mesh
+        glBindVertexArray(VAO.Get());
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        rg::DrawCalls()++;
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // draws one level of detail, clamped to the coarsest one, the full mesh when there are no LODs
+    void DrawLod(Shader &shader, size_t level)
+    {
+        if (lods.empty())
+        {
+            Draw(shader);
+            return;
+        }
+        const MeshLod &lod = lods[std::min(level, lods.size() - 1)];
+        BindTextures(shader);
+        glBindVertexArray(VAO.Get());
+        glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, (const void *) (lod.firstIndex * sizeof(unsigned int)));
+        rg::DrawCalls()++;
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // draws a level choice, a cross-fade draws both levels with complementary dither patterns
+    // through the shader's lodFade uniform (positive keeps that fraction of the pixels, negative
+    // the rest of them)
+    void DrawLod(Shader &shader, const rg::LodChoice &choice)
+    {
+        if (!choice.Fading())
+        {
+            DrawLod(shader, choice.level);
+            return;
+        }
+        shader.setFloat("lodFade", std::max(choice.fade, 1.0f / 256.0f));
+        DrawLod(shader, choice.level);
+        shader.setFloat("lodFade", -std::max(choice.fade, 1.0f / 256.0f));
+        DrawLod(shader, choice.previous);
+        shader.setFloat("lodFade", 0.0f);
+    }
+
+    // puts the index lists of the coarser levels behind the full mesh's indices in the element
+    // buffer, needs the CPU indices
+    void SetLods(const vector<vector<unsigned int>> &levels, const vector<float> &errors)
+    {
+        lods.assign(1, MeshLod{0, indexCount, 0.0f});
+        lodIndices.clear();
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            lods.push_back(MeshLod{(unsigned int) (indexCount + lodIndices.size()), (unsigned int) levels[i].size(), errors[i]});
+            lodIndices.insert(lodIndices.end(), levels[i].begin(), levels[i].end());
+        }
+        uploadElements();
+    }
+
+    // takes over the meshlets and the indices reordered meshlet by meshlet, the coarser levels
+    // keep their indices. Needs the CPU indices.
+    void SetMeshlets(vector<rg::geometry::Meshlet> clusters, vector<unsigned int> ordered)
+    {
+        meshlets = std::move(clusters);
+        indices = std::move(ordered);
+        uploadElements();
+    }
+
+    // draws the meshlets visible(meshlet) accepts with a single glMultiDrawElements, meshlets that
+    // follow each other in the index buffer are joined. Nothing is bound when none is visible.
+    template<typename Visible>
+    void DrawMeshlets(Shader &shader, Visible &&visible)
+    {
+        drawCounts.clear();
+        drawOffsets.clear();
+        unsigned int end = 0;
+        for (const rg::geometry::Meshlet &meshlet : meshlets)
+            if (visible(meshlet))
+                addDraw(meshlet.firstIndex, meshlet.indexCount, end);
+        if (drawCounts.empty())
+            return;
+        BindTextures(shader);
+        glBindVertexArray(VAO.Get());
+        glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), drawCounts.size());
+        rg::DrawCalls()++;
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // draws the ranges visible(range) accepts with a single glMultiDrawElements, ranges that follow
+    // each other in the index buffer are joined. Nothing is bound when no range is visible.
+    template<typename Visible>
+    void DrawRanges(Shader &shader, Visible &&visible)
+    {
+        DrawRanges(shader, visible, [](const MeshRange &) { return rg::LodChoice(); });
+    }
+
+    // like DrawRanges above, choose(range) picks the level of each visible range. Ranges in a
+    // cross-fade are left out of the multi-draw and drawn one by one with their two dithered levels.
+    template<typename Visible, typename Choose>
+    void DrawRanges(Shader &shader, Visible &&visible, Choose &&choose)
+    {
+        DrawRanges(shader, visible, choose, nullptr);
+    }
+
+    // like DrawRanges above, ranges drawn at level 0 and not in a cross-fade are split up into their
+    // meshlets and only the ones meshletVisible(range, meshlet) accepts are drawn. nullptr draws
+    // the ranges whole.
+    template<typename Visible, typename Choose, typename MeshletVisible>
+    void DrawRanges(Shader &shader, Visible &&visible, Choose &&choose, MeshletVisible &&meshletVisible)
+    {
+        drawCounts.clear();
+        drawOffsets.clear();
+        fading.clear();
+        unsigned int end = 0;
+        for (const MeshRange &range : ranges)
+        {
+            if (!visible(range))
+                continue;
+            rg::LodChoice choice = choose(range);
+            if (choice.Fading())
+            {
+                fading.push_back(std::make_pair(&range, choice));
+                continue;
+            }
+            if (choice.level == 0 && range.meshletCount > 0 && testsMeshlets(meshletVisible))
+            {
+                for (unsigned int i = range.firstMeshlet; i < range.firstMeshlet + range.meshletCount; i++)
+                    if (callMeshletVisible(meshletVisible, range, meshlets[i]))
+                        addDraw(meshlets[i].firstIndex, meshlets[i].indexCount, end);
+                continue;
+            }
+            MeshLod lod = rangeLod(range, choice.level);
+            addDraw(lod.firstIndex, lod.indexCount, end);
+        }
+        if (drawCounts.empty() && fading.empty())
+            return;
+        BindTextures(shader);
+        glBindVertexArray(VAO.Get());
+        if (!drawCounts.empty())
+        {
+            glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), drawCounts.size());
+            rg::DrawCalls()++;
+        }
+        for (const auto &range : fading)
+        {
+            float fade = std::max(range.second.fade, 1.0f / 256.0f);
+            for (int side = 0; side < 2; side++)
+            {
+                MeshLod lod = rangeLod(*range.first, side == 0 ? range.second.level : range.second.previous);
+                shader.setFloat("lodFade", side == 0 ? fade : -fade);
+                glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, (const void *) (lod.firstIndex * sizeof(unsigned int)));
+                rg::DrawCalls()++;
+            }
+        }
+        if (!fading.empty())
+            shader.setFloat("lodFade", 0.0f);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // frees the CPU copy of the vertices and indices once they live in the GPU buffers,
+    // everything reading them (BVH build, occluders, merged buffers) has to run before
+    void ReleaseGeometry()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+        vector<unsigned int>().swap(lodIndices);
+    }
+
+    bool HasGeometry() const
+    {
+        return !indices.empty();
+    }
+
+    void BuildBVH()
+    {
+        vector<glm::vec3> positions(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+            positions[i] = vertices[i].Position;
+        bvh.Build(positions, indices);
+    }
+
+    // identifies the geometry the BVH was built from
+    uint64_t GeometryHash() const
+    {
+        uint64_t hash = rg::cache::Hash(vertices.data(), vertices.size() * sizeof(Vertex));
+        return rg::cache::Hash(indices.data(), indices.size() * sizeof(unsigned int), hash);
+    }
+
+    // binds the mesh textures to consecutive units and points the shader samplers at them. Textures
+    // moved to arrays bind their array, which the pool skips when it's bound already, and pass
+    // their layer through the material layer attributes.
+    void BindTextures(Shader &shader)
     {
         // bind appropriate textures
         unsigned int diffuseNr  = 1;
@@ -62,9 +337,11 @@ public:
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
         unsigned int emissiveNr   = 1;
+        if (texturePool)
+            for (int slot = 0; slot < MaterialLayerCount; slot++)
+                glVertexAttribI1i(MaterialLayerAttribute + slot, 0);
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -81,43 +358,53 @@ public:
 
             // now set the sampler to the correct texture unit
             glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
+            if (texturePool && textures[i].layer >= 0)
+            {
+                texturePool->Bind(i, textures[i].array);
+                // only the first texture of a type has a layer attribute
+                int slot = layerSlot(name);
+                if (slot >= 0 && number == "1")
+                    glVertexAttribI1i(MaterialLayerAttribute + slot, textures[i].layer);
+                continue;
+            }
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            // recency for the eviction of material textures
+            rg::GpuMemory::Instance().Touch(textures[i].id);
         }
-
-
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
+    // material layer attribute of a texture type, -1 for types the shaders don't know
+    static int layerSlot(const string &type)
+    {
+        static const char *types[MaterialLayerCount] = {"texture_diffuse", "texture_specular", "texture_normal",
+                                                         "texture_height", "texture_emissive"};
+        for (int slot = 0; slot < MaterialLayerCount; slot++)
+            if (type == types[slot])
+                return slot;
+        return -1;
+    }
 
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // fills the given, freshly generated vertex array and buffers with the mesh data and takes them over
+    void Upload(rg::GLVertexArray vertexArray, rg::GLBuffer vertexBuffer, rg::GLBuffer elementBuffer)
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        VAO = std::move(vertexArray);
+        VBO = std::move(vertexBuffer);
+        EBO = std::move(elementBuffer);
 
-        glBindVertexArray(VAO);
+        glBindVertexArray(VAO.Get());
         // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO.Get());
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        rg::GpuMemory::Instance().TrackBuffer(VBO.Get(), rg::GpuMemory::ModelGeometry, vertices.size() * sizeof(Vertex));
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.Get());
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        rg::GpuMemory::Instance().TrackBuffer(EBO.Get(), rg::GpuMemory::ModelGeometry, indices.size() * sizeof(unsigned int));
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -138,5 +425,66 @@ private:
 
         glBindVertexArray(0);
     }
+
+private:
+    // render data
+    rg::GLBuffer VBO, EBO;
+    // index counts and offsets of the joined visible ranges, reused by DrawRanges() and DrawMeshlets()
+    vector<GLsizei> drawCounts;
+    vector<const void *> drawOffsets;
+    // ranges in a cross-fade, drawn after the multi-draw
+    vector<std::pair<const MeshRange *, rg::LodChoice>> fading;
+
+    // appends a draw to drawCounts and drawOffsets, joined with the one before when it follows it
+    void addDraw(unsigned int firstIndex, unsigned int count, unsigned int &end)
+    {
+        if (!drawCounts.empty() && firstIndex == end)
+            drawCounts.back() += count;
+        else
+        {
+            drawCounts.push_back(count);
+            drawOffsets.push_back((const void *) (firstIndex * sizeof(unsigned int)));
+        }
+        end = firstIndex + count;
+    }
+
+    static bool testsMeshlets(std::nullptr_t) { return false; }
+    template<typename MeshletVisible>
+    static bool testsMeshlets(const MeshletVisible &) { return true; }
+
+    static bool callMeshletVisible(std::nullptr_t, const MeshRange &, const rg::geometry::Meshlet &) { return true; }
+    template<typename MeshletVisible>
+    static bool callMeshletVisible(MeshletVisible &meshletVisible, const MeshRange &range, const rg::geometry::Meshlet &meshlet)
+    {
+        return meshletVisible(range, meshlet);
+    }
+
+    // uploads the full mesh's indices followed by the coarser levels' into the element buffer
+    void uploadElements()
+    {
+        vector<unsigned int> elements(indices);
+        elements.insert(elements.end(), lodIndices.begin(), lodIndices.end());
+        // the element buffer binding belongs to the vertex array
+        glBindVertexArray(VAO.Get());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.Get());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(unsigned int), elements.data(), GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        rg::GpuMemory::Instance().TrackBuffer(EBO.Get(), rg::GpuMemory::ModelGeometry, elements.size() * sizeof(unsigned int));
+    }
+
+    // level of a range, clamped to its coarsest one
+    static MeshLod rangeLod(const MeshRange &range, int level)
+    {
+        if (range.lods.empty())
+            return MeshLod{range.firstIndex, range.indexCount, 0.0f};
+        return range.lods[std::min((size_t) std::max(level, 0), range.lods.size() - 1)];
+    }
+
+    // initializes all the buffer objects/arrays
+    void setupMesh()
+    {
+        // create buffers/arrays
+        Upload(rg::GLVertexArray::Create(), rg::GLBuffer::Create(), rg::GLBuffer::Create());
+    }
 };
 #endif
\ No newline at end of file
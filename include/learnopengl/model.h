@@ -12,6 +12,14 @@
 
 #include <learnopengl/mesh.h>
 #include <learnopengl/shader.h>
+#include <rg/MappedFile.h>
+#include <rg/MeshProcessing.h>
+#include <rg/MeshSimplification.h>
+#include <rg/Meshlets.h>
+#include <rg/ObjLoader.h>
+#include <rg/TextureCompression.h>
+#include <rg/TextureQuality.h>
+#include <rg/TextureStreaming.h>
 
 #include <string>
 #include <fstream>
@@ -21,9 +29,31 @@
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
-
+rg::GLTexture TextureFromFile(const char *path, const string &directory, bool gamma = false,
+                              rg::texture::Usage usage = rg::texture::Usage::Color);
+
+// closest triangle hit by Model::Raycast, in the model's object space
+struct ModelHit {
+    float t = FLT_MAX;
+    int mesh = -1;
+    int triangle = -1;
+    // barycentric weights of the triangle's three vertices
+    glm::vec3 barycentrics = glm::vec3(0.0f);
+    glm::vec2 uv = glm::vec2(0.0f);
+    glm::vec3 position = glm::vec3(0.0f);
+
+    bool Hit() const {
+        return mesh >= 0;
+    }
+};
 
+// what happens to the CPU copy of the vertices and indices once the meshes are uploaded
+enum class GeometryPolicy {
+    // kept for BVH rebuilds, occluders, merged instancing buffers and picking UVs
+    Keep,
+    // the triangle BVHs are built during loading, then the geometry is freed
+    ReleaseAfterUpload
+};
 
 class Model
 {
@@ -31,13 +61,26 @@ public:
     // model data
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
+    string path;
     string directory;
     bool gammaCorrection;
+    // object space bounds of all meshes
+    rg::AABB bounds;
+    GeometryPolicy geometryPolicy;
+    // object space error of each level of detail, the largest of any mesh, empty without LODs
+    vector<float> lodObjectErrors;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const &path, bool gamma = false, GeometryPolicy geometryPolicy = GeometryPolicy::Keep)
+        : gammaCorrection(gamma), geometryPolicy(geometryPolicy)
     {
         loadModel(path);
+        if (geometryPolicy == GeometryPolicy::ReleaseAfterUpload)
+        {
+            BuildBVH();
+            for (Mesh &mesh : meshes)
+                mesh.ReleaseGeometry();
+        }
     }
 
     // draws the model, and thus all its meshes
@@ -47,18 +90,316 @@ public:
             meshes[i].Draw(shader);
     }
 
+    // draws every mesh at a level picked by rg::LodSelector, the full meshes without LODs
+    void DrawLod(Shader &shader, const rg::LodChoice &choice)
+    {
+        for (Mesh &mesh : meshes)
+            mesh.DrawLod(shader, choice);
+    }
+
+    // draws the meshlets of every mesh that visible(meshlet) accepts, meshes without meshlets whole
+    template<typename Visible>
+    void DrawMeshlets(Shader &shader, Visible &&visible)
+    {
+        for (Mesh &mesh : meshes)
+        {
+            if (mesh.meshlets.empty())
+                mesh.Draw(shader);
+            else
+                mesh.DrawMeshlets(shader, visible);
+        }
+    }
+
     void SetShaderTextureNamePrefix(std::string prefix) {
         for (Mesh& mesh: meshes) {
             mesh.glslIdentifierPrefix = prefix;
         }
     }
+
+    // queues the textures of all meshes in a texture array pool, false when one of them can't go there
+    bool AddTextures(rg::TextureArrayPool &pool)
+    {
+        bool all = true;
+        for (const Texture &texture : textures_loaded)
+            all = pool.Add(texture.id) && all;
+        return all;
+    }
+
+    // switches the meshes to the layers of a built pool and lets go of the 2D textures. Textures
+    // the pool couldn't take, which only happens when they failed to load, are dropped from the
+    // meshes. Drawing then needs the TEXTURE_ARRAYS shader variants.
+    void UseTextureArrays(rg::TextureArrayPool &pool)
+    {
+        for (Mesh &mesh : meshes)
+        {
+            vector<Texture> pooled;
+            for (Texture &texture : mesh.textures)
+            {
+                rg::TextureArrayPool::Layer layer = pool.Find(texture.id);
+                if (!layer.Valid())
+                    continue;
+                texture.array = layer.array;
+                texture.layer = layer.index;
+                texture.id = 0;
+                texture.handle.reset();
+                pooled.push_back(std::move(texture));
+            }
+            mesh.textures = std::move(pooled);
+            mesh.texturePool = &pool;
+        }
+        textures_loaded.clear();
+    }
+
+    // builds the triangle BVHs of all meshes, or loads them from the cache when the geometry didn't change
+    void BuildBVH()
+    {
+        // released geometry had its BVHs built while loading
+        for (const Mesh &mesh : meshes)
+            if (!mesh.HasGeometry())
+                return;
+
+        static const char magic[8] = {'R', 'G', 'T', 'B', 'V', 'H', '0', '1'};
+        uint64_t hash = meshes.size();
+        for (const Mesh &mesh : meshes)
+            hash = rg::cache::Hash(&hash, sizeof(hash), mesh.GeometryHash());
+
+        string cachePath = rg::cache::PathFor(path, "bvh");
+        ifstream in(cachePath, ios::binary);
+        if (in) {
+            char fileMagic[8];
+            uint64_t fileHash = 0;
+            in.read(fileMagic, sizeof(fileMagic));
+            in.read((char *) &fileHash, sizeof(fileHash));
+            bool valid = in && std::equal(magic, magic + 8, fileMagic) && fileHash == hash;
+            for (size_t i = 0; valid && i < meshes.size(); i++)
+                valid = meshes[i].bvh.Read(in, meshes[i].indices.size() / 3);
+            if (valid)
+                return;
+        }
+
+        for (Mesh &mesh : meshes)
+            mesh.BuildBVH();
+        ofstream out(cachePath, ios::binary);
+        out.write(magic, sizeof(magic));
+        out.write((const char *) &hash, sizeof(hash));
+        for (const Mesh &mesh : meshes)
+            mesh.bvh.Write(out);
+        if (!out)
+            cout << "Failed to write BVH cache " << cachePath << endl;
+    }
+
+    // errors the LODs after the full mesh are simplified to, relative to the diagonal of the mesh bounds
+    static const vector<float> &LodErrors()
+    {
+        static const vector<float> errors = {0.002f, 0.008f, 0.03f};
+        return errors;
+    }
+
+    // simplifies a mesh into the levels of LodErrors(), each one continuing from the one before.
+    // errors gets the error each level actually reached.
+    static void SimplifyMesh(const Mesh &mesh, vector<vector<unsigned int>> &levels, vector<float> &errors)
+    {
+        levels.clear();
+        errors.clear();
+        // corners with the same position, normal and UV are one vertex to the simplifier
+        rg::geometry::Simplifier simplifier(mesh.vertices.data(), mesh.vertices.size(), sizeof(Vertex),
+                                            offsetof(Vertex, Tangent), mesh.indices);
+        for (float error : LodErrors())
+        {
+            errors.push_back(simplifier.Simplify(error));
+            levels.push_back(simplifier.Indices());
+        }
+    }
+
+    // adds the LODs of LodErrors() to every mesh, loaded from the cache when the geometry didn't
+    // change. They share the vertex buffer of their mesh and go into its element buffer, so the
+    // CPU geometry has to be there (GeometryPolicy::Keep).
+    void GenerateLods()
+    {
+        for (const Mesh &mesh : meshes)
+            if (!mesh.HasGeometry())
+            {
+                cout << "GenerateLods: " << path << " released its geometry" << endl;
+                return;
+            }
+
+        static const char magic[8] = {'R', 'G', 'L', 'O', 'D', '0', '0', '1'};
+        uint64_t hash = meshes.size();
+        for (const Mesh &mesh : meshes)
+            hash = rg::cache::Hash(&hash, sizeof(hash), mesh.GeometryHash());
+        hash = rg::cache::Hash(LodErrors().data(), LodErrors().size() * sizeof(float), hash);
+
+        vector<vector<vector<unsigned int>>> levels(meshes.size());
+        vector<vector<float>> errors(meshes.size());
+        string cachePath = rg::cache::PathFor(path, "lod");
+        ifstream in(cachePath, ios::binary);
+        bool valid = false;
+        if (in) {
+            char fileMagic[8];
+            uint64_t fileHash = 0;
+            in.read(fileMagic, sizeof(fileMagic));
+            in.read((char *) &fileHash, sizeof(fileHash));
+            valid = in && std::equal(magic, magic + 8, fileMagic) && fileHash == hash;
+            for (size_t i = 0; valid && i < meshes.size(); i++)
+                valid = readLods(in, meshes[i], levels[i], errors[i]);
+        }
+
+        if (!valid) {
+            forEachMesh(meshes.size(), [&](size_t i, rg::ThreadPool &) {
+                SimplifyMesh(meshes[i], levels[i], errors[i]);
+            });
+            ofstream out(cachePath, ios::binary);
+            out.write(magic, sizeof(magic));
+            out.write((const char *) &hash, sizeof(hash));
+            for (size_t i = 0; i < meshes.size(); i++)
+                writeLods(out, levels[i], errors[i]);
+            if (!out)
+                cout << "Failed to write LOD cache " << cachePath << endl;
+        }
+        lodObjectErrors.assign(LodErrors().size() + 1, 0.0f);
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            Mesh &mesh = meshes[i];
+            mesh.SetLods(levels[i], errors[i]);
+            float diagonal = glm::length(mesh.bounds.max - mesh.bounds.min);
+            for (size_t level = 0; level < mesh.lods.size(); level++)
+                lodObjectErrors[level] = std::max(lodObjectErrors[level], mesh.lods[level].error * diagonal);
+        }
+        if (meshes.empty())
+            lodObjectErrors.clear();
+    }
+
+    // splits every mesh into meshlets and reorders its indices meshlet by meshlet, loaded from the
+    // cache when the geometry didn't change. The reorder changes the geometry hash, so it runs
+    // before BuildBVH() and GenerateLods() and their caches stay valid from the second run on.
+    void GenerateMeshlets()
+    {
+        for (const Mesh &mesh : meshes)
+            if (!mesh.HasGeometry())
+            {
+                cout << "GenerateMeshlets: " << path << " released its geometry" << endl;
+                return;
+            }
+
+        static const char magic[8] = {'R', 'G', 'M', 'S', 'H', 'L', '0', '1'};
+        uint64_t hash = meshes.size();
+        for (const Mesh &mesh : meshes)
+            hash = rg::cache::Hash(&hash, sizeof(hash), mesh.GeometryHash());
+
+        vector<vector<rg::geometry::Meshlet>> meshlets(meshes.size());
+        vector<vector<unsigned int>> ordered(meshes.size());
+        string cachePath = rg::cache::PathFor(path, "meshlets");
+        ifstream in(cachePath, ios::binary);
+        bool valid = false;
+        if (in) {
+            char fileMagic[8];
+            uint64_t fileHash = 0;
+            in.read(fileMagic, sizeof(fileMagic));
+            in.read((char *) &fileHash, sizeof(fileHash));
+            valid = in && std::equal(magic, magic + 8, fileMagic) && fileHash == hash;
+            for (size_t i = 0; valid && i < meshes.size(); i++)
+                valid = readMeshlets(in, meshes[i], meshlets[i], ordered[i]);
+        }
+
+        if (!valid) {
+            forEachMesh(meshes.size(), [&](size_t i, rg::ThreadPool &) {
+                const Mesh &mesh = meshes[i];
+                meshlets[i] = rg::geometry::BuildMeshlets(mesh.vertices.data(), mesh.vertices.size(), sizeof(Vertex),
+                                                          mesh.indices, ordered[i]);
+            });
+            ofstream out(cachePath, ios::binary);
+            out.write(magic, sizeof(magic));
+            out.write((const char *) &hash, sizeof(hash));
+            for (size_t i = 0; i < meshes.size(); i++)
+                writeMeshlets(out, meshlets[i], ordered[i]);
+            if (!out)
+                cout << "Failed to write meshlet cache " << cachePath << endl;
+        }
+        for (size_t i = 0; i < meshes.size(); i++)
+            meshes[i].SetMeshlets(std::move(meshlets[i]), std::move(ordered[i]));
+    }
+
+    size_t MeshletCount() const
+    {
+        size_t count = 0;
+        for (const Mesh &mesh : meshes)
+            count += mesh.meshlets.size();
+        return count;
+    }
+
+    // exact closest hit against the triangles, BuildBVH() has to be called first
+    ModelHit Raycast(const rg::Ray &ray, float maxT = FLT_MAX) const
+    {
+        ModelHit hit;
+        hit.t = maxT;
+        glm::vec3 inverseDirection = 1.0f / ray.direction;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const Mesh &mesh = meshes[i];
+            float tEntry;
+            if (!mesh.bounds.Intersect(ray.origin, inverseDirection, hit.t, tEntry))
+                continue;
+            rg::TriangleHit triangleHit = mesh.bvh.Intersect(ray, hit.t);
+            if (!triangleHit.Hit())
+                continue;
+            hit.t = triangleHit.t;
+            hit.mesh = i;
+            hit.triangle = triangleHit.triangle;
+            hit.barycentrics = glm::vec3(1.0f - triangleHit.u - triangleHit.v, triangleHit.u, triangleHit.v);
+        }
+        if (!hit.Hit())
+        {
+            hit.t = FLT_MAX;
+            return hit;
+        }
+        hit.position = ray.At(hit.t);
+        const Mesh &mesh = meshes[hit.mesh];
+        if (!mesh.HasGeometry())
+            return hit;
+        const Vertex &a = mesh.vertices[mesh.indices[3 * hit.triangle]];
+        const Vertex &b = mesh.vertices[mesh.indices[3 * hit.triangle + 1]];
+        const Vertex &c = mesh.vertices[mesh.indices[3 * hit.triangle + 2]];
+        hit.uv = a.TexCoords * hit.barycentrics.x + b.TexCoords * hit.barycentrics.y + c.TexCoords * hit.barycentrics.z;
+        return hit;
+    }
 private:
+    // vertex and index data of one mesh, produced off the GL thread
+    struct MeshGeometry {
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+    };
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // .obj files go through the multithreaded rg::obj importer, which produces the same meshes much faster.
+    // Normals (when the file has none) and tangents come from the rg::geometry kernels in both cases.
+    // Loading runs in two phases: the geometry of all meshes is built in parallel, then the GL
+    // thread loads the textures and uploads every mesh in one batch.
     void loadModel(string const &path)
     {
+        if (path.size() > 4 && (path.compare(path.size() - 4, 4, ".obj") == 0 || path.compare(path.size() - 4, 4, ".OBJ") == 0))
+        {
+            rg::obj::Scene scene;
+            if (rg::obj::Load(path, scene, 0))
+            {
+                this->path = path;
+                directory = path.substr(0, path.find_last_of('/'));
+                vector<MeshGeometry> geometry(scene.meshes.size());
+                forEachMesh(geometry.size(), [&](size_t i, rg::ThreadPool &pool) {
+                    geometry[i] = processMesh(scene.meshes[i], pool);
+                });
+                meshes.reserve(geometry.size());
+                for (size_t i = 0; i < geometry.size(); i++)
+                    meshes.emplace_back(std::move(geometry[i].vertices), std::move(geometry[i].indices),
+                                        processMaterial(scene.materials[scene.meshes[i].material]), false);
+                uploadMeshes();
+                return;
+            }
+            cout << "OBJ importer can't handle " << path << ", falling back to Assimp" << endl;
+        }
+
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
@@ -66,102 +407,235 @@ private:
             return;
         }
         // retrieve the directory path of the filepath
+        this->path = path;
         directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        vector<const aiMesh *> sceneMeshes;
+        vector<aiMatrix4x4> meshTransforms;
+        processNode(scene->mRootNode, scene, aiMatrix4x4(), sceneMeshes, meshTransforms);
+
+        vector<MeshGeometry> geometry(sceneMeshes.size());
+        forEachMesh(geometry.size(), [&](size_t i, rg::ThreadPool &pool) {
+            geometry[i] = processMesh(sceneMeshes[i], meshTransforms[i], pool);
+        });
+        meshes.reserve(geometry.size());
+        for (size_t i = 0; i < geometry.size(); i++)
+            meshes.emplace_back(std::move(geometry[i].vertices), std::move(geometry[i].indices),
+                                processMaterial(scene->mMaterials[sceneMeshes[i]->mMaterialIndex]), false);
+        uploadMeshes();
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // processes a node in a recursive fashion. Collects each individual mesh located at the node together with
+    // the node's transform relative to the root and repeats this process on its children nodes (if any).
+    void processNode(aiNode *node, const aiScene *scene, const aiMatrix4x4 &parentTransform,
+                     vector<const aiMesh *> &sceneMeshes, vector<aiMatrix4x4> &meshTransforms)
     {
-        // process each mesh located at the current node
+        aiMatrix4x4 transform = parentTransform * node->mTransformation;
+        // collect each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+            meshTransforms.push_back(transform);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, transform, sceneMeshes, meshTransforms);
+        }
+
+    }
+
+    // Runs body(i, pool) for every mesh. With at least as many meshes as threads the meshes are
+    // spread over the shared pool and the kernels inside run serially, otherwise the meshes go
+    // one after another and the kernels get the pool.
+    template<typename Body>
+    static void forEachMesh(size_t count, Body &&body)
+    {
+        rg::ThreadPool &pool = rg::ThreadPool::Shared();
+        if (count >= pool.Size())
+            pool.ParallelFor(count, [&](size_t i) { body(i, rg::ThreadPool::Serial()); });
+        else
+            for (size_t i = 0; i < count; i++)
+                body(i, pool);
+    }
+
+    // a level count, then per level its error, index count and indices
+    static void writeLods(ostream &out, const vector<vector<unsigned int>> &levels, const vector<float> &errors)
+    {
+        uint32_t count = levels.size();
+        out.write((const char *) &count, sizeof(count));
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            uint32_t indexCount = levels[i].size();
+            out.write((const char *) &errors[i], sizeof(float));
+            out.write((const char *) &indexCount, sizeof(indexCount));
+            out.write((const char *) levels[i].data(), levels[i].size() * sizeof(unsigned int));
+        }
+    }
+
+    // false for a truncated file or indices past the mesh's vertices
+    static bool readLods(istream &in, const Mesh &mesh, vector<vector<unsigned int>> &levels, vector<float> &errors)
+    {
+        uint32_t count = 0;
+        if (!in.read((char *) &count, sizeof(count)) || count != LodErrors().size())
+            return false;
+        levels.resize(count);
+        errors.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t indexCount = 0;
+            in.read((char *) &errors[i], sizeof(float));
+            if (!in.read((char *) &indexCount, sizeof(indexCount)) || indexCount > mesh.indices.size())
+                return false;
+            levels[i].resize(indexCount);
+            if (!in.read((char *) levels[i].data(), indexCount * sizeof(unsigned int)))
+                return false;
+            for (unsigned int index : levels[i])
+                if (index >= mesh.vertices.size())
+                    return false;
         }
+        return true;
+    }
+
+    // a meshlet count and the meshlets, then the reordered indices
+    static void writeMeshlets(ostream &out, const vector<rg::geometry::Meshlet> &meshlets, const vector<unsigned int> &ordered)
+    {
+        uint32_t count = meshlets.size();
+        out.write((const char *) &count, sizeof(count));
+        out.write((const char *) meshlets.data(), meshlets.size() * sizeof(rg::geometry::Meshlet));
+        out.write((const char *) ordered.data(), ordered.size() * sizeof(unsigned int));
+    }
+
+    // false for a truncated file or meshlets that don't cover the mesh's indices
+    static bool readMeshlets(istream &in, const Mesh &mesh, vector<rg::geometry::Meshlet> &meshlets, vector<unsigned int> &ordered)
+    {
+        uint32_t count = 0;
+        if (!in.read((char *) &count, sizeof(count)) || count > mesh.indices.size() / 3)
+            return false;
+        meshlets.resize(count);
+        ordered.resize(mesh.indices.size());
+        if (!in.read((char *) meshlets.data(), count * sizeof(rg::geometry::Meshlet)) ||
+            !in.read((char *) ordered.data(), ordered.size() * sizeof(unsigned int)))
+            return false;
+        size_t end = 0;
+        for (const rg::geometry::Meshlet &meshlet : meshlets)
+        {
+            if (meshlet.firstIndex != end)
+                return false;
+            end += meshlet.indexCount;
+        }
+        for (unsigned int index : ordered)
+            if (index >= mesh.vertices.size())
+                return false;
+        return end == ordered.size();
+    }
 
+    // generates the GL objects of all meshes with one call each and uploads the data
+    void uploadMeshes()
+    {
+        vector<unsigned int> vertexArrays(meshes.size()), buffers(2 * meshes.size());
+        if (!meshes.empty())
+        {
+            glGenVertexArrays(vertexArrays.size(), vertexArrays.data());
+            glGenBuffers(buffers.size(), buffers.data());
+        }
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshes[i].Upload(rg::GLVertexArray(vertexArrays[i]), rg::GLBuffer(buffers[2 * i]), rg::GLBuffer(buffers[2 * i + 1]));
+            bounds.Expand(meshes[i].bounds);
+        }
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // CPU side of processing a mesh, safe to run on any thread. The temporary buffers come from
+    // an arena sized for the mesh, the results are allocated at their exact size. The transform of
+    // the mesh's node is baked into the vertices.
+    static MeshGeometry processMesh(const aiMesh *mesh, const aiMatrix4x4 &transform, rg::ThreadPool &pool)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        rg::Arena arena(rg::geometry::ArenaBytes(mesh->mNumVertices, mesh->mNumFaces));
+        rg::geometry::VertexStreams streams(arena, mesh->mNumVertices);
+        MeshGeometry geometry;
 
-        // walk through each of the mesh's vertices
+        // copy the vertex attributes into separate streams for the normal and tangent kernels
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
-            glm::vec3 vector; // we declare a placeholder vector since assimp_ uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-            // positions
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-            vertex.Position = vector;
-            // normals
+            streams.px[i] = mesh->mVertices[i].x;
+            streams.py[i] = mesh->mVertices[i].y;
+            streams.pz[i] = mesh->mVertices[i].z;
             if (mesh->HasNormals())
             {
-                vector.x = mesh->mNormals[i].x;
-                vector.y = mesh->mNormals[i].y;
-                vector.z = mesh->mNormals[i].z;
-                vertex.Normal = vector;
+                streams.nx[i] = mesh->mNormals[i].x;
+                streams.ny[i] = mesh->mNormals[i].y;
+                streams.nz[i] = mesh->mNormals[i].z;
             }
-            // texture coordinates
-            if(mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+            // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
+            // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
+            if (mesh->mTextureCoords[0])
             {
-                glm::vec2 vec;
-                // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
-                // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
-                // tangent
-                vector.x = mesh->mTangents[i].x;
-                vector.y = mesh->mTangents[i].y;
-                vector.z = mesh->mTangents[i].z;
-                vertex.Tangent = vector;
-                // bitangent
-                vector.x = mesh->mBitangents[i].x;
-                vector.y = mesh->mBitangents[i].y;
-                vector.z = mesh->mBitangents[i].z;
-                vertex.Bitangent = vector;
+                streams.u[i] = mesh->mTextureCoords[0][i].x;
+                streams.v[i] = mesh->mTextureCoords[0][i].y;
             }
-            else
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-
-            vertices.push_back(vertex);
-
-
         }
+        if (!transform.IsIdentity())
+            transformStreams(streams, mesh->mNumVertices, transform, mesh->HasNormals());
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        geometry.indices.reserve(3 * mesh->mNumFaces);
         for(unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace &face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
             for(unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+                geometry.indices.push_back(face.mIndices[j]);
+        }
+        geometry.vertices = buildVertices(streams, geometry.indices, mesh->HasNormals(), mesh->mTextureCoords[0] != nullptr, arena, pool);
+        return geometry;
+    }
+
+    // moves the positions by a node transform and turns the normals with its inverse transpose, which
+    // is the cofactor matrix up to a scale. Tangents are derived from the result afterwards.
+    static void transformStreams(rg::geometry::VertexStreams &streams, size_t count, const aiMatrix4x4 &m, bool normals)
+    {
+        const float cofactors[3][3] = {
+                {m.b2 * m.c3 - m.b3 * m.c2, m.b3 * m.c1 - m.b1 * m.c3, m.b1 * m.c2 - m.b2 * m.c1},
+                {m.c2 * m.a3 - m.c3 * m.a2, m.c3 * m.a1 - m.c1 * m.a3, m.c1 * m.a2 - m.c2 * m.a1},
+                {m.a2 * m.b3 - m.a3 * m.b2, m.a3 * m.b1 - m.a1 * m.b3, m.a1 * m.b2 - m.a2 * m.b1}};
+        // a mirroring transform has a negative determinant, which would flip the cofactor normals
+        float determinant = m.a1 * cofactors[0][0] + m.a2 * cofactors[0][1] + m.a3 * cofactors[0][2];
+        float sign = determinant < 0.0f ? -1.0f : 1.0f;
+        for (size_t i = 0; i < count; i++)
+        {
+            float x = streams.px[i], y = streams.py[i], z = streams.pz[i];
+            streams.px[i] = m.a1 * x + m.a2 * y + m.a3 * z + m.a4;
+            streams.py[i] = m.b1 * x + m.b2 * y + m.b3 * z + m.b4;
+            streams.pz[i] = m.c1 * x + m.c2 * y + m.c3 * z + m.c4;
+            if (!normals)
+                continue;
+            glm::vec3 n(streams.nx[i], streams.ny[i], streams.nz[i]);
+            glm::vec3 normal(cofactors[0][0] * n.x + cofactors[0][1] * n.y + cofactors[0][2] * n.z,
+                             cofactors[1][0] * n.x + cofactors[1][1] * n.y + cofactors[1][2] * n.z,
+                             cofactors[2][0] * n.x + cofactors[2][1] * n.y + cofactors[2][2] * n.z);
+            float normalLength = glm::length(normal);
+            if (normalLength > 0.0f)
+                normal *= sign / normalLength;
+            streams.nx[i] = normal.x;
+            streams.ny[i] = normal.y;
+            streams.nz[i] = normal.z;
         }
-        // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+    }
+
+    // GL side of processing a mesh: loads the textures of its material
+    vector<Texture> processMaterial(aiMaterial *material)
+    {
+        vector<Texture> textures;
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
         // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
         // Same applies to other texture as the following list summarizes:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
-        aiColor3D color(0.0f, 0.0f, 0.0f);
-        material->Get(AI_MATKEY_COLOR_AMBIENT, color);
-
 
         // 1. diffuse maps
         vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
@@ -176,10 +650,83 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
+        return textures;
+    }
+
+    // same as above for a mesh from the OBJ importer, its indices are moved out and the rest of
+    // its data freed as soon as it's copied so the imported scene doesn't add to the peak
+    static MeshGeometry processMesh(rg::obj::Mesh &mesh, rg::ThreadPool &pool)
+    {
+        rg::Arena arena(rg::geometry::ArenaBytes(mesh.positions.size(), mesh.indices.size() / 3));
+        rg::geometry::VertexStreams streams(arena, mesh.positions.size());
+        for (size_t i = 0; i < mesh.positions.size(); i++)
+        {
+            streams.px[i] = mesh.positions[i].x;
+            streams.py[i] = mesh.positions[i].y;
+            streams.pz[i] = mesh.positions[i].z;
+            if (!mesh.normals.empty())
+            {
+                streams.nx[i] = mesh.normals[i].x;
+                streams.ny[i] = mesh.normals[i].y;
+                streams.nz[i] = mesh.normals[i].z;
+            }
+            if (!mesh.texCoords.empty())
+            {
+                streams.u[i] = mesh.texCoords[i].x;
+                streams.v[i] = mesh.texCoords[i].y;
+            }
+        }
+        bool hasNormals = !mesh.normals.empty(), hasTexCoords = !mesh.texCoords.empty();
+        vector<glm::vec3>().swap(mesh.positions);
+        vector<glm::vec3>().swap(mesh.normals);
+        vector<glm::vec2>().swap(mesh.texCoords);
+        MeshGeometry geometry;
+        geometry.indices = std::move(mesh.indices);
+        geometry.vertices = buildVertices(streams, geometry.indices, hasNormals, hasTexCoords, arena, pool);
+        return geometry;
+    }
+
+    // the material texture types map like Assimp maps them
+    vector<Texture> processMaterial(const rg::obj::Material &material)
+    {
+        vector<Texture> textures;
+        struct Map {
+            const string *file;
+            const char *typeName;
+            aiTextureType type;
+        };
+        const Map maps[] = {
+                {&material.diffuse, "texture_diffuse", aiTextureType_DIFFUSE},
+                {&material.specular, "texture_specular", aiTextureType_SPECULAR},
+                {&material.bump, "texture_normal", aiTextureType_HEIGHT},
+                {&material.ambient, "texture_height", aiTextureType_AMBIENT}};
+        for (const Map &map : maps)
+            if (!map.file->empty())
+                textures.push_back(loadMaterialTexture(*map.file, map.typeName, usageOf(map.type)));
+        return textures;
+    }
 
+    // generates what the mesh lacks (smooth normals, tangent frames when it has texture coordinates)
+    // and interleaves the streams into the vertex layout
+    static vector<Vertex> buildVertices(rg::geometry::VertexStreams &streams, const vector<unsigned int> &indices, bool hasNormals, bool hasTexCoords,
+                                        rg::Arena &arena, rg::ThreadPool &pool)
+    {
+        if (!hasNormals)
+            rg::geometry::GenerateNormals(streams, indices, arena, pool);
+        if (hasTexCoords)
+            rg::geometry::GenerateTangents(streams, indices, arena, pool);
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        vector<Vertex> vertices(streams.Size());
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            Vertex &vertex = vertices[i];
+            vertex.Position = glm::vec3(streams.px[i], streams.py[i], streams.pz[i]);
+            vertex.Normal = glm::vec3(streams.nx[i], streams.ny[i], streams.nz[i]);
+            vertex.TexCoords = glm::vec2(streams.u[i], streams.v[i]);
+            vertex.Tangent = glm::vec3(streams.tx[i], streams.ty[i], streams.tz[i]);
+            vertex.Bitangent = glm::vec3(streams.bx[i], streams.by[i], streams.bz[i]);
+        }
+        return vertices;
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -191,43 +738,111 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(loadMaterialTexture(str.C_Str(), typeName, usageOf(type)));
         }
         return textures;
     }
+
+    // what a texture of an Assimp type holds. The OBJ bump map comes in as aiTextureType_HEIGHT and
+    // is the normal map here, the height map as aiTextureType_AMBIENT.
+    static rg::texture::Usage usageOf(aiTextureType type)
+    {
+        switch (type)
+        {
+            case aiTextureType_DIFFUSE:
+            case aiTextureType_EMISSIVE:
+                return rg::texture::Usage::Color;
+            case aiTextureType_HEIGHT:
+            case aiTextureType_NORMALS:
+                return rg::texture::Usage::NormalMap;
+            default:
+                return rg::texture::Usage::Data;
+        }
+    }
+
+    Texture loadMaterialTexture(const string &file, const string &typeName, rg::texture::Usage usage)
+    {
+        // check if texture was loaded before and if so, skip loading a new texture
+        for(unsigned int j = 0; j < textures_loaded.size(); j++)
+        {
+            if(textures_loaded[j].path == file)
+                return textures_loaded[j];
+        }
+        // if texture hasn't been loaded already, load it
+        Texture texture;
+        texture.handle = rg::Share(TextureFromFile(file.c_str(), this->directory, false, usage));
+        texture.id = texture.handle->Get();
+        texture.type = typeName;
+        texture.path = file;
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
+    }
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+// uploads a block compressed version of the image with its baked mip chain when one was converted
+// (--compress-textures) from the same source and the context supports its format. Either is
+// reduced to the global texture quality first. The mips of decoded images are generated on the CPU
+// (rg::texture::CpuMipmaps()) or by the driver.
+rg::GLTexture TextureFromFile(const char *path, const string &directory, bool gamma, rg::texture::Usage usage)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    rg::GLTexture texture = rg::GLTexture::Create();
+
+    // the baked mip chains differ by usage, data maps used to be filtered as colors under "ktx"
+    const char *extension = usage == rg::texture::Usage::NormalMap ? "bc5.ktx" :
+                            (usage == rg::texture::Usage::Data ? "data.ktx" : "ktx");
+    string compressedPath = rg::cache::PathFor(filename, extension);
+    uint64_t sourceHash = 0;
+    {
+        rg::MappedFile source(filename);
+        if (source.IsOpen())
+            sourceHash = rg::cache::Hash(source.Data(), source.Size());
+    }
+    rg::texture::CompressedImage compressed;
+    bool useCompressed = rg::texture::ReadKtx(compressedPath, sourceHash, compressed) &&
+                         rg::texture::Supported(compressed.internalFormat);
 
     int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    unsigned char *data = nullptr;
+    if (!useCompressed)
+        data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    if (data && rg::texture::CompressOnLoad())
+    {
+        compressed = rg::texture::Compress(data, width, height, nrComponents, usage);
+        useCompressed = rg::texture::Supported(compressed.internalFormat);
+        if (!rg::texture::WriteKtx(compressedPath, compressed, sourceHash))
+            std::cout << "Failed to write compressed texture " << compressedPath << std::endl;
+    }
+
+    // the converter needs every level, streamed textures start with their small ones
+    rg::TextureStreamer &streamer = rg::TextureStreamer::Instance();
+    bool stream = streamer.enabled && !rg::texture::CompressOnLoad();
+    rg::TextureStreamer::Source source;
+    source.path = filename;
+    source.usage = usage;
+    if (useCompressed)
+    {
+        source.compressedPath = compressedPath;
+        source.sourceHash = sourceHash;
+        source.skip = rg::texture::LevelsToSkip(compressed.width, compressed.height);
+        compressed.DropLevels(source.skip);
+        glBindTexture(GL_TEXTURE_2D, texture.Get());
+        if (stream)
+        {
+            streamer.Add(texture.Get(), source, compressed);
+        }
+        else
+        {
+            rg::texture::Upload(compressed);
+            rg::GpuMemory::Instance().TrackCompressedTexture(texture.Get(), compressed.width, compressed.height,
+                                                             compressed.internalFormat,
+                                                             rg::texture::BlockBytes(compressed.internalFormat));
+        }
+    }
+    else if (data)
     {
         GLenum format;
         if (nrComponents == 1)
@@ -237,10 +852,37 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        source.skip = rg::texture::LevelsToSkip(width, height);
+        std::vector<unsigned char> reduced = rg::texture::Reduce(data, width, height, nrComponents, usage);
+        const unsigned char *pixels = reduced.empty() ? data : reduced.data();
+        glBindTexture(GL_TEXTURE_2D, texture.Get());
+        if (stream)
+        {
+            streamer.Add(texture.Get(), source, pixels, width, height, nrComponents);
+        }
+        else
+        {
+            // rows of RGB levels aren't 4 byte aligned
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+            if (rg::texture::CpuMipmaps())
+            {
+                std::vector<std::vector<unsigned char>> mips = rg::texture::GenerateMips(pixels, width, height, nrComponents, usage);
+                for (size_t level = 0; level < mips.size(); level++)
+                    glTexImage2D(GL_TEXTURE_2D, level + 1, format, std::max(1, width >> (level + 1)),
+                                 std::max(1, height >> (level + 1)), 0, format, GL_UNSIGNED_BYTE, mips[level].data());
+            }
+            else
+            {
+                glGenerateMipmap(GL_TEXTURE_2D);
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            rg::GpuMemory::Instance().TrackMipmappedTexture(texture.Get(), width, height, format, format);
+        }
+    }
 
+    if (useCompressed || data)
+    {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -254,6 +896,6 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
         stbi_image_free(data);
     }
 
-    return textureID;
+    return texture;
 }
 #endif
@@ -5,17 +5,23 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <common.h>
+#include <rg/GLExt.h>
+#include <rg/GLHandle.h>
 class Shader
 {
 public:
-    unsigned int ID;
-    // constructor generates the shader on the fly
+    // name of the program, owned by the shader and deleted with it
+    unsigned int ID = 0;
+    // constructor generates the shader on the fly, every name in defines is #defined in all stages
+    // so one source can build several variants
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const std::vector<std::string> &defines = std::vector<std::string>())
     {
         std::string vertexPathString(vertexPath);
         std::string fragmentPathString(fragmentPath);
@@ -64,6 +70,9 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        vertexCode = addDefines(vertexCode, defines);
+        fragmentCode = addDefines(fragmentCode, defines);
+        geometryCode = addDefines(geometryCode, defines);
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -89,7 +98,8 @@ public:
             checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
+        program = rg::GLProgram::Create();
+        ID = program.Get();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         if(geometryPath != nullptr)
@@ -103,6 +113,53 @@ public:
             glDeleteShader(geometry);
 
     }
+    // constructor for a compute-only program, needs a GL 4.3 context (see rg::gl43)
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath)
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        program = rg::GLProgram::Create();
+        ID = program.Get();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+    }
+    Shader(Shader &&other) noexcept : ID(other.ID), program(std::move(other.program))
+    {
+        other.ID = 0;
+    }
+    Shader &operator=(Shader &&other) noexcept
+    {
+        if (this != &other)
+        {
+            program = std::move(other.program);
+            ID = other.ID;
+            other.ID = 0;
+        }
+        return *this;
+    }
+    Shader(const Shader &) = delete;
+    Shader &operator=(const Shader &) = delete;
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
@@ -169,6 +226,23 @@ public:
     }
 
 private:
+    rg::GLProgram program;
+
+    // the #defines go right after the #version line, which has to stay first
+    // ------------------------------------------------------------------------
+    static std::string addDefines(const std::string &code, const std::vector<std::string> &defines)
+    {
+        if (defines.empty() || code.empty())
+            return code;
+        std::string block;
+        for (const std::string &define : defines)
+            block += "#define " + define + "\n";
+        size_t lineEnd = code.find('\n');
+        if (code.compare(0, 8, "#version") != 0 || lineEnd == std::string::npos)
+            return block + code;
+        return code.substr(0, lineEnd + 1) + block + code.substr(lineEnd + 1);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
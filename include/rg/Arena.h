@@ -0,0 +1,112 @@
+#ifndef PROJECT_BASE_ARENA_H
+#define PROJECT_BASE_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <type_traits>
+#include <vector>
+
+namespace rg {
+
+    // Bump allocator for the temporary buffers of a load. Allocations are carved out of large
+    // blocks and only freed all at once, either by Rewind() to an earlier Mark() or when the arena
+    // goes away. Sized well up front, a whole mesh is processed with a single malloc. Only for
+    // trivially copyable data, nothing is constructed or destroyed.
+    class Arena {
+    public:
+        // position in the arena to rewind to
+        struct Marker {
+            size_t block = 0;
+            size_t offset = 0;
+        };
+
+        explicit Arena(size_t blockSize = 1 << 20) : blockSize((std::max<size_t>(blockSize, 1) + Alignment - 1) & ~(Alignment - 1)) {}
+
+        ~Arena() {
+            for (Block &block : blocks)
+                std::free(block.data);
+        }
+
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        // uninitialized storage for count values, aligned for SIMD loads
+        template<typename T>
+        T *Allocate(size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value, "the arena doesn't run constructors or destructors");
+            size_t size = (count * sizeof(T) + Alignment - 1) & ~(Alignment - 1);
+            while (current < blocks.size() && blocks[current].used + size > blocks[current].size)
+                current++;
+            if (current == blocks.size()) {
+                Block block;
+                block.size = std::max(blockSize, size);
+                block.data = static_cast<char *>(aligned_alloc(Alignment, block.size));
+                blocks.push_back(block);
+            }
+            Block &block = blocks[current];
+            T *result = reinterpret_cast<T *>(block.data + block.used);
+            block.used += size;
+            return result;
+        }
+
+        template<typename T>
+        T *Allocate(size_t count, const T &value) {
+            T *result = Allocate<T>(count);
+            std::fill(result, result + count, value);
+            return result;
+        }
+
+        Marker Mark() const {
+            return current < blocks.size() ? Marker{current, blocks[current].used} : Marker{current, 0};
+        }
+
+        // frees everything allocated since the marker, the blocks stay for reuse
+        void Rewind(const Marker &marker) {
+            for (size_t i = marker.block; i < blocks.size(); i++)
+                blocks[i].used = i == marker.block ? marker.offset : 0;
+            current = marker.block;
+        }
+
+        // bytes held from the system
+        size_t Reserved() const {
+            size_t reserved = 0;
+            for (const Block &block : blocks)
+                reserved += block.size;
+            return reserved;
+        }
+
+    private:
+        static const size_t Alignment = 32;
+
+        struct Block {
+            char *data = nullptr;
+            size_t size = 0;
+            size_t used = 0;
+        };
+
+        size_t blockSize;
+        std::vector<Block> blocks;
+        size_t current = 0;
+    };
+
+    // frees the arena allocations of a scope when it ends
+    class ArenaScope {
+    public:
+        explicit ArenaScope(Arena &arena) : arena(arena), marker(arena.Mark()) {}
+
+        ~ArenaScope() {
+            arena.Rewind(marker);
+        }
+
+        ArenaScope(const ArenaScope &) = delete;
+        ArenaScope &operator=(const ArenaScope &) = delete;
+
+    private:
+        Arena &arena;
+        Arena::Marker marker;
+    };
+
+};
+
+#endif //PROJECT_BASE_ARENA_H
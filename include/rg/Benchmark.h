@@ -0,0 +1,71 @@
+#ifndef PROJECT_BASE_BENCHMARK_H
+#define PROJECT_BASE_BENCHMARK_H
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Results of the micro-benchmarks run by `project_base --bench`, printed as they come in and
+// written to bench_output.json at the end.
+namespace rg {
+namespace bench {
+
+    struct Result {
+        std::string name;
+        double value;
+        std::string unit;
+    };
+
+    inline std::vector<Result> &Results() {
+        static std::vector<Result> results;
+        return results;
+    }
+
+    inline void Report(const std::string &name, double value, const std::string &unit) {
+        Results().push_back(Result{name, value, unit});
+        std::cout << "[bench] " << name << ": " << value << ' ' << unit << std::endl;
+    }
+
+    inline bool WriteJson(const std::string &path) {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        out << "{\n  \"results\": [\n";
+        const std::vector<Result> &results = Results();
+        for (size_t i = 0; i < results.size(); i++) {
+            out << "    {\"name\": \"" << results[i].name << "\", \"value\": " << results[i].value
+                << ", \"unit\": \"" << results[i].unit << "\"}" << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        return true;
+    }
+
+    class Timer {
+    public:
+        Timer() : start(std::chrono::steady_clock::now()) {}
+
+        double ElapsedMs() const {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // a memory figure of the process from /proc/self/status in MB, e.g. "VmRSS" for the
+    // resident memory or "VmHWM" for its peak, 0 where that isn't available
+    inline double ProcessMemoryMB(const std::string &field) {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line))
+            if (line.compare(0, field.size() + 1, field + ":") == 0)
+                return std::stod(line.substr(field.size() + 1)) / 1024.0;
+        return 0.0;
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_BENCHMARK_H
@@ -0,0 +1,154 @@
+#ifndef PROJECT_BASE_BOUNDS_H
+#define PROJECT_BASE_BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace rg {
+
+    struct Ray {
+        glm::vec3 origin = glm::vec3(0.0f);
+        glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+
+        Ray() = default;
+        Ray(const glm::vec3 &origin, const glm::vec3 &direction) : origin(origin), direction(direction) {}
+
+        glm::vec3 At(float t) const {
+            return origin + direction * t;
+        }
+    };
+
+    struct AABB {
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+
+        AABB() = default;
+        AABB(const glm::vec3 &min, const glm::vec3 &max) : min(min), max(max) {}
+
+        bool IsEmpty() const {
+            return min.x > max.x || min.y > max.y || min.z > max.z;
+        }
+
+        void Expand(const glm::vec3 &point) {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+
+        void Expand(const AABB &other) {
+            if (other.IsEmpty())
+                return;
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+
+        bool Contains(const glm::vec3 &point) const {
+            return point.x >= min.x && point.y >= min.y && point.z >= min.z &&
+                   point.x <= max.x && point.y <= max.y && point.z <= max.z;
+        }
+
+        glm::vec3 Center() const {
+            return (min + max) * 0.5f;
+        }
+
+        glm::vec3 Extent() const {
+            return (max - min) * 0.5f;
+        }
+
+        float SurfaceArea() const {
+            if (IsEmpty())
+                return 0.0f;
+            glm::vec3 d = max - min;
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        // slab test with a precomputed 1 / direction, tEntry is clamped to 0 when the origin is inside
+        bool Intersect(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxT, float &tEntry) const {
+            glm::vec3 t0 = (min - origin) * inverseDirection;
+            glm::vec3 t1 = (max - origin) * inverseDirection;
+            glm::vec3 tMin = glm::min(t0, t1), tMax = glm::max(t0, t1);
+            float tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+            float tFar = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxT));
+            tEntry = tNear;
+            return tNear <= tFar;
+        }
+
+        float DistanceSquared(const glm::vec3 &point) const {
+            glm::vec3 d = glm::max(glm::max(min - point, point - max), glm::vec3(0.0f));
+            return glm::dot(d, d);
+        }
+
+        // bounds of the box after an affine transform (Arvo's method), tighter than transforming the 8 corners
+        AABB Transformed(const glm::mat4 &transform) const {
+            if (IsEmpty())
+                return *this;
+            AABB result;
+            result.min = result.max = glm::vec3(transform[3]);
+            for (int column = 0; column < 3; column++) {
+                for (int row = 0; row < 3; row++) {
+                    float a = transform[column][row] * min[column];
+                    float b = transform[column][row] * max[column];
+                    result.min[row] += a < b ? a : b;
+                    result.max[row] += a < b ? b : a;
+                }
+            }
+            return result;
+        }
+    };
+
+    // planes are stored as (normal, distance) with normals pointing inside the frustum
+    struct Frustum {
+        glm::vec4 planes[6];
+
+        Frustum() = default;
+
+        explicit Frustum(const glm::mat4 &viewProjection) {
+            glm::mat4 m = glm::transpose(viewProjection);
+            planes[0] = m[3] + m[0]; // left
+            planes[1] = m[3] - m[0]; // right
+            planes[2] = m[3] + m[1]; // bottom
+            planes[3] = m[3] - m[1]; // top
+            planes[4] = m[3] + m[2]; // near
+            planes[5] = m[3] - m[2]; // far
+            for (glm::vec4 &plane : planes)
+                plane /= glm::length(glm::vec3(plane));
+        }
+
+        bool Intersects(const AABB &box) const {
+            for (const glm::vec4 &plane : planes) {
+                // the box corner furthest along the plane normal
+                glm::vec3 p(plane.x > 0.0f ? box.max.x : box.min.x,
+                            plane.y > 0.0f ? box.max.y : box.min.y,
+                            plane.z > 0.0f ? box.max.z : box.min.z);
+                if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f)
+                    return false;
+            }
+            return true;
+        }
+
+        // the box is entirely on the inner side of every plane
+        bool Contains(const AABB &box) const {
+            for (const glm::vec4 &plane : planes) {
+                glm::vec3 n(plane.x > 0.0f ? box.min.x : box.max.x,
+                            plane.y > 0.0f ? box.min.y : box.max.y,
+                            plane.z > 0.0f ? box.min.z : box.max.z);
+                if (glm::dot(glm::vec3(plane), n) + plane.w < 0.0f)
+                    return false;
+            }
+            return true;
+        }
+
+        bool Intersects(const glm::vec3 &center, float radius) const {
+            for (const glm::vec4 &plane : planes) {
+                if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                    return false;
+            }
+            return true;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_BOUNDS_H
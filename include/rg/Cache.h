@@ -0,0 +1,48 @@
+#ifndef PROJECT_BASE_CACHE_H
+#define PROJECT_BASE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Data derived from the source assets (acceleration structures, simplified meshes, ...) is
+// cached under resources/cache. Every cache file stores a hash of the input it was built from
+// and is simply rebuilt when that doesn't match anymore.
+namespace rg {
+namespace cache {
+
+    inline const std::string &Directory() {
+        static const std::string directory = "resources/cache";
+        return directory;
+    }
+
+    // cache file for a source asset, e.g. resources/objects/bat/Bat.obj -> resources/cache/objects_bat_Bat.obj.bvh
+    inline std::string PathFor(const std::string &source, const std::string &extension) {
+        std::string name = source;
+        if (name.compare(0, 10, "resources/") == 0)
+            name = name.substr(10);
+        for (char &c : name)
+            if (c == '/' || c == '\\')
+                c = '_';
+        mkdir(Directory().c_str(), 0755);
+        return Directory() + '/' + name + '.' + extension;
+    }
+
+    // 64 bit FNV-1a, chain calls through seed to hash several buffers
+    inline uint64_t Hash(const void *data, size_t size, uint64_t seed = 14695981039346656037ull) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_CACHE_H
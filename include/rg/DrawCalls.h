@@ -0,0 +1,17 @@
+#ifndef PROJECT_BASE_DRAWCALLS_H
+#define PROJECT_BASE_DRAWCALLS_H
+
+#include <cstddef>
+
+namespace rg {
+
+    // draw calls issued by Mesh and InstanceCuller, a multi-draw or an indirect draw counts as one.
+    // The benchmarks reset it around what they compare.
+    inline size_t &DrawCalls() {
+        static size_t calls = 0;
+        return calls;
+    }
+
+};
+
+#endif //PROJECT_BASE_DRAWCALLS_H
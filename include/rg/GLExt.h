@@ -0,0 +1,121 @@
+#ifndef PROJECT_BASE_GLEXT_H
+#define PROJECT_BASE_GLEXT_H
+
+#include <glad/glad.h>
+
+// The bundled glad loader only covers core 3.3, so the few GL 4.3 entry points
+// the renderer can take advantage of are fetched here at runtime. Everything that
+// uses them has to check rg::gl43::available() and keep a 3.3 code path.
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+#define GL_ANY_SAMPLES_PASSED_CONSERVATIVE 0x8D6A
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+
+namespace rg {
+namespace gl43 {
+
+    typedef void (APIENTRYP PFNDISPATCHCOMPUTEPROC)(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+    typedef void (APIENTRYP PFNMEMORYBARRIERPROC)(GLbitfield barriers);
+    typedef void (APIENTRYP PFNBINDIMAGETEXTUREPROC)(GLuint unit, GLuint texture, GLint level, GLboolean layered,
+                                                   GLint layer, GLenum access, GLenum format);
+    typedef void (APIENTRYP PFNDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void *indirect);
+    typedef void (APIENTRYP PFNMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void *indirect,
+                                                             GLsizei drawCount, GLsizei stride);
+
+    struct Functions {
+        PFNDISPATCHCOMPUTEPROC dispatchCompute = nullptr;
+        PFNMEMORYBARRIERPROC memoryBarrier = nullptr;
+        PFNBINDIMAGETEXTUREPROC bindImageTexture = nullptr;
+        PFNDRAWELEMENTSINDIRECTPROC drawElementsIndirect = nullptr;
+        PFNMULTIDRAWELEMENTSINDIRECTPROC multiDrawElementsIndirect = nullptr;
+        bool loaded = false;
+    };
+
+    // one table for the whole program: a function-local static of an inline function is shared by
+    // every translation unit, a static at namespace scope would leave each with its own null copy
+    inline Functions &functions() {
+        static Functions table;
+        return table;
+    }
+
+    // has to be called after gladLoadGLLoader, with the same loader
+    inline bool load(GLADloadproc loader) {
+        Functions &gl = functions();
+        gl.loaded = false;
+        if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 3))
+            return false;
+
+        gl.dispatchCompute = (PFNDISPATCHCOMPUTEPROC) loader("glDispatchCompute");
+        gl.memoryBarrier = (PFNMEMORYBARRIERPROC) loader("glMemoryBarrier");
+        gl.bindImageTexture = (PFNBINDIMAGETEXTUREPROC) loader("glBindImageTexture");
+        gl.drawElementsIndirect = (PFNDRAWELEMENTSINDIRECTPROC) loader("glDrawElementsIndirect");
+        gl.multiDrawElementsIndirect = (PFNMULTIDRAWELEMENTSINDIRECTPROC) loader("glMultiDrawElementsIndirect");
+
+        gl.loaded = gl.dispatchCompute && gl.memoryBarrier && gl.bindImageTexture && gl.drawElementsIndirect &&
+                    gl.multiDrawElementsIndirect;
+        return gl.loaded;
+    }
+
+    inline bool available() {
+        return functions().loaded;
+    }
+
+    inline void DispatchCompute(GLuint groupsX, GLuint groupsY, GLuint groupsZ) {
+        functions().dispatchCompute(groupsX, groupsY, groupsZ);
+    }
+
+    inline void MemBarrier(GLbitfield barriers) {
+        functions().memoryBarrier(barriers);
+    }
+
+    inline void BindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access,
+                                 GLenum format) {
+        functions().bindImageTexture(unit, texture, level, layered, layer, access, format);
+    }
+
+    inline void DrawElementsIndirect(GLenum mode, GLenum type, const void *indirect) {
+        functions().drawElementsIndirect(mode, type, indirect);
+    }
+
+    inline void MultiDrawElementsIndirect(GLenum mode, GLenum type, const void *indirect, GLsizei drawCount,
+                                          GLsizei stride) {
+        functions().multiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_GLEXT_H
@@ -0,0 +1,113 @@
+#ifndef PROJECT_BASE_GLHANDLE_H
+#define PROJECT_BASE_GLHANDLE_H
+
+#include <glad/glad.h>
+
+#include <rg/GpuMemory.h>
+
+#include <memory>
+#include <utility>
+
+// Owning wrappers for GL object names. A handle deletes its object when it goes out of scope,
+// it can be moved but not copied, so every GL object has exactly one owner. Objects that several
+// owners use (textures shared between meshes and models) go through SharedTexture and are deleted
+// with the last reference. All of them have to be gone before the context is destroyed.
+// Deleting a texture or buffer also drops it from the GpuMemory bookkeeping.
+namespace rg {
+
+    namespace detail {
+
+        struct TextureTraits {
+            static GLuint Create() { GLuint name; glGenTextures(1, &name); return name; }
+            static void Destroy(GLuint name) { GpuMemory::Instance().ReleaseTexture(name); glDeleteTextures(1, &name); }
+        };
+
+        struct BufferTraits {
+            static GLuint Create() { GLuint name; glGenBuffers(1, &name); return name; }
+            static void Destroy(GLuint name) { GpuMemory::Instance().ReleaseBuffer(name); glDeleteBuffers(1, &name); }
+        };
+
+        struct VertexArrayTraits {
+            static GLuint Create() { GLuint name; glGenVertexArrays(1, &name); return name; }
+            static void Destroy(GLuint name) { glDeleteVertexArrays(1, &name); }
+        };
+
+        struct FramebufferTraits {
+            static GLuint Create() { GLuint name; glGenFramebuffers(1, &name); return name; }
+            static void Destroy(GLuint name) { glDeleteFramebuffers(1, &name); }
+        };
+
+        struct ProgramTraits {
+            static GLuint Create() { return glCreateProgram(); }
+            static void Destroy(GLuint name) { glDeleteProgram(name); }
+        };
+
+    };
+
+    template<typename Traits>
+    class GLHandle {
+    public:
+        GLHandle() = default;
+
+        // takes ownership of an existing name, e.g. one of a batch from a single glGen* call
+        explicit GLHandle(GLuint name) : name(name) {}
+
+        static GLHandle Create() {
+            return GLHandle(Traits::Create());
+        }
+
+        ~GLHandle() {
+            Reset();
+        }
+
+        GLHandle(GLHandle &&other) noexcept : name(other.name) {
+            other.name = 0;
+        }
+
+        GLHandle &operator=(GLHandle &&other) noexcept {
+            if (this != &other) {
+                Reset();
+                name = other.name;
+                other.name = 0;
+            }
+            return *this;
+        }
+
+        GLHandle(const GLHandle &) = delete;
+        GLHandle &operator=(const GLHandle &) = delete;
+
+        GLuint Get() const {
+            return name;
+        }
+
+        explicit operator bool() const {
+            return name != 0;
+        }
+
+        // deletes the object now, the handle is empty afterwards
+        void Reset() {
+            if (name != 0)
+                Traits::Destroy(name);
+            name = 0;
+        }
+
+    private:
+        GLuint name = 0;
+    };
+
+    typedef GLHandle<detail::TextureTraits> GLTexture;
+    typedef GLHandle<detail::BufferTraits> GLBuffer;
+    typedef GLHandle<detail::VertexArrayTraits> GLVertexArray;
+    typedef GLHandle<detail::FramebufferTraits> GLFramebuffer;
+    typedef GLHandle<detail::ProgramTraits> GLProgram;
+
+    // reference counted texture, deleted when the last mesh or model using it goes away
+    typedef std::shared_ptr<const GLTexture> SharedTexture;
+
+    inline SharedTexture Share(GLTexture &&texture) {
+        return std::make_shared<const GLTexture>(std::move(texture));
+    }
+
+};
+
+#endif //PROJECT_BASE_GLHANDLE_H
@@ -0,0 +1,620 @@
+#ifndef PROJECT_BASE_GPUCULLING_H
+#define PROJECT_BASE_GPUCULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/DrawCalls.h>
+#include <rg/GLExt.h>
+#include <rg/GpuMemory.h>
+#include <rg/Impostors.h>
+#include <rg/LodSelection.h>
+#include <rg/SceneBVH.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace rg {
+
+    // layout mandated by glDrawElementsIndirect
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // levels of detail an InstanceCuller draws, the last one after the mesh levels can be an
+    // impostor. cull.cs has as many counters.
+    const int MaxCullLodLevels = 5;
+
+    struct CullStats {
+        unsigned int tested = 0;
+        unsigned int visible = 0;
+        // visible instances at each level of detail
+        unsigned int levels[MaxCullLodLevels] = {};
+        // of those, the instances drawn as impostors
+        unsigned int impostors = 0;
+        // triangles the visible instances submit
+        size_t triangles = 0;
+        bool gpu = false;
+    };
+
+    // Max-depth mip chain of the previous frame's depth buffer, built with hiz.cs.
+    class HiZPyramid {
+    public:
+        HiZPyramid(Shader &buildShader, int width, int height)
+                : buildShader(buildShader), width(width), height(height) {
+            levels = 1 + (int) std::floor(std::log2((float) std::max(width, height)));
+
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            int levelWidth = width, levelHeight = height;
+            for (int level = 0; level < levels; level++) {
+                glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, levelWidth, levelHeight, 0, GL_RED, GL_FLOAT, NULL);
+                levelWidth = std::max(1, levelWidth / 2);
+                levelHeight = std::max(1, levelHeight / 2);
+            }
+            GpuMemory::Instance().TrackTexture(texture, GpuMemory::RenderTarget, (size_t) width * height * 4 * 4 / 3);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        ~HiZPyramid() {
+            GpuMemory::Instance().ReleaseTexture(texture);
+            glDeleteTextures(1, &texture);
+        }
+
+        HiZPyramid(const HiZPyramid &) = delete;
+        HiZPyramid &operator=(const HiZPyramid &) = delete;
+
+        // depthTexture must not be attached to the bound framebuffer
+        void Build(unsigned int depthTexture) {
+            buildShader.use();
+            buildShader.setInt("depthTexture", 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+            int levelWidth = width, levelHeight = height;
+            for (int level = 0; level < levels; level++) {
+                buildShader.setBool("copyDepth", level == 0);
+                if (level > 0)
+                    gl43::BindImageTexture(0, texture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+                gl43::BindImageTexture(1, texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+                gl43::DispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+                gl43::MemBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+                levelWidth = std::max(1, levelWidth / 2);
+                levelHeight = std::max(1, levelHeight / 2);
+            }
+            gl43::MemBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        unsigned int Texture() const { return texture; }
+        int Levels() const { return levels; }
+        glm::vec2 Size() const { return glm::vec2(width, height); }
+
+    private:
+        Shader &buildShader;
+        unsigned int texture = 0;
+        int width, height, levels;
+    };
+
+    // Culls the instances of one model and draws the survivors with a single VAO holding the
+    // geometry of all of its meshes (the mega-buffer). With a compute shader the frustum and Hi-Z
+    // tests run on the GPU and write compacted instance matrices plus glDrawElementsIndirect
+    // commands; otherwise the frustum test runs here and the draws are plain instanced calls.
+    // Instance matrices are fed to the vertex shader through attribute locations 5-8.
+    // Models with levels of detail get one visible list per level, each instance goes to the level
+    // its projected error selects (with hysteresis, no cross-fade) and the far ones draw cheap.
+    // Instances can belong to HLOD clusters (rg::HlodClusters), those of replaced clusters are skipped.
+    // With an impostor the level after the coarsest mesh level draws camera facing quads instead.
+    class InstanceCuller {
+    public:
+        // cullShader may be null when compute shaders are unavailable
+        InstanceCuller(Model &model, Shader *cullShader)
+                : model(model), cullShader(cullShader) {
+            setupMegaBuffer();
+
+            glGenBuffers(1, &instanceBuffer);
+            glGenBuffers(1, &levelBuffer);
+            glGenBuffers(1, &clusterBuffer);
+            glGenBuffers(1, &replacedBuffer);
+            glGenBuffers(1, &counterBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, counterBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, CounterCount * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+            GpuMemory::Instance().TrackBuffer(counterBuffer, GpuMemory::ModelGeometry, CounterCount * sizeof(GLuint));
+            glGenBuffers(1, &commandBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+                         commands.data(), GL_DYNAMIC_DRAW);
+            GpuMemory::Instance().TrackBuffer(commandBuffer, GpuMemory::ModelGeometry, commands.size() * sizeof(DrawElementsIndirectCommand));
+            glGenBuffers(ReadbackLatency, readbackBuffers);
+            for (unsigned int buffer : readbackBuffers) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, CounterCount * sizeof(GLuint), NULL, GL_STREAM_READ);
+                GpuMemory::Instance().TrackBuffer(buffer, GpuMemory::Staging, CounterCount * sizeof(GLuint));
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        ~InstanceCuller() {
+            for (GLsync &fence : readbackFences)
+                if (fence)
+                    glDeleteSync(fence);
+            for (unsigned int buffer : readbackBuffers)
+                GpuMemory::Instance().ReleaseBuffer(buffer);
+            for (unsigned int buffer : {commandBuffer, counterBuffer, levelBuffer, clusterBuffer, replacedBuffer,
+                                        instanceBuffer, visibleBuffer, EBO, VBO})
+                GpuMemory::Instance().ReleaseBuffer(buffer);
+            glDeleteBuffers(ReadbackLatency, readbackBuffers);
+            glDeleteBuffers(1, &commandBuffer);
+            glDeleteBuffers(1, &counterBuffer);
+            glDeleteBuffers(1, &levelBuffer);
+            glDeleteBuffers(1, &clusterBuffer);
+            glDeleteBuffers(1, &replacedBuffer);
+            glDeleteBuffers(1, &instanceBuffer);
+            glDeleteBuffers(1, &visibleBuffer);
+            glDeleteBuffers(1, &EBO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteVertexArrays(1, &VAO);
+        }
+
+        InstanceCuller(const InstanceCuller &) = delete;
+        InstanceCuller &operator=(const InstanceCuller &) = delete;
+
+        // adds the impostor as the last level, before SetInstances since it adds a visible list
+        void SetImpostor(const Impostor *baked) {
+            impostor = baked;
+            levelCount = meshLevelCount + (impostor ? 1 : 0);
+            levelTriangles[meshLevelCount] = impostor ? 2 : 0;
+            if (!impostor)
+                return;
+            impostorVAO = GLVertexArray::Create();
+            glBindVertexArray(impostorVAO.Get());
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, impostor->QuadElements());
+            glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+            for (int column = 0; column < 4; column++) {
+                glEnableVertexAttribArray(5 + column);
+                glVertexAttribDivisor(5 + column, 1);
+            }
+            pointInstances(0);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        void SetInstances(const std::vector<glm::mat4> &transforms) {
+            instances = transforms;
+            instanceBounds.resize(instances.size());
+            instanceTree.Clear();
+            for (size_t i = 0; i < instances.size(); i++) {
+                instanceBounds[i] = model.bounds.Transformed(instances[i]);
+                instanceTree.Insert(instanceBounds[i]);
+            }
+            instanceTree.Build();
+
+            glBindBuffer(GL_COPY_WRITE_BUFFER, instanceBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_STATIC_DRAW);
+            // a list per level, the GPU path fills each from its start
+            size_t visibleBytes = levelCount * instances.size() * sizeof(glm::mat4);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, visibleBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, visibleBytes, NULL, GL_DYNAMIC_COPY);
+            std::vector<GLuint> noLevel(instances.size(), ~0u);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, levelBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, noLevel.size() * sizeof(GLuint), noLevel.data(), GL_DYNAMIC_COPY);
+            GpuMemory::Instance().TrackBuffer(instanceBuffer, GpuMemory::ModelGeometry, instances.size() * sizeof(glm::mat4));
+            GpuMemory::Instance().TrackBuffer(visibleBuffer, GpuMemory::ModelGeometry, visibleBytes);
+            GpuMemory::Instance().TrackBuffer(levelBuffer, GpuMemory::ModelGeometry, noLevel.size() * sizeof(GLuint));
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            selector = LodSelector();
+            instanceClusters.clear();
+            replacedClusters.clear();
+        }
+
+        // the HLOD cluster of each instance, -1 for instances outside any cluster
+        void SetClusters(const std::vector<int> &clusters) {
+            instanceClusters = clusters;
+            instanceClusters.resize(instances.size(), -1);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, clusterBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, instanceClusters.size() * sizeof(GLint), instanceClusters.data(), GL_STATIC_DRAW);
+            GpuMemory::Instance().TrackBuffer(clusterBuffer, GpuMemory::ModelGeometry, instanceClusters.size() * sizeof(GLint));
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        // per cluster, whether its proxy draws instead of its instances; set every frame before Cull
+        void SetReplacedClusters(const std::vector<char> &replaced) {
+            replacedClusters = replaced;
+            if (instanceClusters.empty() || !UsesGpu())
+                return;
+            std::vector<GLuint> flags(replaced.begin(), replaced.end());
+            if (flags.empty())
+                flags.push_back(0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, replacedBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, flags.size() * sizeof(GLuint), flags.data(), GL_STREAM_DRAW);
+            GpuMemory::Instance().TrackBuffer(replacedBuffer, GpuMemory::ModelGeometry, flags.size() * sizeof(GLuint));
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        void SetUseGpu(bool enabled) {
+            useGpu = enabled;
+        }
+
+        bool UsesGpu() const {
+            return useGpu && cullShader != nullptr && gl43::available();
+        }
+
+        // hiZ (built from the previous frame with previousViewProjection) is optional, view places
+        // the camera for the LOD selection
+        void Cull(const glm::mat4 &viewProjection, const HiZPyramid *hiZ, const glm::mat4 &previousViewProjection,
+                  const LodView &view) {
+            updateLevelErrors();
+            if (UsesGpu())
+                cullGpu(viewProjection, hiZ, previousViewProjection, view);
+            else
+                cullCpu(viewProjection, view);
+        }
+
+        // the instance attributes are repointed at each level's list, so no draw needs a base instance
+        void Draw(Shader &shader) {
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+            bool gpu = UsesGpu();
+            if (gpu)
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            size_t meshCount = model.meshes.size();
+            for (size_t i = 0; i < meshCount; i++) {
+                model.meshes[i].BindTextures(shader);
+                for (int level = 0; level < meshLevelCount; level++) {
+                    if (gpu) {
+                        pointInstances(level * instances.size());
+                        gl43::DrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                                   (void *) ((level * meshCount + i) * sizeof(DrawElementsIndirectCommand)));
+                        DrawCalls()++;
+                    } else if (cpuLevelCounts[level] > 0) {
+                        const DrawElementsIndirectCommand &command = commands[level * meshCount + i];
+                        pointInstances(cpuLevelFirst[level]);
+                        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                                          (void *) (command.firstIndex * sizeof(unsigned int)),
+                                                          cpuLevelCounts[level], command.baseVertex);
+                        DrawCalls()++;
+                    }
+                }
+            }
+            if (gpu)
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        // the instances at the impostor level, with impostor.vs and impostor.fs
+        void DrawImpostors(Shader &shader) {
+            if (!impostor || levelCount <= meshLevelCount)
+                return;
+            bool gpu = UsesGpu();
+            if (!gpu && cpuLevelCounts[meshLevelCount] == 0)
+                return;
+            impostor->Bind(shader);
+            glBindVertexArray(impostorVAO.Get());
+            glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+            if (gpu) {
+                pointInstances(meshLevelCount * instances.size());
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+                gl43::DrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                           (void *) ((commands.size() - 1) * sizeof(DrawElementsIndirectCommand)));
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            } else {
+                pointInstances(cpuLevelFirst[meshLevelCount]);
+                glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, cpuLevelCounts[meshLevelCount]);
+            }
+            DrawCalls()++;
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+        }
+
+        // GPU counters lag a few frames behind because they are read back without stalling
+        const CullStats &Stats() const {
+            return stats;
+        }
+
+    private:
+        static const int ReadbackLatency = 3;
+        // tested, visible and the visible instances of each level
+        static const int CounterCount = 2 + MaxCullLodLevels;
+
+        Model &model;
+        Shader *cullShader;
+        bool useGpu = true;
+
+        unsigned int VAO = 0, VBO = 0, EBO = 0;
+        unsigned int instanceBuffer = 0, visibleBuffer = 0, levelBuffer = 0, counterBuffer = 0, commandBuffer = 0;
+        unsigned int clusterBuffer = 0, replacedBuffer = 0;
+        unsigned int readbackBuffers[ReadbackLatency] = {};
+        GLsync readbackFences[ReadbackLatency] = {};
+        unsigned int frame = 0;
+
+        // one command per mesh level and mesh, level major, then the impostor quad's
+        std::vector<DrawElementsIndirectCommand> commands;
+        // levels with meshes, and all levels with the impostor's
+        int meshLevelCount = 1;
+        int levelCount = 1;
+        std::vector<float> lodErrors;
+        // lodErrors with the impostor's for this frame's settings
+        std::vector<float> levelErrors;
+        const Impostor *impostor = nullptr;
+        GLVertexArray impostorVAO;
+        // triangles of one instance at each level
+        size_t levelTriangles[MaxCullLodLevels] = {};
+        std::vector<glm::mat4> instances;
+        std::vector<AABB> instanceBounds;
+        // the CPU path walks this instead of testing every instance
+        SceneBVH instanceTree;
+        std::vector<glm::mat4> visibleScratch;
+        std::vector<int> visibleLevels;
+        GLsizei cpuLevelCounts[MaxCullLodLevels] = {};
+        size_t cpuLevelFirst[MaxCullLodLevels] = {};
+        LodSelector selector;
+        std::vector<int> instanceClusters;
+        std::vector<char> replacedClusters;
+        CullStats stats;
+
+        bool replacedByCluster(int instance) const {
+            if (instanceClusters.empty())
+                return false;
+            int cluster = instanceClusters[instance];
+            return cluster >= 0 && cluster < (int) replacedClusters.size() && replacedClusters[cluster];
+        }
+
+        // points the instance matrix attributes at a list in the visible buffer, which has to be bound
+        void pointInstances(size_t firstInstance) {
+            for (int column = 0; column < 4; column++)
+                glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                      (void*)(firstInstance * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+        }
+
+        void setupMegaBuffer() {
+            lodErrors = model.lodObjectErrors;
+            // one level stays free for an impostor
+            if (lodErrors.size() > (size_t) MaxCullLodLevels - 1)
+                lodErrors.resize(MaxCullLodLevels - 1);
+            meshLevelCount = levelCount = std::max((int) lodErrors.size(), 1);
+            size_t meshCount = model.meshes.size();
+            commands.resize(levelCount * meshCount + 1);
+            size_t vertexCount = 0, indexCount = 0;
+            std::vector<size_t> firstIndices;
+            for (size_t i = 0; i < meshCount; i++) {
+                const Mesh &mesh = model.meshes[i];
+                for (int level = 0; level < levelCount; level++) {
+                    DrawElementsIndirectCommand &command = commands[level * meshCount + i];
+                    bool lod = level < (int) mesh.lods.size();
+                    command.count = lod ? mesh.lods[level].indexCount : mesh.indices.size();
+                    command.instanceCount = 0;
+                    command.firstIndex = indexCount + (lod ? mesh.lods[level].firstIndex : 0);
+                    command.baseVertex = vertexCount;
+                    command.baseInstance = 0;
+                    levelTriangles[level] += command.count / 3;
+                }
+                firstIndices.push_back(indexCount);
+                vertexCount += mesh.vertices.size();
+                indexCount += mesh.indices.size() + mesh.lodIndices.size();
+            }
+            DrawElementsIndirectCommand &quad = commands.back();
+            quad.count = 6;
+            quad.instanceCount = 0;
+            quad.firstIndex = 0;
+            quad.baseVertex = 0;
+            quad.baseInstance = 0;
+
+            glGenVertexArrays(1, &VAO);
+            glGenBuffers(1, &VBO);
+            glGenBuffers(1, &EBO);
+            glGenBuffers(1, &visibleBuffer);
+
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+            GpuMemory::Instance().TrackBuffer(VBO, GpuMemory::ModelGeometry, vertexCount * sizeof(Vertex));
+            GpuMemory::Instance().TrackBuffer(EBO, GpuMemory::ModelGeometry, indexCount * sizeof(unsigned int));
+            for (size_t i = 0; i < meshCount; i++) {
+                const Mesh &mesh = model.meshes[i];
+                glBufferSubData(GL_ARRAY_BUFFER, commands[i].baseVertex * sizeof(Vertex),
+                                mesh.vertices.size() * sizeof(Vertex), mesh.vertices.data());
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndices[i] * sizeof(unsigned int),
+                                mesh.indices.size() * sizeof(unsigned int), mesh.indices.data());
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (firstIndices[i] + mesh.indices.size()) * sizeof(unsigned int),
+                                mesh.lodIndices.size() * sizeof(unsigned int), mesh.lodIndices.data());
+            }
+
+            // same layout as Mesh::setupMesh
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+            glEnableVertexAttribArray(4);
+            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+
+            // per instance model matrix, read from the compacted visible list
+            glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+            for (int column = 0; column < 4; column++) {
+                glEnableVertexAttribArray(5 + column);
+                glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                      (void*)(column * sizeof(glm::vec4)));
+                glVertexAttribDivisor(5 + column, 1);
+            }
+            glBindVertexArray(0);
+        }
+
+        // the impostor's error grows with its bounds, it never undercuts the coarsest mesh level
+        void updateLevelErrors() {
+            levelErrors = lodErrors;
+            const LodSettings &settings = GlobalLodSettings();
+            if (!impostor || !settings.impostors)
+                return;
+            if (levelErrors.empty())
+                levelErrors.push_back(0.0f);
+            levelErrors.push_back(std::max(levelErrors.back(), impostor->Error(settings.impostorPixels)));
+        }
+
+        void cullCpu(const glm::mat4 &viewProjection, const LodView &view) {
+            Frustum frustum(viewProjection);
+            visibleLevels.clear();
+            std::fill(cpuLevelCounts, cpuLevelCounts + MaxCullLodLevels, 0);
+            instanceTree.QueryFrustum(frustum, [&](int instance) {
+                if (replacedByCluster(instance))
+                    return;
+                int level = 0;
+                if (levelErrors.size() > 1)
+                    level = selector.Select(instance, levelErrors, MaxScale(instances[instance]), instanceBounds[instance],
+                                            view).level;
+                visibleLevels.push_back(instance * MaxCullLodLevels + level);
+                cpuLevelCounts[level]++;
+            });
+
+            // the visible instances grouped by level, each level's list follows the one before
+            size_t visibleCount = visibleLevels.size();
+            size_t first = 0;
+            for (int level = 0; level < levelCount; level++) {
+                cpuLevelFirst[level] = first;
+                first += cpuLevelCounts[level];
+            }
+            visibleScratch.resize(visibleCount);
+            size_t next[MaxCullLodLevels];
+            std::copy(cpuLevelFirst, cpuLevelFirst + MaxCullLodLevels, next);
+            for (int entry : visibleLevels)
+                visibleScratch[next[entry % MaxCullLodLevels]++] = instances[entry / MaxCullLodLevels];
+            if (!visibleScratch.empty()) {
+                glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, visibleScratch.size() * sizeof(glm::mat4), visibleScratch.data());
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+            stats.tested = instances.size();
+            stats.visible = visibleCount;
+            stats.triangles = 0;
+            for (int level = 0; level < MaxCullLodLevels; level++) {
+                stats.levels[level] = cpuLevelCounts[level];
+                stats.triangles += cpuLevelCounts[level] * levelTriangles[level];
+            }
+            stats.impostors = impostor ? stats.levels[meshLevelCount] : 0;
+            stats.gpu = false;
+        }
+
+        void cullGpu(const glm::mat4 &viewProjection, const HiZPyramid *hiZ, const glm::mat4 &previousViewProjection,
+                     const LodView &view) {
+            const GLuint zero[CounterCount] = {};
+            glBindBuffer(GL_COPY_WRITE_BUFFER, counterBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(zero), zero);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+            Frustum frustum(viewProjection);
+            cullShader->use();
+            cullShader->setInt("instanceCount", (int) instances.size());
+            cullShader->setVec3("boundsMin", model.bounds.min);
+            cullShader->setVec3("boundsMax", model.bounds.max);
+            for (int i = 0; i < 6; i++)
+                cullShader->setVec4("frustumPlanes[" + std::to_string(i) + "]", frustum.planes[i]);
+            cullShader->setBool("useHiZ", hiZ != nullptr);
+            if (hiZ) {
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, hiZ->Texture());
+                cullShader->setInt("hiZ", 0);
+                cullShader->setInt("hiZLevels", hiZ->Levels());
+                cullShader->setVec2("hiZSize", hiZ->Size());
+                cullShader->setMat4("previousViewProjection", previousViewProjection);
+            }
+            const LodSettings &settings = GlobalLodSettings();
+            cullShader->setInt("lodLevels", (int) levelErrors.size());
+            for (size_t level = 0; level < levelErrors.size(); level++)
+                cullShader->setFloat("lodErrors[" + std::to_string(level) + "]", levelErrors[level]);
+            cullShader->setVec3("cameraPosition", view.position);
+            cullShader->setFloat("pixelsPerUnit", view.pixelsPerUnit);
+            cullShader->setFloat("lodThreshold", settings.Threshold());
+            cullShader->setFloat("lodHysteresis", settings.hysteresis);
+            bool clusters = !instanceClusters.empty() && !replacedClusters.empty();
+            cullShader->setBool("useClusters", clusters);
+
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, counterBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, levelBuffer);
+            if (clusters) {
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, clusterBuffer);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, replacedBuffer);
+            }
+            gl43::DispatchCompute((instances.size() + 63) / 64, 1, 1);
+            gl43::MemBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+            // every mesh of the model draws the same compacted instance list of a level
+            glBindBuffer(GL_COPY_READ_BUFFER, counterBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+            size_t meshCount = model.meshes.size();
+            for (size_t i = 0; i < commands.size(); i++) {
+                size_t level = i / std::max(meshCount, (size_t) 1);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (2 + level) * sizeof(GLuint),
+                                    i * sizeof(DrawElementsIndirectCommand) + offsetof(DrawElementsIndirectCommand, instanceCount),
+                                    sizeof(GLuint));
+            }
+            readCounters();
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        // copies this frame's counters into a ring of buffers and reads the oldest one whose fence has passed
+        void readCounters() {
+            int slot = frame % ReadbackLatency;
+            if (readbackFences[slot]) {
+                // still pending after a full ring; block rather than overwrite it
+                glClientWaitSync(readbackFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                collect(slot);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[slot]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, CounterCount * sizeof(GLuint));
+            readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            frame++;
+
+            for (int i = 1; i < ReadbackLatency; i++) {
+                int pending = (slot + i) % ReadbackLatency;
+                if (readbackFences[pending]) {
+                    GLenum status = glClientWaitSync(readbackFences[pending], 0, 0);
+                    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+                        collect(pending);
+                }
+            }
+        }
+
+        void collect(int slot) {
+            GLuint counters[CounterCount];
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[slot]);
+            glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(counters), counters);
+            glDeleteSync(readbackFences[slot]);
+            readbackFences[slot] = 0;
+            stats.tested = counters[0];
+            stats.visible = counters[1];
+            stats.triangles = 0;
+            for (int level = 0; level < MaxCullLodLevels; level++) {
+                stats.levels[level] = counters[2 + level];
+                stats.triangles += counters[2 + level] * levelTriangles[level];
+            }
+            stats.impostors = impostor ? stats.levels[meshLevelCount] : 0;
+            stats.gpu = true;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_GPUCULLING_H
@@ -0,0 +1,368 @@
+#ifndef PROJECT_BASE_GPUMEMORY_H
+#define PROJECT_BASE_GPUMEMORY_H
+
+#include <glad/glad.h>
+
+#include "imgui.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+    // Bookkeeping of the texture and buffer memory the viewer holds. Every allocation is tracked
+    // by its GL name with a category and its size as the driver most likely stores it (RGB
+    // textures padded to 4 bytes a texel), and forgotten when the object is deleted. Material
+    // textures with a full mip chain take part in the budget: once the total goes over it,
+    // EndFrame() drops the top mip level of the least recently bound one, a few per frame, so the
+    // scene gets blurrier instead of running the device out of memory. The texture keeps its
+    // name, so the meshes referring to it don't notice.
+    class GpuMemory {
+    public:
+        enum Category {
+            ModelGeometry,
+            MaterialTexture,
+            RenderTarget,
+            Staging,
+            CategoryCount
+        };
+
+        // evict while the total is above this, 0 disables eviction
+        int budgetMB = 1024;
+        int maxEvictionsPerFrame = 2;
+        // textures aren't shrunk below this many texels on their smaller side
+        int minEvictedSize = 64;
+
+        static GpuMemory &Instance() {
+            static GpuMemory memory;
+            return memory;
+        }
+
+        static const char *CategoryName(Category category) {
+            static const char *names[CategoryCount] = {"model geometry", "material texture", "render target", "staging"};
+            return names[category];
+        }
+
+        void TrackBuffer(GLuint name, Category category, size_t bytes) {
+            Allocation &allocation = buffers[name];
+            allocation.category = category;
+            allocation.bytes = bytes;
+        }
+
+        void TrackTexture(GLuint name, Category category, size_t bytes) {
+            cancelEviction(name);
+            Allocation &allocation = textures[name];
+            allocation = Allocation();
+            allocation.category = category;
+            allocation.bytes = bytes;
+        }
+
+        // an 8 bit material texture with a full mip chain, these can be evicted to lower mips
+        void TrackMipmappedTexture(GLuint name, int width, int height, GLenum internalFormat, GLenum format) {
+            cancelEviction(name);
+            Allocation &allocation = textures[name];
+            allocation = Allocation();
+            allocation.category = MaterialTexture;
+            allocation.evictable = true;
+            allocation.width = width;
+            allocation.height = height;
+            allocation.internalFormat = internalFormat;
+            allocation.format = format;
+            allocation.bytes = chainBytes(allocation);
+            allocation.lastUse = frame;
+        }
+
+        // a block compressed material texture with a full mip chain, evicted the same way
+        void TrackCompressedTexture(GLuint name, int width, int height, GLenum internalFormat, size_t blockBytes) {
+            TrackMipmappedTexture(name, width, height, internalFormat, internalFormat);
+            Allocation &allocation = textures[name];
+            allocation.blockBytes = blockBytes;
+            allocation.bytes = chainBytes(allocation);
+        }
+
+        void ReleaseBuffer(GLuint name) {
+            buffers.erase(name);
+        }
+
+        void ReleaseTexture(GLuint name) {
+            cancelEviction(name);
+            textures.erase(name);
+            for (const auto &listener : releaseListeners)
+                listener.second(name);
+        }
+
+        // tells released(name) about every texture that goes away, e.g. so the streamer forgets its
+        // levels. GL reuses the names, whoever keys anything by them has to listen. Returns the id
+        // for RemoveReleaseListener().
+        int AddReleaseListener(std::function<void(GLuint)> released) {
+            releaseListeners.emplace_back(nextListener, std::move(released));
+            return nextListener++;
+        }
+
+        void RemoveReleaseListener(int id) {
+            releaseListeners.erase(std::remove_if(releaseListeners.begin(), releaseListeners.end(),
+                                                  [id](const std::pair<int, std::function<void(GLuint)>> &listener) {
+                                                      return listener.first == id;
+                                                  }),
+                                   releaseListeners.end());
+        }
+
+        // marks a texture as used this frame
+        void Touch(GLuint texture) {
+            auto found = textures.find(texture);
+            if (found != textures.end())
+                found->second.lastUse = frame;
+        }
+
+        size_t Total(Category category) const {
+            size_t total = 0;
+            for (const auto *allocations : {&buffers, &textures})
+                for (const auto &entry : *allocations)
+                    if (entry.second.category == category)
+                        total += entry.second.bytes;
+            return total;
+        }
+
+        size_t Total() const {
+            size_t total = 0;
+            for (int category = 0; category < CategoryCount; category++)
+                total += Total((Category) category);
+            return total;
+        }
+
+        size_t Count(Category category) const {
+            size_t count = 0;
+            for (const auto *allocations : {&buffers, &textures})
+                for (const auto &entry : *allocations)
+                    count += entry.second.category == category;
+            return count;
+        }
+
+        // evicts mip levels while the budget is exceeded, call once per frame on the GL thread. The
+        // levels picked this frame are copied on the GPU and freed on the next one.
+        void EndFrame() {
+            for (const Eviction &eviction : pendingEvictions)
+                finishEviction(eviction);
+            pendingEvictions.clear();
+            for (int i = 0; i < maxEvictionsPerFrame && budgetMB > 0 && Total() - pendingBytes() > (size_t) budgetMB << 20; i++) {
+                GLuint victim = 0;
+                const Allocation *oldest = nullptr;
+                for (const auto &entry : textures) {
+                    const Allocation &allocation = entry.second;
+                    if (!allocation.evictable || std::min(allocation.width, allocation.height) / 2 < minEvictedSize ||
+                        evicting(entry.first))
+                        continue;
+                    if (!oldest || allocation.lastUse < oldest->lastUse ||
+                        (allocation.lastUse == oldest->lastUse && allocation.bytes > oldest->bytes)) {
+                        oldest = &allocation;
+                        victim = entry.first;
+                    }
+                }
+                if (!oldest)
+                    break;
+                startEviction(victim, *oldest);
+            }
+            frame++;
+        }
+
+        void DrawImGui() {
+            ImGui::Begin("GPU memory");
+            for (int category = 0; category < CategoryCount; category++)
+                ImGui::Text("%-17s %8.1f MB in %zu objects", CategoryName((Category) category),
+                            Total((Category) category) / (1024.0 * 1024.0), Count((Category) category));
+            ImGui::Text("%-17s %8.1f MB", "total", Total() / (1024.0 * 1024.0));
+            ImGui::Separator();
+            ImGui::DragInt("Budget (MB, 0 = off)", &budgetMB, 4.0f, 0, 16384);
+            ImGui::SliderInt("Evictions per frame", &maxEvictionsPerFrame, 1, 16);
+            ImGui::Text("Mip levels evicted: %zu", evictions);
+            if (ImGui::Button("Write gpu_memory.json"))
+                WriteJson("gpu_memory.json");
+            ImGui::End();
+        }
+
+        bool WriteJson(const std::string &path) const {
+            std::ofstream out(path);
+            if (!out)
+                return false;
+            out << "{\n  \"categories\": {\n";
+            for (int category = 0; category < CategoryCount; category++)
+                out << "    \"" << CategoryName((Category) category) << "\": {\"bytes\": " << Total((Category) category)
+                    << ", \"objects\": " << Count((Category) category) << "}" << (category + 1 < CategoryCount ? ",\n" : "\n");
+            out << "  },\n  \"total_bytes\": " << Total() << ",\n  \"budget_bytes\": " << ((size_t) budgetMB << 20)
+                << ",\n  \"evicted_mip_levels\": " << evictions << "\n}\n";
+            return true;
+        }
+
+    private:
+        struct Allocation {
+            Category category = Staging;
+            size_t bytes = 0;
+            bool evictable = false;
+            int width = 0, height = 0;
+            GLenum internalFormat = GL_RGBA, format = GL_RGBA;
+            // bytes per 4x4 block of compressed textures, 0 for uncompressed ones
+            size_t blockBytes = 0;
+            long lastUse = 0;
+        };
+
+        std::unordered_map<GLuint, Allocation> buffers, textures;
+        std::vector<std::pair<int, std::function<void(GLuint)>>> releaseListeners;
+
+        // a top level on its way out: the levels below it were packed into buffer on the frame it
+        // was picked and are unpacked one level up on the next, when the copy had time to finish
+        struct Eviction {
+            GLuint texture = 0;
+            GLuint buffer = 0;
+            size_t savedBytes = 0;
+        };
+        std::vector<Eviction> pendingEvictions;
+        int nextListener = 0;
+        long frame = 0;
+        size_t evictions = 0;
+
+        static int channels(GLenum format) {
+            return format == GL_RED ? 1 : (format == GL_RG ? 2 : (format == GL_RGB ? 3 : 4));
+        }
+
+        static size_t levelBytes(const Allocation &allocation, int width, int height) {
+            if (allocation.blockBytes > 0)
+                return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * allocation.blockBytes;
+            return (size_t) width * height * channels(allocation.format);
+        }
+
+        static size_t chainBytes(const Allocation &allocation) {
+            // three channel textures are padded to four by the drivers
+            size_t texelBytes = channels(allocation.format) == 3 ? 4 : channels(allocation.format);
+            size_t bytes = 0;
+            int width = allocation.width, height = allocation.height;
+            while (true) {
+                bytes += allocation.blockBytes > 0 ? levelBytes(allocation, width, height) : (size_t) width * height * texelBytes;
+                if (width == 1 && height == 1)
+                    return bytes;
+                width = std::max(1, width / 2);
+                height = std::max(1, height / 2);
+            }
+        }
+
+        bool evicting(GLuint name) const {
+            for (const Eviction &eviction : pendingEvictions)
+                if (eviction.texture == name)
+                    return true;
+            return false;
+        }
+
+        size_t pendingBytes() const {
+            size_t bytes = 0;
+            for (const Eviction &eviction : pendingEvictions)
+                bytes += eviction.savedBytes;
+            return bytes;
+        }
+
+        // the texture went away or was respecified, the packed levels are stale
+        void cancelEviction(GLuint name) {
+            for (auto eviction = pendingEvictions.begin(); eviction != pendingEvictions.end(); ++eviction)
+                if (eviction->texture == name) {
+                    glDeleteBuffers(1, &eviction->buffer);
+                    pendingEvictions.erase(eviction);
+                    return;
+                }
+        }
+
+        // packs levels 1.. into a pixel buffer. The copy stays on the GPU, nothing is read back and
+        // the frame doesn't wait for it.
+        void startEviction(GLuint name, const Allocation &allocation) {
+            GLint previousTexture, previousBuffer, previousPack;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+            glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previousBuffer);
+            glGetIntegerv(GL_PACK_ALIGNMENT, &previousPack);
+
+            Allocation smaller = allocation;
+            smaller.width = std::max(1, allocation.width / 2);
+            smaller.height = std::max(1, allocation.height / 2);
+            size_t packedBytes = 0;
+            for (int width = smaller.width, height = smaller.height; ; width = std::max(1, width / 2), height = std::max(1, height / 2)) {
+                packedBytes += levelBytes(allocation, width, height);
+                if (width == 1 && height == 1)
+                    break;
+            }
+            Eviction eviction;
+            eviction.texture = name;
+            eviction.savedBytes = allocation.bytes - chainBytes(smaller);
+            glGenBuffers(1, &eviction.buffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, eviction.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, packedBytes, nullptr, GL_STREAM_COPY);
+            glBindTexture(GL_TEXTURE_2D, name);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+            size_t offset = 0;
+            int width = smaller.width, height = smaller.height;
+            for (int level = 1; ; level++) {
+                if (allocation.blockBytes > 0)
+                    glGetCompressedTexImage(GL_TEXTURE_2D, level, (void *) offset);
+                else
+                    glGetTexImage(GL_TEXTURE_2D, level, allocation.format, GL_UNSIGNED_BYTE, (void *) offset);
+                offset += levelBytes(allocation, width, height);
+                if (width == 1 && height == 1)
+                    break;
+                width = std::max(1, width / 2);
+                height = std::max(1, height / 2);
+            }
+
+            glPixelStorei(GL_PACK_ALIGNMENT, previousPack);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, previousBuffer);
+            glBindTexture(GL_TEXTURE_2D, previousTexture);
+            pendingEvictions.push_back(eviction);
+        }
+
+        // respecifies the packed levels as levels 0.. straight from the pixel buffer, the old top
+        // level is freed
+        void finishEviction(const Eviction &eviction) {
+            Allocation &allocation = textures[eviction.texture];
+            GLint previousTexture, previousBuffer, previousUnpack;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+            glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &previousBuffer);
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousUnpack);
+            glBindTexture(GL_TEXTURE_2D, eviction.texture);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, eviction.buffer);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+            size_t offset = 0;
+            int width = std::max(1, allocation.width / 2), height = std::max(1, allocation.height / 2);
+            for (int level = 1; ; level++) {
+                size_t bytes = levelBytes(allocation, width, height);
+                if (allocation.blockBytes > 0)
+                    glCompressedTexImage2D(GL_TEXTURE_2D, level - 1, allocation.internalFormat, width, height, 0, bytes,
+                                           (const void *) offset);
+                else
+                    glTexImage2D(GL_TEXTURE_2D, level - 1, allocation.internalFormat, width, height, 0, allocation.format,
+                                 GL_UNSIGNED_BYTE, (const void *) offset);
+                offset += bytes;
+                if (width == 1 && height == 1) {
+                    // the old 1x1 level stays behind past the end of the shorter chain
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+                    break;
+                }
+                width = std::max(1, width / 2);
+                height = std::max(1, height / 2);
+            }
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, previousUnpack);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, previousBuffer);
+            glBindTexture(GL_TEXTURE_2D, previousTexture);
+            glDeleteBuffers(1, &eviction.buffer);
+            allocation.width = std::max(1, allocation.width / 2);
+            allocation.height = std::max(1, allocation.height / 2);
+            allocation.bytes = chainBytes(allocation);
+            evictions++;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_GPUMEMORY_H
@@ -0,0 +1,166 @@
+#ifndef PROJECT_BASE_GPUPROFILER_H
+#define PROJECT_BASE_GPUPROFILER_H
+
+#include <glad/glad.h>
+
+#include "imgui.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+    // GPU time and shaded fragments of named passes. Begin() and End() wrap a pass in a
+    // GL_TIME_ELAPSED query and, when asked to, a GL_SAMPLES_PASSED query. The results are
+    // collected a few frames later so reading them never stalls, and shown averaged over the
+    // last frames. Passes can't nest, and the fragment count can't wrap occlusion queries, GL
+    // allows one active query per occlusion target family.
+    class GpuProfiler {
+    public:
+        bool enabled = true;
+
+        static GpuProfiler &Instance() {
+            static GpuProfiler profiler;
+            return profiler;
+        }
+
+        GpuProfiler(const GpuProfiler &) = delete;
+        GpuProfiler &operator=(const GpuProfiler &) = delete;
+
+        // has to go before the context is destroyed
+        void Release() {
+            for (Pass &pass : passes) {
+                glDeleteQueries(FrameLatency, pass.timeQueries);
+                glDeleteQueries(FrameLatency, pass.sampleQueries);
+            }
+            passes.clear();
+        }
+
+        void Begin(const std::string &name, bool countFragments = true) {
+            active = -1;
+            if (!enabled)
+                return;
+            active = find(name);
+            Pass &pass = passes[active];
+            int slot = frame % FrameLatency;
+            glBeginQuery(GL_TIME_ELAPSED, pass.timeQueries[slot]);
+            pass.counting = countFragments;
+            if (countFragments)
+                glBeginQuery(GL_SAMPLES_PASSED, pass.sampleQueries[slot]);
+            pass.issued[slot] = frame;
+            pass.countedSlot[slot] = countFragments;
+        }
+
+        void End() {
+            if (active < 0)
+                return;
+            glEndQuery(GL_TIME_ELAPSED);
+            if (passes[active].counting)
+                glEndQuery(GL_SAMPLES_PASSED);
+            active = -1;
+        }
+
+        // call once per frame with the pixels of the render target the passes draw to
+        void EndFrame(int pixels) {
+            framePixels = pixels;
+            for (Pass &pass : passes)
+                for (int slot = 0; slot < FrameLatency; slot++) {
+                    if (pass.issued[slot] < 0 || pass.issued[slot] > frame - (FrameLatency - 1))
+                        continue;
+                    GLint available = 0;
+                    glGetQueryObjectiv(pass.timeQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                    if (!available)
+                        continue;
+                    GLuint64 nanoseconds = 0;
+                    glGetQueryObjectui64v(pass.timeQueries[slot], GL_QUERY_RESULT, &nanoseconds);
+                    pass.milliseconds = smooth(pass.milliseconds, nanoseconds / 1.0e6);
+                    if (pass.countedSlot[slot]) {
+                        GLuint64 samples = 0;
+                        glGetQueryObjectui64v(pass.sampleQueries[slot], GL_QUERY_RESULT, &samples);
+                        pass.fragments = smooth(pass.fragments, (double) samples);
+                    } else {
+                        pass.fragments = -1.0;
+                    }
+                    pass.issued[slot] = -1;
+                }
+            frame++;
+        }
+
+        // averaged GPU time of a pass, 0 until its first result came back
+        double Milliseconds(const std::string &name) const {
+            for (const Pass &pass : passes)
+                if (pass.name == name)
+                    return pass.milliseconds;
+            return 0.0;
+        }
+
+        // fragments that passed the depth test per pixel of the render target, the overdraw of the
+        // shading work. Negative when the pass doesn't count them.
+        double FragmentsPerPixel(const std::string &name) const {
+            for (const Pass &pass : passes)
+                if (pass.name == name)
+                    return pass.fragments < 0.0 ? -1.0 : pass.fragments / std::max(framePixels, 1);
+            return -1.0;
+        }
+
+        void DrawImGui() {
+            ImGui::Begin("Profiler");
+            ImGui::Checkbox("GPU timers", &enabled);
+            ImGui::Text("%-20s %8s %12s", "pass", "GPU ms", "fragments/px");
+            double total = 0.0;
+            for (const Pass &pass : passes) {
+                total += pass.milliseconds;
+                if (pass.fragments < 0.0)
+                    ImGui::Text("%-20s %8.3f %12s", pass.name.c_str(), pass.milliseconds, "-");
+                else
+                    ImGui::Text("%-20s %8.3f %12.2f", pass.name.c_str(), pass.milliseconds,
+                                pass.fragments / std::max(framePixels, 1));
+            }
+            ImGui::Text("%-20s %8.3f", "profiled total", total);
+            ImGui::End();
+        }
+
+    private:
+        // frames a query has to finish in before it's read
+        static const int FrameLatency = 3;
+
+        struct Pass {
+            std::string name;
+            GLuint timeQueries[FrameLatency] = {};
+            GLuint sampleQueries[FrameLatency] = {};
+            long issued[FrameLatency] = {-1, -1, -1};
+            bool countedSlot[FrameLatency] = {};
+            bool counting = false;
+            double milliseconds = 0.0;
+            double fragments = -1.0;
+        };
+
+        std::vector<Pass> passes;
+        int active = -1;
+        long frame = 0;
+        int framePixels = 1;
+
+        GpuProfiler() = default;
+
+        int find(const std::string &name) {
+            for (size_t i = 0; i < passes.size(); i++)
+                if (passes[i].name == name)
+                    return i;
+            passes.emplace_back();
+            Pass &pass = passes.back();
+            pass.name = name;
+            glGenQueries(FrameLatency, pass.timeQueries);
+            glGenQueries(FrameLatency, pass.sampleQueries);
+            return passes.size() - 1;
+        }
+
+        // an average over roughly the last 16 frames
+        static double smooth(double average, double value) {
+            return average <= 0.0 ? value : average + (value - average) / 16.0;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_GPUPROFILER_H
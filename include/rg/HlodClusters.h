@@ -0,0 +1,391 @@
+#ifndef PROJECT_BASE_HLODCLUSTERS_H
+#define PROJECT_BASE_HLODCLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/GLHandle.h>
+#include <rg/GpuMemory.h>
+#include <rg/MeshSimplification.h>
+#include <rg/TextureArrays.h>
+#include <rg/ThreadPool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+    // Hierarchical LOD for the scattered props. Build() sorts the instances of every source into the
+    // cells of a grid on the ground plane and bakes each cell into one proxy: the coarsest LOD of all
+    // its instances in world space, simplified once more as a whole, with the UVs moved into an atlas
+    // of the sources' diffuse textures. The proxies share one mesh with a MeshRange each, so the far
+    // field is one multi-draw however many props there are.
+    // Update() replaces the clusters beyond switchDistance, the instance cullers skip the instances of
+    // replaced clusters (InstanceCuller::SetClusters). Only sources that kept the CPU geometry of all
+    // their meshes are clustered, the instances of the others always draw themselves.
+    class HlodClusters {
+    public:
+        struct Source {
+            const Model *model;
+            std::vector<glm::mat4> transforms;
+            // atlased for the proxies, a 2D texture or a layer of a texture array
+            GLuint diffuse;
+            TextureArrayPool::Layer diffuseLayer;
+        };
+
+        // side of the grid cells on the ground plane
+        float cellSize = 45.0f;
+        // clusters farther than this from the camera draw as their proxy
+        float switchDistance = 70.0f;
+        // replaced clusters come back once the camera is this fraction closer than switchDistance
+        float hysteresis = 0.1f;
+        // error the merged proxies are simplified to, relative to the bounds diagonal of their cluster
+        float proxyError = 0.01f;
+        // texels of one source in the atlas
+        int tileSize = 256;
+        // false keeps every cluster on its instances
+        bool enabled = true;
+
+        // the proxies, empty before Build() or without instances
+        std::vector<Mesh> meshes;
+
+        void Build(const std::vector<Source> &sources) {
+            meshes.clear();
+            clusters.clear();
+            replaced.clear();
+            instanceClusters.assign(sources.size(), std::vector<int>());
+
+            // the grid cell of every instance, cells with less than two instances are left alone
+            std::map<std::pair<int, int>, std::vector<std::pair<int, int>>> cells;
+            for (size_t source = 0; source < sources.size(); source++) {
+                instanceClusters[source].assign(sources[source].transforms.size(), -1);
+                if (!hasGeometry(*sources[source].model))
+                    continue;
+                for (size_t instance = 0; instance < sources[source].transforms.size(); instance++) {
+                    glm::vec3 position(sources[source].transforms[instance][3]);
+                    std::pair<int, int> cell((int) std::floor(position.x / cellSize), (int) std::floor(position.z / cellSize));
+                    cells[cell].push_back(std::make_pair((int) source, (int) instance));
+                }
+            }
+            std::vector<std::vector<std::pair<int, int>>> members;
+            for (auto &cell : cells)
+                if (cell.second.size() >= 2)
+                    members.push_back(std::move(cell.second));
+            if (members.empty())
+                return;
+
+            buildAtlas(sources);
+            std::vector<Proxy> proxies(members.size());
+            ThreadPool::Shared().ParallelFor(members.size(), [&](size_t cluster) {
+                proxies[cluster] = bake(sources, members[cluster]);
+            });
+
+            std::vector<Vertex> vertices;
+            std::vector<unsigned int> indices;
+            std::vector<MeshRange> ranges;
+            for (size_t member = 0; member < members.size(); member++) {
+                const Proxy &proxy = proxies[member];
+                // degenerate members can simplify away entirely, they stay on their instances
+                if (proxy.indices.empty())
+                    continue;
+                int cluster = clusters.size();
+                MeshRange range;
+                range.firstIndex = indices.size();
+                range.indexCount = proxy.indices.size();
+                range.bounds = proxy.bounds;
+                range.source = cluster;
+                unsigned int baseVertex = vertices.size();
+                vertices.insert(vertices.end(), proxy.vertices.begin(), proxy.vertices.end());
+                for (unsigned int index : proxy.indices)
+                    indices.push_back(baseVertex + index);
+                ranges.push_back(range);
+                Cluster info;
+                info.bounds = proxy.bounds;
+                info.instances = members[member].size();
+                info.vertices = proxy.vertices.size();
+                info.triangles = proxy.indices.size() / 3;
+                info.sourceTriangles = proxy.sourceTriangles;
+                clusters.push_back(info);
+                for (const std::pair<int, int> &instance : members[member])
+                    instanceClusters[instance.first][instance.second] = cluster;
+            }
+            replaced.assign(clusters.size(), 0);
+            if (clusters.empty())
+                return;
+
+            Texture texture;
+            texture.id = atlas.Get();
+            texture.type = "texture_diffuse";
+            texture.path = "hlod atlas";
+            texture.handle = Share(std::move(atlas));
+            meshes.emplace_back(std::move(vertices), std::move(indices), std::vector<Texture>{texture});
+            meshes.back().glslIdentifierPrefix = "material.";
+            meshes.back().ranges = std::move(ranges);
+            meshes.back().ReleaseGeometry();
+        }
+
+        // the cluster of each instance of a source, -1 for instances that are always drawn themselves
+        const std::vector<int> &InstanceClusters(size_t source) const {
+            return instanceClusters[source];
+        }
+
+        // decides which clusters draw as their proxy this frame
+        void Update(const glm::vec3 &camera) {
+            for (size_t cluster = 0; cluster < replaced.size(); cluster++) {
+                const AABB &bounds = clusters[cluster].bounds;
+                float distance = glm::length(glm::max(glm::max(bounds.min - camera, camera - bounds.max), glm::vec3(0.0f)));
+                float limit = replaced[cluster] ? switchDistance * (1.0f - hysteresis) : switchDistance;
+                replaced[cluster] = enabled && distance > limit;
+            }
+        }
+
+        // per cluster, whether it draws as its proxy
+        const std::vector<char> &Replaced() const {
+            return replaced;
+        }
+
+        // draws the proxies of the replaced clusters whose bounds visible(bounds) accepts
+        template<typename Visible>
+        void Draw(Shader &shader, Visible &&visible) {
+            for (Mesh &mesh : meshes)
+                mesh.DrawRanges(shader, [&](const MeshRange &range) {
+                    return replaced[range.source] && visible(range.bounds);
+                });
+        }
+
+        size_t ClusterCount() const {
+            return replaced.size();
+        }
+
+        size_t ReplacedCount() const {
+            return std::count(replaced.begin(), replaced.end(), 1);
+        }
+
+        // totals over the clusters, or over the replaced ones only
+        size_t ClusteredInstances(bool replacedOnly = false) const {
+            return sum(&Cluster::instances, replacedOnly);
+        }
+
+        size_t ProxyVertices(bool replacedOnly = false) const {
+            return sum(&Cluster::vertices, replacedOnly);
+        }
+
+        size_t ProxyTriangles(bool replacedOnly = false) const {
+            return sum(&Cluster::triangles, replacedOnly);
+        }
+
+        // triangles the clustered instances have at their coarsest LOD
+        size_t SourceTriangles(bool replacedOnly = false) const {
+            return sum(&Cluster::sourceTriangles, replacedOnly);
+        }
+
+    private:
+        // border texels repeated around each tile so the atlas mips don't bleed between tiles
+        static const int Gutter = 4;
+
+        struct Cluster {
+            AABB bounds;
+            size_t instances = 0;
+            size_t vertices = 0;
+            size_t triangles = 0;
+            size_t sourceTriangles = 0;
+        };
+
+        struct Proxy {
+            std::vector<Vertex> vertices;
+            std::vector<unsigned int> indices;
+            AABB bounds;
+            size_t sourceTriangles = 0;
+        };
+
+        GLTexture atlas;
+        // where each source's tile sits in the atlas
+        std::vector<glm::vec2> tileOffsets;
+        glm::vec2 tileScale = glm::vec2(1.0f);
+        std::vector<std::vector<int>> instanceClusters;
+        std::vector<Cluster> clusters;
+        std::vector<char> replaced;
+
+        size_t sum(size_t Cluster::*field, bool replacedOnly) const {
+            size_t total = 0;
+            for (size_t cluster = 0; cluster < clusters.size(); cluster++)
+                if (!replacedOnly || replaced[cluster])
+                    total += clusters[cluster].*field;
+            return total;
+        }
+
+        // a proxy has to stand in for the whole model, every mesh has to be there to bake
+        static bool hasGeometry(const Model &model) {
+            for (const Mesh &mesh : model.meshes)
+                if (!mesh.HasGeometry())
+                    return false;
+            return true;
+        }
+
+        // the coarsest LOD of every member in world space, simplified as one mesh
+        Proxy bake(const std::vector<Source> &sources, const std::vector<std::pair<int, int>> &members) const {
+            std::vector<Vertex> vertices;
+            std::vector<unsigned int> indices;
+            std::vector<int> remap;
+            Proxy proxy;
+            for (const std::pair<int, int> &member : members) {
+                const Source &source = sources[member.first];
+                const glm::mat4 &transform = source.transforms[member.second];
+                glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+                for (const Mesh &mesh : source.model->meshes) {
+                    const unsigned int *levelIndices = mesh.indices.data();
+                    size_t count = mesh.indices.size();
+                    if (mesh.lods.size() > 1) {
+                        const MeshLod &lod = mesh.lods.back();
+                        levelIndices = mesh.lodIndices.data() + (lod.firstIndex - mesh.indices.size());
+                        count = lod.indexCount;
+                    }
+                    proxy.sourceTriangles += count / 3;
+                    // only the vertices the level uses
+                    remap.assign(mesh.vertices.size(), -1);
+                    for (size_t k = 0; k < count; k++) {
+                        unsigned int index = levelIndices[k];
+                        if (remap[index] < 0) {
+                            remap[index] = vertices.size();
+                            vertices.push_back(toWorld(mesh.vertices[index], transform, normalMatrix, member.first));
+                        }
+                        indices.push_back(remap[index]);
+                    }
+                }
+            }
+            if (indices.empty())
+                return proxy;
+
+            geometry::Simplifier simplifier(vertices.data(), vertices.size(), sizeof(Vertex), offsetof(Vertex, Tangent), indices);
+            simplifier.Simplify(proxyError);
+            std::vector<unsigned int> simplified = simplifier.Indices();
+            remap.assign(vertices.size(), -1);
+            for (unsigned int index : simplified) {
+                if (remap[index] < 0) {
+                    remap[index] = proxy.vertices.size();
+                    proxy.vertices.push_back(vertices[index]);
+                    proxy.bounds.Expand(vertices[index].Position);
+                }
+                proxy.indices.push_back(remap[index]);
+            }
+            return proxy;
+        }
+
+        // UVs are clamped into the source's tile, tiling textures show their first repeat
+        Vertex toWorld(const Vertex &source, const glm::mat4 &transform, const glm::mat3 &normalMatrix, int tile) const {
+            Vertex vertex = source;
+            vertex.Position = glm::vec3(transform * glm::vec4(source.Position, 1.0f));
+            glm::vec3 normal = normalMatrix * source.Normal;
+            float length = glm::length(normal);
+            vertex.Normal = length > 0.0f ? normal / length : normal;
+            vertex.TexCoords = tileOffsets[tile] + glm::clamp(source.TexCoords, 0.0f, 1.0f) * tileScale;
+            vertex.Tangent = glm::vec3(0.0f);
+            vertex.Bitangent = glm::vec3(0.0f);
+            return vertex;
+        }
+
+        // lays the diffuse textures out in a square grid of tiles and uploads the atlas with its mips
+        void buildAtlas(const std::vector<Source> &sources) {
+            int count = std::max((int) sources.size(), 1);
+            int columns = (int) std::ceil(std::sqrt((float) count));
+            int rows = (count + columns - 1) / columns;
+            int cell = tileSize + 2 * Gutter;
+            int width = columns * cell, height = rows * cell;
+            std::vector<unsigned char> pixels((size_t) width * height * 4, 0);
+            tileOffsets.clear();
+            tileScale = glm::vec2((float) tileSize / width, (float) tileSize / height);
+            for (size_t source = 0; source < sources.size(); source++) {
+                std::vector<unsigned char> tile = readTile(sources[source]);
+                int x0 = (int) (source % columns) * cell, y0 = (int) (source / columns) * cell;
+                for (int y = 0; y < cell; y++)
+                    for (int x = 0; x < cell; x++) {
+                        int tx = std::min(std::max(x - Gutter, 0), tileSize - 1);
+                        int ty = std::min(std::max(y - Gutter, 0), tileSize - 1);
+                        std::copy_n(&tile[((size_t) ty * tileSize + tx) * 4], 4, &pixels[((size_t) (y0 + y) * width + x0 + x) * 4]);
+                    }
+                tileOffsets.push_back(glm::vec2((float) (x0 + Gutter) / width, (float) (y0 + Gutter) / height));
+            }
+
+            GLint previousTexture, previousUnpack;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousUnpack);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            atlas = GLTexture::Create();
+            glBindTexture(GL_TEXTURE_2D, atlas.Get());
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            GpuMemory::Instance().TrackTexture(atlas.Get(), GpuMemory::MaterialTexture, pixels.size() * 4 / 3);
+            glBindTexture(GL_TEXTURE_2D, previousTexture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, previousUnpack);
+        }
+
+        // a source's diffuse texture box filtered to tileSize, read back from the finest resident
+        // level no larger than twice the tile. White when the source has no texture.
+        std::vector<unsigned char> readTile(const Source &source) const {
+            std::vector<unsigned char> tile((size_t) tileSize * tileSize * 4, 255);
+            bool layered = source.diffuseLayer.Valid();
+            GLenum target = layered ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+            GLuint texture = layered ? source.diffuseLayer.array : source.diffuse;
+            if (texture == 0)
+                return tile;
+
+            GLint previousTexture, previousPack;
+            glGetIntegerv(layered ? GL_TEXTURE_BINDING_2D_ARRAY : GL_TEXTURE_BINDING_2D, &previousTexture);
+            glGetIntegerv(GL_PACK_ALIGNMENT, &previousPack);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glBindTexture(target, texture);
+            // streamed textures start at their resident top level
+            GLint level = 0, width = 0, height = 0, layers = 1;
+            glGetTexParameteriv(target, GL_TEXTURE_BASE_LEVEL, &level);
+            glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+            while (std::max(width, height) > 2 * tileSize) {
+                GLint nextWidth = 0, nextHeight = 0;
+                glGetTexLevelParameteriv(target, level + 1, GL_TEXTURE_WIDTH, &nextWidth);
+                glGetTexLevelParameteriv(target, level + 1, GL_TEXTURE_HEIGHT, &nextHeight);
+                if (nextWidth == 0 || nextHeight == 0)
+                    break;
+                level++;
+                width = nextWidth;
+                height = nextHeight;
+            }
+            if (layered)
+                glGetTexLevelParameteriv(target, level, GL_TEXTURE_DEPTH, &layers);
+            if (width > 0 && height > 0) {
+                std::vector<unsigned char> data((size_t) width * height * layers * 4);
+                glGetTexImage(target, level, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+                const unsigned char *pixels = data.data() + (layered ? (size_t) source.diffuseLayer.index * width * height * 4 : 0);
+                for (int y = 0; y < tileSize; y++)
+                    for (int x = 0; x < tileSize; x++) {
+                        // the source texels under the tile texel, at least one
+                        int sx0 = x * width / tileSize, sx1 = std::max(sx0 + 1, (x + 1) * width / tileSize);
+                        int sy0 = y * height / tileSize, sy1 = std::max(sy0 + 1, (y + 1) * height / tileSize);
+                        unsigned int sum[4] = {0, 0, 0, 0};
+                        for (int sy = sy0; sy < sy1; sy++)
+                            for (int sx = sx0; sx < sx1; sx++)
+                                for (int c = 0; c < 4; c++)
+                                    sum[c] += pixels[((size_t) sy * width + sx) * 4 + c];
+                        unsigned int samples = (sx1 - sx0) * (sy1 - sy0);
+                        for (int c = 0; c < 4; c++)
+                            tile[((size_t) y * tileSize + x) * 4 + c] = (unsigned char) (sum[c] / samples);
+                    }
+            }
+            glBindTexture(target, previousTexture);
+            glPixelStorei(GL_PACK_ALIGNMENT, previousPack);
+            return tile;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_HLODCLUSTERS_H
@@ -0,0 +1,213 @@
+#ifndef PROJECT_BASE_IMPOSTORS_H
+#define PROJECT_BASE_IMPOSTORS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/GLHandle.h>
+#include <rg/GpuMemory.h>
+#include <rg/TextureArrays.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace rg {
+
+    // Octahedral impostor of a model. Bake() renders the model from frames x frames view directions,
+    // spread over the sphere by an octahedral map, into two atlases: albedo with coverage in alpha,
+    // and the object space normal with the depth in front of the bounding sphere's center. Far
+    // instances draw as a camera facing quad (impostor.vs) that blends the four frames around the
+    // direction it is seen from and is lit like the model (impostor.fs).
+    // Both atlases are cleared to zero, so they are premultiplied by the coverage and their mips
+    // and frame blends stay correct at the silhouettes.
+    class Impostor {
+    public:
+        // frames along each side of the octahedral map and texels along each side of a frame
+        explicit Impostor(int frames = 12, int frameSize = 96)
+                : frames(frames), frameSize(frameSize) {}
+
+        Impostor(const Impostor &) = delete;
+        Impostor &operator=(const Impostor &) = delete;
+
+        // bakes the model's albedo from a diffuse texture (or its layer) or, without one, a flat color
+        void Bake(Model &model, Shader &bakeShader, GLuint diffuse, TextureArrayPool::Layer diffuseLayer,
+                  const glm::vec3 &color) {
+            center = model.bounds.Center();
+            radius = std::max(glm::length(model.bounds.Extent()), 1e-4f);
+            int size = frames * frameSize;
+
+            GLint previousFramebuffer, previousViewport[4];
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+            glGetIntegerv(GL_VIEWPORT, previousViewport);
+            GLboolean blend = glIsEnabled(GL_BLEND), cullFace = glIsEnabled(GL_CULL_FACE);
+
+            albedo = createAtlas(size);
+            normalDepth = createAtlas(size);
+            GLTexture depth = GLTexture::Create();
+            glBindTexture(GL_TEXTURE_2D, depth.Get());
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+            GLFramebuffer framebuffer = GLFramebuffer::Create();
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.Get());
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo.Get(), 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalDepth.Get(), 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth.Get(), 0);
+            const GLenum attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+            glDrawBuffers(2, attachments);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "Impostor: bake framebuffer incomplete for " << model.path << std::endl;
+
+            glViewport(0, 0, size, size);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glEnable(GL_DEPTH_TEST);
+            glDisable(GL_BLEND);
+            glDisable(GL_CULL_FACE);
+
+            bakeShader.use();
+            bakeShader.setMat4("model", glm::mat4(1.0f));
+            bakeShader.setVec3("albedoColor", color);
+            bakeShader.setBool("useAlbedoTexture", diffuse != 0 || diffuseLayer.Valid());
+            bakeShader.setInt("albedoLayer", diffuseLayer.Valid() ? diffuseLayer.index : -1);
+            // past the units Mesh::Draw binds the model's own textures to, samplers of different
+            // types can't share a unit
+            glActiveTexture(GL_TEXTURE8);
+            glBindTexture(GL_TEXTURE_2D, diffuseLayer.Valid() ? 0 : diffuse);
+            glActiveTexture(GL_TEXTURE9);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, diffuseLayer.array);
+            bakeShader.setInt("albedoTexture", 8);
+            bakeShader.setInt("albedoArray", 9);
+            bakeShader.setFloat("impostorRadius", radius);
+            glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, radius, 3.0f * radius);
+            bakeShader.setMat4("projection", projection);
+            for (int y = 0; y < frames; y++)
+                for (int x = 0; x < frames; x++) {
+                    glm::vec3 direction = FrameDirection(x, y);
+                    glViewport(x * frameSize, y * frameSize, frameSize, frameSize);
+                    bakeShader.setMat4("view", glm::lookAt(center + direction * 2.0f * radius, center, FrameUp(direction)));
+                    model.Draw(bakeShader);
+                }
+
+            for (GLTexture *atlas : {&albedo, &normalDepth}) {
+                glBindTexture(GL_TEXTURE_2D, atlas->Get());
+                glGenerateMipmap(GL_TEXTURE_2D);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(GL_TEXTURE9);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            glActiveTexture(GL_TEXTURE8);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+            glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+            if (blend)
+                glEnable(GL_BLEND);
+            if (cullFace)
+                glEnable(GL_CULL_FACE);
+            setupQuad();
+        }
+
+        bool Baked() const {
+            return albedo.Get() != 0;
+        }
+
+        // Object space error an LOD selection compares against the other levels: the impostor is
+        // taken once the bounding sphere covers less than pixels at the allowed pixel error.
+        float Error(float pixels) const {
+            return 2.0f * radius / std::max(pixels, 1.0f);
+        }
+
+        const glm::vec3 &Center() const { return center; }
+        float Radius() const { return radius; }
+
+        // binds the atlases to units 0 and 1 and sets the uniforms impostor.vs and impostor.fs share
+        void Bind(Shader &shader) const {
+            shader.setVec3("impostorCenter", center);
+            shader.setFloat("impostorRadius", radius);
+            shader.setInt("impostorFrames", frames);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, albedo.Get());
+            shader.setInt("impostorAlbedo", 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, normalDepth.Get());
+            shader.setInt("impostorNormalDepth", 1);
+            GpuMemory::Instance().Touch(albedo.Get());
+            GpuMemory::Instance().Touch(normalDepth.Get());
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        // one impostor with the instance matrix as a constant attribute, the shader must be in use
+        void Draw(Shader &shader, const glm::mat4 &model) const {
+            Bind(shader);
+            glBindVertexArray(quadVAO.Get());
+            for (int column = 0; column < 4; column++)
+                glVertexAttrib4fv(5 + column, &model[column][0]);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            glBindVertexArray(0);
+        }
+
+        // the quad's element buffer, for other vertex arrays that stream the instance matrices
+        GLuint QuadElements() const {
+            return quadEBO.Get();
+        }
+
+        // view direction of a frame, from the center towards the camera, in object space
+        glm::vec3 FrameDirection(int x, int y) const {
+            glm::vec2 uv = glm::vec2((float) x, (float) y) / (float) std::max(frames - 1, 1);
+            return OctahedronDecode(uv);
+        }
+
+        // the octahedral map around the Y axis, the upper hemisphere fills the inner diamond
+        static glm::vec3 OctahedronDecode(const glm::vec2 &uv) {
+            glm::vec2 p = uv * 2.0f - 1.0f;
+            float y = 1.0f - std::fabs(p.x) - std::fabs(p.y);
+            if (y < 0.0f)
+                p = glm::vec2((1.0f - std::fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                              (1.0f - std::fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+            return glm::normalize(glm::vec3(p.x, y, p.y));
+        }
+
+        // up vector of a frame's camera, impostor.vs builds its quads the same way
+        static glm::vec3 FrameUp(const glm::vec3 &direction) {
+            return std::fabs(direction.y) > 0.999f ? glm::vec3(0.0f, 0.0f, -1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+
+    private:
+        int frames, frameSize;
+        glm::vec3 center = glm::vec3(0.0f);
+        float radius = 1.0f;
+        GLTexture albedo, normalDepth;
+        GLVertexArray quadVAO;
+        GLBuffer quadEBO;
+
+        static GLTexture createAtlas(int size) {
+            GLTexture atlas = GLTexture::Create();
+            glBindTexture(GL_TEXTURE_2D, atlas.Get());
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            GpuMemory::Instance().TrackTexture(atlas.Get(), GpuMemory::MaterialTexture, (size_t) size * size * 4 * 4 / 3);
+            return atlas;
+        }
+
+        // the corners come from gl_VertexID, the quad only needs its indices
+        void setupQuad() {
+            const unsigned int indices[6] = {0, 1, 2, 2, 1, 3};
+            quadVAO = GLVertexArray::Create();
+            quadEBO = GLBuffer::Create();
+            glBindVertexArray(quadVAO.Get());
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO.Get());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+            GpuMemory::Instance().TrackBuffer(quadEBO.Get(), GpuMemory::ModelGeometry, sizeof(indices));
+            glBindVertexArray(0);
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_IMPOSTORS_H
@@ -0,0 +1,160 @@
+#ifndef PROJECT_BASE_LODSELECTION_H
+#define PROJECT_BASE_LODSELECTION_H
+
+#include <glm/glm.hpp>
+
+#include <rg/Bounds.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// Picks the level of detail of a drawn instance from the error its levels show on screen. Each
+// level has an object space error (Model::lodObjectErrors), projected at the distance of the
+// instance's bounds it becomes pixels, and the coarsest level within the allowed pixel error is
+// drawn. Going coarser needs the error to be a hysteresis margin below the threshold, so an
+// instance sitting right at a switch distance doesn't flicker between two levels.
+namespace rg {
+
+    struct LodSettings {
+        // screen-space error a level may show, in pixels
+        float pixelError = 1.0f;
+        // the allowed error is scaled by 2^bias, positive values pick coarser levels
+        float bias = 0.0f;
+        // a coarser level is taken once its error is this fraction below the threshold
+        float hysteresis = 0.25f;
+        // switches blend over fadeSeconds with complementary dither patterns instead of popping
+        bool crossFade = true;
+        float fadeSeconds = 0.3f;
+        // models with an impostor (rg::Impostor) switch to it once they are smaller on screen than
+        // impostorPixels, scaled like the pixel error
+        bool impostors = true;
+        float impostorPixels = 48.0f;
+
+        float Threshold() const {
+            return pixelError * std::exp2(bias);
+        }
+    };
+
+    // the settings every draw path selects with, the quality settings adjust the bias
+    inline LodSettings &GlobalLodSettings() {
+        static LodSettings settings;
+        return settings;
+    }
+
+    // the camera of a frame as far as LOD selection is concerned
+    struct LodView {
+        glm::vec3 position = glm::vec3(0.0f);
+        // pixels a world unit covers at distance 1, from the vertical FOV and the framebuffer height
+        float pixelsPerUnit = 1.0f;
+        float time = 0.0f;
+
+        LodView() = default;
+
+        LodView(const glm::vec3 &position, float fovYDegrees, int viewportHeight, float time)
+                : position(position), time(time) {
+            pixelsPerUnit = viewportHeight / (2.0f * std::tan(glm::radians(fovYDegrees) * 0.5f));
+        }
+
+        // pixels per world unit at the point of the bounds closest to the camera, FLT_MAX inside them
+        float PixelsPerUnit(const AABB &bounds) const {
+            if (bounds.IsEmpty())
+                return 0.0f;
+            float distance = glm::length(bounds.Center() - position) - glm::length(bounds.Extent());
+            return distance > 0.0f ? pixelsPerUnit / distance : FLT_MAX;
+        }
+    };
+
+    // largest scale of a transform, what its object space errors grow by
+    inline float MaxScale(const glm::mat4 &transform) {
+        return std::max(std::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))),
+                        glm::length(glm::vec3(transform[2])));
+    }
+
+    // Level for an instance currently drawn at level current (-1 for none), errors ascend from
+    // level 0 and are in the units pixelsPerUnit is given in. cull.cs does the same on the GPU.
+    inline int SelectLod(const float *errors, int levelCount, float pixelsPerUnit, int current,
+                         const LodSettings &settings) {
+        float threshold = settings.Threshold();
+        // coarsest level within the threshold, and within the threshold less the hysteresis margin
+        int within = 0, withinMargin = 0;
+        for (int level = 0; level < levelCount; level++) {
+            float pixels = errors[level] * pixelsPerUnit;
+            if (pixels <= threshold)
+                within = level;
+            if (pixels <= threshold * (1.0f - settings.hysteresis))
+                withinMargin = level;
+        }
+        if (current < 0 || current >= levelCount || errors[current] * pixelsPerUnit > threshold)
+            return within;
+        return std::max(current, withinMargin);
+    }
+
+    struct LodChoice {
+        int level = 0;
+        // level fading out while level fades in, -1 when there is no cross-fade
+        int previous = -1;
+        // progress of the cross-fade from 0 to 1
+        float fade = 1.0f;
+
+        bool Fading() const {
+            return previous >= 0;
+        }
+    };
+
+    // The levels of a set of instances across frames, for the hysteresis and the cross-fades.
+    // Instances are told apart by a key the caller picks, keys are small indices.
+    class LodSelector {
+    public:
+        // errors are the object space errors of the levels, the instance is scaled by scale and has
+        // these world bounds. Instances that weren't selected for longer than a fade snap to their level.
+        LodChoice Select(size_t key, const std::vector<float> &errors, float scale, const AABB &worldBounds,
+                         const LodView &view) {
+            if (key >= states.size())
+                states.resize(key + 1);
+            State &state = states[key];
+            const LodSettings &settings = GlobalLodSettings();
+            bool seen = state.level >= 0 && view.time - state.lastTime <= settings.fadeSeconds;
+            int level = SelectLod(errors.data(), (int) errors.size(), view.PixelsPerUnit(worldBounds) * scale,
+                                  seen ? state.level : -1, settings);
+            if (level != state.level) {
+                state.previous = seen && settings.crossFade ? state.level : -1;
+                state.fadeStart = view.time;
+                state.level = level;
+            }
+            state.lastTime = view.time;
+
+            LodChoice choice;
+            choice.level = level;
+            if (state.previous >= 0 && settings.crossFade && settings.fadeSeconds > 0.0f) {
+                choice.fade = (view.time - state.fadeStart) / settings.fadeSeconds;
+                if (choice.fade < 1.0f)
+                    choice.previous = state.previous;
+                else
+                    state.previous = -1;
+            }
+            if (!choice.Fading())
+                choice.fade = 1.0f;
+            return choice;
+        }
+
+        // current level of an instance, -1 before it was selected
+        int Level(size_t key) const {
+            return key < states.size() ? states[key].level : -1;
+        }
+
+    private:
+        struct State {
+            int level = -1;
+            int previous = -1;
+            float fadeStart = 0.0f;
+            float lastTime = 0.0f;
+        };
+
+        std::vector<State> states;
+    };
+
+};
+
+#endif //PROJECT_BASE_LODSELECTION_H
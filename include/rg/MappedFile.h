@@ -0,0 +1,61 @@
+#ifndef PROJECT_BASE_MAPPEDFILE_H
+#define PROJECT_BASE_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rg {
+
+    // Read only memory mapping of a whole file, the pages are faulted in by whoever touches them
+    // first so parsers can split the file between threads without copying it.
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string &path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping != MAP_FAILED) {
+                    bytes = static_cast<const char *>(mapping);
+                    length = info.st_size;
+                    madvise(mapping, length, MADV_SEQUENTIAL);
+                }
+            }
+            close(fd);
+        }
+
+        ~MappedFile() {
+            if (bytes)
+                munmap(const_cast<char *>(bytes), length);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool IsOpen() const {
+            return bytes != nullptr;
+        }
+
+        const char *Data() const {
+            return bytes;
+        }
+
+        size_t Size() const {
+            return length;
+        }
+
+    private:
+        const char *bytes = nullptr;
+        size_t length = 0;
+    };
+
+};
+
+#endif //PROJECT_BASE_MAPPEDFILE_H
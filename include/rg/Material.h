@@ -0,0 +1,205 @@
+#ifndef PROJECT_BASE_MATERIAL_H
+#define PROJECT_BASE_MATERIAL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/shader.h>
+#include <rg/GLHandle.h>
+#include <rg/GpuMemory.h>
+#include <rg/TextureArrays.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+    // binding point of the MaterialBlock uniform block of every material shader
+    const GLuint MaterialBlockBinding = 0;
+
+    // MaterialBlock in std140 layout, the vec4 goes first so the floats after it need no padding
+    struct MaterialParameters {
+        glm::vec4 specular = glm::vec4(0.0f);
+        float shininess = 32.0f;
+        float alpha = 1.0f;
+        float emissiveStrength = 0.0f;
+        float parallaxScale = 0.0f;
+    };
+    static_assert(sizeof(MaterialParameters) == 32, "MaterialParameters has to match the std140 MaterialBlock");
+
+    // what a draw needs besides its geometry: the shader variant, its textures and the parameter block
+    struct Material {
+        // bound to the unit of its position in the texture set, a layer binds its array instead and
+        // goes to the material layer attribute of its slot
+        struct Texture {
+            std::string sampler;
+            GLuint texture = 0;
+            TextureArrayPool::Layer layer;
+            MaterialLayerSlot slot = DiffuseLayer;
+
+            Texture(std::string sampler, GLuint texture, TextureArrayPool::Layer layer, MaterialLayerSlot slot)
+                    : sampler(std::move(sampler)), texture(texture), layer(layer), slot(slot) {}
+        };
+
+        uint16_t id = 0;
+        std::string name;
+        Shader *shader = nullptr;
+        MaterialParameters parameters;
+        std::vector<Texture> textures;
+        // sampler uniform of each texture
+        std::vector<GLint> locations;
+        // drawn into the depth prepass and shaded with GL_EQUAL afterwards, worth it for opaque
+        // materials whose fragments cost more than drawing the geometry twice
+        bool depthPrepass = false;
+    };
+
+    // All materials of the scene with their parameter blocks in one uniform buffer. Add() registers a
+    // material and returns its compact ID, Upload() writes every block once at offsets aligned for
+    // glBindBufferRange. Binding a material is then a program switch, one range bind and its textures,
+    // the parameters are never set as single uniforms again.
+    class MaterialLibrary {
+    public:
+        explicit MaterialLibrary(TextureArrayPool &pool) : pool(pool) {}
+        MaterialLibrary(const MaterialLibrary &) = delete;
+        MaterialLibrary &operator=(const MaterialLibrary &) = delete;
+
+        // the shader's MaterialBlock gets the material binding point and its samplers are looked up once,
+        // materials added after Upload() need another Upload()
+        uint16_t Add(const std::string &name, Shader &shader, const MaterialParameters &parameters,
+                     std::vector<Material::Texture> textures = std::vector<Material::Texture>()) {
+            materials.emplace_back();
+            Material &material = materials.back();
+            material.id = (uint16_t) (materials.size() - 1);
+            material.name = name;
+            material.shader = &shader;
+            material.parameters = parameters;
+            material.textures = std::move(textures);
+            for (const Material::Texture &texture : material.textures)
+                material.locations.push_back(glGetUniformLocation(shader.ID, texture.sampler.c_str()));
+            // parallax mapping samples the height map for every fragment before the lighting does
+            material.depthPrepass = parameters.alpha >= 1.0f && parameters.parallaxScale > 0.0f;
+
+            GLuint blockIndex = glGetUniformBlockIndex(shader.ID, "MaterialBlock");
+            if (blockIndex != GL_INVALID_INDEX)
+                glUniformBlockBinding(shader.ID, blockIndex, MaterialBlockBinding);
+            else
+                std::cout << "Material " << name << ": shader has no MaterialBlock" << std::endl;
+            return material.id;
+        }
+
+        // (re)creates the uniform buffer with the blocks of all materials
+        void Upload() {
+            GLint alignment = 0;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            alignment = std::max(alignment, 1);
+            stride = (sizeof(MaterialParameters) + alignment - 1) / alignment * alignment;
+
+            std::vector<unsigned char> blocks(stride * materials.size());
+            for (const Material &material : materials)
+                std::memcpy(blocks.data() + material.id * stride, &material.parameters, sizeof(MaterialParameters));
+            if (!buffer)
+                buffer = GLBuffer::Create();
+            GLint previousBuffer;
+            glGetIntegerv(GL_UNIFORM_BUFFER_BINDING, &previousBuffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer.Get());
+            glBufferData(GL_UNIFORM_BUFFER, blocks.size(), blocks.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, previousBuffer);
+            GpuMemory::Instance().TrackBuffer(buffer.Get(), GpuMemory::ModelGeometry, blocks.size());
+            boundMaterial = -1;
+        }
+
+        // rewrites the block of one material, for tweaking parameters at runtime
+        void SetParameters(uint16_t id, const MaterialParameters &parameters) {
+            materials[id].parameters = parameters;
+            if (!buffer)
+                return;
+            GLint previousBuffer;
+            glGetIntegerv(GL_UNIFORM_BUFFER_BINDING, &previousBuffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer.Get());
+            glBufferSubData(GL_UNIFORM_BUFFER, id * stride, sizeof(MaterialParameters), &parameters);
+            glBindBuffer(GL_UNIFORM_BUFFER, previousBuffer);
+        }
+
+        // uses the material's shader and binds its block and textures, returns the shader for the
+        // per-draw uniforms. The samplers are pointed at their units on every bind, Mesh::BindTextures
+        // repoints them for the textures a mesh brings itself. The 2D textures count as used for
+        // GpuMemory's eviction.
+        Shader &Bind(uint16_t id) {
+            Material &material = materials[id];
+            material.shader->use();
+            if (boundMaterial != id) {
+                glBindBufferRange(GL_UNIFORM_BUFFER, MaterialBlockBinding, buffer.Get(), id * stride,
+                                  sizeof(MaterialParameters));
+                boundMaterial = id;
+                binds++;
+            } else {
+                skipped++;
+            }
+            for (size_t unit = 0; unit < material.textures.size(); unit++) {
+                const Material::Texture &texture = material.textures[unit];
+                if (texture.layer.Valid()) {
+                    pool.Bind(unit, texture.layer.array);
+                    glVertexAttribI1i(MaterialLayerAttribute + texture.slot, texture.layer.index);
+                } else {
+                    glActiveTexture(GL_TEXTURE0 + unit);
+                    glBindTexture(GL_TEXTURE_2D, texture.texture);
+                    GpuMemory::Instance().Touch(texture.texture);
+                }
+                glUniform1i(material.locations[unit], unit);
+            }
+            return *material.shader;
+        }
+
+        const Material &Get(uint16_t id) const {
+            return materials[id];
+        }
+
+        bool DepthPrepass(uint16_t id) const {
+            return materials[id].depthPrepass;
+        }
+
+        void SetDepthPrepass(uint16_t id, bool depthPrepass) {
+            materials[id].depthPrepass = depthPrepass;
+        }
+
+        // call once per frame, keeps the block bind counts of the finished frame
+        void EndFrame() {
+            bindsLastFrame = binds;
+            skippedLastFrame = skipped;
+            binds = skipped = 0;
+        }
+
+        size_t Count() const {
+            return materials.size();
+        }
+
+        size_t Bytes() const {
+            return stride * materials.size();
+        }
+
+        size_t BindsLastFrame() const {
+            return bindsLastFrame;
+        }
+
+        size_t SkippedBindsLastFrame() const {
+            return skippedLastFrame;
+        }
+
+    private:
+        TextureArrayPool &pool;
+        std::vector<Material> materials;
+        GLBuffer buffer;
+        size_t stride = sizeof(MaterialParameters);
+        // material whose block is bound at MaterialBlockBinding, -1 for none
+        int boundMaterial = -1;
+        size_t binds = 0, skipped = 0, bindsLastFrame = 0, skippedLastFrame = 0;
+    };
+
+};
+
+#endif //PROJECT_BASE_MATERIAL_H
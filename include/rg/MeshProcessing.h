@@ -0,0 +1,468 @@
+#ifndef PROJECT_BASE_MESHPROCESSING_H
+#define PROJECT_BASE_MESHPROCESSING_H
+
+#include <rg/Arena.h>
+#include <rg/ThreadPool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+// Normal and tangent generation for imported meshes. The per triangle work (face normals, corner
+// angles, texture space axes) runs over blocks of triangles in SIMD lanes on the thread pool and
+// writes one contribution per triangle corner. Vertices are then welded into groups and every
+// group sums the contributions of its corners on its own, so nothing is accumulated through
+// shared memory and the result doesn't depend on the thread count. All buffers, the streams
+// and the kernels' scratch, come from an arena so processing a mesh doesn't hit the heap.
+namespace rg {
+namespace geometry {
+
+    // vertex attributes as separate float arrays, the layout the kernels vectorize over,
+    // zero initialized in one allocation from the arena
+    struct VertexStreams {
+        float *px, *py, *pz;
+        float *nx, *ny, *nz;
+        float *u, *v;
+        float *tx, *ty, *tz;
+        float *bx, *by, *bz;
+
+        VertexStreams(Arena &arena, size_t count) : count(count) {
+            float *data = arena.Allocate<float>(StreamCount * count, 0.0f);
+            float **streams[StreamCount] = {&px, &py, &pz, &nx, &ny, &nz, &u, &v, &tx, &ty, &tz, &bx, &by, &bz};
+            for (int i = 0; i < StreamCount; i++)
+                *streams[i] = data + i * count;
+        }
+
+        size_t Size() const {
+            return count;
+        }
+
+        // arena bytes for the streams of count vertices
+        static size_t Bytes(size_t count) {
+            return StreamCount * count * sizeof(float) + 32;
+        }
+
+    private:
+        static const int StreamCount = 14;
+        size_t count;
+    };
+
+    inline const char *SimdPath() {
+#if defined(__AVX2__)
+        return "AVX2";
+#elif defined(__SSE4_1__)
+        return "SSE4.1";
+#else
+        return "scalar";
+#endif
+    }
+
+    namespace detail {
+
+#if defined(__AVX2__)
+        typedef __m256 Lanes;
+        const int LaneCount = 8;
+        inline Lanes set1(float f) { return _mm256_set1_ps(f); }
+        inline Lanes load(const float *p) { return _mm256_load_ps(p); }
+        inline void store(float *p, Lanes a) { _mm256_store_ps(p, a); }
+        inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+        inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+        inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+        inline Lanes div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+        inline Lanes sqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+        inline Lanes min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+        inline Lanes max(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+        inline Lanes abs(Lanes a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+        inline Lanes greater(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        inline Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+#elif defined(__SSE4_1__)
+        typedef __m128 Lanes;
+        const int LaneCount = 4;
+        inline Lanes set1(float f) { return _mm_set1_ps(f); }
+        inline Lanes load(const float *p) { return _mm_load_ps(p); }
+        inline void store(float *p, Lanes a) { _mm_store_ps(p, a); }
+        inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+        inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+        inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+        inline Lanes div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+        inline Lanes sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+        inline Lanes min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+        inline Lanes max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+        inline Lanes abs(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+        inline Lanes greater(Lanes a, Lanes b) { return _mm_cmpgt_ps(a, b); }
+        inline Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm_blendv_ps(b, a, mask); }
+#else
+        // one lane, the comparisons return 1 or 0
+        typedef float Lanes;
+        const int LaneCount = 1;
+        inline Lanes set1(float f) { return f; }
+        inline Lanes load(const float *p) { return *p; }
+        inline void store(float *p, Lanes a) { *p = a; }
+        inline Lanes add(Lanes a, Lanes b) { return a + b; }
+        inline Lanes sub(Lanes a, Lanes b) { return a - b; }
+        inline Lanes mul(Lanes a, Lanes b) { return a * b; }
+        inline Lanes div(Lanes a, Lanes b) { return a / b; }
+        inline Lanes sqrt(Lanes a) { return std::sqrt(a); }
+        inline Lanes min(Lanes a, Lanes b) { return std::min(a, b); }
+        inline Lanes max(Lanes a, Lanes b) { return std::max(a, b); }
+        inline Lanes abs(Lanes a) { return std::fabs(a); }
+        inline Lanes greater(Lanes a, Lanes b) { return a > b ? 1.0f : 0.0f; }
+        inline Lanes select(Lanes mask, Lanes a, Lanes b) { return mask != 0.0f ? a : b; }
+#endif
+
+        struct Vec3 {
+            Lanes x, y, z;
+        };
+
+        inline Vec3 sub(const Vec3 &a, const Vec3 &b) {
+            return Vec3{sub(a.x, b.x), sub(a.y, b.y), sub(a.z, b.z)};
+        }
+
+        inline Vec3 scale(const Vec3 &a, Lanes f) {
+            return Vec3{mul(a.x, f), mul(a.y, f), mul(a.z, f)};
+        }
+
+        inline Lanes dot(const Vec3 &a, const Vec3 &b) {
+            return add(add(mul(a.x, b.x), mul(a.y, b.y)), mul(a.z, b.z));
+        }
+
+        inline Vec3 cross(const Vec3 &a, const Vec3 &b) {
+            return Vec3{sub(mul(a.y, b.z), mul(a.z, b.y)), sub(mul(a.z, b.x), mul(a.x, b.z)), sub(mul(a.x, b.y), mul(a.y, b.x))};
+        }
+
+        // 1 / length, 0 for zero vectors so degenerate input contributes nothing
+        inline Lanes inverseLength(const Vec3 &a) {
+            Lanes squared = dot(a, a);
+            return select(greater(squared, set1(1e-30f)), div(set1(1.0f), sqrt(squared)), set1(0.0f));
+        }
+
+        inline Vec3 normalize(const Vec3 &a) {
+            return scale(a, inverseLength(a));
+        }
+
+        // acos of a cosine, polynomial approximation accurate to 7e-5 radians (Abramowitz & Stegun 4.4.45)
+        inline Lanes acos(Lanes x) {
+            x = min(max(x, set1(-1.0f)), set1(1.0f));
+            Lanes a = abs(x);
+            Lanes polynomial = add(set1(1.5707288f), mul(a, add(set1(-0.2121144f), mul(a, add(set1(0.0742610f), mul(a, set1(-0.0187293f)))))));
+            Lanes result = mul(polynomial, sqrt(sub(set1(1.0f), a)));
+            return select(greater(set1(0.0f), x), sub(set1(3.14159265f), result), result);
+        }
+
+        // interior angles at the three corners of the triangles
+        inline void cornerAngles(const Vec3 (&p)[3], Lanes (&angles)[3]) {
+            Vec3 edges[3] = {normalize(sub(p[1], p[0])), normalize(sub(p[2], p[1])), normalize(sub(p[0], p[2]))};
+            for (int k = 0; k < 3; k++) {
+                // the edges leaving and entering the corner
+                const Vec3 &out = edges[k], &in = edges[(k + 2) % 3];
+                angles[k] = acos(sub(set1(0.0f), dot(out, in)));
+            }
+        }
+
+        // per corner output of the triangle kernels, corner k of triangle t at k * triangleCount + t
+        struct Corners {
+            float *x, *y, *z;
+            // second vector, the bitangent direction for the tangent kernel
+            float *bx, *by, *bz;
+        };
+
+        // Runs kernel(first, end, results) over blocks of LaneCount triangles and copies
+        // results[output][corner] to the outputs. Lanes past the end repeat the last triangle,
+        // their results are dropped.
+        template<typename Kernel>
+        void forEachTriangleBlock(size_t triangleCount, ThreadPool &pool, int outputCount, float *const *outputs, Kernel &&kernel) {
+            const size_t blockSize = 2048;
+            size_t taskCount = (triangleCount + blockSize - 1) / blockSize;
+            pool.ParallelFor(taskCount, [&](size_t task) {
+                size_t begin = task * blockSize, end = std::min(triangleCount, begin + blockSize);
+                alignas(32) float results[6][3][LaneCount];
+                for (size_t t = begin; t < end; t += LaneCount) {
+                    kernel(t, end, results);
+                    size_t valid = std::min<size_t>(LaneCount, end - t);
+                    for (int o = 0; o < outputCount; o++)
+                        for (int k = 0; k < 3; k++)
+                            std::memcpy(&outputs[o][k * triangleCount + t], results[o][k], valid * sizeof(float));
+                }
+            });
+        }
+
+        // gathers the lanes' corner attributes out of the streams
+        inline void gather(const std::vector<unsigned int> &indices, size_t first, size_t end, const float *x, const float *y, const float *z, Vec3 (&out)[3]) {
+            alignas(32) float values[3][3][LaneCount];
+            for (int lane = 0; lane < LaneCount; lane++) {
+                size_t triangle = std::min(first + lane, end - 1);
+                for (int k = 0; k < 3; k++) {
+                    unsigned int vertex = indices[3 * triangle + k];
+                    values[k][0][lane] = x[vertex];
+                    values[k][1][lane] = y[vertex];
+                    values[k][2][lane] = z ? z[vertex] : 0.0f;
+                }
+            }
+            for (int k = 0; k < 3; k++)
+                out[k] = Vec3{load(values[k][0]), load(values[k][1]), load(values[k][2])};
+        }
+
+        inline uint32_t keyBits(float f) {
+            // +0 and -0 weld together
+            if (f == 0.0f)
+                f = 0.0f;
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            return bits;
+        }
+
+        // Groups vertices whose attributes are bit identical, returns the group of every vertex.
+        // The meshes come with one vertex per face corner so this is what connects the faces.
+        // The hash table is scratch, the groups stay in the arena.
+        inline unsigned int *weld(size_t count, std::initializer_list<const float *> attributes, Arena &arena, unsigned int &groupCount) {
+            unsigned int *groups = arena.Allocate<unsigned int>(count);
+            ArenaScope scratch(arena);
+            size_t capacity = 16;
+            while (capacity < 2 * count)
+                capacity *= 2;
+            unsigned int *table = arena.Allocate<unsigned int>(capacity, UINT32_MAX);
+            unsigned int *representatives = arena.Allocate<unsigned int>(count);
+            groupCount = 0;
+            for (size_t i = 0; i < count; i++) {
+                uint64_t hash = 14695981039346656037ull;
+                for (const float *attribute : attributes)
+                    hash = (hash ^ keyBits(attribute[i])) * 1099511628211ull;
+                size_t slot = (hash ^ (hash >> 29)) & (capacity - 1);
+                while (true) {
+                    unsigned int group = table[slot];
+                    if (group == UINT32_MAX) {
+                        table[slot] = groupCount;
+                        representatives[groupCount] = i;
+                        groups[i] = groupCount++;
+                        break;
+                    }
+                    bool same = true;
+                    for (const float *attribute : attributes)
+                        same = same && keyBits(attribute[i]) == keyBits(attribute[representatives[group]]);
+                    if (same) {
+                        groups[i] = group;
+                        break;
+                    }
+                    slot = (slot + 1) & (capacity - 1);
+                }
+            }
+            return groups;
+        }
+
+        // corners of every group in compressed rows: the corners of group g are
+        // corners[offsets[g]] .. corners[offsets[g + 1] - 1]
+        inline void groupCorners(const std::vector<unsigned int> &indices, const unsigned int *groups, unsigned int groupCount, Arena &arena,
+                                 unsigned int *&offsets, unsigned int *&corners) {
+            size_t triangleCount = indices.size() / 3;
+            offsets = arena.Allocate<unsigned int>(groupCount + 1, 0u);
+            corners = arena.Allocate<unsigned int>(indices.size());
+            for (unsigned int vertex : indices)
+                offsets[groups[vertex] + 1]++;
+            for (unsigned int g = 0; g < groupCount; g++)
+                offsets[g + 1] += offsets[g];
+            ArenaScope scratch(arena);
+            unsigned int *fill = arena.Allocate<unsigned int>(groupCount);
+            std::copy(offsets, offsets + groupCount, fill);
+            for (size_t i = 0; i < indices.size(); i++)
+                corners[fill[groups[indices[i]]]++] = (i % 3) * triangleCount + i / 3;
+        }
+
+        // arena bytes the kernels need at most for a mesh
+        inline size_t scratchBytes(size_t vertexCount, size_t triangleCount) {
+            size_t capacity = 16;
+            while (capacity < 2 * vertexCount)
+                capacity *= 2;
+            // corner outputs, groups, hash table and representatives, offsets and fill, corner lists, group results
+            size_t words = 6 * 3 * triangleCount + vertexCount + capacity + vertexCount + 2 * (vertexCount + 1) + 3 * triangleCount + 6 * vertexCount;
+            return words * sizeof(float) + 16 * 32;
+        }
+
+        template<typename Body>
+        void forEachRange(size_t count, ThreadPool &pool, Body &&body) {
+            const size_t rangeSize = 4096;
+            pool.ParallelFor((count + rangeSize - 1) / rangeSize, [&](size_t task) {
+                body(task * rangeSize, std::min(count, (task + 1) * rangeSize));
+            });
+        }
+
+    };
+
+    // arena bytes for processing a mesh: its streams plus the kernels' scratch
+    inline size_t ArenaBytes(size_t vertexCount, size_t triangleCount) {
+        return VertexStreams::Bytes(vertexCount) + detail::scratchBytes(vertexCount, triangleCount);
+    }
+
+    // Angle weighted smooth normals: every face contributes its normal weighted by the angle at
+    // the corner, summed over all vertices at the same position. The scratch is returned to the
+    // arena afterwards.
+    inline void GenerateNormals(VertexStreams &streams, const std::vector<unsigned int> &indices, Arena &arena, ThreadPool &pool = ThreadPool::Shared()) {
+        using namespace detail;
+        size_t triangleCount = indices.size() / 3, vertexCount = streams.Size();
+        std::fill(streams.nx, streams.nx + vertexCount, 0.0f);
+        std::fill(streams.ny, streams.ny + vertexCount, 0.0f);
+        std::fill(streams.nz, streams.nz + vertexCount, 0.0f);
+        if (triangleCount == 0)
+            return;
+
+        ArenaScope scratch(arena);
+        Corners corners;
+        corners.x = arena.Allocate<float>(3 * triangleCount);
+        corners.y = arena.Allocate<float>(3 * triangleCount);
+        corners.z = arena.Allocate<float>(3 * triangleCount);
+        float *const outputs[] = {corners.x, corners.y, corners.z};
+        forEachTriangleBlock(triangleCount, pool, 3, outputs, [&](size_t first, size_t end, float (&results)[6][3][LaneCount]) {
+            Vec3 p[3];
+            gather(indices, first, end, streams.px, streams.py, streams.pz, p);
+            Vec3 normal = normalize(cross(sub(p[1], p[0]), sub(p[2], p[0])));
+            Lanes angles[3];
+            cornerAngles(p, angles);
+            for (int k = 0; k < 3; k++) {
+                Vec3 weighted = scale(normal, angles[k]);
+                store(results[0][k], weighted.x);
+                store(results[1][k], weighted.y);
+                store(results[2][k], weighted.z);
+            }
+        });
+
+        unsigned int groupCount;
+        unsigned int *groups = weld(vertexCount, {streams.px, streams.py, streams.pz}, arena, groupCount);
+        unsigned int *offsets, *groupCornerList;
+        groupCorners(indices, groups, groupCount, arena, offsets, groupCornerList);
+
+        float *sums = arena.Allocate<float>(3 * groupCount);
+        forEachRange(groupCount, pool, [&](size_t begin, size_t end) {
+            for (size_t g = begin; g < end; g++) {
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                for (unsigned int i = offsets[g]; i < offsets[g + 1]; i++) {
+                    unsigned int corner = groupCornerList[i];
+                    x += corners.x[corner];
+                    y += corners.y[corner];
+                    z += corners.z[corner];
+                }
+                float length = std::sqrt(x * x + y * y + z * z);
+                float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+                sums[3 * g] = x * inverse;
+                sums[3 * g + 1] = y * inverse;
+                sums[3 * g + 2] = z * inverse;
+            }
+        });
+        forEachRange(vertexCount, pool, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                streams.nx[i] = sums[3 * groups[i]];
+                streams.ny[i] = sums[3 * groups[i] + 1];
+                streams.nz[i] = sums[3 * groups[i] + 2];
+            }
+        });
+    }
+
+    // Tangent frames following the MikkTSpace conventions: per face texture space axes,
+    // projected into the plane of each corner's normal and weighted by the corner angle, summed
+    // over the vertices that share position, normal and texture coordinate, so the frame splits at
+    // UV seams. The bitangent is rebuilt as sign * cross(normal, tangent) with the handedness of
+    // the summed texture space, which is what MikkTSpace based normal map bakers expect.
+    inline void GenerateTangents(VertexStreams &streams, const std::vector<unsigned int> &indices, Arena &arena, ThreadPool &pool = ThreadPool::Shared()) {
+        using namespace detail;
+        size_t triangleCount = indices.size() / 3, vertexCount = streams.Size();
+        for (float *stream : {streams.tx, streams.ty, streams.tz, streams.bx, streams.by, streams.bz})
+            std::fill(stream, stream + vertexCount, 0.0f);
+        if (triangleCount == 0)
+            return;
+
+        ArenaScope scratch(arena);
+        Corners corners;
+        for (float **output : {&corners.x, &corners.y, &corners.z, &corners.bx, &corners.by, &corners.bz})
+            *output = arena.Allocate<float>(3 * triangleCount);
+        float *const outputs[] = {corners.x, corners.y, corners.z, corners.bx, corners.by, corners.bz};
+        forEachTriangleBlock(triangleCount, pool, 6, outputs, [&](size_t first, size_t end, float (&results)[6][3][LaneCount]) {
+            Vec3 p[3], uv[3], n[3];
+            gather(indices, first, end, streams.px, streams.py, streams.pz, p);
+            gather(indices, first, end, streams.u, streams.v, nullptr, uv);
+            gather(indices, first, end, streams.nx, streams.ny, streams.nz, n);
+            Vec3 edge1 = sub(p[1], p[0]), edge2 = sub(p[2], p[0]);
+            Lanes du1 = sub(uv[1].x, uv[0].x), dv1 = sub(uv[1].y, uv[0].y);
+            Lanes du2 = sub(uv[2].x, uv[0].x), dv2 = sub(uv[2].y, uv[0].y);
+            // faces without a texture space (zero UV area) don't contribute
+            Lanes determinant = sub(mul(du1, dv2), mul(du2, dv1));
+            Lanes valid = greater(abs(determinant), set1(1e-20f));
+            Lanes inverse = select(valid, div(set1(1.0f), determinant), set1(0.0f));
+            Vec3 tangent = normalize(scale(sub(scale(edge1, dv2), scale(edge2, dv1)), inverse));
+            Vec3 bitangent = normalize(scale(sub(scale(edge2, du1), scale(edge1, du2)), inverse));
+            Lanes angles[3];
+            cornerAngles(p, angles);
+            for (int k = 0; k < 3; k++) {
+                Vec3 projectedTangent = scale(normalize(sub(tangent, scale(n[k], dot(n[k], tangent)))), angles[k]);
+                Vec3 projectedBitangent = scale(normalize(sub(bitangent, scale(n[k], dot(n[k], bitangent)))), angles[k]);
+                store(results[0][k], projectedTangent.x);
+                store(results[1][k], projectedTangent.y);
+                store(results[2][k], projectedTangent.z);
+                store(results[3][k], projectedBitangent.x);
+                store(results[4][k], projectedBitangent.y);
+                store(results[5][k], projectedBitangent.z);
+            }
+        });
+
+        unsigned int groupCount;
+        unsigned int *groups = weld(vertexCount, {streams.px, streams.py, streams.pz, streams.nx, streams.ny, streams.nz,
+                                                  streams.u, streams.v}, arena, groupCount);
+        unsigned int *offsets, *groupCornerList;
+        groupCorners(indices, groups, groupCount, arena, offsets, groupCornerList);
+
+        // the group's frame, computed by whichever range owns the group
+        float *frames = arena.Allocate<float>(6 * groupCount);
+        forEachRange(groupCount, pool, [&](size_t begin, size_t end) {
+            for (size_t g = begin; g < end; g++) {
+                float t[3] = {0.0f, 0.0f, 0.0f}, b[3] = {0.0f, 0.0f, 0.0f};
+                for (unsigned int i = offsets[g]; i < offsets[g + 1]; i++) {
+                    unsigned int corner = groupCornerList[i];
+                    t[0] += corners.x[corner];
+                    t[1] += corners.y[corner];
+                    t[2] += corners.z[corner];
+                    b[0] += corners.bx[corner];
+                    b[1] += corners.by[corner];
+                    b[2] += corners.bz[corner];
+                }
+                frames[6 * g] = t[0];
+                frames[6 * g + 1] = t[1];
+                frames[6 * g + 2] = t[2];
+                frames[6 * g + 3] = b[0];
+                frames[6 * g + 4] = b[1];
+                frames[6 * g + 5] = b[2];
+            }
+        });
+        forEachRange(vertexCount, pool, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const float *frame = &frames[6 * groups[i]];
+                float n[3] = {streams.nx[i], streams.ny[i], streams.nz[i]};
+                // Gram-Schmidt against the normal
+                float d = n[0] * frame[0] + n[1] * frame[1] + n[2] * frame[2];
+                float t[3] = {frame[0] - n[0] * d, frame[1] - n[1] * d, frame[2] - n[2] * d};
+                float length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+                if (length <= 0.0f)
+                    continue;
+                for (float &c : t)
+                    c /= length;
+                float b[3] = {n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0]};
+                float sign = b[0] * frame[3] + b[1] * frame[4] + b[2] * frame[5] < 0.0f ? -1.0f : 1.0f;
+                streams.tx[i] = t[0];
+                streams.ty[i] = t[1];
+                streams.tz[i] = t[2];
+                streams.bx[i] = sign * b[0];
+                streams.by[i] = sign * b[1];
+                streams.bz[i] = sign * b[2];
+            }
+        });
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_MESHPROCESSING_H
@@ -0,0 +1,462 @@
+#ifndef PROJECT_BASE_MESHSIMPLIFICATION_H
+#define PROJECT_BASE_MESHSIMPLIFICATION_H
+
+#include <glm/glm.hpp>
+
+#include <rg/Cache.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Quadric error metric simplification for the LOD chains of the models. Only half edge collapses
+// are done, a vertex is merged into one of its neighbours and never moved, so every level indexes
+// the vertex buffer of the full mesh.
+//
+// The loaders write one vertex per face corner. Corners with the same position, normal and UV are
+// one wedge, wedges at the same position one vertex of the topology. A vertex with a single wedge
+// and closed surroundings collapses freely, a vertex on one open border or on one UV/normal seam
+// only slides along it into the next border or seam vertex, and anything more involved stays.
+// Borders and seams carry extra quadrics so they keep their course.
+namespace rg {
+namespace geometry {
+
+    class Simplifier {
+    public:
+        // vertices whose first weldBytes bytes match are one wedge, their first three floats the position
+        Simplifier(const void *vertexData, size_t vertexCount, size_t stride, size_t weldBytes,
+                   const std::vector<unsigned int> &indices) {
+            const unsigned char *bytes = static_cast<const unsigned char *>(vertexData);
+            std::vector<unsigned int> wedgeOfVertex, positionOfWedge;
+            group(bytes, vertexCount, stride, weldBytes, wedgeOfVertex, wedgeVertex);
+            group(bytes, wedgeVertex.size(), stride, sizeof(float) * 3, positionOfWedge, positionVertex, &wedgeVertex);
+
+            wedgePosition = positionOfWedge;
+            positions.resize(positionVertex.size());
+            for (size_t p = 0; p < positions.size(); p++)
+                std::memcpy(&positions[p], bytes + positionVertex[p] * stride, sizeof(float) * 3);
+            positionWedges.resize(positions.size());
+            for (unsigned int w = 0; w < wedgeVertex.size(); w++)
+                positionWedges[wedgePosition[w]].push_back(w);
+
+            size_t triangleCount = indices.size() / 3;
+            triangles.resize(3 * triangleCount);
+            alive.assign(triangleCount, 1);
+            incident.resize(positions.size());
+            quadrics.resize(positions.size());
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++)
+                    triangles[3 * t + k] = wedgeOfVertex[indices[3 * t + k]];
+                unsigned int a = corner(t, 0), b = corner(t, 1), c = corner(t, 2);
+                if (a == b || b == c || c == a) {
+                    alive[t] = 0;
+                    continue;
+                }
+                liveTriangles++;
+                for (int k = 0; k < 3; k++)
+                    incident[corner(t, k)].push_back(t);
+                glm::vec3 normal = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+                float doubleArea = glm::length(normal);
+                if (doubleArea == 0.0f)
+                    continue;
+                normal /= doubleArea;
+                for (int k = 0; k < 3; k++)
+                    quadrics[corner(t, k)].AddPlane(normal, -glm::dot(normal, positions[a]), 0.5 * doubleArea);
+            }
+            classify();
+
+            glm::vec3 lower(FLT_MAX), upper(-FLT_MAX);
+            for (const glm::vec3 &position : positions) {
+                lower = glm::min(lower, position);
+                upper = glm::max(upper, position);
+            }
+            diagonal = positions.empty() ? 0.0f : glm::length(upper - lower);
+            collapsed.assign(positions.size(), 0);
+        }
+
+        // collapses edges while the error stays below maxError, a fraction of the bounding box diagonal.
+        // Calls continue from the last level, returns the largest error of any collapse so far.
+        float Simplify(float maxError) {
+            double limit = (double) maxError * diagonal * maxError * diagonal;
+            std::vector<Collapse> collapses;
+            std::vector<char> touched(positions.size());
+            for (;;) {
+                collapses.clear();
+                for (unsigned int p = 0; p < positions.size(); p++) {
+                    Collapse collapse;
+                    if (!collapsed[p] && kinds[p] != Locked && bestCollapse(p, limit, collapse))
+                        collapses.push_back(collapse);
+                }
+                if (collapses.empty())
+                    break;
+                std::sort(collapses.begin(), collapses.end(),
+                          [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+                // collapses of one pass don't share neighbourhoods, so their checks stay valid
+                std::fill(touched.begin(), touched.end(), 0);
+                size_t done = 0;
+                for (const Collapse &collapse : collapses) {
+                    if (touched[collapse.from] || touched[collapse.to])
+                        continue;
+                    touched[collapse.to] = 1;
+                    for (unsigned int t : incident[collapse.from])
+                        if (alive[t])
+                            for (int k = 0; k < 3; k++)
+                                touched[corner(t, k)] = 1;
+                    apply(collapse);
+                    maxCost = std::max(maxCost, collapse.cost);
+                    done++;
+                }
+                if (done == 0)
+                    break;
+            }
+            return Error();
+        }
+
+        // largest collapse error so far, relative to the bounding box diagonal
+        float Error() const {
+            return diagonal > 0.0f ? (float) (std::sqrt(maxCost) / diagonal) : 0.0f;
+        }
+
+        size_t TriangleCount() const {
+            return liveTriangles;
+        }
+
+        // the remaining triangles as indices into the original vertices
+        std::vector<unsigned int> Indices() const {
+            std::vector<unsigned int> result;
+            result.reserve(3 * liveTriangles);
+            for (size_t t = 0; t < alive.size(); t++)
+                if (alive[t])
+                    for (int k = 0; k < 3; k++)
+                        result.push_back(wedgeVertex[triangles[3 * t + k]]);
+            return result;
+        }
+
+    private:
+        enum Kind : unsigned char {
+            Manifold,
+            Border,
+            Seam,
+            Locked
+        };
+
+        // sum of squared plane distances, weighted by area
+        struct Quadric {
+            double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+            double b0 = 0, b1 = 0, b2 = 0, c = 0, weight = 0;
+
+            // plane dot(n, x) + d = 0 with a unit normal
+            void AddPlane(const glm::vec3 &n, float d, double w) {
+                a00 += w * n.x * n.x;
+                a01 += w * n.x * n.y;
+                a02 += w * n.x * n.z;
+                a11 += w * n.y * n.y;
+                a12 += w * n.y * n.z;
+                a22 += w * n.z * n.z;
+                b0 += w * n.x * d;
+                b1 += w * n.y * d;
+                b2 += w * n.z * d;
+                c += w * d * d;
+                weight += w;
+            }
+
+            void Add(const Quadric &o) {
+                a00 += o.a00;
+                a01 += o.a01;
+                a02 += o.a02;
+                a11 += o.a11;
+                a12 += o.a12;
+                a22 += o.a22;
+                b0 += o.b0;
+                b1 += o.b1;
+                b2 += o.b2;
+                c += o.c;
+                weight += o.weight;
+            }
+
+            // mean squared distance of a point to the planes
+            double Error(const glm::vec3 &p) const {
+                double x = p.x, y = p.y, z = p.z;
+                double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                           2.0 * (b0 * x + b1 * y + b2 * z) + c;
+                return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+            }
+        };
+
+        struct Collapse {
+            unsigned int from = 0, to = 0;
+            double cost = 0.0;
+        };
+
+        // triangles hold wedges, the topology works on the positions
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned int> positionVertex, wedgeVertex, wedgePosition;
+        std::vector<std::vector<unsigned int>> positionWedges;
+        std::vector<unsigned int> triangles;
+        std::vector<char> alive;
+        // triangles around each position, dead ones are skipped
+        std::vector<std::vector<unsigned int>> incident;
+        std::vector<Quadric> quadrics;
+        std::vector<Kind> kinds;
+        std::vector<char> collapsed;
+        size_t liveTriangles = 0;
+        float diagonal = 0.0f;
+        double maxCost = 0.0;
+
+        unsigned int corner(size_t triangle, int k) const {
+            return wedgePosition[triangles[3 * triangle + k]];
+        }
+
+        // Groups items whose first size bytes are identical, returns the group of every item and the
+        // first item of each group. Items are vertices, or the vertices listed in items when given.
+        static void group(const unsigned char *bytes, size_t count, size_t stride, size_t size,
+                          std::vector<unsigned int> &groupOf, std::vector<unsigned int> &first,
+                          const std::vector<unsigned int> *items = nullptr) {
+            auto data = [&](unsigned int item) {
+                return bytes + (size_t) (items ? (*items)[item] : item) * stride;
+            };
+            std::vector<std::pair<uint64_t, unsigned int>> keys(count);
+            for (unsigned int i = 0; i < count; i++)
+                keys[i] = std::make_pair(cache::Hash(data(i), size), i);
+            std::sort(keys.begin(), keys.end());
+            groupOf.assign(count, 0);
+            first.clear();
+            std::vector<unsigned int> firstItem;
+            size_t runStart = 0;
+            for (size_t k = 0; k < count; k++) {
+                if (k > 0 && keys[k].first != keys[k - 1].first)
+                    runStart = firstItem.size();
+                unsigned int item = keys[k].second;
+                // groups with the same hash sit together, hash collisions are told apart by the bytes
+                size_t g = runStart;
+                while (g < firstItem.size() && std::memcmp(data(firstItem[g]), data(item), size) != 0)
+                    g++;
+                if (g == firstItem.size()) {
+                    firstItem.push_back(item);
+                    first.push_back(items ? (*items)[item] : item);
+                }
+                groupOf[item] = g;
+            }
+        }
+
+        // sorts every position into a kind by its wedges and its open and seam edges, and adds the
+        // quadrics that hold borders and seams in place
+        void classify() {
+            struct Edge {
+                unsigned int from, to, count;
+                size_t triangle;
+            };
+            // directed edges between positions, keyed by both ends
+            std::unordered_map<uint64_t, Edge> edges;
+            for (size_t t = 0; t < alive.size(); t++) {
+                if (!alive[t])
+                    continue;
+                for (int k = 0; k < 3; k++) {
+                    unsigned int a = triangles[3 * t + k], b = triangles[3 * t + (k + 1) % 3];
+                    uint64_t key = (uint64_t) wedgePosition[a] << 32 | wedgePosition[b];
+                    auto inserted = edges.insert(std::make_pair(key, Edge{a, b, 1, t}));
+                    if (!inserted.second)
+                        inserted.first->second.count++;
+                }
+            }
+
+            std::vector<unsigned int> open(positions.size(), 0), seams(positions.size(), 0);
+            std::vector<char> nonManifold(positions.size(), 0);
+            for (const auto &entry : edges) {
+                const Edge &edge = entry.second;
+                unsigned int a = wedgePosition[edge.from], b = wedgePosition[edge.to];
+                auto reverse = edges.find((uint64_t) b << 32 | a);
+                if (edge.count > 1 || (reverse != edges.end() && reverse->second.count > 1)) {
+                    nonManifold[a] = nonManifold[b] = 1;
+                    continue;
+                }
+                bool isOpen = reverse == edges.end();
+                bool isSeam = !isOpen && (reverse->second.from != edge.to || reverse->second.to != edge.from);
+                if (isOpen) {
+                    open[a]++;
+                    open[b]++;
+                } else if (isSeam && a < b) {
+                    seams[a]++;
+                    seams[b]++;
+                }
+                if (isOpen || isSeam)
+                    addEdgeQuadric(edge.triangle, a, b);
+            }
+
+            kinds.resize(positions.size());
+            for (size_t p = 0; p < positions.size(); p++) {
+                size_t wedges = positionWedges[p].size();
+                if (nonManifold[p])
+                    kinds[p] = Locked;
+                else if (wedges == 1 && open[p] == 0 && seams[p] == 0)
+                    kinds[p] = Manifold;
+                else if (wedges == 1 && open[p] == 2 && seams[p] == 0)
+                    kinds[p] = Border;
+                else if (wedges == 2 && open[p] == 0 && seams[p] == 2)
+                    kinds[p] = Seam;
+                else
+                    kinds[p] = Locked;
+            }
+        }
+
+        // plane through the edge, perpendicular to its triangle, weighted like a square over the edge
+        void addEdgeQuadric(size_t triangle, unsigned int a, unsigned int b) {
+            glm::vec3 p0 = positions[corner(triangle, 0)], p1 = positions[corner(triangle, 1)], p2 = positions[corner(triangle, 2)];
+            glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+            glm::vec3 edge = positions[b] - positions[a];
+            glm::vec3 normal = glm::cross(edge, faceNormal);
+            float length = glm::length(normal);
+            if (length == 0.0f)
+                return;
+            normal /= length;
+            double weight = glm::dot(edge, edge);
+            quadrics[a].AddPlane(normal, -glm::dot(normal, positions[a]), weight);
+            quadrics[b].AddPlane(normal, -glm::dot(normal, positions[a]), weight);
+        }
+
+        bool contains(size_t triangle, unsigned int position) const {
+            return corner(triangle, 0) == position || corner(triangle, 1) == position || corner(triangle, 2) == position;
+        }
+
+        // the wedge of a triangle at a position
+        unsigned int wedgeAt(size_t triangle, unsigned int position) const {
+            for (int k = 0; k < 3; k++)
+                if (corner(triangle, k) == position)
+                    return triangles[3 * triangle + k];
+            return 0;
+        }
+
+        void neighbours(unsigned int p, std::vector<unsigned int> &result) const {
+            result.clear();
+            for (unsigned int t : incident[p])
+                if (alive[t])
+                    for (int k = 0; k < 3; k++)
+                        if (corner(t, k) != p)
+                            result.push_back(corner(t, k));
+            std::sort(result.begin(), result.end());
+            result.erase(std::unique(result.begin(), result.end()), result.end());
+        }
+
+        // Checks that from can collapse into to and finds the wedge each wedge of from turns into.
+        // Borders and seams only collapse along themselves, the collapse must not pinch the
+        // surface (link condition) and no remaining triangle may flip.
+        bool collapsible(unsigned int from, unsigned int to, std::vector<std::pair<unsigned int, unsigned int>> &wedgeMap) const {
+            // triangles on the edge with the wedges they use at both ends
+            size_t shared = 0;
+            unsigned int edgeWedges[2][2] = {{0, 0}, {0, 0}};
+            for (unsigned int t : incident[from]) {
+                if (!alive[t] || !contains(t, to))
+                    continue;
+                if (shared < 2) {
+                    edgeWedges[shared][0] = wedgeAt(t, from);
+                    edgeWedges[shared][1] = wedgeAt(t, to);
+                }
+                shared++;
+            }
+            if (shared == 0 || shared > 2)
+                return false;
+            bool open = shared == 1;
+            bool seam = shared == 2 && (edgeWedges[0][0] != edgeWedges[1][0] || edgeWedges[0][1] != edgeWedges[1][1]);
+            if (kinds[from] == Manifold && (open || seam))
+                return false;
+            if (kinds[from] == Border && (!open || (kinds[to] != Border && kinds[to] != Locked)))
+                return false;
+            if (kinds[from] == Seam && (!seam || (kinds[to] != Seam && kinds[to] != Locked)))
+                return false;
+
+            std::vector<unsigned int> fromNeighbours, toNeighbours;
+            neighbours(from, fromNeighbours);
+            neighbours(to, toNeighbours);
+            size_t common = 0;
+            for (unsigned int n : fromNeighbours)
+                common += std::binary_search(toNeighbours.begin(), toNeighbours.end(), n) ? 1 : 0;
+            if (common != shared)
+                return false;
+
+            wedgeMap.clear();
+            for (unsigned int wedge : positionWedges[from]) {
+                bool found = false, ambiguous = false;
+                unsigned int target = 0;
+                for (size_t e = 0; e < std::min<size_t>(shared, 2); e++) {
+                    if (edgeWedges[e][0] != wedge)
+                        continue;
+                    ambiguous |= found && target != edgeWedges[e][1];
+                    target = edgeWedges[e][1];
+                    found = true;
+                }
+                if (!found || ambiguous)
+                    return false;
+                wedgeMap.push_back(std::make_pair(wedge, target));
+            }
+
+            for (unsigned int t : incident[from]) {
+                if (!alive[t] || contains(t, to))
+                    continue;
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++) {
+                    before[k] = positions[corner(t, k)];
+                    after[k] = corner(t, k) == from ? positions[to] : before[k];
+                }
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+                if (lengths == 0.0f || glm::dot(normalBefore, normalAfter) < 0.25f * lengths)
+                    return false;
+            }
+            return true;
+        }
+
+        // cheapest allowed collapse of a position within the limit
+        bool bestCollapse(unsigned int from, double limit, Collapse &best) const {
+            std::vector<unsigned int> candidates;
+            neighbours(from, candidates);
+            std::vector<std::pair<double, unsigned int>> costs;
+            for (unsigned int to : candidates) {
+                double cost = quadrics[from].Error(positions[to]);
+                if (cost <= limit)
+                    costs.push_back(std::make_pair(cost, to));
+            }
+            std::sort(costs.begin(), costs.end());
+            std::vector<std::pair<unsigned int, unsigned int>> wedgeMap;
+            for (const auto &cost : costs)
+                if (collapsible(from, cost.second, wedgeMap)) {
+                    best.from = from;
+                    best.to = cost.second;
+                    best.cost = cost.first;
+                    return true;
+                }
+            return false;
+        }
+
+        void apply(const Collapse &collapse) {
+            std::vector<std::pair<unsigned int, unsigned int>> wedgeMap;
+            collapsible(collapse.from, collapse.to, wedgeMap);
+            for (unsigned int t : incident[collapse.from]) {
+                if (!alive[t])
+                    continue;
+                if (contains(t, collapse.to)) {
+                    alive[t] = 0;
+                    liveTriangles--;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                    for (const auto &mapped : wedgeMap)
+                        if (triangles[3 * t + k] == mapped.first)
+                            triangles[3 * t + k] = mapped.second;
+                incident[collapse.to].push_back(t);
+            }
+            std::vector<unsigned int>().swap(incident[collapse.from]);
+            quadrics[collapse.to].Add(quadrics[collapse.from]);
+            collapsed[collapse.from] = 1;
+        }
+    };
+
+};
+};
+
+#endif //PROJECT_BASE_MESHSIMPLIFICATION_H
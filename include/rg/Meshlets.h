@@ -0,0 +1,302 @@
+#ifndef PROJECT_BASE_MESHLETS_H
+#define PROJECT_BASE_MESHLETS_H
+
+#include <glm/glm.hpp>
+
+#include <rg/Bounds.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Meshlets: small clusters of neighbouring triangles that are culled on their own. Each one keeps a
+// bounding sphere for the frustum and occlusion tests and a normal cone for backface culling, a
+// meshlet whose triangles all face away from the camera is dropped as a whole.
+//
+// BuildMeshlets() grows the clusters greedily over triangles sharing a position (the loaders write
+// one vertex per face corner, so shared indices say nothing) and returns the indices reordered so
+// every meshlet is one contiguous range. The cone follows meshoptimizer's formulation: axis, cutoff
+// and an apex, and a meshlet is backfacing when
+//     dot(normalize(apex - camera), axis) >= cutoff.
+namespace rg {
+namespace geometry {
+
+    struct Meshlet {
+        unsigned int firstIndex = 0;
+        unsigned int indexCount = 0;
+        glm::vec3 center = glm::vec3(0.0f);
+        float radius = 0.0f;
+        glm::vec3 coneApex = glm::vec3(0.0f);
+        glm::vec3 coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+        // above 1 when the normals spread too far for the cone to ever reject the meshlet
+        float coneCutoff = 2.0f;
+    };
+
+    // the camera and the frustum in the object space of the instance being drawn
+    struct MeshletView {
+        glm::mat4 model;
+        // the tests assume the model matrix scales uniformly
+        float scale;
+        glm::vec3 camera;
+        Frustum frustum;
+
+        MeshletView(const glm::mat4 &viewProjection, const glm::mat4 &model, const glm::vec3 &worldCamera)
+                : model(model), frustum(viewProjection * model) {
+            scale = std::max(std::max(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1]))),
+                             glm::length(glm::vec3(model[2])));
+            camera = glm::vec3(glm::inverse(model) * glm::vec4(worldCamera, 1.0f));
+        }
+
+        // world bounds of a meshlet's sphere, for the occlusion tests
+        AABB WorldBounds(const Meshlet &meshlet) const {
+            glm::vec3 center = glm::vec3(model * glm::vec4(meshlet.center, 1.0f));
+            glm::vec3 extent(meshlet.radius * scale);
+            return AABB(center - extent, center + extent);
+        }
+    };
+
+    // what the meshlet tests rejected, summed over the draws of a frame
+    struct MeshletStats {
+        size_t meshlets = 0;
+        size_t backfacing = 0;
+        size_t outside = 0;
+        size_t occluded = 0;
+        size_t triangles = 0;
+        size_t drawnTriangles = 0;
+    };
+
+    enum class MeshletCull {
+        Visible,
+        Backfacing,
+        Outside
+    };
+
+    inline MeshletCull CullMeshlet(const Meshlet &meshlet, const MeshletView &view) {
+        if (glm::dot(glm::normalize(meshlet.coneApex - view.camera), meshlet.coneAxis) >= meshlet.coneCutoff)
+            return MeshletCull::Backfacing;
+        if (!view.frustum.Intersects(meshlet.center, meshlet.radius))
+            return MeshletCull::Outside;
+        return MeshletCull::Visible;
+    }
+
+    // the cone and frustum tests, then visible(world bounds) for occlusion, counted into stats
+    template<typename Visible>
+    bool MeshletVisible(const Meshlet &meshlet, const MeshletView &view, MeshletStats &stats, Visible &&visible) {
+        stats.meshlets++;
+        stats.triangles += meshlet.indexCount / 3;
+        switch (CullMeshlet(meshlet, view)) {
+            case MeshletCull::Backfacing:
+                stats.backfacing++;
+                return false;
+            case MeshletCull::Outside:
+                stats.outside++;
+                return false;
+            default:
+                break;
+        }
+        if (!visible(view.WorldBounds(meshlet))) {
+            stats.occluded++;
+            return false;
+        }
+        stats.drawnTriangles += meshlet.indexCount / 3;
+        return true;
+    }
+
+    // Partitions the triangles into meshlets of at most maxTriangles triangles and maxPositions
+    // distinct positions, the positions are the first three floats of each vertex. ordered gets the
+    // indices meshlet by meshlet, in their original order within a meshlet.
+    inline std::vector<Meshlet> BuildMeshlets(const void *vertexData, size_t vertexCount, size_t stride,
+                                              const std::vector<unsigned int> &indices,
+                                              std::vector<unsigned int> &ordered,
+                                              size_t maxPositions = 64, size_t maxTriangles = 124) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(vertexData);
+        auto position = [&](unsigned int vertex) {
+            glm::vec3 p;
+            std::memcpy(&p, bytes + vertex * stride, sizeof(p));
+            return p;
+        };
+
+        // corners at the same position are one point of the topology
+        struct PositionKey {
+            float x, y, z;
+            bool operator==(const PositionKey &other) const {
+                return std::memcmp(this, &other, sizeof(PositionKey)) == 0;
+            }
+        };
+        struct PositionHash {
+            size_t operator()(const PositionKey &key) const {
+                uint32_t words[3];
+                std::memcpy(words, &key, sizeof(words));
+                return (words[0] * 73856093u) ^ (words[1] * 19349663u) ^ (words[2] * 83492791u);
+            }
+        };
+        std::unordered_map<PositionKey, unsigned int, PositionHash> pointOfPosition;
+        std::vector<unsigned int> pointOfVertex(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            glm::vec3 p = position(v);
+            auto inserted = pointOfPosition.emplace(PositionKey{p.x, p.y, p.z}, (unsigned int) pointOfPosition.size());
+            pointOfVertex[v] = inserted.first->second;
+        }
+        size_t pointCount = pointOfPosition.size();
+
+        size_t triangleCount = indices.size() / 3;
+        std::vector<glm::vec3> normals(triangleCount), centroids(triangleCount);
+        // triangles around each point, compressed rows
+        std::vector<unsigned int> pointStart(pointCount + 1, 0), pointTriangles(3 * triangleCount);
+        for (size_t t = 0; t < triangleCount; t++) {
+            glm::vec3 a = position(indices[3 * t]), b = position(indices[3 * t + 1]), c = position(indices[3 * t + 2]);
+            glm::vec3 n = glm::cross(b - a, c - a);
+            float length = glm::length(n);
+            normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+            centroids[t] = (a + b + c) / 3.0f;
+            for (int k = 0; k < 3; k++)
+                pointStart[pointOfVertex[indices[3 * t + k]] + 1]++;
+        }
+        for (size_t p = 0; p < pointCount; p++)
+            pointStart[p + 1] += pointStart[p];
+        std::vector<unsigned int> fill(pointStart.begin(), pointStart.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                pointTriangles[fill[pointOfVertex[indices[3 * t + k]]]++] = t;
+
+        std::vector<Meshlet> meshlets;
+        ordered.clear();
+        ordered.reserve(indices.size());
+        std::vector<char> emitted(triangleCount, 0);
+        // meshlet that last used each point or listed each triangle, so membership is a comparison
+        std::vector<int> pointMeshlet(pointCount, -1), candidateMeshlet(triangleCount, -1);
+        std::vector<unsigned int> members, candidates;
+        size_t cursor = 0;
+        int seed = -1;
+        while (true) {
+            if (seed < 0) {
+                while (cursor < triangleCount && emitted[cursor])
+                    cursor++;
+                if (cursor == triangleCount)
+                    break;
+                seed = cursor;
+            }
+            int id = meshlets.size();
+            members.clear();
+            candidates.clear();
+            size_t points = 0;
+            float spread = 0.0f;
+            glm::vec3 normalSum(0.0f), centroidSum(0.0f);
+            auto pointsAdded = [&](unsigned int t) {
+                int added = 0;
+                for (int k = 0; k < 3; k++) {
+                    unsigned int p = pointOfVertex[indices[3 * t + k]];
+                    // a triangle can touch the same point twice when it is degenerate
+                    bool repeated = (k > 0 && pointOfVertex[indices[3 * t]] == p) ||
+                                    (k > 1 && pointOfVertex[indices[3 * t + 1]] == p);
+                    added += pointMeshlet[p] != id && !repeated;
+                }
+                return added;
+            };
+            auto add = [&](unsigned int t) {
+                points += pointsAdded(t);
+                emitted[t] = 1;
+                members.push_back(t);
+                normalSum += normals[t];
+                centroidSum += centroids[t];
+                spread = std::max(spread, glm::length(centroids[t] - centroidSum / (float) members.size()));
+                for (int k = 0; k < 3; k++) {
+                    unsigned int p = pointOfVertex[indices[3 * t + k]];
+                    pointMeshlet[p] = id;
+                    for (unsigned int i = pointStart[p]; i < pointStart[p + 1]; i++) {
+                        unsigned int neighbour = pointTriangles[i];
+                        if (!emitted[neighbour] && candidateMeshlet[neighbour] != id) {
+                            candidateMeshlet[neighbour] = id;
+                            candidates.push_back(neighbour);
+                        }
+                    }
+                }
+            };
+            add(seed);
+            seed = -1;
+
+            // grows towards the neighbour that adds the fewest points, then the one that bends the
+            // cone and the sphere the least
+            while (members.size() < maxTriangles) {
+                glm::vec3 axis = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : glm::vec3(0.0f);
+                glm::vec3 centroid = centroidSum / (float) members.size();
+                int best = -1;
+                float bestScore = 0.0f;
+                for (size_t i = 0; i < candidates.size();) {
+                    unsigned int candidate = candidates[i];
+                    if (emitted[candidate]) {
+                        candidates[i] = candidates.back();
+                        candidates.pop_back();
+                        continue;
+                    }
+                    i++;
+                    int added = pointsAdded(candidate);
+                    if (points + added > maxPositions)
+                        continue;
+                    float score = (float) added + (1.0f - glm::dot(normals[candidate], axis)) +
+                                  0.5f * glm::length(centroids[candidate] - centroid) / (spread + 1e-6f);
+                    if (best < 0 || score < bestScore) {
+                        best = candidate;
+                        bestScore = score;
+                    }
+                }
+                if (best < 0)
+                    break;
+                add(best);
+            }
+            // the next meshlet starts next to this one
+            for (unsigned int candidate : candidates)
+                if (!emitted[candidate]) {
+                    seed = candidate;
+                    break;
+                }
+
+            std::sort(members.begin(), members.end());
+            Meshlet meshlet;
+            meshlet.firstIndex = ordered.size();
+            meshlet.indexCount = 3 * members.size();
+            AABB box;
+            for (unsigned int t : members)
+                for (int k = 0; k < 3; k++) {
+                    ordered.push_back(indices[3 * t + k]);
+                    box.Expand(position(indices[3 * t + k]));
+                }
+            meshlet.center = box.Center();
+            for (unsigned int t : members)
+                for (int k = 0; k < 3; k++)
+                    meshlet.radius = std::max(meshlet.radius, glm::length(position(indices[3 * t + k]) - meshlet.center));
+
+            // the cone around the average normal, with its apex behind every triangle plane
+            if (glm::length(normalSum) > 0.0f) {
+                glm::vec3 axis = glm::normalize(normalSum);
+                float minDot = 1.0f;
+                for (unsigned int t : members)
+                    if (normals[t] != glm::vec3(0.0f))
+                        minDot = std::min(minDot, glm::dot(normals[t], axis));
+                // wider than about 84 degrees the apex runs off and the cone rejects nothing useful
+                if (minDot > 0.1f) {
+                    float maxT = 0.0f;
+                    for (unsigned int t : members) {
+                        if (normals[t] == glm::vec3(0.0f))
+                            continue;
+                        glm::vec3 corner = position(indices[3 * t]);
+                        float distance = glm::dot(meshlet.center - corner, normals[t]);
+                        maxT = std::max(maxT, distance / glm::dot(axis, normals[t]));
+                    }
+                    meshlet.coneAxis = axis;
+                    meshlet.coneApex = meshlet.center - axis * maxT;
+                    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+                }
+            }
+            meshlets.push_back(meshlet);
+        }
+        return meshlets;
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_MESHLETS_H
@@ -0,0 +1,339 @@
+#ifndef PROJECT_BASE_MIPGENERATION_H
+#define PROJECT_BASE_MIPGENERATION_H
+
+#include <rg/ThreadPool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+// CPU side mip generation for 8 bit (R8, RGB8, RGBA8) and half float images, used for texture
+// quality tiers, the mip chains baked into compressed textures and the mips TextureFromFile
+// uploads itself. Color images are filtered in linear light, averaging the sRGB values directly
+// would darken every level; normal maps are renormalized after averaging. Data maps (height,
+// specular, roughness) are linear already and averaged as they are stored, decoding them as sRGB
+// would bias every level.
+//
+// Rows are decoded through tables into one float plane per channel, the 2x2 box filter and the
+// renormalization run in SIMD lanes over the planes and the result is encoded back. Blocks of
+// output rows are spread over the thread pool. The SIMD and scalar paths do the same float
+// operations in the same order, so every build produces the same bytes.
+namespace rg {
+namespace texture {
+
+    enum class Usage {
+        // albedo and emissive colors, sRGB encoded
+        Color,
+        // tangent space normals, stored as XY only when compressed
+        NormalMap,
+        // linear values like height, specular, roughness or masks, filtered as they are stored
+        Data
+    };
+
+    // whether TextureFromFile generates the mips itself instead of calling glGenerateMipmap,
+    // on by default since the driver averages the sRGB values of color textures as they are
+    inline bool &CpuMipmaps() {
+        static bool enabled = true;
+        return enabled;
+    }
+
+    namespace detail {
+
+        inline const float *srgbToLinear() {
+            static const std::vector<float> table = []() {
+                std::vector<float> values(256);
+                for (int i = 0; i < 256; i++) {
+                    float c = i / 255.0f;
+                    values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+                return values;
+            }();
+            return table.data();
+        }
+
+        inline const float *unitToFloat() {
+            static const std::vector<float> table = []() {
+                std::vector<float> values(256);
+                for (int i = 0; i < 256; i++)
+                    values[i] = i / 255.0f;
+                return values;
+            }();
+            return table.data();
+        }
+
+        inline const float *normalToFloat() {
+            static const std::vector<float> table = []() {
+                std::vector<float> values(256);
+                for (int i = 0; i < 256; i++)
+                    values[i] = i / 127.5f - 1.0f;
+                return values;
+            }();
+            return table.data();
+        }
+
+        static const int LinearToSrgbSize = 1 << 14;
+
+        // indexed by the linear value scaled to the table size, fine enough for 8 bit results
+        inline const unsigned char *linearToSrgb() {
+            static const std::vector<unsigned char> table = []() {
+                std::vector<unsigned char> values(LinearToSrgbSize + 1);
+                for (int i = 0; i <= LinearToSrgbSize; i++) {
+                    float l = (float) i / LinearToSrgbSize;
+                    float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                    values[i] = (unsigned char) std::min(255.0f, c * 255.0f + 0.5f);
+                }
+                return values;
+            }();
+            return table.data();
+        }
+
+        inline float halfToFloat(uint16_t half) {
+            uint32_t sign = (uint32_t) (half & 0x8000) << 16, exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+            if (exponent == 0) {
+                // zero and subnormals, exact in float
+                float value = mantissa * (1.0f / 16777216.0f);
+                return sign ? -value : value;
+            }
+            uint32_t bits = exponent == 31 ? sign | 0x7F800000 | mantissa << 13 : sign | (exponent + 112) << 23 | mantissa << 13;
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        // rounds to nearest even like the F16C conversion
+        inline uint16_t floatToHalf(float value) {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            uint16_t sign = (bits >> 16) & 0x8000;
+            uint32_t magnitude = bits & 0x7FFFFFFF;
+            if (magnitude >= 0x7F800000)
+                return sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0);
+            if (magnitude >= 0x477FF000)
+                return sign | 0x7C00;
+            if (magnitude < 0x38800000) {
+                float small;
+                memcpy(&small, &magnitude, sizeof(small));
+                return sign | (uint16_t) std::lrint(small * 16777216.0f);
+            }
+            magnitude += 0xC8000FFF + ((magnitude >> 13) & 1);
+            return sign | (uint16_t) (magnitude >> 13);
+        }
+
+        // out[x] = (a[2x] + a[2x + 1] + b[2x] + b[2x + 1]) / 4, the planes hold 2 * count floats
+        inline void filterPlane(const float *a, const float *b, float *out, int count) {
+            int x = 0;
+#if defined(__AVX2__)
+            const __m256 quarter = _mm256_set1_ps(0.25f);
+            for (; x + 8 <= count; x += 8) {
+                __m256 low = _mm256_add_ps(_mm256_loadu_ps(a + 2 * x), _mm256_loadu_ps(b + 2 * x));
+                __m256 high = _mm256_add_ps(_mm256_loadu_ps(a + 2 * x + 8), _mm256_loadu_ps(b + 2 * x + 8));
+                // hadd works within 128 bit halves, the 64 bit quarters come out as 0 2 1 3
+                __m256 sum = _mm256_hadd_ps(low, high);
+                sum = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum), 0xD8));
+                _mm256_storeu_ps(out + x, _mm256_mul_ps(sum, quarter));
+            }
+#elif defined(__SSE4_1__)
+            const __m128 quarter = _mm_set1_ps(0.25f);
+            for (; x + 4 <= count; x += 4) {
+                __m128 low = _mm_add_ps(_mm_loadu_ps(a + 2 * x), _mm_loadu_ps(b + 2 * x));
+                __m128 high = _mm_add_ps(_mm_loadu_ps(a + 2 * x + 4), _mm_loadu_ps(b + 2 * x + 4));
+                _mm_storeu_ps(out + x, _mm_mul_ps(_mm_hadd_ps(low, high), quarter));
+            }
+#endif
+            for (; x < count; x++)
+                out[x] = ((a[2 * x] + b[2 * x]) + (a[2 * x + 1] + b[2 * x + 1])) * 0.25f;
+        }
+
+        // scales the vectors in three planes to unit length, zero vectors stay as they are
+        inline void normalizePlanes(float *px, float *py, float *pz, int count) {
+            int x = 0;
+#if defined(__AVX2__)
+            const __m256 epsilon = _mm256_set1_ps(1e-12f), one = _mm256_set1_ps(1.0f);
+            for (; x + 8 <= count; x += 8) {
+                __m256 vx = _mm256_loadu_ps(px + x), vy = _mm256_loadu_ps(py + x), vz = _mm256_loadu_ps(pz + x);
+                __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+                __m256 valid = _mm256_cmp_ps(lengthSquared, epsilon, _CMP_GT_OQ);
+                __m256 inverse = _mm256_blendv_ps(one, _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared)), valid);
+                _mm256_storeu_ps(px + x, _mm256_mul_ps(vx, inverse));
+                _mm256_storeu_ps(py + x, _mm256_mul_ps(vy, inverse));
+                _mm256_storeu_ps(pz + x, _mm256_mul_ps(vz, inverse));
+            }
+#elif defined(__SSE4_1__)
+            const __m128 epsilon = _mm_set1_ps(1e-12f), one = _mm_set1_ps(1.0f);
+            for (; x + 4 <= count; x += 4) {
+                __m128 vx = _mm_loadu_ps(px + x), vy = _mm_loadu_ps(py + x), vz = _mm_loadu_ps(pz + x);
+                __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+                __m128 valid = _mm_cmpgt_ps(lengthSquared, epsilon);
+                __m128 inverse = _mm_blendv_ps(one, _mm_div_ps(one, _mm_sqrt_ps(lengthSquared)), valid);
+                _mm_storeu_ps(px + x, _mm_mul_ps(vx, inverse));
+                _mm_storeu_ps(py + x, _mm_mul_ps(vy, inverse));
+                _mm_storeu_ps(pz + x, _mm_mul_ps(vz, inverse));
+            }
+#endif
+            for (; x < count; x++) {
+                float lengthSquared = (px[x] * px[x] + py[x] * py[x]) + pz[x] * pz[x];
+                float inverse = lengthSquared > 1e-12f ? 1.0f / std::sqrt(lengthSquared) : 1.0f;
+                px[x] *= inverse;
+                py[x] *= inverse;
+                pz[x] *= inverse;
+            }
+        }
+
+        // integer part of clamp(value * scale + bias, 0, maximum)
+        inline void quantizePlane(const float *plane, int count, float scale, float bias, float maximum, int *out) {
+            int x = 0;
+#if defined(__AVX2__)
+            for (; x + 8 <= count; x += 8) {
+                __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(plane + x), _mm256_set1_ps(scale)), _mm256_set1_ps(bias));
+                v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(maximum));
+                _mm256_storeu_si256((__m256i *) (out + x), _mm256_cvttps_epi32(v));
+            }
+#elif defined(__SSE4_1__)
+            for (; x + 4 <= count; x += 4) {
+                __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(plane + x), _mm_set1_ps(scale)), _mm_set1_ps(bias));
+                v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(maximum));
+                _mm_storeu_si128((__m128i *) (out + x), _mm_cvttps_epi32(v));
+            }
+#endif
+            for (; x < count; x++)
+                out[x] = (int) std::min(std::max(plane[x] * scale + bias, 0.0f), maximum);
+        }
+
+        // 8 bit texels: sRGB color, linear data or signed normal components per channel
+        struct ByteFormat {
+            typedef unsigned char Texel;
+            const float *decode[4];
+            float scale[4], bias[4], maximum[4];
+            const unsigned char *table[4];
+
+            ByteFormat(int channels, Usage usage) {
+                for (int k = 0; k < 4; k++) {
+                    // only the color channels of albedo and emissive textures are sRGB, alpha and
+                    // Usage::Data go through unitToFloat()
+                    bool srgb = usage == Usage::Color && channels >= 3 && k < 3;
+                    bool normal = usage == Usage::NormalMap && channels >= 3 && k < 3;
+                    decode[k] = srgb ? srgbToLinear() : (normal ? normalToFloat() : unitToFloat());
+                    scale[k] = srgb ? (float) LinearToSrgbSize : (normal ? 127.5f : 255.0f);
+                    bias[k] = normal ? 128.0f : 0.5f;
+                    maximum[k] = srgb ? (float) LinearToSrgbSize : 255.0f;
+                    table[k] = srgb ? linearToSrgb() : nullptr;
+                }
+            }
+
+            void Decode(const Texel *row, int width, int channels, float **planes) const {
+                for (int k = 0; k < channels; k++)
+                    for (int x = 0; x < width; x++)
+                        planes[k][x] = decode[k][row[x * channels + k]];
+            }
+
+            void Encode(float **planes, int count, int channels, Texel *row, int *scratch) const {
+                for (int k = 0; k < channels; k++) {
+                    quantizePlane(planes[k], count, scale[k], bias[k], maximum[k], scratch);
+                    if (table[k])
+                        for (int x = 0; x < count; x++)
+                            row[x * channels + k] = table[k][scratch[x]];
+                    else
+                        for (int x = 0; x < count; x++)
+                            row[x * channels + k] = (unsigned char) scratch[x];
+                }
+            }
+        };
+
+        // half float texels, already linear
+        struct HalfFormat {
+            typedef uint16_t Texel;
+
+            void Decode(const Texel *row, int width, int channels, float **planes) const {
+                for (int k = 0; k < channels; k++)
+                    for (int x = 0; x < width; x++)
+                        planes[k][x] = halfToFloat(row[x * channels + k]);
+            }
+
+            void Encode(float **planes, int count, int channels, Texel *row, int *) const {
+                for (int k = 0; k < channels; k++)
+                    for (int x = 0; x < count; x++)
+                        row[x * channels + k] = floatToHalf(planes[k][x]);
+            }
+        };
+
+        template<typename Format>
+        std::vector<typename Format::Texel> downsample(const Format &format, const typename Format::Texel *pixels,
+                                                       int width, int height, int channels, bool normalize,
+                                                       ThreadPool &pool) {
+            typedef typename Format::Texel Texel;
+            const int RowsPerTask = 8;
+            int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+            std::vector<Texel> next((size_t) nextWidth * nextHeight * channels);
+            // one column of padding, a single column image reads its only column twice
+            size_t stride = (width + 8) & ~7;
+            pool.ParallelFor((nextHeight + RowsPerTask - 1) / RowsPerTask, [&](size_t task) {
+                std::vector<float> scratch(stride * channels * 3);
+                std::vector<int> quantized(nextWidth);
+                float *a[4], *b[4], *out[4];
+                for (int k = 0; k < channels; k++) {
+                    a[k] = &scratch[stride * k];
+                    b[k] = &scratch[stride * (channels + k)];
+                    out[k] = &scratch[stride * (2 * channels + k)];
+                }
+                int end = std::min(nextHeight, (int) (task + 1) * RowsPerTask);
+                for (int y = task * RowsPerTask; y < end; y++) {
+                    int row0 = std::min(2 * y, height - 1), row1 = std::min(2 * y + 1, height - 1);
+                    format.Decode(pixels + (size_t) row0 * width * channels, width, channels, a);
+                    format.Decode(pixels + (size_t) row1 * width * channels, width, channels, b);
+                    for (int k = 0; k < channels; k++) {
+                        a[k][width] = a[k][width - 1];
+                        b[k][width] = b[k][width - 1];
+                        filterPlane(a[k], b[k], out[k], nextWidth);
+                    }
+                    if (normalize)
+                        normalizePlanes(out[0], out[1], out[2], nextWidth);
+                    format.Encode(out, nextWidth, channels, &next[(size_t) y * nextWidth * channels], quantized.data());
+                }
+            });
+            return next;
+        }
+
+    };
+
+    // half resolution image by a 2x2 box filter, the last row or column repeats for odd sizes.
+    // Color images with three or four channels are averaged in linear light (alpha stays linear),
+    // one and two channel images hold data and are averaged as they are.
+    inline std::vector<unsigned char> Downsample(const unsigned char *pixels, int width, int height, int channels,
+                                                 Usage usage, ThreadPool &pool = ThreadPool::Shared()) {
+        return detail::downsample(detail::ByteFormat(channels, usage), pixels, width, height, channels,
+                                  usage == Usage::NormalMap && channels >= 3, pool);
+    }
+
+    // the same for half float images, normal maps hold signed components
+    inline std::vector<uint16_t> DownsampleHalf(const uint16_t *pixels, int width, int height, int channels,
+                                                Usage usage, ThreadPool &pool = ThreadPool::Shared()) {
+        return detail::downsample(detail::HalfFormat(), pixels, width, height, channels,
+                                  usage == Usage::NormalMap && channels >= 3, pool);
+    }
+
+    // levels 1.. of an 8 bit image down to 1x1, level 0 is the image itself
+    inline std::vector<std::vector<unsigned char>> GenerateMips(const unsigned char *pixels, int width, int height,
+                                                                int channels, Usage usage,
+                                                                ThreadPool &pool = ThreadPool::Shared()) {
+        std::vector<std::vector<unsigned char>> levels;
+        while (width > 1 || height > 1) {
+            levels.push_back(Downsample(levels.empty() ? pixels : levels.back().data(), width, height, channels, usage, pool));
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return levels;
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_MIPGENERATION_H
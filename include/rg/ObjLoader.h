@@ -0,0 +1,1150 @@
+#ifndef PROJECT_BASE_OBJLOADER_H
+#define PROJECT_BASE_OBJLOADER_H
+
+#include <glm/glm.hpp>
+
+#include <rg/MappedFile.h>
+#include <rg/ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Wavefront OBJ/MTL importer for the models under resources/objects. The file is memory mapped,
+// cut into chunks at line boundaries and the chunks are parsed on the thread pool. A short serial
+// pass then replays the o/g/usemtl statements to lay the faces out into meshes, and the vertex
+// arrays, triangulation and tangent frames are produced in parallel again.
+//
+// The output is what model.h got out of Assimp with aiProcess_Triangulate | GenSmoothNormals |
+// FlipUVs | CalcTangentSpace: the same mesh split and material assignment, one vertex per face
+// corner, the same number parsing, ear clipping and tangent smoothing. Anything the fast path
+// doesn't handle (lines, points, line continuations, odd vertex formats) makes Load() return
+// false so the caller can go through Assimp instead.
+namespace rg {
+namespace obj {
+
+    // texture file names relative to the .obj, empty when the material has none of the kind
+    struct Material {
+        std::string name;
+        std::string diffuse;  // map_Kd
+        std::string specular; // map_Ks
+        std::string bump;     // map_Bump and bump, Assimp's aiTextureType_HEIGHT
+        std::string ambient;  // map_Ka
+    };
+
+    struct Mesh {
+        std::string name;
+        // index into Scene::materials
+        int material = 0;
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        // texture coordinates and tangent frames are empty when the mesh has no texture coordinates,
+        // the tangent frames also without TangentSpace or normals
+        std::vector<glm::vec2> texCoords;
+        std::vector<glm::vec3> tangents;
+        std::vector<glm::vec3> bitangents;
+        std::vector<unsigned int> indices;
+    };
+
+    // Assimp's post processing steps the importer reproduces, meshes without normals in the file
+    // come back without normals and no mesh has tangents when they are left out
+    enum Steps {
+        SmoothNormals = 1,
+        TangentSpace = 2,
+        AllSteps = SmoothNormals | TangentSpace
+    };
+
+    struct Scene {
+        std::vector<Mesh> meshes;
+        // the first one is Assimp's DefaultMaterial, used by faces before any usemtl
+        std::vector<Material> materials;
+    };
+
+    namespace detail {
+
+        inline bool isDigit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+        inline bool isSpace(char c) {
+            return c == ' ' || c == '\t';
+        }
+
+        inline const char *skipSpaces(const char *c, const char *end) {
+            while (c < end && isSpace(*c))
+                c++;
+            return c;
+        }
+
+        inline const char *skipWord(const char *c, const char *end) {
+            while (c < end && !isSpace(*c))
+                c++;
+            return c;
+        }
+
+        inline const char *trimEnd(const char *begin, const char *end) {
+            while (end > begin && (isSpace(end[-1]) || end[-1] == '\r' || end[-1] == '\f'))
+                end--;
+            return end;
+        }
+
+        // the rest of the line after the keyword, without surrounding white space
+        inline std::string argument(const char *c, const char *end) {
+            c = skipSpaces(skipWord(c, end), end);
+            return std::string(c, trimEnd(c, end));
+        }
+
+        inline bool startsWith(const char *c, const char *end, const char *prefix, bool ignoreCase = false) {
+            for (; *prefix; prefix++, c++) {
+                if (c >= end)
+                    return false;
+                char a = *c, b = *prefix;
+                if (ignoreCase) {
+                    a = a >= 'A' && a <= 'Z' ? a - 'A' + 'a' : a;
+                    b = b >= 'A' && b <= 'Z' ? b - 'A' + 'a' : b;
+                }
+                if (a != b)
+                    return false;
+            }
+            return true;
+        }
+
+        // strtoul10_64 from Assimp's fast_atof.h, digits past maxDigits are skipped
+        inline uint64_t parseUnsigned(const char *&c, const char *end, unsigned int *maxDigits = nullptr) {
+            unsigned int digits = 0;
+            uint64_t value = 0;
+            while (c < end && isDigit(*c)) {
+                uint64_t next = value * 10 + (uint64_t) (*c - '0');
+                if (next < value)
+                    return 0;
+                value = next;
+                c++;
+                digits++;
+                if (maxDigits && digits == *maxDigits) {
+                    while (c < end && isDigit(*c))
+                        c++;
+                    return value;
+                }
+            }
+            if (maxDigits)
+                *maxDigits = digits;
+            return value;
+        }
+
+        // fast_atoreal_move<float> from Assimp: the integer and fractional parts are converted
+        // separately, which rounds differently from strtof, so this is what keeps the vertex
+        // data bit identical to the Assimp import
+        inline bool parseFloat(const char *&c, const char *end, float &out) {
+            static const double fractionScale[16] = {
+                    0.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001, 0.00000001,
+                    0.000000001, 0.0000000001, 0.00000000001, 0.000000000001, 0.0000000000001,
+                    0.00000000000001, 0.000000000000001};
+            bool negative = c < end && *c == '-';
+            if (c < end && (*c == '-' || *c == '+'))
+                c++;
+            bool separator = c < end && (*c == '.' || *c == ',');
+            if (c >= end || !(isDigit(*c) || (separator && c + 1 < end && isDigit(c[1]))))
+                return false;
+
+            float f = 0.0f;
+            if (!separator)
+                f = (float) parseUnsigned(c, end);
+            if (c + 1 < end && (*c == '.' || *c == ',') && isDigit(c[1])) {
+                c++;
+                unsigned int digits = 15;
+                double fraction = (double) parseUnsigned(c, end, &digits);
+                fraction *= fractionScale[digits];
+                f += (float) fraction;
+            } else if (c < end && *c == '.') {
+                c++;
+            }
+            if (c < end && (*c == 'e' || *c == 'E')) {
+                c++;
+                bool negativeExponent = c < end && *c == '-';
+                if (c < end && (*c == '-' || *c == '+'))
+                    c++;
+                if (c >= end || !isDigit(*c))
+                    return false;
+                float exponent = (float) parseUnsigned(c, end);
+                if (negativeExponent)
+                    exponent = -exponent;
+                f *= std::pow(10.0f, exponent);
+            }
+            out = negative ? -f : f;
+            return true;
+        }
+
+        // white space separated numbers after the keyword, false on anything that isn't one
+        inline bool parseFloats(const char *c, const char *end, float *values, int maxCount, int &count) {
+            count = 0;
+            c = skipWord(c, end);
+            while (true) {
+                c = skipSpaces(c, end);
+                if (c >= end)
+                    return true;
+                if (count == maxCount || !parseFloat(c, end, values[count++]))
+                    return false;
+                c = skipWord(c, end);
+            }
+        }
+
+        struct Corner {
+            // indices into the file wide arrays, -1 when the corner doesn't reference one
+            int position, texCoord, normal;
+        };
+
+        struct Face {
+            unsigned int firstCorner;
+            unsigned int cornerCount;
+            bool hasTexCoords, hasNormals;
+        };
+
+        struct Command {
+            enum Type {
+                Object, Group, UseMaterial, MaterialLibrary
+            } type;
+            // number of faces of the chunk that came before the statement
+            unsigned int face;
+            std::string name;
+        };
+
+        struct Chunk {
+            const char *begin = nullptr, *end = nullptr;
+            std::vector<glm::vec3> positions, normals;
+            std::vector<glm::vec2> texCoords;
+            std::vector<Corner> corners;
+            std::vector<Face> faces;
+            std::vector<Command> commands;
+            // negative indices count back from the end of the arrays, they are resolved against the
+            // chunk's own data here (corner * 3 + attribute) and rebased once the chunks are merged
+            std::vector<unsigned int> relative;
+            // offsets of the chunk's data in the merged arrays
+            size_t positionBase = 0, texCoordBase = 0, normalBase = 0;
+        };
+
+        inline bool parseFace(Chunk &chunk, const char *c, const char *end, bool anyTexCoords, bool anyNormals,
+                              std::vector<int> (&lists)[3], std::vector<char> (&relative)[3]) {
+            for (int i = 0; i < 3; i++) {
+                lists[i].clear();
+                relative[i].clear();
+            }
+            const size_t counts[3] = {chunk.positions.size(), chunk.texCoords.size(), chunk.normals.size()};
+            int slot = 0;
+            c++;
+            while (c < end) {
+                if (*c == '/') {
+                    slot++;
+                    c++;
+                    continue;
+                }
+                if (isSpace(*c) || *c == '\r') {
+                    slot = 0;
+                    c++;
+                    continue;
+                }
+                bool negative = *c == '-';
+                if (*c == '-' || *c == '+')
+                    c++;
+                if (c >= end || !isDigit(*c))
+                    return false;
+                long long value = 0;
+                while (c < end && isDigit(*c) && value <= INT_MAX)
+                    value = value * 10 + (*c++ - '0');
+                if (value == 0 || value > INT_MAX)
+                    return false;
+                // v/vn in a file without texture coordinates
+                if (slot == 1 && !anyTexCoords && anyNormals)
+                    slot = 2;
+                if (slot > 2)
+                    return false;
+                lists[slot].push_back(negative ? (int) ((long long) counts[slot] - value) : (int) (value - 1));
+                relative[slot].push_back(negative);
+            }
+            // points and lines go through Assimp
+            size_t cornerCount = lists[0].size();
+            if (cornerCount < 3)
+                return false;
+
+            Face face;
+            face.firstCorner = chunk.corners.size();
+            face.cornerCount = cornerCount;
+            face.hasTexCoords = !lists[1].empty();
+            face.hasNormals = !lists[2].empty();
+            for (size_t i = 0; i < cornerCount; i++) {
+                Corner corner;
+                int *attributes[3] = {&corner.position, &corner.texCoord, &corner.normal};
+                for (int a = 0; a < 3; a++) {
+                    *attributes[a] = i < lists[a].size() ? lists[a][i] : -1;
+                    if (i < lists[a].size() && relative[a][i])
+                        chunk.relative.push_back((face.firstCorner + i) * 3 + a);
+                }
+                chunk.corners.push_back(corner);
+            }
+            chunk.faces.push_back(face);
+            return true;
+        }
+
+        inline bool parseChunk(Chunk &chunk, bool anyTexCoords, bool anyNormals) {
+            std::vector<int> lists[3];
+            std::vector<char> relative[3];
+            const char *next;
+            for (const char *c = chunk.begin; c < chunk.end; c = next) {
+                const char *end = static_cast<const char *>(memchr(c, '\n', chunk.end - c));
+                if (!end)
+                    end = chunk.end;
+                next = end + 1;
+                c = skipSpaces(c, end);
+                end = trimEnd(c, end);
+                if (c == end || *c == '#')
+                    continue;
+                if (end[-1] == '\\')
+                    return false;
+
+                float values[7];
+                int count;
+                switch (*c) {
+                    case 'v':
+                        if (c + 1 < end && isSpace(c[1])) {
+                            if (!parseFloats(c, end, values, 7, count))
+                                return false;
+                            if (count == 3 || count == 6) {
+                                chunk.positions.push_back(glm::vec3(values[0], values[1], values[2]));
+                            } else if (count == 4 && values[3] != 0.0f) {
+                                float w = values[3];
+                                chunk.positions.push_back(glm::vec3(values[0] / w, values[1] / w, values[2] / w));
+                            } else {
+                                return false;
+                            }
+                        } else if (c + 2 < end && c[1] == 't' && isSpace(c[2])) {
+                            if (!parseFloats(c, end, values, 3, count) || count < 2)
+                                return false;
+                            // non finite coordinates default to 0 like they do in Assimp
+                            for (int i = 0; i < 2; i++)
+                                if (!std::isfinite(values[i]))
+                                    values[i] = 0.0f;
+                            chunk.texCoords.push_back(glm::vec2(values[0], values[1]));
+                        } else if (c + 2 < end && c[1] == 'n' && isSpace(c[2])) {
+                            if (!parseFloats(c, end, values, 3, count) || count != 3)
+                                return false;
+                            chunk.normals.push_back(glm::vec3(values[0], values[1], values[2]));
+                        }
+                        break;
+                    case 'f':
+                        if (c + 1 < end && isSpace(c[1]) && !parseFace(chunk, c, end, anyTexCoords, anyNormals, lists, relative))
+                            return false;
+                        break;
+                    case 'l':
+                    case 'p':
+                        return false;
+                    case 'o':
+                    case 'g':
+                        if (c + 1 == end || isSpace(c[1])) {
+                            Command command{*c == 'o' ? Command::Object : Command::Group, (unsigned int) chunk.faces.size(), argument(c, end)};
+                            // objects are named by their first word only
+                            if (command.type == Command::Object)
+                                command.name = command.name.substr(0, command.name.find_first_of(" \t"));
+                            chunk.commands.push_back(command);
+                        }
+                        break;
+                    case 'u':
+                        if (skipWord(c, end) - c == 6 && startsWith(c, end, "usemtl")) {
+                            std::string name = argument(c, end);
+                            if (!name.empty())
+                                chunk.commands.push_back(Command{Command::UseMaterial, (unsigned int) chunk.faces.size(), name});
+                        }
+                        break;
+                    case 'm':
+                        if (skipWord(c, end) - c == 6 && startsWith(c, end, "mtllib")) {
+                            std::string name = argument(c, end);
+                            if (!name.empty())
+                                chunk.commands.push_back(Command{Command::MaterialLibrary, (unsigned int) chunk.faces.size(), name});
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+            return true;
+        }
+
+        inline int findMaterial(const std::vector<Material> &materials, const std::string &name) {
+            for (size_t i = 0; i < materials.size(); i++)
+                if (materials[i].name == name)
+                    return i;
+            return -1;
+        }
+
+        // ObjFileMtlImporter, only keeps the texture maps model.h loads. The library leaves its
+        // last material current, which is what meshes created before the first usemtl get.
+        inline void parseMaterialLibrary(const char *c, const char *fileEnd, std::vector<Material> &materials, int &current) {
+            struct Map {
+                const char *keyword;
+                std::string Material::*texture;
+            };
+            // matched as case insensitive prefixes in this order, the nullptr ones are ignored
+            static const Map maps[] = {
+                    {"map_Kd", &Material::diffuse}, {"map_Ka", &Material::ambient},
+                    {"map_Ks", &Material::specular}, {"map_d", nullptr}, {"map_emissive", nullptr},
+                    {"map_Ke", nullptr}, {"map_bump", &Material::bump}, {"bump", &Material::bump}};
+            const char *next;
+            for (; c < fileEnd; c = next) {
+                const char *end = static_cast<const char *>(memchr(c, '\n', fileEnd - c));
+                if (!end)
+                    end = fileEnd;
+                next = end + 1;
+                c = skipSpaces(c, end);
+                end = trimEnd(c, end);
+                if (c == end)
+                    continue;
+
+                if (skipWord(c, end) - c == 6 && startsWith(c, end, "newmtl")) {
+                    std::string name = argument(c, end);
+                    if (name.empty())
+                        name = "DefaultMaterial";
+                    current = findMaterial(materials, name);
+                    if (current < 0) {
+                        materials.push_back(Material());
+                        materials.back().name = name;
+                        current = materials.size() - 1;
+                    }
+                    continue;
+                }
+                if (current < 0 || !(*c == 'm' || *c == 'b'))
+                    continue;
+                for (const Map &map : maps) {
+                    if (!startsWith(c, end, map.keyword, true))
+                        continue;
+                    if (!map.texture)
+                        break;
+                    // skip the keyword and the texture options with their arguments
+                    const char *name = skipSpaces(skipWord(c, end), end);
+                    while (name < end && *name == '-') {
+                        int tokens = 1;
+                        if (startsWith(name, end, "-clamp", true) || startsWith(name, end, "-type", true) ||
+                            startsWith(name, end, "-blendu", true) || startsWith(name, end, "-blendv", true) ||
+                            startsWith(name, end, "-boost", true) || startsWith(name, end, "-texres", true) ||
+                            startsWith(name, end, "-bm", true) || startsWith(name, end, "-imfchan", true))
+                            tokens = 2;
+                        else if (startsWith(name, end, "-mm", true))
+                            tokens = 3;
+                        else if (startsWith(name, end, "-o", true) || startsWith(name, end, "-s", true) ||
+                                 startsWith(name, end, "-t", true))
+                            tokens = 4;
+                        for (int i = 0; i < tokens; i++)
+                            name = skipSpaces(skipWord(name, end), end);
+                    }
+                    materials[current].*map.texture = std::string(name, end);
+                    break;
+                }
+            }
+        }
+
+        // Assimp's SpatialSort: positions sorted along a fixed axis, FindPositions() returns the
+        // ones within a radius in that order, which the smoothing passes below depend on
+        class SpatialSort {
+        public:
+            void Fill(const std::vector<glm::vec3> &positions) {
+                planeNormal = scaled(glm::vec3(0.8523f, 0.34321f, 0.5736f), 1.0f / length(glm::vec3(0.8523f, 0.34321f, 0.5736f)));
+                centroid = glm::vec3(0.0f);
+                entries.resize(positions.size());
+                const float scale = 1.0f / positions.size();
+                for (size_t i = 0; i < positions.size(); i++)
+                    centroid += scaled(positions[i], scale);
+                for (size_t i = 0; i < positions.size(); i++)
+                    entries[i] = Entry{(unsigned int) i, positions[i], distance(positions[i])};
+                std::sort(entries.begin(), entries.end());
+            }
+
+            void FindPositions(const glm::vec3 &position, float radius, std::vector<unsigned int> &results) const {
+                results.clear();
+                if (entries.empty())
+                    return;
+                const float dist = distance(position);
+                const float minDist = dist - radius, maxDist = dist + radius;
+                if (maxDist < entries.front().distance || minDist > entries.back().distance)
+                    return;
+
+                unsigned int index = entries.size() / 2;
+                unsigned int step = entries.size() / 4;
+                while (step > 1) {
+                    if (entries[index].distance < minDist)
+                        index += step;
+                    else
+                        index -= step;
+                    step /= 2;
+                }
+                while (index > 0 && entries[index].distance > minDist)
+                    index--;
+                while (index < entries.size() - 1 && entries[index].distance < minDist)
+                    index++;
+
+                const float radiusSquared = radius * radius;
+                for (size_t i = index; i < entries.size() && entries[i].distance < maxDist; i++) {
+                    glm::vec3 d = entries[i].position - position;
+                    if (dot(d, d) < radiusSquared)
+                        results.push_back(entries[i].index);
+                }
+            }
+
+            static float dot(const glm::vec3 &a, const glm::vec3 &b) {
+                return a.x * b.x + a.y * b.y + a.z * b.z;
+            }
+
+            static float length(const glm::vec3 &v) {
+                return std::sqrt(dot(v, v));
+            }
+
+            static glm::vec3 scaled(const glm::vec3 &v, float f) {
+                return glm::vec3(v.x * f, v.y * f, v.z * f);
+            }
+
+        private:
+            struct Entry {
+                unsigned int index;
+                glm::vec3 position;
+                float distance;
+
+                bool operator<(const Entry &other) const {
+                    return distance < other.distance;
+                }
+            };
+
+            std::vector<Entry> entries;
+            glm::vec3 planeNormal, centroid;
+
+            float distance(const glm::vec3 &position) const {
+                return dot(position - centroid, planeNormal);
+            }
+        };
+
+        inline glm::vec3 normalizeSafe(const glm::vec3 &v) {
+            float length = SpatialSort::length(v);
+            return length > 0.0f ? SpatialSort::scaled(v, 1.0f / length) : v;
+        }
+
+        inline bool isSpecial(float f) {
+            return std::isnan(f) || std::isinf(f);
+        }
+
+        // 1e-4 of the bounding box diagonal, ComputePositionEpsilon()
+        inline float positionEpsilon(const std::vector<glm::vec3> &positions) {
+            glm::vec3 minimum(1e10f), maximum(-1e10f);
+            for (const glm::vec3 &p : positions) {
+                minimum = glm::min(minimum, p);
+                maximum = glm::max(maximum, p);
+            }
+            return SpatialSort::length(maximum - minimum) * 1e-4f;
+        }
+
+        // Assimp's TriangulateProcess for one polygon with corners first .. first + count - 1:
+        // quads are split at their concave corner, larger polygons are ear clipped in the plane
+        // of their Newell normal
+        inline void triangulate(const std::vector<glm::vec3> &positions, unsigned int first, unsigned int count,
+                                unsigned int *out, std::vector<glm::vec2> &projected, std::vector<char> &done) {
+            if (count == 3) {
+                out[0] = first;
+                out[1] = first + 1;
+                out[2] = first + 2;
+                return;
+            }
+            if (count == 4) {
+                unsigned int start = 0;
+                for (unsigned int i = 0; i < 4; i++) {
+                    const glm::vec3 &v0 = positions[first + (i + 3) % 4];
+                    const glm::vec3 &v1 = positions[first + (i + 2) % 4];
+                    const glm::vec3 &v2 = positions[first + (i + 1) % 4];
+                    const glm::vec3 &v = positions[first + i];
+                    glm::vec3 left = v0 - v, diagonal = v1 - v, right = v2 - v;
+                    left = SpatialSort::scaled(left, 1.0f / SpatialSort::length(left));
+                    diagonal = SpatialSort::scaled(diagonal, 1.0f / SpatialSort::length(diagonal));
+                    right = SpatialSort::scaled(right, 1.0f / SpatialSort::length(right));
+                    float angle = std::acos(SpatialSort::dot(left, diagonal)) + std::acos(SpatialSort::dot(right, diagonal));
+                    if (angle > 3.1415926538f) {
+                        start = i;
+                        break;
+                    }
+                }
+                out[0] = first + start;
+                out[1] = first + (start + 1) % 4;
+                out[2] = first + (start + 2) % 4;
+                out[3] = first + start;
+                out[4] = first + (start + 2) % 4;
+                out[5] = first + (start + 3) % 4;
+                return;
+            }
+
+            // Newell normal, its largest axis is dropped for the projection
+            float sumXY = 0.0f, sumYZ = 0.0f, sumZX = 0.0f;
+            for (unsigned int i = 0; i < count; i++) {
+                const glm::vec3 &p = positions[first + (i + 1) % count];
+                const glm::vec3 &low = positions[first + i];
+                const glm::vec3 &high = positions[first + (i + 2) % count];
+                sumXY += p.x * (high.y - low.y);
+                sumYZ += p.y * (high.z - low.z);
+                sumZX += p.z * (high.x - low.x);
+            }
+            glm::vec3 n(sumYZ, sumZX, sumXY);
+            float ax = std::fabs(n.x), ay = std::fabs(n.y), az = std::fabs(n.z);
+            int ac = 0, bc = 1;
+            float inv = n.z;
+            if (ax > ay) {
+                if (ax > az) {
+                    ac = 1;
+                    bc = 2;
+                    inv = n.x;
+                }
+            } else if (ay > az) {
+                ac = 2;
+                bc = 0;
+                inv = n.y;
+            }
+            if (inv < 0.0f)
+                std::swap(ac, bc);
+
+            projected.resize(count);
+            done.assign(count, 0);
+            for (unsigned int i = 0; i < count; i++)
+                projected[i] = glm::vec2(positions[first + i][ac], positions[first + i][bc]);
+
+            auto area = [](const glm::vec2 &v1, const glm::vec2 &v2, const glm::vec2 &v3) {
+                return 0.5 * (v1.x * ((float) v3.y - v2.y) + v2.x * ((float) v1.y - v3.y) + v3.x * ((float) v2.y - v1.y));
+            };
+            auto inTriangle = [](const glm::vec2 &p0, const glm::vec2 &p1, const glm::vec2 &p2, const glm::vec2 &pp) {
+                glm::vec2 v0 = p1 - p0, v1 = p2 - p0, v2 = pp - p0;
+                double dot00 = v0.x * v0.x + v0.y * v0.y;
+                double dot01 = v0.x * v1.x + v0.y * v1.y;
+                double dot02 = v0.x * v2.x + v0.y * v2.y;
+                double dot11 = v1.x * v1.x + v1.y * v1.y;
+                double dot12 = v1.x * v2.x + v1.y * v2.y;
+                const double invDenom = 1 / (dot00 * dot11 - dot01 * dot01);
+                dot11 = (dot11 * dot02 - dot01 * dot12) * invDenom;
+                dot00 = (dot00 * dot12 - dot01 * dot02) * invDenom;
+                return dot11 > 0 && dot00 > 0 && dot11 + dot00 < 1;
+            };
+
+            int max = count, num = count, prev = max - 1, next = 0, current = 0;
+            unsigned int *triangle = out;
+            while (num > 3) {
+                int found = 0;
+                for (current = next;; prev = current, current = next) {
+                    for (next = current + 1; done[next >= max ? next = 0 : next]; ++next);
+                    if (next < current && ++found == 2)
+                        break;
+                    const glm::vec2 &p1 = projected[current], &p0 = projected[prev], &p2 = projected[next];
+                    // must be a convex corner
+                    if (area(p1, p0, p2) > 0)
+                        continue;
+                    // and not a degenerate one
+                    glm::vec2 left = p0 - p1, right = p2 - p1;
+                    float leftLength = std::sqrt(left.x * left.x + left.y * left.y);
+                    float rightLength = std::sqrt(right.x * right.x + right.y * right.y);
+                    left = glm::vec2(left.x / leftLength, left.y / leftLength);
+                    right = glm::vec2(right.x / rightLength, right.y / rightLength);
+                    float cosine = left.x * right.x + left.y * right.y;
+                    if (std::fabs(cosine - 1.0f) < 1e-6f || std::fabs(cosine + 1.0f) < 1e-6f)
+                        continue;
+                    int other = 0;
+                    for (; other < max; other++) {
+                        const glm::vec2 &p = projected[other];
+                        if (p != p1 && p != p2 && p != p0 && inTriangle(p0, p1, p2, p))
+                            break;
+                    }
+                    if (other == max)
+                        break;
+                }
+                if (found == 2) {
+                    // no ear, not a simple polygon: fall back to a fan
+                    for (int i = 0; i < max - 2; i++) {
+                        out[3 * i] = first;
+                        out[3 * i + 1] = first + i + 1;
+                        out[3 * i + 2] = first + i + 2;
+                    }
+                    return;
+                }
+                *triangle++ = first + prev;
+                *triangle++ = first + current;
+                *triangle++ = first + next;
+                done[current] = 1;
+                num--;
+            }
+            int i = 0;
+            for (int k = 0; k < 3; k++, i++) {
+                while (done[i])
+                    i++;
+                *triangle++ = first + i;
+            }
+        }
+
+        // GenVertexNormalsProcess without an angle limit: face normals averaged over all
+        // vertices sharing a position
+        inline void faceNormals(Mesh &mesh, size_t firstIndex, size_t indexCount) {
+            for (size_t i = firstIndex; i < firstIndex + indexCount; i += 3) {
+                const glm::vec3 &a = mesh.positions[mesh.indices[i]];
+                const glm::vec3 &b = mesh.positions[mesh.indices[i + 1]];
+                const glm::vec3 &c = mesh.positions[mesh.indices[i + 2]];
+                glm::vec3 normal = normalizeSafe(glm::cross(b - a, c - a));
+                for (int k = 0; k < 3; k++)
+                    mesh.normals[mesh.indices[i + k]] = normal;
+            }
+        }
+
+        inline void smoothNormals(Mesh &mesh, const SpatialSort &sort, float epsilon) {
+            std::vector<glm::vec3> smoothed(mesh.normals.size());
+            std::vector<char> had(mesh.normals.size(), 0);
+            std::vector<unsigned int> found;
+            for (size_t i = 0; i < mesh.positions.size(); i++) {
+                if (had[i])
+                    continue;
+                sort.FindPositions(mesh.positions[i], epsilon, found);
+                glm::vec3 normal(0.0f);
+                for (unsigned int vertex : found)
+                    if (!std::isnan(mesh.normals[vertex].x))
+                        normal += mesh.normals[vertex];
+                normal = normalizeSafe(normal);
+                for (unsigned int vertex : found) {
+                    smoothed[vertex] = normal;
+                    had[vertex] = 1;
+                }
+            }
+            mesh.normals.swap(smoothed);
+        }
+
+        // CalcTangentsProcess: per triangle tangent and bitangent along the texture axes,
+        // projected into the plane of each corner's normal
+        inline void faceTangents(Mesh &mesh, size_t firstIndex, size_t indexCount) {
+            const std::vector<glm::vec3> &positions = mesh.positions, &normals = mesh.normals;
+            const std::vector<glm::vec2> &texCoords = mesh.texCoords;
+            for (size_t i = firstIndex; i < firstIndex + indexCount; i += 3) {
+                unsigned int p0 = mesh.indices[i], p1 = mesh.indices[i + 1], p2 = mesh.indices[i + 2];
+                glm::vec3 v = positions[p1] - positions[p0], w = positions[p2] - positions[p0];
+                float sx = texCoords[p1].x - texCoords[p0].x, sy = texCoords[p1].y - texCoords[p0].y;
+                float tx = texCoords[p2].x - texCoords[p0].x, ty = texCoords[p2].y - texCoords[p0].y;
+                float dirCorrection = (tx * sy - ty * sx) < 0.0f ? -1.0f : 1.0f;
+                // all corners at the same texture coordinate, use the default texture axes
+                if (sx * ty == sy * tx) {
+                    sx = 0.0f;
+                    sy = 1.0f;
+                    tx = 1.0f;
+                    ty = 0.0f;
+                }
+                glm::vec3 tangent((w.x * sy - v.x * ty) * dirCorrection,
+                                  (w.y * sy - v.y * ty) * dirCorrection,
+                                  (w.z * sy - v.z * ty) * dirCorrection);
+                glm::vec3 bitangent((-w.x * sx + v.x * tx) * dirCorrection,
+                                    (-w.y * sx + v.y * tx) * dirCorrection,
+                                    (-w.z * sx + v.z * tx) * dirCorrection);
+                for (int k = 0; k < 3; k++) {
+                    unsigned int p = mesh.indices[i + k];
+                    const glm::vec3 &n = normals[p];
+                    glm::vec3 localTangent = normalizeSafe(tangent - SpatialSort::scaled(n, SpatialSort::dot(tangent, n)));
+                    glm::vec3 localBitangent = normalizeSafe(bitangent - SpatialSort::scaled(n, SpatialSort::dot(bitangent, n)));
+                    bool invalidTangent = isSpecial(localTangent.x) || isSpecial(localTangent.y) || isSpecial(localTangent.z);
+                    bool invalidBitangent = isSpecial(localBitangent.x) || isSpecial(localBitangent.y) || isSpecial(localBitangent.z);
+                    if (invalidTangent != invalidBitangent) {
+                        if (invalidTangent)
+                            localTangent = normalizeSafe(glm::cross(n, localBitangent));
+                        else
+                            localBitangent = normalizeSafe(glm::cross(localTangent, n));
+                    }
+                    mesh.tangents[p] = localTangent;
+                    mesh.bitangents[p] = localBitangent;
+                }
+            }
+        }
+
+        // averages the frames of vertices at the same position whose normals match and whose
+        // tangents are within 45 degrees of each other
+        inline void smoothTangents(Mesh &mesh, const SpatialSort &sort, float epsilon) {
+            const float limit = std::cos(45.0f * 0.0174532925f);
+            std::vector<char> done(mesh.positions.size(), 0);
+            std::vector<unsigned int> found, close;
+            for (size_t a = 0; a < mesh.positions.size(); a++) {
+                if (done[a])
+                    continue;
+                const glm::vec3 normal = mesh.normals[a], tangent = mesh.tangents[a], bitangent = mesh.bitangents[a];
+                sort.FindPositions(mesh.positions[a], epsilon, found);
+                close.clear();
+                close.push_back(a);
+                for (unsigned int b : found) {
+                    if (done[b] || SpatialSort::dot(mesh.normals[b], normal) < 0.9999f ||
+                        SpatialSort::dot(mesh.tangents[b], tangent) < limit ||
+                        SpatialSort::dot(mesh.bitangents[b], bitangent) < limit)
+                        continue;
+                    close.push_back(b);
+                    done[b] = 1;
+                }
+                glm::vec3 smoothTangent(0.0f), smoothBitangent(0.0f);
+                for (unsigned int vertex : close) {
+                    smoothTangent += mesh.tangents[vertex];
+                    smoothBitangent += mesh.bitangents[vertex];
+                }
+                float tangentLength = SpatialSort::length(smoothTangent);
+                float bitangentLength = SpatialSort::length(smoothBitangent);
+                if (tangentLength != 0.0f)
+                    smoothTangent = SpatialSort::scaled(smoothTangent, 1.0f / tangentLength);
+                if (bitangentLength != 0.0f)
+                    smoothBitangent = SpatialSort::scaled(smoothBitangent, 1.0f / bitangentLength);
+                for (unsigned int vertex : close) {
+                    mesh.tangents[vertex] = smoothTangent;
+                    mesh.bitangents[vertex] = smoothBitangent;
+                }
+            }
+        }
+
+        inline bool readFile(const std::string &path, std::vector<char> &contents) {
+            MappedFile file(path);
+            if (!file.IsOpen())
+                return false;
+            contents.assign(file.Data(), file.Data() + file.Size());
+            return true;
+        }
+
+        // faces of one chunk that end up next to each other in one mesh
+        struct Range {
+            unsigned int chunk, firstFace, faceCount;
+            unsigned int mesh;
+            size_t firstVertex = 0, firstIndex = 0;
+            size_t vertexCount = 0, indexCount = 0;
+        };
+
+        // replays the statements in file order the way ObjFileParser builds its objects and meshes
+        struct Layout {
+            static const int NoMaterial = -1;
+
+            struct MeshEntry {
+                std::string name;
+                int material = NoMaterial;
+                bool attached = false;
+                bool hasTexCoords = false, hasNormals = false;
+                std::vector<Range> ranges;
+            };
+
+            struct Object {
+                std::string name;
+                std::vector<int> meshes;
+            };
+
+            std::string directory, objPath;
+            std::vector<Material> &materials;
+            std::vector<Object> objects;
+            std::vector<MeshEntry> meshes;
+            int currentObject = -1, currentMesh = -1, currentMaterial = -1;
+            std::string activeGroup;
+
+            Layout(std::vector<Material> &materials) : materials(materials) {}
+
+            void createMesh(const std::string &name) {
+                meshes.push_back(MeshEntry());
+                meshes.back().name = name;
+                currentMesh = meshes.size() - 1;
+                // a mesh created before any object never makes it into the scene
+                if (currentObject >= 0) {
+                    objects[currentObject].meshes.push_back(currentMesh);
+                    meshes.back().attached = true;
+                }
+            }
+
+            void createObject(const std::string &name) {
+                objects.push_back(Object{name, {}});
+                currentObject = objects.size() - 1;
+                createMesh(name);
+                if (currentMaterial >= 0)
+                    meshes[currentMesh].material = currentMaterial;
+            }
+
+            void apply(const Command &command) {
+                switch (command.type) {
+                    case Command::Object: {
+                        if (command.name.empty())
+                            break;
+                        currentObject = -1;
+                        for (size_t i = 0; i < objects.size(); i++)
+                            if (objects[i].name == command.name)
+                                currentObject = i;
+                        if (currentObject < 0)
+                            createObject(command.name);
+                        break;
+                    }
+                    case Command::Group:
+                        if (activeGroup != command.name) {
+                            createObject(command.name);
+                            activeGroup = command.name;
+                        }
+                        break;
+                    case Command::UseMaterial: {
+                        if (currentMaterial >= 0 && materials[currentMaterial].name == command.name)
+                            break;
+                        int material = findMaterial(materials, command.name);
+                        if (material < 0) {
+                            std::cout << "OBJ: failed to locate material " << command.name << ", creating new material" << std::endl;
+                            materials.push_back(Material());
+                            materials.back().name = command.name;
+                            material = materials.size() - 1;
+                        }
+                        currentMaterial = material;
+                        if (currentMesh < 0 || (meshes[currentMesh].material != NoMaterial &&
+                                                meshes[currentMesh].material != material &&
+                                                !meshes[currentMesh].ranges.empty()))
+                            createMesh(command.name);
+                        meshes[currentMesh].material = material;
+                        break;
+                    }
+                    case Command::MaterialLibrary: {
+                        std::vector<char> contents;
+                        if (!readFile(directory + '/' + command.name, contents) &&
+                            !readFile(objPath.substr(0, objPath.size() - 3) + "mtl", contents)) {
+                            std::cout << "OBJ: Unable to locate material file " << command.name << std::endl;
+                            break;
+                        }
+                        parseMaterialLibrary(contents.data(), contents.data() + contents.size(), materials, currentMaterial);
+                        break;
+                    }
+                }
+            }
+
+            void addFaces(const Chunk &chunk, unsigned int chunkIndex, unsigned int first, unsigned int last) {
+                if (first == last)
+                    return;
+                if (currentMaterial < 0)
+                    currentMaterial = 0;
+                if (currentObject < 0)
+                    createObject("defaultobject");
+                if (currentMesh < 0)
+                    createMesh("defaultobject");
+                MeshEntry &mesh = meshes[currentMesh];
+                Range range;
+                range.chunk = chunkIndex;
+                range.firstFace = first;
+                range.faceCount = last - first;
+                for (unsigned int i = first; i < last; i++) {
+                    mesh.hasTexCoords = mesh.hasTexCoords || chunk.faces[i].hasTexCoords;
+                    mesh.hasNormals = mesh.hasNormals || chunk.faces[i].hasNormals;
+                }
+                mesh.ranges.push_back(range);
+            }
+        };
+
+    };
+
+    // loads an OBJ file the way Assimp would, false when the file can't be read or uses
+    // something only Assimp handles
+    inline bool Load(const std::string &path, Scene &scene, unsigned int steps = AllSteps, ThreadPool &pool = ThreadPool::Shared()) {
+        using namespace detail;
+        MappedFile file(path);
+        if (!file.IsOpen())
+            return false;
+        const char *data = file.Data();
+        const size_t size = file.Size();
+        // v/vn corners only mean normals in files without texture coordinates
+        auto contains = [&](const char *keyword) {
+            size_t length = strlen(keyword);
+            if (size >= length - 1 && memcmp(data, keyword + 1, length - 1) == 0)
+                return true;
+            return memmem(data, size, keyword, length) != nullptr;
+        };
+        const bool anyTexCoords = contains("\nvt "), anyNormals = contains("\nvn ");
+
+        // chunks of roughly 256kB that start and end at line boundaries
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(size / (256 << 10), pool.Size() * 8));
+        std::vector<Chunk> chunks(chunkCount);
+        const char *begin = data;
+        for (size_t i = 0; i < chunkCount; i++) {
+            const char *end = data + size * (i + 1) / chunkCount;
+            if (i + 1 < chunkCount) {
+                end = std::max(end, begin);
+                const char *newline = static_cast<const char *>(memchr(end, '\n', data + size - end));
+                end = newline ? newline + 1 : data + size;
+            }
+            chunks[i].begin = begin;
+            chunks[i].end = end;
+            begin = end;
+        }
+        std::atomic<bool> failed(false);
+        pool.ParallelFor(chunkCount, [&](size_t i) {
+            if (!parseChunk(chunks[i], anyTexCoords, anyNormals))
+                failed = true;
+        });
+        if (failed)
+            return false;
+
+        // merge the vertex data and turn the chunk relative indices into file wide ones
+        std::vector<glm::vec3> positions, normals;
+        std::vector<glm::vec2> texCoords;
+        size_t positionCount = 0, texCoordCount = 0, normalCount = 0;
+        for (Chunk &chunk : chunks) {
+            chunk.positionBase = positionCount;
+            chunk.texCoordBase = texCoordCount;
+            chunk.normalBase = normalCount;
+            positionCount += chunk.positions.size();
+            texCoordCount += chunk.texCoords.size();
+            normalCount += chunk.normals.size();
+        }
+        positions.resize(positionCount);
+        texCoords.resize(texCoordCount);
+        normals.resize(normalCount);
+        pool.ParallelFor(chunkCount, [&](size_t i) {
+            Chunk &chunk = chunks[i];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+            std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + chunk.texCoordBase);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+            const size_t bases[3] = {chunk.positionBase, chunk.texCoordBase, chunk.normalBase};
+            for (unsigned int slot : chunk.relative) {
+                Corner &corner = chunk.corners[slot / 3];
+                int &index = slot % 3 == 0 ? corner.position : (slot % 3 == 1 ? corner.texCoord : corner.normal);
+                index += bases[slot % 3];
+                if (index < 0)
+                    failed = true;
+            }
+        });
+        if (failed)
+            return false;
+
+        // objects, meshes and materials
+        scene.meshes.clear();
+        scene.materials.assign(1, Material());
+        scene.materials[0].name = "DefaultMaterial";
+        Layout layout(scene.materials);
+        layout.objPath = path;
+        layout.directory = path.substr(0, path.find_last_of('/'));
+        for (size_t i = 0; i < chunkCount; i++) {
+            unsigned int face = 0;
+            for (const Command &command : chunks[i].commands) {
+                layout.addFaces(chunks[i], i, face, command.face);
+                face = command.face;
+                layout.apply(command);
+            }
+            layout.addFaces(chunks[i], i, face, chunks[i].faces.size());
+        }
+
+        std::vector<Layout::MeshEntry *> entries;
+        std::vector<Range> ranges;
+        for (const Layout::Object &object : layout.objects) {
+            for (int index : object.meshes) {
+                Layout::MeshEntry &entry = layout.meshes[index];
+                if (entry.ranges.empty())
+                    continue;
+                for (Range &range : entry.ranges) {
+                    range.mesh = entries.size();
+                    ranges.push_back(range);
+                }
+                entries.push_back(&entry);
+            }
+        }
+
+        // vertex and index counts of the ranges give every range its slice of its mesh
+        pool.ParallelFor(ranges.size(), [&](size_t i) {
+            Range &range = ranges[i];
+            const Chunk &chunk = chunks[range.chunk];
+            for (unsigned int f = range.firstFace; f < range.firstFace + range.faceCount; f++) {
+                range.vertexCount += chunk.faces[f].cornerCount;
+                range.indexCount += 3 * (chunk.faces[f].cornerCount - 2);
+            }
+        });
+        scene.meshes.resize(entries.size());
+        std::vector<size_t> vertexCounts(entries.size(), 0), indexCounts(entries.size(), 0);
+        for (Range &range : ranges) {
+            range.firstVertex = vertexCounts[range.mesh];
+            range.firstIndex = indexCounts[range.mesh];
+            vertexCounts[range.mesh] += range.vertexCount;
+            indexCounts[range.mesh] += range.indexCount;
+        }
+        for (size_t i = 0; i < entries.size(); i++) {
+            Mesh &mesh = scene.meshes[i];
+            mesh.name = entries[i]->name;
+            mesh.material = entries[i]->material == Layout::NoMaterial ? 0 : entries[i]->material;
+            mesh.positions.resize(vertexCounts[i]);
+            mesh.normals.resize(vertexCounts[i]);
+            mesh.indices.resize(indexCounts[i]);
+            // the corners of the faces are only meaningful if the file has the data at all
+            entries[i]->hasTexCoords = entries[i]->hasTexCoords && !texCoords.empty();
+            entries[i]->hasNormals = entries[i]->hasNormals && !normals.empty();
+            if (entries[i]->hasTexCoords) {
+                mesh.texCoords.resize(vertexCounts[i]);
+                if (steps & TangentSpace) {
+                    mesh.tangents.resize(vertexCounts[i]);
+                    mesh.bitangents.resize(vertexCounts[i]);
+                }
+            }
+        }
+
+        // one vertex per face corner, then the triangles
+        pool.ParallelFor(ranges.size(), [&](size_t i) {
+            const Range &range = ranges[i];
+            const Chunk &chunk = chunks[range.chunk];
+            Mesh &mesh = scene.meshes[range.mesh];
+            const Layout::MeshEntry &entry = *entries[range.mesh];
+            std::vector<glm::vec2> projected;
+            std::vector<char> done;
+            size_t vertex = range.firstVertex, index = range.firstIndex;
+            for (unsigned int f = range.firstFace; f < range.firstFace + range.faceCount; f++) {
+                const Face &face = chunk.faces[f];
+                size_t first = vertex;
+                for (unsigned int c = 0; c < face.cornerCount; c++, vertex++) {
+                    const Corner &corner = chunk.corners[face.firstCorner + c];
+                    if (corner.position < 0 || (size_t) corner.position >= positions.size() ||
+                        (corner.texCoord >= 0 && (size_t) corner.texCoord >= texCoords.size()) ||
+                        (corner.normal >= 0 && (size_t) corner.normal >= normals.size())) {
+                        failed = true;
+                        return;
+                    }
+                    mesh.positions[vertex] = positions[corner.position];
+                    if (entry.hasNormals && corner.normal >= 0)
+                        mesh.normals[vertex] = normals[corner.normal];
+                    if (entry.hasTexCoords) {
+                        glm::vec2 uv = corner.texCoord >= 0 ? texCoords[corner.texCoord] : glm::vec2(0.0f);
+                        mesh.texCoords[vertex] = glm::vec2(uv.x, 1.0f - uv.y);
+                    }
+                }
+                triangulate(mesh.positions, first, face.cornerCount, &mesh.indices[index], projected, done);
+                index += 3 * (face.cornerCount - 2);
+            }
+            if (!entry.hasNormals && (steps & SmoothNormals))
+                faceNormals(mesh, range.firstIndex, range.indexCount);
+        });
+        if (failed)
+            return false;
+        if (!(steps & SmoothNormals))
+            for (size_t i = 0; i < entries.size(); i++)
+                if (!entries[i]->hasNormals) {
+                    scene.meshes[i].normals.clear();
+                    scene.meshes[i].tangents.clear();
+                    scene.meshes[i].bitangents.clear();
+                }
+        if (!(steps & (SmoothNormals | TangentSpace)))
+            return true;
+
+        std::vector<SpatialSort> sorts(entries.size());
+        std::vector<float> epsilons(entries.size());
+        pool.ParallelFor(entries.size(), [&](size_t i) {
+            Mesh &mesh = scene.meshes[i];
+            sorts[i].Fill(mesh.positions);
+            epsilons[i] = positionEpsilon(mesh.positions);
+            if (!entries[i]->hasNormals && (steps & SmoothNormals))
+                smoothNormals(mesh, sorts[i], epsilons[i]);
+        });
+
+        // tangent frames for the meshes with texture coordinates
+        if (!(steps & TangentSpace))
+            return true;
+        pool.ParallelFor(ranges.size(), [&](size_t i) {
+            const Range &range = ranges[i];
+            if (!scene.meshes[range.mesh].tangents.empty())
+                faceTangents(scene.meshes[range.mesh], range.firstIndex, range.indexCount);
+        });
+        pool.ParallelFor(entries.size(), [&](size_t i) {
+            if (!scene.meshes[i].tangents.empty())
+                smoothTangents(scene.meshes[i], sorts[i], epsilons[i]);
+        });
+        return true;
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_OBJLOADER_H
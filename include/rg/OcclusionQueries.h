@@ -0,0 +1,246 @@
+#ifndef PROJECT_BASE_OCCLUSIONQUERIES_H
+#define PROJECT_BASE_OCCLUSIONQUERIES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "imgui.h"
+#include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/GLExt.h>
+#include <rg/GpuMemory.h>
+
+#include <string>
+#include <vector>
+
+namespace rg {
+
+    // Hardware occlusion culling for individually drawn objects. Once the large occluders are
+    // drawn, Begin() rasterizes the bounding box of an object inside an occlusion query and the
+    // object itself is drawn before End() under conditional rendering, so the GPU drops it when
+    // none of its box samples passed. Nothing is read back synchronously:
+    // finished results are collected a frame or two later and used for temporal coherence, objects
+    // that were recently visible are drawn unconditionally and only re-queried every few frames.
+    class OcclusionQueries {
+    public:
+        struct Object {
+            std::string name;
+            AABB bounds;
+            unsigned int queries[3] = {};
+            long issuedFrame[3] = {-1, -1, -1};
+            int activeQuery = -1;
+            // latest result we got back from the GPU
+            bool visible = true;
+            long resultFrame = -1;
+            long lastQueryFrame = -1;
+            unsigned int skippedFrames = 0;
+        };
+
+        bool enabled = true;
+        // GL_QUERY_NO_WAIT renders anyway when the result isn't ready, GL_QUERY_WAIT stalls only the GPU
+        bool noWait = false;
+        // frames between queries of objects that were visible last time
+        int requeryInterval = 4;
+
+        explicit OcclusionQueries(Shader &boxShader) : boxShader(boxShader) {
+            target = gl43::available() ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+
+            // unit cube, expanded to the bounds in the vertex shader
+            static const float corners[] = {
+                    0, 0, 0,  1, 0, 0,  1, 1, 0,  0, 1, 0,
+                    0, 0, 1,  1, 0, 1,  1, 1, 1,  0, 1, 1
+            };
+            static const unsigned char indices[] = {
+                    0, 1, 2, 2, 3, 0,   4, 6, 5, 6, 4, 7,
+                    0, 3, 7, 7, 4, 0,   1, 5, 6, 6, 2, 1,
+                    0, 4, 5, 5, 1, 0,   3, 2, 6, 6, 7, 3
+            };
+            glGenVertexArrays(1, &boxVAO);
+            glGenBuffers(1, &boxVBO);
+            glGenBuffers(1, &boxEBO);
+            glBindVertexArray(boxVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+            GpuMemory::Instance().TrackBuffer(boxVBO, GpuMemory::ModelGeometry, sizeof(corners));
+            GpuMemory::Instance().TrackBuffer(boxEBO, GpuMemory::ModelGeometry, sizeof(indices));
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+            glBindVertexArray(0);
+        }
+
+        ~OcclusionQueries() {
+            for (Object &object : objects)
+                glDeleteQueries(3, object.queries);
+            GpuMemory::Instance().ReleaseBuffer(boxEBO);
+            GpuMemory::Instance().ReleaseBuffer(boxVBO);
+            glDeleteBuffers(1, &boxEBO);
+            glDeleteBuffers(1, &boxVBO);
+            glDeleteVertexArrays(1, &boxVAO);
+        }
+
+        OcclusionQueries(const OcclusionQueries &) = delete;
+        OcclusionQueries &operator=(const OcclusionQueries &) = delete;
+
+        int Register(const std::string &name) {
+            Object object;
+            object.name = name;
+            glGenQueries(3, object.queries);
+            objects.push_back(object);
+            return objects.size() - 1;
+        }
+
+        // call once per frame before any Begin, picks up the results that have arrived in the meantime
+        void BeginFrame(const glm::mat4 &viewProjection, const glm::vec3 &cameraPosition) {
+            frame++;
+            this->viewProjection = viewProjection;
+            this->cameraPosition = cameraPosition;
+            for (Object &object : objects) {
+                collectResults(object);
+                object.activeQuery = -1;
+            }
+        }
+
+        // Queries the world space bounds of the object if it is due and starts conditional rendering
+        // on the query. The occluders have to be drawn before this. Keeps the current program bound.
+        void Begin(int id, const AABB &bounds) {
+            Object &object = objects[id];
+            object.bounds = bounds;
+            object.activeQuery = -1;
+            if (!enabled || !needsQuery(object))
+                return;
+            int slot = freeSlot(object);
+            if (slot < 0)
+                return;
+
+            GLint previousProgram, depthFunc;
+            glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+            glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+            GLboolean cullFace = glIsEnabled(GL_CULL_FACE), depthMask, colorMask[4];
+            glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+            glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+
+            boxShader.use();
+            boxShader.setMat4("viewProjection", viewProjection);
+            boxShader.setVec3("boxMin", bounds.min);
+            boxShader.setVec3("boxMax", bounds.max);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDepthMask(GL_FALSE);
+            // a main pass after the depth prepass tests with GL_EQUAL, the box still needs GL_LESS
+            glDepthFunc(GL_LESS);
+            glDisable(GL_CULL_FACE);
+            glBindVertexArray(boxVAO);
+            glBeginQuery(target, object.queries[slot]);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+            glEndQuery(target);
+            glBindVertexArray(0);
+            if (cullFace)
+                glEnable(GL_CULL_FACE);
+            glDepthFunc(depthFunc);
+            glDepthMask(depthMask);
+            glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+            glUseProgram(previousProgram);
+
+            object.issuedFrame[slot] = frame;
+            object.lastQueryFrame = frame;
+            object.activeQuery = slot;
+            glBeginConditionalRender(object.queries[slot], noWait ? GL_QUERY_NO_WAIT : GL_QUERY_WAIT);
+        }
+
+        void End(int id) {
+            if (objects[id].activeQuery >= 0)
+                glEndConditionalRender();
+        }
+
+        const std::vector<Object> &Objects() const {
+            return objects;
+        }
+
+        void DrawImGui() {
+            ImGui::Begin("Occlusion queries");
+            ImGui::Checkbox("Enabled", &enabled);
+            ImGui::Checkbox("GL_QUERY_NO_WAIT", &noWait);
+            ImGui::SliderInt("Re-query interval", &requeryInterval, 1, 30);
+            ImGui::Text("%s", target == GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+                              ? "GL_ANY_SAMPLES_PASSED_CONSERVATIVE" : "GL_ANY_SAMPLES_PASSED");
+            ImGui::Separator();
+            ImGui::Columns(4);
+            ImGui::Text("Object"); ImGui::NextColumn();
+            ImGui::Text("State"); ImGui::NextColumn();
+            ImGui::Text("Result age"); ImGui::NextColumn();
+            ImGui::Text("Frames skipped"); ImGui::NextColumn();
+            ImGui::Separator();
+            for (const Object &object : objects) {
+                ImGui::Text("%s", object.name.c_str()); ImGui::NextColumn();
+                if (object.resultFrame < 0)
+                    ImGui::Text("untested");
+                else if (object.visible)
+                    ImGui::Text("drawn");
+                else
+                    ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "skipped");
+                ImGui::NextColumn();
+                if (object.resultFrame < 0)
+                    ImGui::Text("-");
+                else
+                    ImGui::Text("%ld", frame - object.resultFrame);
+                ImGui::NextColumn();
+                ImGui::Text("%u", object.skippedFrames); ImGui::NextColumn();
+            }
+            ImGui::Columns(1);
+            ImGui::End();
+        }
+
+    private:
+        Shader &boxShader;
+        GLenum target;
+        unsigned int boxVAO = 0, boxVBO = 0, boxEBO = 0;
+        std::vector<Object> objects;
+        long frame = 0;
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+        glm::vec3 cameraPosition = glm::vec3(0.0f);
+
+        bool needsQuery(Object &object) {
+            // the box would be clipped by the near plane, just draw the object
+            AABB padded(object.bounds.min - glm::vec3(0.5f), object.bounds.max + glm::vec3(0.5f));
+            if (padded.Contains(cameraPosition)) {
+                object.visible = true;
+                return false;
+            }
+            if (!object.visible || object.lastQueryFrame < 0)
+                return true;
+            // visible objects are only re-queried periodically
+            return frame - object.lastQueryFrame >= requeryInterval;
+        }
+
+        int freeSlot(const Object &object) const {
+            for (int slot = 0; slot < 3; slot++)
+                if (object.issuedFrame[slot] < 0)
+                    return slot;
+            return -1;
+        }
+
+        void collectResults(Object &object) {
+            for (int slot = 0; slot < 3; slot++) {
+                if (object.issuedFrame[slot] < 0)
+                    continue;
+                GLuint available = 0;
+                glGetQueryObjectuiv(object.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    continue;
+                GLuint passed = 0;
+                glGetQueryObjectuiv(object.queries[slot], GL_QUERY_RESULT, &passed);
+                if (object.issuedFrame[slot] > object.resultFrame) {
+                    object.visible = passed != 0;
+                    object.resultFrame = object.issuedFrame[slot];
+                    if (!object.visible)
+                        object.skippedFrames++;
+                }
+                object.issuedFrame[slot] = -1;
+            }
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_OCCLUSIONQUERIES_H
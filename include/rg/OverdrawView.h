@@ -0,0 +1,203 @@
+#ifndef PROJECT_BASE_OVERDRAWVIEW_H
+#define PROJECT_BASE_OVERDRAWVIEW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/GLHandle.h>
+#include <rg/GpuMemory.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+namespace rg {
+
+    // Debug view of the fragment work. Between Begin() and End() the scene is drawn again with
+    // position-only shaders into a float counter target that adds 1 for every fragment, and into a
+    // second target that keeps the material of the last fragment (blending off there). Display()
+    // shows the counts as a heatmap or the materials as flat colors, ReadStats() sums up the
+    // counts. Without the depth test every rasterized fragment counts, with it the ones that pass
+    // in draw order, what the material shaders run for without a depth prepass.
+    class OverdrawView {
+    public:
+        enum Mode {
+            Heatmap,
+            LastMaterial
+        };
+
+        struct Stats {
+            // fragments per pixel over the whole target and over the pixels anything covers
+            double average = 0.0;
+            double averageCovered = 0.0;
+            float max = 0.0f;
+        };
+
+        Mode mode = Heatmap;
+        bool depthTest = false;
+        // fragments per pixel at the hot end of the heatmap
+        float heatmapMax = 8.0f;
+
+        // count and countInstanced draw the meshes and the instanced props with overdraw.fs,
+        // display is the full screen pass of overdraw_view.fs
+        OverdrawView(Shader &count, Shader &countInstanced, Shader &display)
+                : countShader(count), countInstancedShader(countInstanced), displayShader(display) {}
+
+        OverdrawView(const OverdrawView &) = delete;
+        OverdrawView &operator=(const OverdrawView &) = delete;
+
+        // binds the counter target at the given size and clears it, keeps the view and projection
+        // for Use()
+        void Begin(int targetWidth, int targetHeight, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix) {
+            if (targetWidth != width || targetHeight != height)
+                createTarget(targetWidth, targetHeight);
+            view = viewMatrix;
+            projection = projectionMatrix;
+
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+            glGetIntegerv(GL_BLEND_SRC_RGB, &previousBlendSource);
+            glGetIntegerv(GL_BLEND_DST_RGB, &previousBlendDestination);
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, previousClearColor);
+            previousDepthTest = glIsEnabled(GL_DEPTH_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.Get());
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glDisablei(GL_BLEND, 1);
+            if (depthTest)
+                glEnable(GL_DEPTH_TEST);
+            else
+                glDisable(GL_DEPTH_TEST);
+        }
+
+        // uses the counting shader for draws of a material and returns it for the model matrix
+        Shader &Use(uint16_t material, bool instanced = false) {
+            Shader &shader = instanced ? countInstancedShader : countShader;
+            shader.use();
+            shader.setMat4("view", view);
+            shader.setMat4("projection", projection);
+            shader.setFloat("materialId", (float) material);
+            shader.setFloat("lodFade", 0.0f);
+            return shader;
+        }
+
+        void End() {
+            glEnablei(GL_BLEND, 1);
+            glBlendFunc(previousBlendSource, previousBlendDestination);
+            glClearColor(previousClearColor[0], previousClearColor[1], previousClearColor[2], previousClearColor[3]);
+            if (previousDepthTest)
+                glEnable(GL_DEPTH_TEST);
+            else
+                glDisable(GL_DEPTH_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+            refreshStats = true;
+        }
+
+        // the heatmap or the material colors over the bound framebuffer, drawQuad() draws the full
+        // screen quad with positions at 0 and texture coordinates at 1
+        template<typename DrawQuad>
+        void Display(DrawQuad &&drawQuad) {
+            displayShader.use();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, counts.Get());
+            displayShader.setInt("overdrawCounts", 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, materials.Get());
+            displayShader.setInt("overdrawMaterials", 1);
+            displayShader.setInt("mode", mode);
+            displayShader.setFloat("heatmapMax", heatmapMax);
+            drawQuad();
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        // reads the counter target back, a synchronous readback meant for benchmarks and the
+        // debug view, not for every frame of normal rendering
+        Stats ReadStats() {
+            Stats stats;
+            if (!counts)
+                return stats;
+            std::vector<float> values((size_t) width * height);
+            glBindTexture(GL_TEXTURE_2D, counts.Get());
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, values.data());
+            glBindTexture(GL_TEXTURE_2D, 0);
+            double sum = 0.0;
+            size_t covered = 0;
+            for (float value : values) {
+                sum += value;
+                covered += value > 0.0f;
+                stats.max = std::max(stats.max, value);
+            }
+            stats.average = sum / std::max<size_t>(values.size(), 1);
+            stats.averageCovered = sum / std::max<size_t>(covered, 1);
+            refreshStats = false;
+            return stats;
+        }
+
+        // true once the target was drawn again since the last ReadStats()
+        bool StatsOutdated() const {
+            return refreshStats;
+        }
+
+        // the color the display pass gives a material, for a legend
+        static glm::vec3 MaterialColor(uint16_t material) {
+            // golden ratio steps around the hue circle keep neighbouring IDs apart
+            float hue = (material + 1) * 0.618034f;
+            hue -= (int) hue;
+            glm::vec3 rgb(std::fabs(hue * 6.0f - 3.0f) - 1.0f, 2.0f - std::fabs(hue * 6.0f - 2.0f),
+                          2.0f - std::fabs(hue * 6.0f - 4.0f));
+            return glm::clamp(rgb, 0.0f, 1.0f) * 0.8f + 0.2f;
+        }
+
+    private:
+        Shader &countShader, &countInstancedShader, &displayShader;
+        int width = 0, height = 0;
+        GLTexture counts, materials, depth;
+        GLFramebuffer framebuffer;
+        glm::mat4 view = glm::mat4(1.0f), projection = glm::mat4(1.0f);
+        GLint previousFramebuffer = 0, previousBlendSource = GL_ONE, previousBlendDestination = GL_ZERO;
+        GLboolean previousDepthTest = GL_TRUE;
+        GLfloat previousClearColor[4] = {};
+        bool refreshStats = false;
+
+        void createTarget(int targetWidth, int targetHeight) {
+            width = targetWidth;
+            height = targetHeight;
+            counts = createTexture(GL_R32F, GL_RED, GL_FLOAT, 4);
+            materials = createTexture(GL_R16F, GL_RED, GL_FLOAT, 2);
+            depth = createTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, 4);
+            framebuffer = GLFramebuffer::Create();
+            GLint previous;
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.Get());
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, counts.Get(), 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, materials.Get(), 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth.Get(), 0);
+            const GLenum attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+            glDrawBuffers(2, attachments);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "OverdrawView: framebuffer incomplete" << std::endl;
+            glBindFramebuffer(GL_FRAMEBUFFER, previous);
+        }
+
+        GLTexture createTexture(GLint internalFormat, GLenum format, GLenum type, size_t bytesPerPixel) {
+            GLTexture texture = GLTexture::Create();
+            glBindTexture(GL_TEXTURE_2D, texture.Get());
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            GpuMemory::Instance().TrackTexture(texture.Get(), GpuMemory::RenderTarget, (size_t) width * height * bytesPerPixel);
+            return texture;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_OVERDRAWVIEW_H
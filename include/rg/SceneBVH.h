@@ -0,0 +1,376 @@
+#ifndef PROJECT_BASE_SCENEBVH_H
+#define PROJECT_BASE_SCENEBVH_H
+
+#include <glm/glm.hpp>
+
+#include <rg/Bounds.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <vector>
+
+namespace rg {
+
+    struct RayHit {
+        int object = -1;
+        float t = FLT_MAX;
+
+        bool Hit() const {
+            return object >= 0;
+        }
+    };
+
+    // Bounding volume hierarchy over object instances. The tree is built with binned SAH and stored
+    // as a flat array of 32 byte nodes, siblings next to each other, so traversal walks memory
+    // mostly forward. Moving objects only need Update() followed by Commit(): that refits the
+    // node bounds bottom up and falls back to a full rebuild once the refitted tree got
+    // noticeably worse than the one that was built. The builder stops splitting at MaxDepth, so the
+    // fixed traversal stacks can't overflow on many coincident objects.
+    class SceneBVH {
+    public:
+        static const int MaxDepth = 63;
+        // depth-first traversal keeps at most one waiting sibling per level and the node just pushed
+        static const int StackSize = MaxDepth + 1;
+
+        struct Node {
+            AABB bounds;
+            // first child for inner nodes (the second one follows it), first object for leaves
+            int leftFirst = 0;
+            // number of objects, 0 for inner nodes
+            int count = 0;
+
+            bool IsLeaf() const {
+                return count > 0;
+            }
+        };
+
+        explicit SceneBVH(int maxLeafSize = 2) : maxLeafSize(maxLeafSize) {}
+
+        int Insert(const AABB &bounds) {
+            objectBounds.push_back(bounds);
+            needsBuild = true;
+            return objectBounds.size() - 1;
+        }
+
+        void Update(int object, const AABB &bounds) {
+            AABB &current = objectBounds[object];
+            if (current.min == bounds.min && current.max == bounds.max)
+                return;
+            current = bounds;
+            needsRefit = true;
+        }
+
+        void Clear() {
+            objectBounds.clear();
+            objectIndices.clear();
+            nodes.clear();
+            needsBuild = needsRefit = false;
+        }
+
+        // brings the tree up to date with the inserted and updated objects
+        void Commit() {
+            if (needsBuild) {
+                Build();
+            } else if (needsRefit) {
+                Refit();
+                if (cost() > 2.0f * builtCost)
+                    Build();
+            }
+        }
+
+        void Build() {
+            needsBuild = needsRefit = false;
+            nodes.clear();
+            objectIndices.resize(objectBounds.size());
+            for (size_t i = 0; i < objectIndices.size(); i++)
+                objectIndices[i] = i;
+            if (objectBounds.empty())
+                return;
+            centroids.resize(objectBounds.size());
+            for (size_t i = 0; i < objectBounds.size(); i++)
+                centroids[i] = objectBounds[i].Center();
+
+            nodes.reserve(2 * objectBounds.size());
+            nodes.push_back(Node());
+            nodes[0].leftFirst = 0;
+            nodes[0].count = objectBounds.size();
+            subdivide(0, 0);
+            builtCost = cost();
+        }
+
+        // recomputes node bounds from the object bounds, children are always stored after their parent
+        void Refit() {
+            needsRefit = false;
+            for (int i = (int) nodes.size() - 1; i >= 0; i--) {
+                Node &node = nodes[i];
+                node.bounds = AABB();
+                if (node.IsLeaf()) {
+                    for (int j = 0; j < node.count; j++)
+                        node.bounds.Expand(objectBounds[objectIndices[node.leftFirst + j]]);
+                } else {
+                    node.bounds.Expand(nodes[node.leftFirst].bounds);
+                    node.bounds.Expand(nodes[node.leftFirst + 1].bounds);
+                }
+            }
+        }
+
+        // calls visit(object) for every object whose bounds intersect the frustum,
+        // subtrees entirely inside are reported without further plane tests
+        template<typename Visit>
+        void QueryFrustum(const Frustum &frustum, Visit &&visit) const {
+            if (nodes.empty())
+                return;
+            int stack[StackSize];
+            bool inside[StackSize];
+            int top = 0;
+            stack[top] = 0;
+            inside[top++] = false;
+            while (top > 0) {
+                top--;
+                const Node &node = nodes[stack[top]];
+                bool contained = inside[top];
+                if (!contained) {
+                    if (!frustum.Intersects(node.bounds))
+                        continue;
+                    contained = frustum.Contains(node.bounds);
+                }
+                if (node.IsLeaf()) {
+                    for (int i = 0; i < node.count; i++) {
+                        int object = objectIndices[node.leftFirst + i];
+                        if (contained || frustum.Intersects(objectBounds[object]))
+                            visit(object);
+                    }
+                } else {
+                    assert(top + 2 <= StackSize);
+                    stack[top] = node.leftFirst + 1;
+                    inside[top++] = contained;
+                    stack[top] = node.leftFirst;
+                    inside[top++] = contained;
+                }
+            }
+        }
+
+        template<typename Visit>
+        void QuerySphere(const glm::vec3 &center, float radius, Visit &&visit) const {
+            if (nodes.empty())
+                return;
+            float radiusSquared = radius * radius;
+            int stack[StackSize];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const Node &node = nodes[stack[--top]];
+                if (node.bounds.DistanceSquared(center) > radiusSquared)
+                    continue;
+                if (node.IsLeaf()) {
+                    for (int i = 0; i < node.count; i++) {
+                        int object = objectIndices[node.leftFirst + i];
+                        if (objectBounds[object].DistanceSquared(center) <= radiusSquared)
+                            visit(object);
+                    }
+                } else {
+                    assert(top + 2 <= StackSize);
+                    stack[top++] = node.leftFirst + 1;
+                    stack[top++] = node.leftFirst;
+                }
+            }
+        }
+
+        // Closest hit along the ray. intersect(object, tEntry, maxT) is asked for the exact distance
+        // once the ray enters the object's bounds and returns FLT_MAX on a miss, children are
+        // visited near to far so most of the tree gets skipped after the first hit.
+        template<typename Intersect>
+        RayHit Raycast(const Ray &ray, float maxT, Intersect &&intersect) const {
+            RayHit hit;
+            hit.t = maxT;
+            if (nodes.empty())
+                return hit;
+            glm::vec3 inverseDirection = 1.0f / ray.direction;
+            float tEntry;
+            if (!nodes[0].bounds.Intersect(ray.origin, inverseDirection, hit.t, tEntry))
+                return hit;
+
+            int stack[StackSize];
+            float stackT[StackSize];
+            int top = 0;
+            stack[top] = 0;
+            stackT[top++] = tEntry;
+            while (top > 0) {
+                top--;
+                if (stackT[top] > hit.t)
+                    continue;
+                const Node &node = nodes[stack[top]];
+                if (node.IsLeaf()) {
+                    for (int i = 0; i < node.count; i++) {
+                        int object = objectIndices[node.leftFirst + i];
+                        if (!objectBounds[object].Intersect(ray.origin, inverseDirection, hit.t, tEntry))
+                            continue;
+                        float t = intersect(object, tEntry, hit.t);
+                        if (t < hit.t) {
+                            hit.t = t;
+                            hit.object = object;
+                        }
+                    }
+                    continue;
+                }
+                int first = node.leftFirst, second = node.leftFirst + 1;
+                float tFirst, tSecond;
+                bool hitFirst = nodes[first].bounds.Intersect(ray.origin, inverseDirection, hit.t, tFirst);
+                bool hitSecond = nodes[second].bounds.Intersect(ray.origin, inverseDirection, hit.t, tSecond);
+                if (hitFirst && hitSecond && tSecond < tFirst) {
+                    std::swap(first, second);
+                    std::swap(tFirst, tSecond);
+                }
+                // the nearer child goes on top of the stack
+                assert(top + 2 <= StackSize);
+                if (hitFirst && hitSecond) {
+                    stack[top] = second;
+                    stackT[top++] = tSecond;
+                    stack[top] = first;
+                    stackT[top++] = tFirst;
+                } else if (hitFirst || hitSecond) {
+                    stack[top] = hitFirst ? first : second;
+                    stackT[top++] = hitFirst ? tFirst : tSecond;
+                }
+            }
+            return hit;
+        }
+
+        // closest object bounds hit by the ray
+        RayHit Raycast(const Ray &ray, float maxT = FLT_MAX) const {
+            return Raycast(ray, maxT, [](int, float tEntry, float) { return tEntry; });
+        }
+
+        const AABB &Bounds(int object) const {
+            return objectBounds[object];
+        }
+
+        size_t ObjectCount() const {
+            return objectBounds.size();
+        }
+
+        const std::vector<Node> &Nodes() const {
+            return nodes;
+        }
+
+        // objects in leaf order, leaves reference ranges of this
+        const std::vector<int> &ObjectIndices() const {
+            return objectIndices;
+        }
+
+    private:
+        static const int Bins = 12;
+
+        int maxLeafSize;
+        std::vector<AABB> objectBounds;
+        std::vector<glm::vec3> centroids;
+        std::vector<int> objectIndices;
+        std::vector<Node> nodes;
+        bool needsBuild = false, needsRefit = false;
+        float builtCost = 0.0f;
+
+        // SAH cost of the current tree relative to its root, used to detect refit degradation
+        float cost() const {
+            if (nodes.empty() || nodes[0].bounds.SurfaceArea() <= 0.0f)
+                return 0.0f;
+            float total = 0.0f;
+            for (const Node &node : nodes)
+                total += node.bounds.SurfaceArea() * (node.IsLeaf() ? node.count : 1.0f);
+            return total / nodes[0].bounds.SurfaceArea();
+        }
+
+        void subdivide(int index, int depth) {
+            Node &node = nodes[index];
+            AABB centroidBounds;
+            node.bounds = AABB();
+            for (int i = 0; i < node.count; i++) {
+                int object = objectIndices[node.leftFirst + i];
+                node.bounds.Expand(objectBounds[object]);
+                centroidBounds.Expand(centroids[object]);
+            }
+            // leaves past the depth limit keep all their objects
+            if (node.count <= maxLeafSize || depth >= MaxDepth)
+                return;
+
+            int axis;
+            float split;
+            if (!findSplit(node, centroidBounds, axis, split))
+                return;
+
+            // partition the object indices around the split plane
+            int i = node.leftFirst, j = node.leftFirst + node.count - 1;
+            while (i <= j) {
+                if (centroids[objectIndices[i]][axis] < split)
+                    i++;
+                else
+                    std::swap(objectIndices[i], objectIndices[j--]);
+            }
+            int leftCount = i - node.leftFirst;
+            if (leftCount == 0 || leftCount == node.count)
+                return;
+
+            int left = nodes.size();
+            Node leftNode, rightNode;
+            leftNode.leftFirst = node.leftFirst;
+            leftNode.count = leftCount;
+            rightNode.leftFirst = i;
+            rightNode.count = node.count - leftCount;
+            // node is invalidated by the push_back
+            nodes[index].leftFirst = left;
+            nodes[index].count = 0;
+            nodes.push_back(leftNode);
+            nodes.push_back(rightNode);
+            subdivide(left, depth + 1);
+            subdivide(left + 1, depth + 1);
+        }
+
+        // binned SAH, false when no split beats keeping the objects in one leaf
+        bool findSplit(const Node &node, const AABB &centroidBounds, int &bestAxis, float &bestSplit) const {
+            float bestCost = node.bounds.SurfaceArea() * node.count;
+            bool found = false;
+            for (int axis = 0; axis < 3; axis++) {
+                float lo = centroidBounds.min[axis], hi = centroidBounds.max[axis];
+                if (hi - lo <= 1e-6f)
+                    continue;
+                AABB binBounds[Bins];
+                int binCount[Bins] = {};
+                float scale = Bins / (hi - lo);
+                for (int i = 0; i < node.count; i++) {
+                    int object = objectIndices[node.leftFirst + i];
+                    int bin = std::min(Bins - 1, (int) ((centroids[object][axis] - lo) * scale));
+                    binCount[bin]++;
+                    binBounds[bin].Expand(objectBounds[object]);
+                }
+                // sweep from both sides to get the area and count on either side of every plane
+                float leftArea[Bins - 1], rightArea[Bins - 1];
+                int leftCount[Bins - 1], rightCount[Bins - 1];
+                AABB leftBox, rightBox;
+                int leftSum = 0, rightSum = 0;
+                for (int i = 0; i < Bins - 1; i++) {
+                    leftSum += binCount[i];
+                    leftBox.Expand(binBounds[i]);
+                    leftCount[i] = leftSum;
+                    leftArea[i] = leftBox.SurfaceArea();
+                    rightSum += binCount[Bins - 1 - i];
+                    rightBox.Expand(binBounds[Bins - 1 - i]);
+                    rightCount[Bins - 2 - i] = rightSum;
+                    rightArea[Bins - 2 - i] = rightBox.SurfaceArea();
+                }
+                for (int i = 0; i < Bins - 1; i++) {
+                    float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = lo + (i + 1) / scale;
+                        found = true;
+                    }
+                }
+            }
+            return found;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_SCENEBVH_H
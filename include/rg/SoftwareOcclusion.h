@@ -0,0 +1,603 @@
+#ifndef PROJECT_BASE_SOFTWAREOCCLUSION_H
+#define PROJECT_BASE_SOFTWAREOCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "imgui.h"
+#include <learnopengl/model.h>
+#include <rg/Benchmark.h>
+#include <rg/Bounds.h>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+namespace rg {
+
+    // Coarse triangle soup used only for CPU occlusion, built by vertex clustering a model. The
+    // clustered surface can stick out of the real one by up to a cell, so every clustered vertex is
+    // pulled inwards along its normal by the cell's extent in that direction: the occluder has to
+    // stay behind the surface it stands in for, or it hides what shows past the model's silhouette.
+    struct OccluderMesh {
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned int> indices;
+
+        static OccluderMesh FromModel(const Model &model, int resolution) {
+            return FromModel(model, resolution, model.bounds);
+        }
+
+        // snaps the vertices inside region (model space) to a grid of resolution^3 cells over it and
+        // keeps the triangles that lie inside, don't collapse and don't turn over when pulled in.
+        // The region leaves out thin parts like branches and foliage, which occlude nothing solid.
+        static OccluderMesh FromModel(const Model &model, int resolution, const AABB &region) {
+            OccluderMesh occluder;
+            if (region.IsEmpty())
+                return occluder;
+            glm::vec3 cellSize = glm::max((region.max - region.min) / (float) resolution, glm::vec3(1e-6f));
+            const unsigned int outside = ~0u;
+
+            std::unordered_map<unsigned int, unsigned int> cellToVertex;
+            std::vector<glm::vec3> sums, normals;
+            std::vector<float> counts;
+            std::unordered_set<unsigned long long> triangles;
+            for (const Mesh &mesh : model.meshes) {
+                std::vector<unsigned int> remap(mesh.vertices.size(), outside);
+                for (size_t i = 0; i < mesh.vertices.size(); i++) {
+                    if (!region.Contains(mesh.vertices[i].Position))
+                        continue;
+                    glm::vec3 cell = glm::floor((mesh.vertices[i].Position - region.min) / cellSize);
+                    unsigned int x = std::min((unsigned int) cell.x, (unsigned int) resolution - 1);
+                    unsigned int y = std::min((unsigned int) cell.y, (unsigned int) resolution - 1);
+                    unsigned int z = std::min((unsigned int) cell.z, (unsigned int) resolution - 1);
+                    unsigned int key = (x * resolution + y) * resolution + z;
+                    auto inserted = cellToVertex.insert(std::make_pair(key, (unsigned int) sums.size()));
+                    if (inserted.second) {
+                        sums.push_back(glm::vec3(0.0f));
+                        normals.push_back(glm::vec3(0.0f));
+                        counts.push_back(0.0f);
+                    }
+                    remap[i] = inserted.first->second;
+                    sums[remap[i]] += mesh.vertices[i].Position;
+                    normals[remap[i]] += mesh.vertices[i].Normal;
+                    counts[remap[i]] += 1.0f;
+                }
+                for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                    unsigned int a = remap[mesh.indices[i]], b = remap[mesh.indices[i + 1]], c = remap[mesh.indices[i + 2]];
+                    if (a == outside || b == outside || c == outside || a == b || b == c || a == c)
+                        continue;
+                    // rotate so the smallest index is first, keeps winding and makes duplicates comparable
+                    while (a > b || a > c) {
+                        unsigned int t = a;
+                        a = b;
+                        b = c;
+                        c = t;
+                    }
+                    unsigned long long key = ((unsigned long long) a << 42) | ((unsigned long long) b << 21) | c;
+                    if (triangles.insert(key).second) {
+                        occluder.indices.push_back(a);
+                        occluder.indices.push_back(b);
+                        occluder.indices.push_back(c);
+                    }
+                }
+            }
+
+            // the real surface crosses every cell its cluster came from, so it is within the cell's
+            // width along the normal of the averaged vertex
+            std::vector<glm::vec3> averaged(sums.size());
+            std::vector<char> valid(sums.size(), 0);
+            occluder.positions.resize(sums.size());
+            for (size_t i = 0; i < sums.size(); i++) {
+                averaged[i] = sums[i] / counts[i];
+                occluder.positions[i] = averaged[i];
+                float length = glm::length(normals[i]);
+                // normals that cancel out belong to thin, two sided parts
+                if (length < 0.5f * counts[i])
+                    continue;
+                normals[i] /= length;
+                occluder.positions[i] -= normals[i] * glm::dot(glm::abs(normals[i]), cellSize);
+                valid[i] = 1;
+            }
+            std::vector<unsigned int> kept;
+            kept.reserve(occluder.indices.size());
+            for (size_t i = 0; i < occluder.indices.size(); i += 3) {
+                unsigned int a = occluder.indices[i], b = occluder.indices[i + 1], c = occluder.indices[i + 2];
+                if (!valid[a] || !valid[b] || !valid[c])
+                    continue;
+                glm::vec3 face = glm::cross(averaged[b] - averaged[a], averaged[c] - averaged[a]);
+                glm::vec3 pulled = glm::cross(occluder.positions[b] - occluder.positions[a],
+                                              occluder.positions[c] - occluder.positions[a]);
+                // a face the vertex normals don't agree with isn't pulled inwards, one that turned
+                // over was thinner than the cells
+                if (glm::dot(face, normals[a]) <= 0.0f || glm::dot(face, normals[b]) <= 0.0f ||
+                    glm::dot(face, normals[c]) <= 0.0f || glm::dot(face, pulled) <= 0.0f)
+                    continue;
+                kept.push_back(a);
+                kept.push_back(b);
+                kept.push_back(c);
+            }
+            occluder.indices.swap(kept);
+            return occluder;
+        }
+
+        size_t TriangleCount() const {
+            return indices.size() / 3;
+        }
+
+        // the solid core of a model (model space) as the region for FromModel(), found by voxelizing
+        // its surface into resolution^3 cells over the bounds. A cell counts as inside when the
+        // surface cells of its horizontal slice enclose it, which also holds for trunks and hills
+        // that are open at the bottom. The region spans the slices around the one with the most
+        // inside cells that have at least a quarter as many, grown by a cell sideways for the walls;
+        // branches and foliage enclose next to nothing and stay out. Empty when nothing is enclosed.
+        static AABB SolidRegion(const Model &model, int resolution) {
+            const AABB &bounds = model.bounds;
+            if (bounds.IsEmpty())
+                return AABB();
+            glm::vec3 cellSize = glm::max((bounds.max - bounds.min) / (float) resolution, glm::vec3(1e-6f));
+            float step = 0.3f * std::min(cellSize.x, std::min(cellSize.y, cellSize.z));
+            auto coordinate = [resolution](float cell) { return std::min(std::max((int) cell, 0), resolution - 1); };
+
+            // every cell a triangle passes through, sampled finer than the cells, indexed [y][x][z]
+            std::vector<char> surface((size_t) resolution * resolution * resolution, 0);
+            for (const Mesh &mesh : model.meshes)
+                for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                    glm::vec3 a = mesh.vertices[mesh.indices[i]].Position;
+                    glm::vec3 ab = mesh.vertices[mesh.indices[i + 1]].Position - a;
+                    glm::vec3 ac = mesh.vertices[mesh.indices[i + 2]].Position - a;
+                    float longest = std::max(glm::length(ab), std::max(glm::length(ac), glm::length(ac - ab)));
+                    int steps = std::max(1, (int) std::ceil(longest / step));
+                    for (int u = 0; u <= steps; u++)
+                        for (int v = 0; u + v <= steps; v++) {
+                            glm::vec3 cell = glm::floor((a + ab * ((float) u / steps) + ac * ((float) v / steps) - bounds.min) / cellSize);
+                            surface[((size_t) coordinate(cell.y) * resolution + coordinate(cell.x)) * resolution + coordinate(cell.z)] = 1;
+                        }
+                }
+
+            // per slice, flood the cells reachable from its border, the rest of the empty ones are inside
+            std::vector<int> inside(resolution, 0);
+            std::vector<int> lowX(resolution, resolution), lowZ(resolution, resolution), highX(resolution, -1), highZ(resolution, -1);
+            std::vector<char> reached((size_t) resolution * resolution);
+            std::vector<int> stack;
+            for (int y = 0; y < resolution; y++) {
+                const char *slice = &surface[(size_t) y * resolution * resolution];
+                std::fill(reached.begin(), reached.end(), 0);
+                auto reach = [&](int x, int z) {
+                    if (x < 0 || z < 0 || x >= resolution || z >= resolution || reached[x * resolution + z] ||
+                        slice[x * resolution + z])
+                        return;
+                    reached[x * resolution + z] = 1;
+                    stack.push_back(x * resolution + z);
+                };
+                for (int k = 0; k < resolution; k++) {
+                    reach(k, 0);
+                    reach(k, resolution - 1);
+                    reach(0, k);
+                    reach(resolution - 1, k);
+                }
+                while (!stack.empty()) {
+                    int x = stack.back() / resolution, z = stack.back() % resolution;
+                    stack.pop_back();
+                    reach(x + 1, z);
+                    reach(x - 1, z);
+                    reach(x, z + 1);
+                    reach(x, z - 1);
+                }
+                for (int x = 0; x < resolution; x++)
+                    for (int z = 0; z < resolution; z++)
+                        if (!reached[x * resolution + z] && !slice[x * resolution + z]) {
+                            inside[y]++;
+                            lowX[y] = std::min(lowX[y], x);
+                            lowZ[y] = std::min(lowZ[y], z);
+                            highX[y] = std::max(highX[y], x);
+                            highZ[y] = std::max(highZ[y], z);
+                        }
+            }
+
+            int widest = (int) (std::max_element(inside.begin(), inside.end()) - inside.begin());
+            if (inside[widest] == 0)
+                return AABB();
+            int first = widest, last = widest;
+            while (first > 0 && 4 * inside[first - 1] >= inside[widest])
+                first--;
+            while (last + 1 < resolution && 4 * inside[last + 1] >= inside[widest])
+                last++;
+            int x0 = resolution, z0 = resolution, x1 = -1, z1 = -1;
+            for (int y = first; y <= last; y++) {
+                x0 = std::min(x0, lowX[y]);
+                z0 = std::min(z0, lowZ[y]);
+                x1 = std::max(x1, highX[y]);
+                z1 = std::max(z1, highZ[y]);
+            }
+            x0 = std::max(x0 - 1, 0);
+            z0 = std::max(z0 - 1, 0);
+            x1 = std::min(x1 + 2, resolution);
+            z1 = std::min(z1 + 2, resolution);
+            return AABB(bounds.min + cellSize * glm::vec3((float) x0, (float) first, (float) z0),
+                        bounds.min + cellSize * glm::vec3((float) x1, (float) (last + 1), (float) z1));
+        }
+    };
+
+    struct OccluderInstance {
+        const OccluderMesh *mesh;
+        glm::mat4 transform;
+    };
+
+    // Low resolution depth buffer the occluders are rasterized into on the CPU, so objects can be
+    // rejected before submission without waiting on the GPU. The buffer is split into 8x8 tiles,
+    // stored contiguously, each keeping its farthest depth for early rejection of whole tiles both
+    // while rasterizing and while testing. Rasterization runs on a worker thread: BeginFrame() kicks
+    // it off and Wait() has to be called before IsVisible().
+    class SoftwareOcclusion {
+    public:
+        static const int Width = 320;
+        static const int Height = 192;
+        static const int TileSize = 8;
+        static const int TilesX = Width / TileSize;
+        static const int TilesY = Height / TileSize;
+
+        struct Stats {
+            size_t triangles = 0;
+            double rasterMs = 0.0;
+            unsigned int tested = 0;
+            unsigned int occluded = 0;
+        };
+
+        bool enabled = true;
+
+        SoftwareOcclusion() : depth(Width * Height, 1.0f), tileMax(TilesX * TilesY, 1.0f) {
+            worker = std::thread([this]() { workerLoop(); });
+        }
+
+        ~SoftwareOcclusion() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+
+        SoftwareOcclusion(const SoftwareOcclusion &) = delete;
+        SoftwareOcclusion &operator=(const SoftwareOcclusion &) = delete;
+
+        static const char *SimdPath() {
+#if defined(__AVX2__)
+            return "AVX2";
+#elif defined(__SSE4_1__)
+            return "SSE4.1";
+#else
+            return "scalar";
+#endif
+        }
+
+        void BeginFrame(const glm::mat4 &viewProjection, const std::vector<OccluderInstance> &occluders) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pendingViewProjection = viewProjection;
+                pendingOccluders = occluders;
+                pending = true;
+                done = false;
+            }
+            frameStats.tested = 0;
+            frameStats.occluded = 0;
+            wake.notify_all();
+        }
+
+        void Wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [this]() { return done || !pending; });
+        }
+
+        // synchronous rasterization into the buffer, also what the worker runs
+        void Rasterize(const glm::mat4 &viewProjection, const std::vector<OccluderInstance> &occluders, bool simd = true) {
+            bench::Timer timer;
+            std::fill(depth.begin(), depth.end(), 1.0f);
+            std::fill(tileMax.begin(), tileMax.end(), 1.0f);
+            this->viewProjection = viewProjection;
+
+            size_t triangles = 0;
+            std::vector<glm::vec4> clip;
+            for (const OccluderInstance &occluder : occluders) {
+                glm::mat4 mvp = viewProjection * occluder.transform;
+                clip.resize(occluder.mesh->positions.size());
+                for (size_t i = 0; i < clip.size(); i++)
+                    clip[i] = mvp * glm::vec4(occluder.mesh->positions[i], 1.0f);
+                const std::vector<unsigned int> &indices = occluder.mesh->indices;
+                for (size_t i = 0; i + 2 < indices.size(); i += 3)
+                    triangles += clipAndRasterize(clip[indices[i]], clip[indices[i + 1]], clip[indices[i + 2]], simd);
+            }
+            frameStats.triangles = triangles;
+            frameStats.rasterMs = timer.ElapsedMs();
+        }
+
+        // conservative: anything touching the near plane or leaving the screen counts as visible
+        bool IsVisible(const AABB &bounds) {
+            if (!enabled)
+                return true;
+            frameStats.tested++;
+
+            glm::vec2 screenMin(FLT_MAX), screenMax(-FLT_MAX);
+            float nearest = FLT_MAX;
+            for (int i = 0; i < 8; i++) {
+                glm::vec3 corner((i & 1) ? bounds.max.x : bounds.min.x,
+                                 (i & 2) ? bounds.max.y : bounds.min.y,
+                                 (i & 4) ? bounds.max.z : bounds.min.z);
+                glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+                if (clip.w <= 1e-4f)
+                    return true;
+                glm::vec3 ndc = glm::vec3(clip) / clip.w;
+                glm::vec2 screen((ndc.x * 0.5f + 0.5f) * Width, (ndc.y * 0.5f + 0.5f) * Height);
+                screenMin = glm::min(screenMin, screen);
+                screenMax = glm::max(screenMax, screen);
+                nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+            }
+            int x0 = std::max(0, (int) std::floor(screenMin.x)), x1 = std::min(Width - 1, (int) std::ceil(screenMax.x));
+            int y0 = std::max(0, (int) std::floor(screenMin.y)), y1 = std::min(Height - 1, (int) std::ceil(screenMax.y));
+            if (x0 > x1 || y0 > y1)
+                return true;
+
+            for (int tileY = y0 / TileSize; tileY <= y1 / TileSize; tileY++) {
+                for (int tileX = x0 / TileSize; tileX <= x1 / TileSize; tileX++) {
+                    // every pixel of the tile is closer than the box
+                    if (tileMax[tileY * TilesX + tileX] < nearest)
+                        continue;
+                    const float *tile = &depth[(tileY * TilesX + tileX) * TileSize * TileSize];
+                    int px0 = std::max(x0 - tileX * TileSize, 0), px1 = std::min(x1 - tileX * TileSize, TileSize - 1);
+                    int py0 = std::max(y0 - tileY * TileSize, 0), py1 = std::min(y1 - tileY * TileSize, TileSize - 1);
+                    for (int py = py0; py <= py1; py++)
+                        for (int px = px0; px <= px1; px++)
+                            if (tile[py * TileSize + px] >= nearest)
+                                return true;
+                }
+            }
+            frameStats.occluded++;
+            return false;
+        }
+
+        const Stats &FrameStats() const {
+            return frameStats;
+        }
+
+        void DrawImGui() {
+            ImGui::Begin("Software occlusion");
+            ImGui::Checkbox("Enabled", &enabled);
+            ImGui::Text("%dx%d depth, %s", Width, Height, SimdPath());
+            ImGui::Text("Occluder triangles: %zu", frameStats.triangles);
+            ImGui::Text("Raster: %.3f ms (%.0f triangles/ms)", frameStats.rasterMs,
+                        frameStats.rasterMs > 0.0 ? frameStats.triangles / frameStats.rasterMs : 0.0);
+            ImGui::Text("Occluded: %u / %u tested", frameStats.occluded, frameStats.tested);
+            ImGui::End();
+        }
+
+        // triangles per millisecond for the given occluders, scalar against the compiled SIMD path
+        void Benchmark(const glm::mat4 &viewProjection, const std::vector<OccluderInstance> &occluders, int iterations) {
+#if defined(__SSE4_1__) || defined(__AVX2__)
+            const int paths = 2;
+#else
+            const int paths = 1;
+#endif
+            for (int simd = 0; simd < paths; simd++) {
+                size_t triangles = 0;
+                double ms = 0.0;
+                for (int i = 0; i < iterations; i++) {
+                    Rasterize(viewProjection, occluders, simd != 0);
+                    triangles += frameStats.triangles;
+                    ms += frameStats.rasterMs;
+                }
+                bench::Report(std::string("software occlusion raster (") + (simd ? SimdPath() : "scalar") + ")",
+                              ms > 0.0 ? triangles / ms : 0.0, "triangles/ms");
+            }
+        }
+
+    private:
+        std::vector<float> depth;
+        std::vector<float> tileMax;
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+        Stats frameStats;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable wake, finished;
+        bool pending = false, done = false, quit = false;
+        glm::mat4 pendingViewProjection;
+        std::vector<OccluderInstance> pendingOccluders;
+
+        void workerLoop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this]() { return pending || quit; });
+                if (quit)
+                    return;
+                glm::mat4 frameViewProjection = pendingViewProjection;
+                std::vector<OccluderInstance> occluders;
+                occluders.swap(pendingOccluders);
+                lock.unlock();
+                Rasterize(frameViewProjection, occluders);
+                lock.lock();
+                pending = false;
+                done = true;
+                finished.notify_all();
+            }
+        }
+
+        // clips against the near plane (z >= -w) and returns the number of triangles rasterized
+        int clipAndRasterize(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c, bool simd) {
+            const glm::vec4 input[3] = {a, b, c};
+            float distance[3];
+            int inside = 0;
+            for (int i = 0; i < 3; i++) {
+                distance[i] = input[i].z + input[i].w;
+                inside += distance[i] >= 0.0f;
+            }
+            if (inside == 0)
+                return 0;
+            if (inside == 3)
+                return rasterizeTriangle(a, b, c, simd);
+
+            glm::vec4 polygon[4];
+            int count = 0;
+            for (int i = 0; i < 3; i++) {
+                int j = (i + 1) % 3;
+                if (distance[i] >= 0.0f)
+                    polygon[count++] = input[i];
+                if ((distance[i] >= 0.0f) != (distance[j] >= 0.0f)) {
+                    float t = distance[i] / (distance[i] - distance[j]);
+                    polygon[count++] = input[i] + (input[j] - input[i]) * t;
+                }
+            }
+            int rasterized = rasterizeTriangle(polygon[0], polygon[1], polygon[2], simd);
+            if (count == 4)
+                rasterized += rasterizeTriangle(polygon[0], polygon[2], polygon[3], simd);
+            return rasterized;
+        }
+
+        int rasterizeTriangle(const glm::vec4 &clip0, const glm::vec4 &clip1, const glm::vec4 &clip2, bool simd) {
+            glm::vec3 v[3];
+            const glm::vec4 *clip[3] = {&clip0, &clip1, &clip2};
+            for (int i = 0; i < 3; i++) {
+                float w = std::max(clip[i]->w, 1e-6f);
+                v[i] = glm::vec3((clip[i]->x / w * 0.5f + 0.5f) * Width,
+                                 (clip[i]->y / w * 0.5f + 0.5f) * Height,
+                                 clip[i]->z / w * 0.5f + 0.5f);
+            }
+            float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+            // back facing or degenerate
+            if (area <= 0.0f)
+                return 0;
+
+            float minX = std::min(v[0].x, std::min(v[1].x, v[2].x)), maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+            float minY = std::min(v[0].y, std::min(v[1].y, v[2].y)), maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+            int x0 = std::max(0, (int) std::floor(minX)), x1 = std::min(Width - 1, (int) std::ceil(maxX));
+            int y0 = std::max(0, (int) std::floor(minY)), y1 = std::min(Height - 1, (int) std::ceil(maxY));
+            if (x0 > x1 || y0 > y1)
+                return 0;
+            float minZ = std::min(v[0].z, std::min(v[1].z, v[2].z));
+
+            // edge functions e = A*x + B*y + C, positive inside a counter clockwise triangle
+            float A[3], B[3], C[3];
+            for (int i = 0; i < 3; i++) {
+                const glm::vec3 &p = v[i], &q = v[(i + 1) % 3];
+                A[i] = p.y - q.y;
+                B[i] = q.x - p.x;
+                C[i] = p.x * q.y - p.y * q.x;
+            }
+            // depth plane z = z0 + dzdx * (x - x0) + dzdy * (y - y0)
+            float dzdx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+            float dzdy = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+            float zc = v[0].z - dzdx * v[0].x - dzdy * v[0].y;
+
+            for (int tileY = y0 / TileSize; tileY <= y1 / TileSize; tileY++) {
+                for (int tileX = x0 / TileSize; tileX <= x1 / TileSize; tileX++) {
+                    int tileIndex = tileY * TilesX + tileX;
+                    // the whole tile is already closer than the triangle
+                    if (minZ >= tileMax[tileIndex])
+                        continue;
+                    float *tile = &depth[tileIndex * TileSize * TileSize];
+                    float baseX = tileX * TileSize + 0.5f, baseY = tileY * TileSize + 0.5f;
+                    if (simd)
+                        rasterizeTileSimd(tile, baseX, baseY, A, B, C, dzdx, dzdy, zc);
+                    else
+                        rasterizeTileScalar(tile, baseX, baseY, A, B, C, dzdx, dzdy, zc);
+                    updateTileMax(tileIndex);
+                }
+            }
+            return 1;
+        }
+
+        static void rasterizeTileScalar(float *tile, float baseX, float baseY, const float *A, const float *B,
+                                        const float *C, float dzdx, float dzdy, float zc) {
+            for (int py = 0; py < TileSize; py++) {
+                float y = baseY + py;
+                for (int px = 0; px < TileSize; px++) {
+                    float x = baseX + px;
+                    if (A[0] * x + B[0] * y + C[0] < 0.0f || A[1] * x + B[1] * y + C[1] < 0.0f ||
+                        A[2] * x + B[2] * y + C[2] < 0.0f)
+                        continue;
+                    float z = zc + dzdx * x + dzdy * y;
+                    float &stored = tile[py * TileSize + px];
+                    stored = std::min(stored, z);
+                }
+            }
+        }
+
+        static void rasterizeTileSimd(float *tile, float baseX, float baseY, const float *A, const float *B,
+                                      const float *C, float dzdx, float dzdy, float zc) {
+#if defined(__AVX2__)
+            const __m256 zero = _mm256_setzero_ps();
+            __m256 x = _mm256_add_ps(_mm256_set1_ps(baseX), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+            __m256 rowA0 = _mm256_mul_ps(_mm256_set1_ps(A[0]), x);
+            __m256 rowA1 = _mm256_mul_ps(_mm256_set1_ps(A[1]), x);
+            __m256 rowA2 = _mm256_mul_ps(_mm256_set1_ps(A[2]), x);
+            __m256 rowZ = _mm256_add_ps(_mm256_set1_ps(zc), _mm256_mul_ps(_mm256_set1_ps(dzdx), x));
+            for (int py = 0; py < TileSize; py++) {
+                float y = baseY + py;
+                __m256 e0 = _mm256_add_ps(rowA0, _mm256_set1_ps(B[0] * y + C[0]));
+                __m256 e1 = _mm256_add_ps(rowA1, _mm256_set1_ps(B[1] * y + C[1]));
+                __m256 e2 = _mm256_add_ps(rowA2, _mm256_set1_ps(B[2] * y + C[2]));
+                __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+                                                            _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+                                              _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+                if (_mm256_testz_ps(inside, inside))
+                    continue;
+                __m256 z = _mm256_add_ps(rowZ, _mm256_set1_ps(dzdy * y));
+                float *row = tile + py * TileSize;
+                __m256 stored = _mm256_loadu_ps(row);
+                _mm256_storeu_ps(row, _mm256_blendv_ps(stored, _mm256_min_ps(stored, z), inside));
+            }
+#elif defined(__SSE4_1__)
+            const __m128 zero = _mm_setzero_ps();
+            for (int half = 0; half < TileSize; half += 4) {
+                __m128 x = _mm_add_ps(_mm_set1_ps(baseX + half), _mm_setr_ps(0, 1, 2, 3));
+                __m128 rowA0 = _mm_mul_ps(_mm_set1_ps(A[0]), x);
+                __m128 rowA1 = _mm_mul_ps(_mm_set1_ps(A[1]), x);
+                __m128 rowA2 = _mm_mul_ps(_mm_set1_ps(A[2]), x);
+                __m128 rowZ = _mm_add_ps(_mm_set1_ps(zc), _mm_mul_ps(_mm_set1_ps(dzdx), x));
+                for (int py = 0; py < TileSize; py++) {
+                    float y = baseY + py;
+                    __m128 e0 = _mm_add_ps(rowA0, _mm_set1_ps(B[0] * y + C[0]));
+                    __m128 e1 = _mm_add_ps(rowA1, _mm_set1_ps(B[1] * y + C[1]));
+                    __m128 e2 = _mm_add_ps(rowA2, _mm_set1_ps(B[2] * y + C[2]));
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+                                               _mm_cmpge_ps(e2, zero));
+                    if (_mm_movemask_ps(inside) == 0)
+                        continue;
+                    __m128 z = _mm_add_ps(rowZ, _mm_set1_ps(dzdy * y));
+                    float *row = tile + py * TileSize + half;
+                    __m128 stored = _mm_loadu_ps(row);
+                    _mm_storeu_ps(row, _mm_blendv_ps(stored, _mm_min_ps(stored, z), inside));
+                }
+            }
+#else
+            rasterizeTileScalar(tile, baseX, baseY, A, B, C, dzdx, dzdy, zc);
+#endif
+        }
+
+        void updateTileMax(int tileIndex) {
+            const float *tile = &depth[tileIndex * TileSize * TileSize];
+#if defined(__SSE4_1__) || defined(__AVX2__)
+            __m128 farthest = _mm_loadu_ps(tile);
+            for (int i = 4; i < TileSize * TileSize; i += 4)
+                farthest = _mm_max_ps(farthest, _mm_loadu_ps(tile + i));
+            farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+            farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+            tileMax[tileIndex] = _mm_cvtss_f32(farthest);
+#else
+            tileMax[tileIndex] = *std::max_element(tile, tile + TileSize * TileSize);
+#endif
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_SOFTWAREOCCLUSION_H
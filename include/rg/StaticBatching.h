@@ -0,0 +1,236 @@
+#ifndef PROJECT_BASE_STATICBATCHING_H
+#define PROJECT_BASE_STATICBATCHING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace rg {
+
+    // Static props baked into world space. Update() transforms the meshes of every instance on the
+    // CPU and merges all geometry sharing a material into one mesh, so the batch draws with one call
+    // per material. Each instance mesh stays a MeshRange with its world bounds and Draw() leaves out
+    // the ranges the visibility test rejects, the meshlets of the instance meshes go along in world
+    // space.
+    // The models need their CPU geometry (GeometryPolicy::Keep), the batch keeps none of its own.
+    class StaticBatch {
+    public:
+        struct Instance {
+            const Model *model;
+            glm::mat4 transform;
+        };
+
+        std::vector<Mesh> meshes;
+
+        // rebuilds the batch when the instances or their transforms changed, true when it did
+        bool Update(const std::vector<Instance> &instances) {
+            if (sameInstances(instances))
+                return false;
+            built = instances;
+            build();
+            return true;
+        }
+
+        // visible(range) decides for every range, MeshRange::source is the index of its instance
+        template<typename Visible>
+        void Draw(Shader &shader, Visible &&visible) {
+            for (Mesh &mesh : meshes)
+                mesh.DrawRanges(shader, visible);
+        }
+
+        // choose(range) picks the level of detail of every visible range
+        template<typename Visible, typename Choose>
+        void Draw(Shader &shader, Visible &&visible, Choose &&choose) {
+            for (Mesh &mesh : meshes)
+                mesh.DrawRanges(shader, visible, choose);
+        }
+
+        // ranges at full detail are split into their world space meshlets, meshletVisible(range,
+        // meshlet) decides for each of them
+        template<typename Visible, typename Choose, typename MeshletVisible>
+        void Draw(Shader &shader, Visible &&visible, Choose &&choose, MeshletVisible &&meshletVisible) {
+            for (Mesh &mesh : meshes)
+                mesh.DrawRanges(shader, visible, choose, meshletVisible);
+        }
+
+        // draw calls the instances take when every mesh of them is drawn on its own
+        size_t SeparateDrawCount() const {
+            size_t count = 0;
+            for (const Instance &instance : built)
+                count += instance.model->meshes.size();
+            return count;
+        }
+
+        size_t RangeCount() const {
+            size_t count = 0;
+            for (const Mesh &mesh : meshes)
+                count += mesh.ranges.size();
+            return count;
+        }
+
+    private:
+        std::vector<Instance> built;
+
+        bool sameInstances(const std::vector<Instance> &instances) const {
+            if (instances.size() != built.size())
+                return false;
+            for (size_t i = 0; i < instances.size(); i++)
+                if (instances[i].model != built[i].model ||
+                    std::memcmp(&instances[i].transform[0][0], &built[i].transform[0][0], sizeof(glm::mat4)) != 0)
+                    return false;
+            return true;
+        }
+
+        // meshes with the same textures bound the same way draw with the same material
+        static bool sameMaterial(const Mesh &a, const Mesh &b) {
+            if (a.texturePool != b.texturePool || a.glslIdentifierPrefix != b.glslIdentifierPrefix ||
+                a.textures.size() != b.textures.size())
+                return false;
+            for (size_t i = 0; i < a.textures.size(); i++) {
+                const Texture &x = a.textures[i], &y = b.textures[i];
+                if (x.id != y.id || x.array != y.array || x.layer != y.layer || x.type != y.type)
+                    return false;
+            }
+            return true;
+        }
+
+        static glm::vec3 direction(const glm::vec3 &v) {
+            float length = glm::length(v);
+            return length > 0.0f ? v / length : v;
+        }
+
+        struct Part {
+            const Mesh *mesh;
+            int instance;
+        };
+
+        // the meshlets of a part in world space, their indices moved to the part's range. A cone
+        // only stays a cone under a uniform scale, other transforms keep the spheres.
+        static void addMeshlets(const Mesh &mesh, const glm::mat4 &transform, MeshRange &range,
+                                std::vector<geometry::Meshlet> &meshlets) {
+            glm::mat3 linear(transform);
+            glm::mat3 normalMatrix = glm::transpose(glm::inverse(linear));
+            float scales[3] = {glm::length(linear[0]), glm::length(linear[1]), glm::length(linear[2])};
+            float scale = std::max(std::max(scales[0], scales[1]), scales[2]);
+            bool uniform = scale - std::min(std::min(scales[0], scales[1]), scales[2]) <= 1e-3f * scale;
+            range.firstMeshlet = meshlets.size();
+            range.meshletCount = mesh.meshlets.size();
+            for (geometry::Meshlet meshlet : mesh.meshlets) {
+                meshlet.firstIndex += range.firstIndex;
+                meshlet.center = glm::vec3(transform * glm::vec4(meshlet.center, 1.0f));
+                meshlet.radius *= scale;
+                meshlet.coneApex = glm::vec3(transform * glm::vec4(meshlet.coneApex, 1.0f));
+                meshlet.coneAxis = direction(normalMatrix * meshlet.coneAxis);
+                if (!uniform)
+                    meshlet.coneCutoff = 2.0f;
+                meshlets.push_back(meshlet);
+            }
+        }
+
+        // appends the coarser levels of the parts behind the full ones, level by level so the
+        // ranges of one level still follow each other
+        static void addLods(const std::vector<Part> &parts, const std::vector<unsigned int> &baseVertices,
+                            std::vector<unsigned int> &indices, std::vector<MeshRange> &ranges) {
+            size_t levelCount = 0;
+            for (size_t i = 0; i < parts.size(); i++) {
+                const Mesh &mesh = *parts[i].mesh;
+                if (!mesh.lods.empty())
+                    ranges[i].lods.push_back(MeshLod{ranges[i].firstIndex, ranges[i].indexCount, 0.0f});
+                levelCount = std::max(levelCount, mesh.lods.size());
+            }
+            for (size_t level = 1; level < levelCount; level++)
+                for (size_t i = 0; i < parts.size(); i++) {
+                    const Mesh &mesh = *parts[i].mesh;
+                    if (level >= mesh.lods.size())
+                        continue;
+                    const MeshLod &lod = mesh.lods[level];
+                    ranges[i].lods.push_back(MeshLod{(unsigned int) indices.size(), lod.indexCount, lod.error});
+                    // the coarser levels sit behind the full mesh's indices in the element buffer
+                    const unsigned int *source = mesh.lodIndices.data() + (lod.firstIndex - mesh.indices.size());
+                    for (unsigned int k = 0; k < lod.indexCount; k++)
+                        indices.push_back(baseVertices[i] + source[k]);
+                }
+        }
+
+        void build() {
+            std::vector<std::vector<Part>> materials;
+            for (size_t instance = 0; instance < built.size(); instance++) {
+                const Model &model = *built[instance].model;
+                for (const Mesh &mesh : model.meshes) {
+                    if (!mesh.HasGeometry()) {
+                        std::cout << "StaticBatch: " << model.path << " released its geometry, left out" << std::endl;
+                        break;
+                    }
+                    size_t material = 0;
+                    while (material < materials.size() && !sameMaterial(*materials[material].front().mesh, mesh))
+                        material++;
+                    if (material == materials.size())
+                        materials.emplace_back();
+                    materials[material].push_back(Part{&mesh, (int) instance});
+                }
+            }
+
+            meshes.clear();
+            meshes.reserve(materials.size());
+            for (const std::vector<Part> &parts : materials) {
+                size_t vertexCount = 0, indexCount = 0;
+                for (const Part &part : parts) {
+                    vertexCount += part.mesh->vertices.size();
+                    indexCount += part.mesh->indices.size();
+                }
+                std::vector<Vertex> vertices;
+                std::vector<unsigned int> indices;
+                std::vector<MeshRange> ranges;
+                std::vector<unsigned int> baseVertices;
+                std::vector<geometry::Meshlet> meshlets;
+                vertices.reserve(vertexCount);
+                indices.reserve(indexCount);
+                for (const Part &part : parts) {
+                    const glm::mat4 &transform = built[part.instance].transform;
+                    glm::mat3 tangentMatrix(transform);
+                    glm::mat3 normalMatrix = glm::transpose(glm::inverse(tangentMatrix));
+                    MeshRange range;
+                    range.firstIndex = indices.size();
+                    range.indexCount = part.mesh->indices.size();
+                    range.source = part.instance;
+                    unsigned int baseVertex = vertices.size();
+                    baseVertices.push_back(baseVertex);
+                    for (const Vertex &source : part.mesh->vertices) {
+                        Vertex vertex = source;
+                        vertex.Position = glm::vec3(transform * glm::vec4(source.Position, 1.0f));
+                        vertex.Normal = direction(normalMatrix * source.Normal);
+                        vertex.Tangent = direction(tangentMatrix * source.Tangent);
+                        vertex.Bitangent = direction(tangentMatrix * source.Bitangent);
+                        range.bounds.Expand(vertex.Position);
+                        vertices.push_back(vertex);
+                    }
+                    for (unsigned int index : part.mesh->indices)
+                        indices.push_back(baseVertex + index);
+                    addMeshlets(*part.mesh, transform, range, meshlets);
+                    ranges.push_back(range);
+                }
+                addLods(parts, baseVertices, indices, ranges);
+
+                const Mesh &first = *parts.front().mesh;
+                meshes.emplace_back(std::move(vertices), std::move(indices), first.textures);
+                Mesh &mesh = meshes.back();
+                mesh.glslIdentifierPrefix = first.glslIdentifierPrefix;
+                mesh.texturePool = first.texturePool;
+                mesh.ranges = std::move(ranges);
+                mesh.meshlets = std::move(meshlets);
+                mesh.ReleaseGeometry();
+            }
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_STATICBATCHING_H
@@ -0,0 +1,280 @@
+#ifndef PROJECT_BASE_TEXTUREARRAYS_H
+#define PROJECT_BASE_TEXTUREARRAYS_H
+
+#include <glad/glad.h>
+
+#include <rg/GLHandle.h>
+#include <rg/GpuMemory.h>
+#include <rg/TextureCompression.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+    // Material textures of the same size, format and mip count packed into the layers of
+    // GL_TEXTURE_2D_ARRAYs. Textures are collected with Add(), Build() copies all their levels into
+    // the arrays and Find() tells where each one went. A draw then samples its array with a layer
+    // index instead of binding its own textures. Meshes whose materials share arrays need no
+    // rebinding between them, and Bind() skips arrays that are bound to the unit already, so the
+    // binds per frame come down to about one per array.
+    // The source textures stay untouched, their owners drop them once they switched to the layers.
+    // Textures are looked up by GL name and GL hands the names of dropped ones out again, so the
+    // pool listens to GpuMemory and forgets every source that goes away.
+    class TextureArrayPool {
+    public:
+        struct Layer {
+            GLuint array = 0;
+            int index = -1;
+
+            bool Valid() const {
+                return array != 0;
+            }
+        };
+
+        TextureArrayPool() {
+            releaseListener = GpuMemory::Instance().AddReleaseListener([this](GLuint texture) { forget(texture); });
+        }
+
+        ~TextureArrayPool() {
+            GpuMemory::Instance().RemoveReleaseListener(releaseListener);
+        }
+
+        TextureArrayPool(const TextureArrayPool &) = delete;
+        TextureArrayPool &operator=(const TextureArrayPool &) = delete;
+
+        // queues a texture with its whole mip chain, false for anything the arrays can't hold, such as
+        // textures that don't start at level 0 (streamed ones) or use an unknown format
+        bool Add(GLuint texture) {
+            if (queued.count(texture))
+                return true;
+            GLint previousTexture;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            GLint baseLevel = 0, maxLevel = 0, width = 0, height = 0, internalFormat = 0, compressed = 0;
+            glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &baseLevel);
+            glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+            glBindTexture(GL_TEXTURE_2D, previousTexture);
+
+            Shape shape;
+            shape.width = width;
+            shape.height = height;
+            shape.internalFormat = internalFormat;
+            shape.compressed = compressed != 0;
+            shape.levels = 1;
+            while (std::max(width >> shape.levels, height >> shape.levels) >= 1)
+                shape.levels++;
+            // glGenerateMipmap leaves MAX_LEVEL at its default of 1000
+            shape.levels = std::min(shape.levels, maxLevel + 1);
+            if (baseLevel != 0 || width == 0 || height == 0 || (!shape.compressed && pixelFormat(internalFormat) == 0))
+                return false;
+
+            size_t group = 0;
+            // arrays that are built already don't grow, late textures start new ones
+            while (group < groups.size() && (groups[group].array || !(groups[group].shape == shape)))
+                group++;
+            if (group == groups.size()) {
+                groups.emplace_back();
+                groups.back().shape = shape;
+            }
+            queued[texture] = group;
+            groups[group].textures.push_back(texture);
+            return true;
+        }
+
+        // creates the arrays of the queued textures and copies every level of them over
+        void Build() {
+            GLint previousTexture, previousArray, previousPack, previousUnpack;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+            glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &previousArray);
+            glGetIntegerv(GL_PACK_ALIGNMENT, &previousPack);
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousUnpack);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+            std::vector<unsigned char> pixels;
+            for (Group &group : groups) {
+                if (group.array || group.textures.empty())
+                    continue;
+                const Shape &shape = group.shape;
+                GLsizei layerCount = group.textures.size();
+                group.array = GLTexture::Create();
+                glBindTexture(GL_TEXTURE_2D_ARRAY, group.array.Get());
+                group.bytes = 0;
+                for (int level = 0; level < shape.levels; level++) {
+                    int width = std::max(1, shape.width >> level), height = std::max(1, shape.height >> level);
+                    size_t layerBytes = levelBytes(shape, width, height);
+                    if (shape.compressed)
+                        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, shape.internalFormat, width, height, layerCount,
+                                               0, layerBytes * layerCount, nullptr);
+                    else
+                        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, shape.internalFormat, width, height, layerCount, 0,
+                                     pixelFormat(shape.internalFormat), GL_UNSIGNED_BYTE, nullptr);
+                    group.bytes += levelBytes(shape, width, height, true) * layerCount;
+
+                    pixels.resize(layerBytes);
+                    for (GLsizei layer = 0; layer < layerCount; layer++) {
+                        glBindTexture(GL_TEXTURE_2D, group.textures[layer]);
+                        if (shape.compressed) {
+                            glGetCompressedTexImage(GL_TEXTURE_2D, level, pixels.data());
+                            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1,
+                                                      shape.internalFormat, layerBytes, pixels.data());
+                        } else {
+                            GLenum format = pixelFormat(shape.internalFormat);
+                            glGetTexImage(GL_TEXTURE_2D, level, format, GL_UNSIGNED_BYTE, pixels.data());
+                            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format,
+                                            GL_UNSIGNED_BYTE, pixels.data());
+                        }
+                    }
+                }
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, shape.levels - 1);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                GpuMemory::Instance().TrackTexture(group.array.Get(), GpuMemory::MaterialTexture, group.bytes);
+                for (GLsizei layer = 0; layer < layerCount; layer++) {
+                    Layer &found = layers[group.textures[layer]];
+                    found.array = group.array.Get();
+                    found.index = layer;
+                }
+            }
+
+            glPixelStorei(GL_PACK_ALIGNMENT, previousPack);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, previousUnpack);
+            glBindTexture(GL_TEXTURE_2D, previousTexture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, previousArray);
+            boundArrays.clear();
+        }
+
+        // where a texture went, invalid when it wasn't added or the pool isn't built yet
+        Layer Find(GLuint texture) const {
+            auto found = layers.find(texture);
+            return found == layers.end() ? Layer() : found->second;
+        }
+
+        // binds an array to a texture unit unless it's bound there already, leaves the unit active
+        void Bind(GLuint unit, GLuint array) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            if (unit < boundArrays.size() && boundArrays[unit] == array) {
+                skipped++;
+                return;
+            }
+            if (unit >= boundArrays.size())
+                boundArrays.resize(unit + 1, 0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+            boundArrays[unit] = array;
+            binds++;
+        }
+
+        // call once per frame, keeps the bind counts of the finished frame
+        void EndFrame() {
+            bindsLastFrame = binds;
+            skippedLastFrame = skipped;
+            binds = skipped = 0;
+        }
+
+        size_t ArrayCount() const {
+            size_t count = 0;
+            for (const Group &group : groups)
+                count += group.array ? 1 : 0;
+            return count;
+        }
+
+        size_t LayerCount() const {
+            size_t count = 0;
+            for (const Group &group : groups)
+                count += group.array ? group.textures.size() : 0;
+            return count;
+        }
+
+        size_t Bytes() const {
+            size_t bytes = 0;
+            for (const Group &group : groups)
+                bytes += group.bytes;
+            return bytes;
+        }
+
+        size_t BindsLastFrame() const {
+            return bindsLastFrame;
+        }
+
+        size_t SkippedBindsLastFrame() const {
+            return skippedLastFrame;
+        }
+
+    private:
+        struct Shape {
+            int width = 0, height = 0, levels = 0;
+            GLenum internalFormat = 0;
+            bool compressed = false;
+
+            bool operator==(const Shape &other) const {
+                return width == other.width && height == other.height && levels == other.levels &&
+                       internalFormat == other.internalFormat && compressed == other.compressed;
+            }
+        };
+
+        struct Group {
+            Shape shape;
+            std::vector<GLuint> textures;
+            GLTexture array;
+            size_t bytes = 0;
+        };
+
+        std::vector<Group> groups;
+        std::unordered_map<GLuint, size_t> queued;
+        std::unordered_map<GLuint, Layer> layers;
+        // array bound to each unit by Bind()
+        std::vector<GLuint> boundArrays;
+        int releaseListener = -1;
+        size_t binds = 0, skipped = 0, bindsLastFrame = 0, skippedLastFrame = 0;
+
+        // a source texture went away: a queued one isn't copied, a built one's name no longer finds
+        // its layer
+        void forget(GLuint texture) {
+            layers.erase(texture);
+            auto found = queued.find(texture);
+            if (found == queued.end())
+                return;
+            Group &group = groups[found->second];
+            if (!group.array)
+                group.textures.erase(std::remove(group.textures.begin(), group.textures.end(), texture), group.textures.end());
+            queued.erase(found);
+        }
+
+        // pixel format the 8 bit levels are copied in, 0 when the pool doesn't handle the format
+        static GLenum pixelFormat(GLenum internalFormat) {
+            switch (internalFormat) {
+                case GL_RED: case GL_R8:
+                    return GL_RED;
+                case GL_RG: case GL_RG8:
+                    return GL_RG;
+                case GL_RGB: case GL_RGB8: case GL_SRGB8:
+                    return GL_RGB;
+                case GL_RGBA: case GL_RGBA8: case GL_SRGB8_ALPHA8:
+                    return GL_RGBA;
+                default:
+                    return 0;
+            }
+        }
+
+        // padded counts RGB texels as four bytes, the way GpuMemory does
+        static size_t levelBytes(const Shape &shape, int width, int height, bool padded = false) {
+            if (shape.compressed)
+                return texture::LevelBytes(shape.internalFormat, width, height);
+            GLenum format = pixelFormat(shape.internalFormat);
+            int channels = format == GL_RED ? 1 : (format == GL_RG ? 2 : (format == GL_RGB ? (padded ? 4 : 3) : 4));
+            return (size_t) width * height * channels;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_TEXTUREARRAYS_H
@@ -0,0 +1,494 @@
+#ifndef PROJECT_BASE_TEXTURECOMPRESSION_H
+#define PROJECT_BASE_TEXTURECOMPRESSION_H
+
+#include <glad/glad.h>
+
+#include <rg/MipGeneration.h>
+#include <rg/ThreadPool.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// S3TC is an extension to the bundled 3.3 core loader, RGTC is core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Block compressed material textures. Textures are converted offline (`project_base
+// --compress-textures`) into KTX 1.1 files under resources/cache with the whole mip chain baked
+// in, and uploaded as they are with glCompressedTexImage2D afterwards:
+//   BC1 (DXT1)  RGB and opaque RGBA,  8 bytes per 4x4 block
+//   BC3 (DXT5)  RGBA,                16 bytes per 4x4 block
+//   BC4 (RGTC1) single channel,       8 bytes per 4x4 block
+//   BC5 (RGTC2) normal maps as XY,   16 bytes per 4x4 block, Z is rebuilt in the shader
+// The encoders fit the endpoints along the principal axis of the block's colors and refine them
+// by least squares, good enough for game textures without being a production compressor.
+namespace rg {
+namespace texture {
+
+    struct CompressedImage {
+        GLenum internalFormat = 0;
+        GLenum baseFormat = 0;
+        int width = 0, height = 0;
+        // level 0 first, down to 1x1
+        std::vector<std::vector<unsigned char>> levels;
+
+        size_t Bytes() const {
+            size_t bytes = 0;
+            for (const std::vector<unsigned char> &level : levels)
+                bytes += level.size();
+            return bytes;
+        }
+
+        // drops the largest levels, the image starts at the next smaller one
+        void DropLevels(int count) {
+            count = std::min(count, (int) levels.size() - 1);
+            if (count <= 0)
+                return;
+            levels.erase(levels.begin(), levels.begin() + count);
+            width = std::max(1, width >> count);
+            height = std::max(1, height >> count);
+        }
+    };
+
+    // the converter writes the cache files while the scene loads
+    inline bool &CompressOnLoad() {
+        static bool enabled = false;
+        return enabled;
+    }
+
+    inline size_t BlockBytes(GLenum internalFormat) {
+        return internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+    }
+
+    inline size_t LevelBytes(GLenum internalFormat, int width, int height) {
+        return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(internalFormat);
+    }
+
+    // whether the context can sample the format, S3TC needs the extension
+    inline bool Supported(GLenum internalFormat) {
+        if (internalFormat == GL_COMPRESSED_RED_RGTC1 || internalFormat == GL_COMPRESSED_RG_RGTC2)
+            return true;
+        static int s3tc = -1;
+        if (s3tc < 0) {
+            s3tc = 0;
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++) {
+                const char *extension = (const char *) glGetStringi(GL_EXTENSIONS, i);
+                if (extension && strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0)
+                    s3tc = 1;
+            }
+        }
+        return s3tc == 1;
+    }
+
+    namespace detail {
+
+        inline uint16_t pack565(const float color[3]) {
+            int r = std::min(31, std::max(0, (int) std::lround(color[0] * 31.0f / 255.0f)));
+            int g = std::min(63, std::max(0, (int) std::lround(color[1] * 63.0f / 255.0f)));
+            int b = std::min(31, std::max(0, (int) std::lround(color[2] * 31.0f / 255.0f)));
+            return (uint16_t) (r << 11 | g << 5 | b);
+        }
+
+        inline void unpack565(uint16_t packed, int color[3]) {
+            int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+            color[0] = r << 3 | r >> 2;
+            color[1] = g << 2 | g >> 4;
+            color[2] = b << 3 | b >> 2;
+        }
+
+        // the four colors of a block in four color mode
+        inline void palette(uint16_t c0, uint16_t c1, int colors[4][3]) {
+            unpack565(c0, colors[0]);
+            unpack565(c1, colors[1]);
+            for (int k = 0; k < 3; k++) {
+                colors[2][k] = (2 * colors[0][k] + colors[1][k]) / 3;
+                colors[3][k] = (colors[0][k] + 2 * colors[1][k]) / 3;
+            }
+        }
+
+        // picks the closest palette entry for every pixel, returns the indices and the squared error
+        inline uint32_t assignColors(const unsigned char rgba[64], uint16_t c0, uint16_t c1, int &error) {
+            int colors[4][3];
+            palette(c0, c1, colors);
+            uint32_t indices = 0;
+            error = 0;
+            for (int i = 0; i < 16; i++) {
+                int best = 0, bestDistance = INT32_MAX;
+                for (int j = 0; j < 4; j++) {
+                    int dr = rgba[4 * i] - colors[j][0], dg = rgba[4 * i + 1] - colors[j][1], db = rgba[4 * i + 2] - colors[j][2];
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = j;
+                    }
+                }
+                indices |= (uint32_t) best << (2 * i);
+                error += bestDistance;
+            }
+            return indices;
+        }
+
+        // endpoints and indices into a block, c0 > c1 selects the four color mode
+        inline void writeColorBlock(uint16_t c0, uint16_t c1, uint32_t indices, unsigned char out[8]) {
+            if (c0 < c1) {
+                std::swap(c0, c1);
+                // index 0 <-> 1 and 2 <-> 3
+                indices ^= 0x55555555u;
+            } else if (c0 == c1) {
+                indices = 0;
+            }
+            out[0] = c0 & 0xFF;
+            out[1] = c0 >> 8;
+            out[2] = c1 & 0xFF;
+            out[3] = c1 >> 8;
+            for (int i = 0; i < 4; i++)
+                out[4 + i] = (indices >> (8 * i)) & 0xFF;
+        }
+
+        // endpoints solving the least squares fit of the colors to their current palette positions
+        inline bool refineEndpoints(const unsigned char rgba[64], uint32_t indices, float end0[3], float end1[3]) {
+            static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {0.0f, 0.0f, 0.0f}, bx[3] = {0.0f, 0.0f, 0.0f};
+            for (int i = 0; i < 16; i++) {
+                float a = weights[(indices >> (2 * i)) & 3], b = 1.0f - a;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int k = 0; k < 3; k++) {
+                    ax[k] += a * rgba[4 * i + k];
+                    bx[k] += b * rgba[4 * i + k];
+                }
+            }
+            float determinant = aa * bb - ab * ab;
+            if (std::fabs(determinant) < 1e-6f)
+                return false;
+            for (int k = 0; k < 3; k++) {
+                end0[k] = std::min(255.0f, std::max(0.0f, (bb * ax[k] - ab * bx[k]) / determinant));
+                end1[k] = std::min(255.0f, std::max(0.0f, (aa * bx[k] - ab * ax[k]) / determinant));
+            }
+            return true;
+        }
+
+    };
+
+    // BC1 block from 4x4 RGBA8 pixels, alpha is ignored
+    inline void EncodeColorBlock(const unsigned char rgba[64], unsigned char out[8]) {
+        float mean[3] = {0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++)
+            for (int k = 0; k < 3; k++)
+                mean[k] += rgba[4 * i + k] / 16.0f;
+        float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++) {
+            float r = rgba[4 * i] - mean[0], g = rgba[4 * i + 1] - mean[1], b = rgba[4 * i + 2] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+        // principal axis by power iteration
+        float axis[3] = {1.0f, 1.0f, 1.0f};
+        for (int iteration = 0; iteration < 6; iteration++) {
+            float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            float length = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+            if (length < 1e-6f)
+                break;
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+        float minimum = FLT_MAX, maximum = -FLT_MAX;
+        for (int i = 0; i < 16; i++) {
+            float t = (rgba[4 * i] - mean[0]) * axis[0] + (rgba[4 * i + 1] - mean[1]) * axis[1] + (rgba[4 * i + 2] - mean[2]) * axis[2];
+            minimum = std::min(minimum, t);
+            maximum = std::max(maximum, t);
+        }
+        float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float end0[3], end1[3];
+        for (int k = 0; k < 3; k++) {
+            float along = lengthSquared > 0.0f ? axis[k] / lengthSquared : 0.0f;
+            end0[k] = std::min(255.0f, std::max(0.0f, mean[k] + maximum * along));
+            end1[k] = std::min(255.0f, std::max(0.0f, mean[k] + minimum * along));
+        }
+
+        uint16_t c0 = detail::pack565(end0), c1 = detail::pack565(end1);
+        int error;
+        uint32_t indices = detail::assignColors(rgba, c0, c1, error);
+        if (c0 != c1 && detail::refineEndpoints(rgba, indices, end0, end1)) {
+            uint16_t refined0 = detail::pack565(end0), refined1 = detail::pack565(end1);
+            int refinedError;
+            uint32_t refinedIndices = detail::assignColors(rgba, refined0, refined1, refinedError);
+            if (refinedError < error) {
+                c0 = refined0;
+                c1 = refined1;
+                indices = refinedIndices;
+            }
+        }
+        detail::writeColorBlock(c0, c1, indices, out);
+    }
+
+    // BC4 block from 16 values of a channel, `stride` bytes apart
+    inline void EncodeChannelBlock(const unsigned char *values, int stride, unsigned char out[8]) {
+        int minimum = 255, maximum = 0;
+        for (int i = 0; i < 16; i++) {
+            minimum = std::min(minimum, (int) values[i * stride]);
+            maximum = std::max(maximum, (int) values[i * stride]);
+        }
+        // eight value mode: the endpoints and six steps between them
+        int palette[8] = {maximum, minimum};
+        for (int j = 2; j < 8; j++)
+            palette[j] = ((8 - j) * maximum + (j - 1) * minimum) / 7;
+        uint64_t indices = 0;
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            for (int j = 1; j < 8; j++)
+                if (std::abs(values[i * stride] - palette[j]) < std::abs(values[i * stride] - palette[best]))
+                    best = j;
+            indices |= (uint64_t) best << (3 * i);
+        }
+        out[0] = (unsigned char) maximum;
+        out[1] = (unsigned char) minimum;
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (indices >> (8 * i)) & 0xFF;
+    }
+
+    inline void DecodeColorBlock(const unsigned char block[8], unsigned char rgba[64]) {
+        uint16_t c0 = block[0] | block[1] << 8, c1 = block[2] | block[3] << 8;
+        uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t) block[7] << 24;
+        int colors[4][3];
+        detail::palette(c0, c1, colors);
+        if (c0 <= c1)
+            for (int k = 0; k < 3; k++) {
+                colors[2][k] = (colors[0][k] + colors[1][k]) / 2;
+                colors[3][k] = 0;
+            }
+        for (int i = 0; i < 16; i++) {
+            const int *color = colors[(indices >> (2 * i)) & 3];
+            rgba[4 * i] = color[0];
+            rgba[4 * i + 1] = color[1];
+            rgba[4 * i + 2] = color[2];
+            rgba[4 * i + 3] = 255;
+        }
+    }
+
+    inline void DecodeChannelBlock(const unsigned char block[8], unsigned char *values, int stride) {
+        int e0 = block[0], e1 = block[1];
+        int palette[8] = {e0, e1};
+        for (int j = 2; j < 8; j++)
+            palette[j] = e0 > e1 ? ((8 - j) * e0 + (j - 1) * e1) / 7 : (j < 6 ? ((6 - j) * e0 + (j - 1) * e1) / 5 : (j == 6 ? 0 : 255));
+        uint64_t indices = 0;
+        for (int i = 0; i < 6; i++)
+            indices |= (uint64_t) block[2 + i] << (8 * i);
+        for (int i = 0; i < 16; i++)
+            values[i * stride] = palette[(indices >> (3 * i)) & 7];
+    }
+
+    namespace detail {
+
+        inline std::vector<unsigned char> encodeLevel(const std::vector<unsigned char> &pixels, int width, int height,
+                                                      int channels, GLenum internalFormat, ThreadPool &pool) {
+            int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+            size_t blockBytes = BlockBytes(internalFormat);
+            std::vector<unsigned char> level((size_t) blocksX * blocksY * blockBytes);
+            pool.ParallelFor(blocksY, [&](size_t by) {
+                unsigned char block[64];
+                for (int bx = 0; bx < blocksX; bx++) {
+                    // edge blocks repeat the last row and column, gray images fill RGB, missing alpha is opaque
+                    for (int i = 0; i < 16; i++) {
+                        int x = std::min(bx * 4 + i % 4, width - 1), y = std::min((int) by * 4 + i / 4, height - 1);
+                        const unsigned char *texel = &pixels[((size_t) y * width + x) * channels];
+                        for (int k = 0; k < 4; k++)
+                            block[4 * i + k] = k < channels ? texel[k] : (k == 3 ? 255 : texel[0]);
+                    }
+                    unsigned char *out = &level[((size_t) by * blocksX + bx) * blockBytes];
+                    if (internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                        EncodeColorBlock(block, out);
+                    } else if (internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+                        EncodeChannelBlock(block + 3, 4, out);
+                        EncodeColorBlock(block, out + 8);
+                    } else if (internalFormat == GL_COMPRESSED_RED_RGTC1) {
+                        EncodeChannelBlock(block, 4, out);
+                    } else {
+                        EncodeChannelBlock(block, 4, out);
+                        EncodeChannelBlock(block + 1, 4, out + 8);
+                    }
+                }
+            });
+            return level;
+        }
+
+    };
+
+    // compresses an 8 bit image with 1 to 4 channels, the format follows from the channels and usage
+    inline CompressedImage Compress(const unsigned char *pixels, int width, int height, int channels, Usage usage,
+                                    ThreadPool &pool = ThreadPool::Shared()) {
+        bool opaque = true;
+        if (channels == 4)
+            for (size_t i = 0; i < (size_t) width * height && opaque; i++)
+                opaque = pixels[4 * i + 3] == 255;
+
+        CompressedImage image;
+        image.width = width;
+        image.height = height;
+        if (usage == Usage::NormalMap) {
+            image.internalFormat = GL_COMPRESSED_RG_RGTC2;
+            image.baseFormat = GL_RG;
+        } else if (channels == 1) {
+            image.internalFormat = GL_COMPRESSED_RED_RGTC1;
+            image.baseFormat = GL_RED;
+        } else if (channels == 3 || opaque) {
+            image.internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            image.baseFormat = GL_RGB;
+        } else {
+            image.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            image.baseFormat = GL_RGBA;
+        }
+
+        std::vector<unsigned char> level(pixels, pixels + (size_t) width * height * channels);
+        while (true) {
+            image.levels.push_back(detail::encodeLevel(level, width, height, channels, image.internalFormat, pool));
+            if (width == 1 && height == 1)
+                break;
+            level = Downsample(level.data(), width, height, channels, usage, pool);
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return image;
+    }
+
+    // RGBA8 pixels of a compressed level, for comparing against the source
+    inline std::vector<unsigned char> Decompress(const CompressedImage &image, int level) {
+        int width = std::max(1, image.width >> level), height = std::max(1, image.height >> level);
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        size_t blockBytes = BlockBytes(image.internalFormat);
+        std::vector<unsigned char> rgba((size_t) width * height * 4);
+        unsigned char block[64];
+        for (int by = 0; by < blocksY; by++)
+            for (int bx = 0; bx < blocksX; bx++) {
+                const unsigned char *in = &image.levels[level][((size_t) by * blocksX + bx) * blockBytes];
+                memset(block, 0, sizeof(block));
+                if (image.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                    DecodeColorBlock(in, block);
+                } else if (image.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+                    DecodeColorBlock(in + 8, block);
+                    DecodeChannelBlock(in, block + 3, 4);
+                } else if (image.internalFormat == GL_COMPRESSED_RED_RGTC1) {
+                    DecodeChannelBlock(in, block, 4);
+                } else {
+                    DecodeChannelBlock(in, block, 4);
+                    DecodeChannelBlock(in + 8, block + 1, 4);
+                }
+                for (int i = 0; i < 16; i++) {
+                    int x = bx * 4 + i % 4, y = by * 4 + i / 4;
+                    if (x < width && y < height)
+                        memcpy(&rgba[((size_t) y * width + x) * 4], block + 4 * i, 4);
+                }
+            }
+        return rgba;
+    }
+
+    // KTX 1.1 file with the source hash in the key/value data, other tools can open these
+    inline bool WriteKtx(const std::string &path, const CompressedImage &image, uint64_t sourceHash) {
+        static const unsigned char identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+        static const char key[] = "rg.sourceHash";
+        uint32_t keyValueSize = sizeof(key) + sizeof(sourceHash);
+        uint32_t keyValuePadding = (4 - keyValueSize % 4) % 4;
+        uint32_t header[13] = {0x04030201, 0, 1, 0, image.internalFormat, image.baseFormat, (uint32_t) image.width,
+                               (uint32_t) image.height, 0, 0, 1, (uint32_t) image.levels.size(),
+                               4 + keyValueSize + keyValuePadding};
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char *) identifier, sizeof(identifier));
+        out.write((const char *) header, sizeof(header));
+        out.write((const char *) &keyValueSize, sizeof(keyValueSize));
+        out.write(key, sizeof(key));
+        out.write((const char *) &sourceHash, sizeof(sourceHash));
+        out.write("\0\0\0", keyValuePadding);
+        for (const std::vector<unsigned char> &level : image.levels) {
+            // blocks are 8 or 16 bytes, no mip padding needed
+            uint32_t size = level.size();
+            out.write((const char *) &size, sizeof(size));
+            out.write((const char *) level.data(), size);
+        }
+        return (bool) out;
+    }
+
+    // reads a file written by WriteKtx(), false when it's missing, damaged or built from another source
+    inline bool ReadKtx(const std::string &path, uint64_t sourceHash, CompressedImage &image) {
+        static const unsigned char identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+        static const char key[] = "rg.sourceHash";
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        unsigned char fileIdentifier[12];
+        uint32_t header[13];
+        in.read((char *) fileIdentifier, sizeof(fileIdentifier));
+        in.read((char *) header, sizeof(header));
+        if (!in || memcmp(identifier, fileIdentifier, sizeof(identifier)) != 0 || header[0] != 0x04030201)
+            return false;
+        GLenum internalFormat = header[4];
+        if (internalFormat != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && internalFormat != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT &&
+            internalFormat != GL_COMPRESSED_RED_RGTC1 && internalFormat != GL_COMPRESSED_RG_RGTC2)
+            return false;
+        if (header[6] == 0 || header[6] > 16384 || header[7] == 0 || header[7] > 16384 || header[10] != 1 || header[11] == 0)
+            return false;
+        // no more levels than the full chain has, and no key/values beyond what WriteKtx() puts there,
+        // before anything is allocated from them
+        uint32_t maxLevels = 1;
+        while ((std::max(header[6], header[7]) >> maxLevels) > 0)
+            maxLevels++;
+        if (header[11] > maxLevels || header[12] > 256)
+            return false;
+
+        std::vector<char> keyValues(header[12]);
+        in.read(keyValues.data(), keyValues.size());
+        uint64_t fileHash = 0;
+        if (!in || keyValues.size() < 4 + sizeof(key) + sizeof(fileHash) || memcmp(&keyValues[4], key, sizeof(key)) != 0)
+            return false;
+        memcpy(&fileHash, &keyValues[4 + sizeof(key)], sizeof(fileHash));
+        if (fileHash != sourceHash)
+            return false;
+
+        image.internalFormat = internalFormat;
+        image.baseFormat = header[5];
+        image.width = header[6];
+        image.height = header[7];
+        image.levels.resize(header[11]);
+        for (uint32_t level = 0; level < header[11]; level++) {
+            uint32_t size = 0;
+            in.read((char *) &size, sizeof(size));
+            if (!in || size != LevelBytes(internalFormat, std::max(1, image.width >> level), std::max(1, image.height >> level)))
+                return false;
+            image.levels[level].resize(size);
+            in.read((char *) image.levels[level].data(), size);
+        }
+        return (bool) in;
+    }
+
+    // uploads every level to the texture bound to GL_TEXTURE_2D
+    inline void Upload(const CompressedImage &image) {
+        for (size_t level = 0; level < image.levels.size(); level++)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, image.internalFormat, std::max(1, image.width >> level),
+                                   std::max(1, image.height >> level), 0, image.levels[level].size(),
+                                   image.levels[level].data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels.size() - 1);
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_TEXTURECOMPRESSION_H
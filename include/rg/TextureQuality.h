@@ -0,0 +1,69 @@
+#ifndef PROJECT_BASE_TEXTUREQUALITY_H
+#define PROJECT_BASE_TEXTUREQUALITY_H
+
+#include <rg/MipGeneration.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Global texture resolution tier, applied while textures are loaded. Lower tiers halve the
+// resolution once or twice: decoded images are downsampled on the CPU before the upload and
+// precompressed ones skip their largest mip levels, so decoding, upload and GPU memory all shrink.
+// Small textures are left alone.
+namespace rg {
+namespace texture {
+
+    enum class Quality {
+        Full,
+        Half,
+        Quarter
+    };
+
+    // textures aren't reduced below this many texels on their smaller side
+    static const int MinReducedSize = 64;
+
+    inline Quality &GlobalQuality() {
+        static Quality quality = Quality::Full;
+        return quality;
+    }
+
+    inline const char *QualityName(Quality quality) {
+        static const char *names[] = {"full", "half", "quarter"};
+        return names[(int) quality];
+    }
+
+    // "full", "half" or "quarter", false for anything else
+    inline bool ParseQuality(const char *name, Quality &quality) {
+        for (int i = 0; i <= (int) Quality::Quarter; i++)
+            if (strcmp(name, QualityName((Quality) i)) == 0) {
+                quality = (Quality) i;
+                return true;
+            }
+        return false;
+    }
+
+    // how many times a texture of this size is halved at the global quality
+    inline int LevelsToSkip(int width, int height) {
+        int skip = 0;
+        while (skip < (int) GlobalQuality() && std::min(width >> skip, height >> skip) / 2 >= MinReducedSize)
+            skip++;
+        return skip;
+    }
+
+    // the decoded image at the global quality, empty when it stays at full resolution
+    inline std::vector<unsigned char> Reduce(const unsigned char *pixels, int &width, int &height, int channels,
+                                             Usage usage) {
+        std::vector<unsigned char> reduced;
+        for (int skip = LevelsToSkip(width, height); skip > 0; skip--) {
+            reduced = Downsample(reduced.empty() ? pixels : reduced.data(), width, height, channels, usage);
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return reduced;
+    }
+
+};
+};
+
+#endif //PROJECT_BASE_TEXTUREQUALITY_H
@@ -0,0 +1,510 @@
+#ifndef PROJECT_BASE_TEXTURESTREAMING_H
+#define PROJECT_BASE_TEXTURESTREAMING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include <rg/Bounds.h>
+#include <rg/GpuMemory.h>
+#include <rg/MipGeneration.h>
+#include <rg/TextureCompression.h>
+#include <rg/ThreadPool.h>
+
+#include "imgui.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+    // Streams the large mip levels of material textures in on demand. A streamed texture starts
+    // out with only its levels of at most ResidentSize texels, those stay for its whole life. Every
+    // frame the renderer reports how big the objects using it appear on screen with Request(), and
+    // Update() turns that into the finest level the texture needs. Missing levels are produced on a
+    // background thread, decoded from the source image or read from its compressed cache file, and
+    // uploaded coarse to fine within a per-frame byte budget. GL_TEXTURE_BASE_LEVEL keeps sampling
+    // within the levels that are there.
+    // The streamed levels share a residency pool. Levels nobody asked for lately are freed first,
+    // and while the pool is full of needed ones new levels wait, so a scene with more texture data
+    // than memory gets blurrier instead of running out.
+    class TextureStreamer {
+    public:
+        // where the levels of a texture come from, the source is read again for every load
+        struct Source {
+            std::string path;
+            texture::Usage usage = texture::Usage::Color;
+            // compressed cache file and the source hash it has to match, empty when the image is decoded
+            std::string compressedPath;
+            uint64_t sourceHash = 0;
+            // times the source is halved for the quality tier
+            int skip = 0;
+        };
+
+        // levels of at most this many texels on their larger side are loaded up front and never freed
+        static const int ResidentSize = 64;
+
+        // textures loaded from now on stream
+        bool enabled = true;
+        int poolMB = 256;
+        int uploadBudgetKB = 4096;
+        int maxLoadsInFlight = 4;
+        // added to the mip level each texture asks for, positive values trade sharpness for memory
+        float lodBias = 0.0f;
+
+        static TextureStreamer &Instance() {
+            static TextureStreamer streamer;
+            return streamer;
+        }
+
+        ~TextureStreamer() {
+            GpuMemory::Instance().RemoveReleaseListener(releaseListener);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+
+        TextureStreamer(const TextureStreamer &) = delete;
+        TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+        // takes over a bound texture whose compressed mip chain is in memory, only the small levels are uploaded
+        void Add(GLuint texture, const Source &source, const texture::CompressedImage &image) {
+            Entry &entry = add(texture, source, image.width, image.height);
+            entry.compressedFormat = image.internalFormat;
+            for (int level = entry.lowTop; level < entry.levels && level < (int) image.levels.size(); level++)
+                upload(entry, level, image.levels[level]);
+            finishAdd(texture, entry);
+        }
+
+        // the same for a decoded 8 bit image, already at the quality tier
+        void Add(GLuint texture, const Source &source, const unsigned char *pixels, int width, int height, int channels) {
+            Entry &entry = add(texture, source, width, height);
+            entry.channels = channels;
+            entry.format = channels == 1 ? GL_RED : (channels == 2 ? GL_RG : (channels == 3 ? GL_RGB : GL_RGBA));
+            std::vector<unsigned char> level = std::vector<unsigned char>(pixels, pixels + (size_t) width * height * channels);
+            for (int i = 0; i < entry.levels; i++) {
+                if (i >= entry.lowTop)
+                    upload(entry, i, level);
+                if (i + 1 < entry.levels)
+                    level = Downsample(level.data(), levelWidth(entry, i), levelHeight(entry, i), channels, source.usage);
+            }
+            finishAdd(texture, entry);
+        }
+
+        bool IsStreamed(GLuint texture) const {
+            return entries.count(texture) > 0;
+        }
+
+        // height in pixels an object with these bounds covers on screen, FLT_MAX when the eye is inside
+        static float ScreenPixels(const AABB &bounds, const glm::vec3 &eye, float fovYDegrees, int screenHeight) {
+            if (bounds.IsEmpty())
+                return 0.0f;
+            float radius = glm::length(bounds.Extent());
+            float distance = glm::length(bounds.Center() - eye);
+            if (distance <= radius)
+                return FLT_MAX;
+            return radius / (distance * std::tan(glm::radians(fovYDegrees) * 0.5f)) * screenHeight;
+        }
+
+        // asks for the levels a texture needs when it spans this many pixels, the largest request of a frame counts
+        void Request(GLuint texture, float screenPixels) {
+            auto found = entries.find(texture);
+            if (found == entries.end())
+                return;
+            Entry &entry = found->second;
+            int level = entry.lowTop;
+            if (screenPixels > 0.0f) {
+                float texels = (float) std::max(entry.width, entry.height);
+                level = (int) std::floor(std::log2(std::max(texels / screenPixels, 1.0f)) + lodBias);
+                level = std::max(0, std::min(level, entry.lowTop));
+            }
+            if (entry.requestFrame != frame || level < entry.requestedTop)
+                entry.requestedTop = level;
+            entry.requestFrame = frame;
+        }
+
+        // starts loads for this frame's requests, uploads finished levels and keeps the pool within
+        // its size, call once per frame on the GL thread after the requests
+        void Update() {
+            for (auto &item : entries) {
+                Entry &entry = item.second;
+                bool requested = entry.requestFrame == frame;
+                entry.wantedTop = requested ? entry.requestedTop : entry.lowTop;
+                if (requested)
+                    entry.lastUse = frame;
+            }
+            scheduleLoads();
+            uploadFinished();
+            // the pool may have been shrunk, only levels nobody wants are freed before the wanted ones
+            while (residentBytes > poolBytes() && (evictOne(false) || evictOne(true))) {
+            }
+            frame++;
+        }
+
+        // whether every texture has the levels requested last frame, or gave up loading them
+        bool Settled() const {
+            for (const auto &item : entries) {
+                const Entry &entry = item.second;
+                if (entry.loading || (!entry.failed && entry.residentTop > entry.wantedTop))
+                    return false;
+            }
+            return true;
+        }
+
+        // streamed textures with every level they have, the small ones included
+        size_t ResidentBytes() const {
+            return residentBytes;
+        }
+
+        size_t Count() const {
+            return entries.size();
+        }
+
+        void DrawImGui() {
+            ImGui::Begin("Texture streaming");
+            ImGui::Text("Streamed textures: %zu%s", entries.size(), enabled ? "" : " (off for new textures)");
+            ImGui::Text("Resident: %.1f / %d MB", residentBytes / (1024.0 * 1024.0), poolMB);
+            ImGui::DragInt("Pool (MB)", &poolMB, 4.0f, 1, 16384);
+            ImGui::DragInt("Upload budget (KB/frame)", &uploadBudgetKB, 64.0f, 64, 1 << 20);
+            ImGui::SliderInt("Loads in flight", &maxLoadsInFlight, 1, 16);
+            ImGui::SliderFloat("LOD bias", &lodBias, -2.0f, 4.0f);
+            ImGui::Text("Uploaded last frame: %.1f KB", uploadedLastFrame / 1024.0);
+            ImGui::Text("Loads in flight: %d, levels uploaded: %zu, freed: %zu", loadsInFlight, levelsUploaded, levelsFreed);
+            ImGui::End();
+        }
+
+    private:
+        struct Entry {
+            Source source;
+            // tells a texture apart from an earlier one with the same name
+            long serial = 0;
+            // 0 for decoded images
+            GLenum compressedFormat = 0;
+            GLenum format = GL_RGBA;
+            int channels = 4;
+            // level 0 size and level count
+            int width = 0, height = 0, levels = 1;
+            // first of the levels loaded up front, first uploaded level, first level wanted this frame
+            int lowTop = 0, residentTop = 0, wantedTop = 0;
+            int requestedTop = 0;
+            long requestFrame = -1, lastUse = 0;
+            bool loading = false, failed = false;
+        };
+
+        struct Job {
+            GLuint texture;
+            long serial;
+            Source source;
+            bool compressed;
+            int channels;
+            int width, height;
+            // levels [top, bottom) are loaded
+            int top, bottom;
+        };
+
+        struct Result {
+            GLuint texture;
+            long serial;
+            int top;
+            // from level top on, empty when the source couldn't be read
+            std::vector<std::vector<unsigned char>> levels;
+        };
+
+        std::unordered_map<GLuint, Entry> entries;
+        size_t residentBytes = 0;
+        long frame = 0, serials = 0;
+
+        // results handed over by the worker, uploaded in order
+        std::deque<Result> ready;
+        int loadsInFlight = 0;
+        size_t uploadedLastFrame = 0, levelsUploaded = 0, levelsFreed = 0;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<Job> jobs;
+        std::deque<Result> finished;
+        bool quit = false;
+        std::thread worker;
+        int releaseListener = -1;
+
+        TextureStreamer() {
+            releaseListener = GpuMemory::Instance().AddReleaseListener([this](GLuint texture) { forget(texture); });
+            worker = std::thread([this]() { workerLoop(); });
+        }
+
+        size_t poolBytes() const {
+            return (size_t) poolMB << 20;
+        }
+
+        static int levelWidth(const Entry &entry, int level) {
+            return std::max(1, entry.width >> level);
+        }
+
+        static int levelHeight(const Entry &entry, int level) {
+            return std::max(1, entry.height >> level);
+        }
+
+        // as GpuMemory counts it, three channel levels are padded to four bytes a texel
+        static size_t levelBytes(const Entry &entry, int level) {
+            int width = levelWidth(entry, level), height = levelHeight(entry, level);
+            if (entry.compressedFormat)
+                return texture::LevelBytes(entry.compressedFormat, width, height);
+            return (size_t) width * height * (entry.channels == 3 ? 4 : entry.channels);
+        }
+
+        static size_t entryBytes(const Entry &entry) {
+            size_t bytes = 0;
+            for (int level = entry.residentTop; level < entry.levels; level++)
+                bytes += levelBytes(entry, level);
+            return bytes;
+        }
+
+        Entry &add(GLuint texture, const Source &source, int width, int height) {
+            forget(texture);
+            Entry &entry = entries[texture];
+            entry.source = source;
+            entry.serial = ++serials;
+            entry.width = width;
+            entry.height = height;
+            entry.levels = 1;
+            while (std::max(width >> entry.levels, height >> entry.levels) >= 1)
+                entry.levels++;
+            entry.lowTop = 0;
+            while (std::max(levelWidth(entry, entry.lowTop), levelHeight(entry, entry.lowTop)) > ResidentSize)
+                entry.lowTop++;
+            entry.residentTop = entry.wantedTop = entry.requestedTop = entry.lowTop;
+            entry.lastUse = frame;
+            return entry;
+        }
+
+        void finishAdd(GLuint texture, Entry &entry) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.residentTop);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.levels - 1);
+            size_t bytes = entryBytes(entry);
+            residentBytes += bytes;
+            GpuMemory::Instance().TrackTexture(texture, GpuMemory::MaterialTexture, bytes);
+        }
+
+        void forget(GLuint texture) {
+            auto found = entries.find(texture);
+            if (found == entries.end())
+                return;
+            residentBytes -= entryBytes(found->second);
+            entries.erase(found);
+        }
+
+        // specifies a level of the bound texture, sampling starts at it
+        void upload(Entry &entry, int level, const std::vector<unsigned char> &pixels) {
+            int width = levelWidth(entry, level), height = levelHeight(entry, level);
+            if (entry.compressedFormat) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.compressedFormat, width, height, 0, pixels.size(),
+                                       pixels.data());
+            } else {
+                // rows of RGB levels aren't 4 byte aligned
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                glTexImage2D(GL_TEXTURE_2D, level, entry.format, width, height, 0, entry.format, GL_UNSIGNED_BYTE,
+                             pixels.data());
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            }
+            entry.residentTop = std::min(entry.residentTop, level);
+        }
+
+        void scheduleLoads() {
+            std::vector<std::pair<int, GLuint>> candidates;
+            for (const auto &item : entries) {
+                const Entry &entry = item.second;
+                if (!entry.loading && !entry.failed && entry.wantedTop < entry.residentTop)
+                    candidates.push_back(std::make_pair(entry.residentTop - entry.wantedTop, item.first));
+            }
+            // the blurriest textures first
+            std::sort(candidates.begin(), candidates.end(), [](const std::pair<int, GLuint> &a, const std::pair<int, GLuint> &b) {
+                return a.first > b.first;
+            });
+            for (const std::pair<int, GLuint> &candidate : candidates) {
+                if (loadsInFlight >= maxLoadsInFlight)
+                    break;
+                Entry &entry = entries[candidate.second];
+                Job job{candidate.second, entry.serial, entry.source, entry.compressedFormat != 0, entry.channels,
+                        entry.width, entry.height, entry.wantedTop, entry.residentTop};
+                entry.loading = true;
+                loadsInFlight++;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    jobs.push_back(std::move(job));
+                }
+                wake.notify_one();
+            }
+        }
+
+        void uploadFinished() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                while (!finished.empty()) {
+                    ready.push_back(std::move(finished.front()));
+                    finished.pop_front();
+                }
+            }
+
+            GLint previousTexture;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+            size_t budget = (size_t) uploadBudgetKB << 10;
+            uploadedLastFrame = 0;
+            while (!ready.empty()) {
+                Result &result = ready.front();
+                auto found = entries.find(result.texture);
+                if (found != entries.end() && found->second.serial == result.serial) {
+                    GLuint texture = found->first;
+                    Entry &entry = found->second;
+                    if (result.levels.empty()) {
+                        entry.failed = true;
+                        std::cout << "Texture streaming failed to load " << entry.source.path << std::endl;
+                    }
+                    bool blocked = false;
+                    size_t before = entryBytes(entry);
+                    glBindTexture(GL_TEXTURE_2D, texture);
+                    // the level right above the resident ones, as long as it's still wanted
+                    for (int level = entry.residentTop - 1; level >= std::max(result.top, entry.wantedTop); level--) {
+                        size_t index = level - result.top;
+                        if (index >= result.levels.size())
+                            break;
+                        size_t bytes = levelBytes(entry, level);
+                        // at least one level a frame goes up, however large
+                        if (uploadedLastFrame > 0 && uploadedLastFrame + bytes > budget) {
+                            blocked = true;
+                            break;
+                        }
+                        while (residentBytes + bytes > poolBytes() && evictOne(false)) {
+                        }
+                        if (residentBytes + bytes > poolBytes()) {
+                            blocked = true;
+                            break;
+                        }
+                        glBindTexture(GL_TEXTURE_2D, texture);
+                        upload(entry, level, result.levels[index]);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+                        // the level's pixels aren't needed anymore
+                        std::vector<unsigned char>().swap(result.levels[index]);
+                        residentBytes += bytes;
+                        uploadedLastFrame += bytes;
+                        levelsUploaded++;
+                    }
+                    size_t after = entryBytes(entry);
+                    if (after != before)
+                        GpuMemory::Instance().TrackTexture(texture, GpuMemory::MaterialTexture, after);
+                    if (blocked)
+                        break;
+                    entry.loading = false;
+                }
+                ready.pop_front();
+                loadsInFlight--;
+            }
+            glBindTexture(GL_TEXTURE_2D, previousTexture);
+        }
+
+        // frees the finest level of the least recently used texture, with wanted levels only when anyway is set
+        bool evictOne(bool anyway) {
+            GLuint victim = 0;
+            const Entry *oldest = nullptr;
+            for (const auto &item : entries) {
+                const Entry &entry = item.second;
+                if (entry.residentTop >= entry.lowTop || (!anyway && entry.residentTop >= entry.wantedTop))
+                    continue;
+                if (!oldest || entry.lastUse < oldest->lastUse ||
+                    (entry.lastUse == oldest->lastUse && levelBytes(entry, entry.residentTop) > levelBytes(*oldest, oldest->residentTop))) {
+                    oldest = &entry;
+                    victim = item.first;
+                }
+            }
+            if (!oldest)
+                return false;
+
+            Entry &entry = entries[victim];
+            int level = entry.residentTop;
+            GLint previousTexture;
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+            glBindTexture(GL_TEXTURE_2D, victim);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+            // respecifying the level as empty frees its storage
+            if (entry.compressedFormat)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.compressedFormat, 0, 0, 0, 0, nullptr);
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, entry.format, 0, 0, 0, entry.format, GL_UNSIGNED_BYTE, nullptr);
+            glBindTexture(GL_TEXTURE_2D, previousTexture);
+
+            residentBytes -= levelBytes(entry, level);
+            entry.residentTop++;
+            GpuMemory::Instance().TrackTexture(victim, GpuMemory::MaterialTexture, entryBytes(entry));
+            levelsFreed++;
+            return true;
+        }
+
+        void workerLoop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this]() { return quit || !jobs.empty(); });
+                if (quit)
+                    return;
+                Job job = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+                Result result = load(job);
+                lock.lock();
+                finished.push_back(std::move(result));
+            }
+        }
+
+        // runs on the worker, the thread pools are the GL thread's so mips are filtered serially
+        static Result load(const Job &job) {
+            Result result{job.texture, job.serial, job.top, {}};
+            if (job.compressed) {
+                texture::CompressedImage image;
+                if (!texture::ReadKtx(job.source.compressedPath, job.source.sourceHash, image))
+                    return result;
+                image.DropLevels(job.source.skip);
+                if (image.width != job.width || image.height != job.height || (int) image.levels.size() < job.bottom)
+                    return result;
+                for (int level = job.top; level < job.bottom; level++)
+                    result.levels.push_back(std::move(image.levels[level]));
+                return result;
+            }
+
+            int width, height, channels;
+            unsigned char *data = stbi_load(job.source.path.c_str(), &width, &height, &channels, 0);
+            if (!data)
+                return result;
+            std::vector<unsigned char> level(data, data + (size_t) width * height * channels);
+            stbi_image_free(data);
+            if (channels != job.channels || std::max(1, width >> job.source.skip) != job.width ||
+                std::max(1, height >> job.source.skip) != job.height)
+                return result;
+            ThreadPool &pool = ThreadPool::Serial();
+            for (int i = -job.source.skip; i < job.bottom; i++) {
+                if (i >= job.top)
+                    result.levels.push_back(level);
+                if (i + 1 < job.bottom) {
+                    level = Downsample(level.data(), width, height, channels, job.source.usage, pool);
+                    width = std::max(1, width / 2);
+                    height = std::max(1, height / 2);
+                }
+            }
+            return result;
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_TEXTURESTREAMING_H
@@ -0,0 +1,133 @@
+#ifndef PROJECT_BASE_THREADPOOL_H
+#define PROJECT_BASE_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rg {
+
+    // Fixed set of worker threads for data parallel loading work. ParallelFor() hands out indices
+    // through an atomic counter, the calling thread takes part in the loop and the call returns
+    // once every index ran. A pool of size 1 runs everything on the caller.
+    class ThreadPool {
+    public:
+        explicit ThreadPool(unsigned threadCount = DefaultThreadCount()) {
+            threadCount = std::max(1u, threadCount);
+            for (unsigned i = 1; i < threadCount; i++)
+                workers.emplace_back([this]() { workerLoop(); });
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+            for (std::thread &worker : workers)
+                worker.join();
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        static unsigned DefaultThreadCount() {
+            return std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // pool shared by the loaders, sized to the machine
+        static ThreadPool &Shared() {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        // pool without workers for nested loops, work already spread over a pool runs its inner loops on it
+        static ThreadPool &Serial() {
+            static ThreadPool pool(1);
+            return pool;
+        }
+
+        unsigned Size() const {
+            return workers.size() + 1;
+        }
+
+        // runs body(i) for every i in [0, count), not reentrant
+        void ParallelFor(size_t count, const std::function<void(size_t)> &body) {
+            if (count == 0)
+                return;
+            if (workers.empty() || count == 1) {
+                for (size_t i = 0; i < count; i++)
+                    body(i);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = &body;
+                jobCount = count;
+                next = 0;
+                remaining = count;
+                generation++;
+            }
+            wake.notify_all();
+            runJob(body, count);
+            std::unique_lock<std::mutex> lock(mutex);
+            // workers still inside runJob() would otherwise pick up indices of the next loop
+            finished.wait(lock, [this]() { return remaining == 0 && active == 0; });
+            job = nullptr;
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake, finished;
+        const std::function<void(size_t)> *job = nullptr;
+        size_t jobCount = 0;
+        std::atomic<size_t> next{0};
+        size_t remaining = 0;
+        unsigned active = 0;
+        unsigned generation = 0;
+        bool quit = false;
+
+        void runJob(const std::function<void(size_t)> &body, size_t count) {
+            size_t done = 0;
+            for (size_t i = next++; i < count; i = next++) {
+                body(i);
+                done++;
+            }
+            if (done > 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                remaining -= done;
+            }
+        }
+
+        void workerLoop() {
+            unsigned seen = 0;
+            while (true) {
+                const std::function<void(size_t)> *body;
+                size_t count;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]() { return quit || (job && generation != seen); });
+                    if (quit)
+                        return;
+                    seen = generation;
+                    body = job;
+                    count = jobCount;
+                    active++;
+                }
+                runJob(*body, count);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--active == 0 && remaining == 0)
+                    finished.notify_all();
+            }
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_THREADPOOL_H
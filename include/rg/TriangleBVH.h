@@ -0,0 +1,334 @@
+#ifndef PROJECT_BASE_TRIANGLEBVH_H
+#define PROJECT_BASE_TRIANGLEBVH_H
+
+#include <glm/glm.hpp>
+
+#include <rg/Bounds.h>
+#include <rg/SceneBVH.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rg {
+
+    struct TriangleHit {
+        float t = FLT_MAX;
+        // index of the triangle in the mesh index buffer (indices[3 * triangle])
+        int triangle = -1;
+        // weights of the second and third vertex, the first one gets 1 - u - v
+        float u = 0.0f, v = 0.0f;
+
+        bool Hit() const {
+            return triangle >= 0;
+        }
+    };
+
+    // BVH over the triangles of one mesh for exact ray queries. It is built with the same binned SAH
+    // builder as SceneBVH, with leaves of up to four triangles. Leaves are packets that store
+    // the triangles as v0, edge1 and edge2 in structure of arrays form, so the SSE kernel
+    // intersects all four at once. Nodes and packets are plain data and are written to and read
+    // from disk as they are.
+    class TriangleBVH {
+    public:
+        static const int PacketSize = 4;
+
+        typedef SceneBVH::Node Node;
+
+        struct Packet {
+            float v0[3][PacketSize];
+            float edge1[3][PacketSize];
+            float edge2[3][PacketSize];
+            int triangle[PacketSize];
+        };
+
+        void Build(const std::vector<glm::vec3> &positions, const std::vector<unsigned int> &indices) {
+            SceneBVH builder(PacketSize);
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                AABB bounds;
+                bounds.Expand(positions[indices[i]]);
+                bounds.Expand(positions[indices[i + 1]]);
+                bounds.Expand(positions[indices[i + 2]]);
+                builder.Insert(bounds);
+            }
+            builder.Build();
+
+            nodes = builder.Nodes();
+            packets.clear();
+            packets.reserve(nodes.size() / 2 + 1);
+            const std::vector<int> &order = builder.ObjectIndices();
+            for (Node &node : nodes) {
+                if (!node.IsLeaf())
+                    continue;
+                // leaves the builder couldn't split further may hold more than one packet
+                int first = node.leftFirst;
+                node.leftFirst = packets.size();
+                for (int start = 0; start < node.count; start += PacketSize) {
+                    Packet packet;
+                    for (int lane = 0; lane < PacketSize; lane++) {
+                        // unused lanes get a degenerate triangle that never passes the determinant test
+                        glm::vec3 v0(0.0f), edge1(0.0f), edge2(0.0f);
+                        int triangle = -1;
+                        if (start + lane < node.count) {
+                            triangle = order[first + start + lane];
+                            v0 = positions[indices[3 * triangle]];
+                            edge1 = positions[indices[3 * triangle + 1]] - v0;
+                            edge2 = positions[indices[3 * triangle + 2]] - v0;
+                        }
+                        for (int axis = 0; axis < 3; axis++) {
+                            packet.v0[axis][lane] = v0[axis];
+                            packet.edge1[axis][lane] = edge1[axis];
+                            packet.edge2[axis][lane] = edge2[axis];
+                        }
+                        packet.triangle[lane] = triangle;
+                    }
+                    packets.push_back(packet);
+                }
+            }
+        }
+
+        bool Empty() const {
+            return nodes.empty();
+        }
+
+        // closest hit in [0, maxT), the ray direction doesn't have to be normalized
+        TriangleHit Intersect(const Ray &ray, float maxT = FLT_MAX) const {
+            TriangleHit hit;
+            hit.t = maxT;
+            if (nodes.empty())
+                return hit;
+            glm::vec3 inverseDirection = 1.0f / ray.direction;
+            float tEntry;
+            if (!intersectBox(nodes[0].bounds, ray.origin, inverseDirection, hit.t, tEntry))
+                return TriangleHit();
+
+            // the builder's depth limit bounds the stack, cached trees are checked against it on Read()
+            int stack[SceneBVH::StackSize];
+            float stackT[SceneBVH::StackSize];
+            int top = 0;
+            stack[top] = 0;
+            stackT[top++] = tEntry;
+            while (top > 0) {
+                top--;
+                if (stackT[top] > hit.t)
+                    continue;
+                const Node &node = nodes[stack[top]];
+                if (node.IsLeaf()) {
+                    for (int packet = 0; packet < (node.count + PacketSize - 1) / PacketSize; packet++)
+                        intersectPacket(packets[node.leftFirst + packet], ray, hit);
+                    continue;
+                }
+                // the nearer child goes on top of the stack
+                assert(top + 2 <= SceneBVH::StackSize);
+                int first = node.leftFirst, second = node.leftFirst + 1;
+                float tFirst, tSecond;
+                bool hitFirst = intersectBox(nodes[first].bounds, ray.origin, inverseDirection, hit.t, tFirst);
+                bool hitSecond = intersectBox(nodes[second].bounds, ray.origin, inverseDirection, hit.t, tSecond);
+                if (hitFirst && hitSecond && tSecond < tFirst) {
+                    std::swap(first, second);
+                    std::swap(tFirst, tSecond);
+                }
+                if (hitFirst && hitSecond) {
+                    stack[top] = second;
+                    stackT[top++] = tSecond;
+                    stack[top] = first;
+                    stackT[top++] = tFirst;
+                } else if (hitFirst || hitSecond) {
+                    stack[top] = hitFirst ? first : second;
+                    stackT[top++] = hitFirst ? tFirst : tSecond;
+                }
+            }
+            if (hit.triangle < 0)
+                hit.t = FLT_MAX;
+            return hit;
+        }
+
+        // many rays at once, hits[i] belongs to rays[i]
+        void IntersectBatch(const std::vector<Ray> &rays, std::vector<TriangleHit> &hits, float maxT = FLT_MAX) const {
+            hits.resize(rays.size());
+            for (size_t i = 0; i < rays.size(); i++)
+                hits[i] = Intersect(rays[i], maxT);
+        }
+
+        size_t NodeCount() const {
+            return nodes.size();
+        }
+
+        size_t PacketCount() const {
+            return packets.size();
+        }
+
+        void Write(std::ostream &out) const {
+            uint32_t counts[2] = {(uint32_t) nodes.size(), (uint32_t) packets.size()};
+            out.write((const char *) counts, sizeof(counts));
+            out.write((const char *) nodes.data(), nodes.size() * sizeof(Node));
+            out.write((const char *) packets.data(), packets.size() * sizeof(Packet));
+        }
+
+        // reads a BVH written for a mesh of triangleCount triangles. A cache that doesn't fit the
+        // mesh (truncated, corrupt) is rejected before anything is allocated for it.
+        bool Read(std::istream &in, size_t triangleCount) {
+            uint32_t counts[2];
+            if (!in.read((char *) counts, sizeof(counts)))
+                return false;
+            // every leaf holds a triangle and every packet at least one
+            if (counts[0] > 2 * std::max<size_t>(triangleCount, 1) - 1 || counts[1] > triangleCount) {
+                in.setstate(std::ios::failbit);
+                return false;
+            }
+            nodes.resize(counts[0]);
+            packets.resize(counts[1]);
+            in.read((char *) nodes.data(), nodes.size() * sizeof(Node));
+            in.read((char *) packets.data(), packets.size() * sizeof(Packet));
+            if (!in || !validNodes() || !validPackets(triangleCount)) {
+                nodes.clear();
+                packets.clear();
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        std::vector<Node> nodes;
+        std::vector<Packet> packets;
+
+        // children after their parent and inside the arrays, leaves inside the packets, no deeper
+        // than the builder goes
+        bool validNodes() const {
+            std::vector<int> depth(nodes.size(), 0);
+            for (size_t i = 0; i < nodes.size(); i++) {
+                const Node &node = nodes[i];
+                if (node.IsLeaf()) {
+                    if (node.leftFirst < 0 || node.leftFirst + (node.count + PacketSize - 1) / PacketSize > (int) packets.size())
+                        return false;
+                } else if (node.count < 0 || node.leftFirst <= (int) i || node.leftFirst + 1 >= (int) nodes.size() ||
+                           depth[i] >= SceneBVH::MaxDepth) {
+                    return false;
+                } else {
+                    depth[node.leftFirst] = depth[node.leftFirst + 1] = depth[i] + 1;
+                }
+            }
+            return true;
+        }
+
+        // every lane empty or a triangle of the mesh, hits index the mesh's indices with it
+        bool validPackets(size_t triangleCount) const {
+            for (const Packet &packet : packets)
+                for (int lane = 0; lane < PacketSize; lane++)
+                    if (packet.triangle[lane] < -1 || (packet.triangle[lane] >= 0 && (size_t) packet.triangle[lane] >= triangleCount))
+                        return false;
+            return true;
+        }
+
+        static bool intersectBox(const AABB &box, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxT,
+                                 float &tEntry) {
+#if defined(__SSE2__)
+            // lane 3 reads past the vec3 and is masked off
+            const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+            __m128 o = _mm_setr_ps(origin.x, origin.y, origin.z, 0.0f);
+            __m128 inv = _mm_setr_ps(inverseDirection.x, inverseDirection.y, inverseDirection.z, 0.0f);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&box.min.x), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(box.max.x, box.max.y, box.max.z, 0.0f), o), inv);
+            __m128 tNear = _mm_and_ps(_mm_min_ps(t0, t1), xyz);
+            __m128 tFar = _mm_or_ps(_mm_and_ps(_mm_max_ps(t0, t1), xyz), _mm_andnot_ps(xyz, _mm_set1_ps(maxT)));
+            tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+            tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+            tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+            tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+            tEntry = _mm_cvtss_f32(tNear);
+            return _mm_comile_ss(tNear, tFar) != 0;
+#else
+            return box.Intersect(origin, inverseDirection, maxT, tEntry);
+#endif
+        }
+
+        // Moller-Trumbore against the four triangles of a packet
+        static void intersectPacket(const Packet &packet, const Ray &ray, TriangleHit &hit) {
+#if defined(__SSE2__)
+            const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+            const __m128 e1x = _mm_loadu_ps(packet.edge1[0]), e1y = _mm_loadu_ps(packet.edge1[1]), e1z = _mm_loadu_ps(packet.edge1[2]);
+            const __m128 e2x = _mm_loadu_ps(packet.edge2[0]), e2y = _mm_loadu_ps(packet.edge2[1]), e2z = _mm_loadu_ps(packet.edge2[2]);
+            // p = d x e2
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            // |det| > epsilon, both faces are hit
+            __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+            __m128 mask = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f));
+            __m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+            __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(packet.v0[0]));
+            __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(packet.v0[1]));
+            __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(packet.v0[2]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+            // q = s x e1
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+
+            const __m128 zero = _mm_setzero_ps();
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+            mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+            mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(hit.t)));
+            int lanes = _mm_movemask_ps(mask);
+            if (lanes == 0)
+                return;
+            float ts[PacketSize], us[PacketSize], vs[PacketSize];
+            _mm_storeu_ps(ts, t);
+            _mm_storeu_ps(us, u);
+            _mm_storeu_ps(vs, v);
+            for (int lane = 0; lane < PacketSize; lane++) {
+                if ((lanes & (1 << lane)) && ts[lane] < hit.t) {
+                    hit.t = ts[lane];
+                    hit.u = us[lane];
+                    hit.v = vs[lane];
+                    hit.triangle = packet.triangle[lane];
+                }
+            }
+#else
+            for (int lane = 0; lane < PacketSize; lane++) {
+                glm::vec3 v0(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+                glm::vec3 edge1(packet.edge1[0][lane], packet.edge1[1][lane], packet.edge1[2][lane]);
+                glm::vec3 edge2(packet.edge2[0][lane], packet.edge2[1][lane], packet.edge2[2][lane]);
+                glm::vec3 p = glm::cross(ray.direction, edge2);
+                float det = glm::dot(edge1, p);
+                if (std::fabs(det) <= 1e-12f)
+                    continue;
+                float inverseDet = 1.0f / det;
+                glm::vec3 s = ray.origin - v0;
+                float u = glm::dot(s, p) * inverseDet;
+                if (u < 0.0f || u > 1.0f)
+                    continue;
+                glm::vec3 q = glm::cross(s, edge1);
+                float v = glm::dot(ray.direction, q) * inverseDet;
+                if (v < 0.0f || u + v > 1.0f)
+                    continue;
+                float t = glm::dot(edge2, q) * inverseDet;
+                if (t >= 0.0f && t < hit.t) {
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.triangle = packet.triangle[lane];
+                }
+            }
+#endif
+        }
+    };
+
+};
+
+#endif //PROJECT_BASE_TRIANGLEBVH_H
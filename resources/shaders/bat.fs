@@ -10,13 +10,35 @@ struct DirectionalLight {
 };
 
 
+// the TEXTURE_ARRAYS variant samples layers of texture arrays, see Mesh::BindTextures
+#ifdef TEXTURE_ARRAYS
+#define MATERIAL_SAMPLER sampler2DArray
+flat in int MaterialLayers[5];
+#define MATERIAL_TEXTURE(sampler, slot, uv) texture(sampler, vec3(uv, MaterialLayers[slot]))
+#else
+#define MATERIAL_SAMPLER sampler2D
+#define MATERIAL_TEXTURE(sampler, slot, uv) texture(sampler, uv)
+#endif
+#define DIFFUSE_LAYER 0
+#define SPECULAR_LAYER 1
+#define NORMAL_LAYER 2
+#define HEIGHT_LAYER 3
+#define EMISSIVE_LAYER 4
+
 struct Material {
-    sampler2D texture_diffuse1;
-    sampler2D texture_specular1;
-    vec3 specular;
+    MATERIAL_SAMPLER texture_diffuse1;
+    MATERIAL_SAMPLER texture_specular1;
+};
 
+// per-material parameters, written once into a uniform buffer by rg::MaterialLibrary
+layout (std140) uniform MaterialBlock {
+    vec4 specular;
     float shininess;
-};
+    float alpha;
+    float emissiveStrength;
+    float parallaxScale;
+} materialParameters;
+
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
@@ -33,11 +55,11 @@ vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * material.specular;
+    vec3 ambient = light.ambient * vec3(MATERIAL_TEXTURE(material.texture_diffuse1, DIFFUSE_LAYER, TexCoords));
+    vec3 diffuse = light.diffuse * diff * vec3(MATERIAL_TEXTURE(material.texture_diffuse1, DIFFUSE_LAYER, TexCoords));
+    vec3 specular = light.specular * spec * materialParameters.specular.rgb;
     return (ambient + diffuse + specular);
 }
 
@@ -7,6 +7,12 @@ out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
 
+#ifdef TEXTURE_ARRAYS
+// layer of each material texture in its array: diffuse, specular, normal, height, emissive
+layout (location = 9) in int aMaterialLayers[5];
+flat out int MaterialLayers[5];
+#endif
+
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
@@ -16,5 +22,8 @@ void main()
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = aNormal;
     TexCoords = aTexCoords;    
+#ifdef TEXTURE_ARRAYS
+    MaterialLayers = aMaterialLayers;
+#endif
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
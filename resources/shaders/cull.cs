@@ -0,0 +1,156 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+layout (std430, binding = 0) readonly buffer Instances {
+    mat4 instances[];
+};
+layout (std430, binding = 1) writeonly buffer VisibleInstances {
+    mat4 visibleInstances[];
+};
+layout (std430, binding = 2) buffer Counters {
+    uint tested;
+    uint visible;
+    // visible instances drawn at each level of detail, the last one used can be impostors
+    uint levelVisible[5];
+};
+// level each instance was drawn at, for the hysteresis, ~0u before the first frame
+layout (std430, binding = 3) buffer InstanceLevels {
+    uint instanceLevels[];
+};
+
+// HLOD cluster of each instance or -1, and whether each cluster draws as its proxy this frame
+layout (std430, binding = 4) readonly buffer InstanceClusters {
+    int instanceClusters[];
+};
+layout (std430, binding = 5) readonly buffer ReplacedClusters {
+    uint replacedClusters[];
+};
+
+uniform int instanceCount;
+// object space bounds of the model
+uniform vec3 boundsMin;
+uniform vec3 boundsMax;
+uniform vec4 frustumPlanes[6];
+
+uniform bool useHiZ;
+uniform sampler2D hiZ;
+uniform int hiZLevels;
+uniform vec2 hiZSize;
+uniform mat4 previousViewProjection;
+
+uniform bool useClusters;
+
+// LOD selection, the same as rg::SelectLod: object space errors of the levels, pixels a world unit
+// covers at distance 1, and the allowed pixel error with the bias applied
+uniform int lodLevels;
+uniform float lodErrors[5];
+uniform vec3 cameraPosition;
+uniform float pixelsPerUnit;
+uniform float lodThreshold;
+uniform float lodHysteresis;
+
+bool FrustumVisible(vec3 worldMin, vec3 worldMax)
+{
+    for (int i = 0; i < 6; i++) {
+        vec4 plane = frustumPlanes[i];
+        vec3 p = mix(worldMin, worldMax, greaterThan(plane.xyz, vec3(0.0)));
+        if (dot(plane.xyz, p) + plane.w < 0.0)
+            return false;
+    }
+    return true;
+}
+
+bool HiZVisible(vec3 worldMin, vec3 worldMax)
+{
+    vec3 ndcMin = vec3(1.0);
+    vec3 ndcMax = vec3(-1.0);
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = vec3((i & 1) != 0 ? worldMax.x : worldMin.x,
+                           (i & 2) != 0 ? worldMax.y : worldMin.y,
+                           (i & 4) != 0 ? worldMax.z : worldMin.z);
+        vec4 clip = previousViewProjection * vec4(corner, 1.0);
+        // crosses the near plane of the previous frame, nothing to compare against
+        if (clip.w <= 0.0)
+            return true;
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+    // (partly) outside the previous view, the pyramid has no depth there
+    if (any(lessThan(ndcMin.xy, vec2(-1.0))) || any(greaterThan(ndcMax.xy, vec2(1.0))))
+        return true;
+    vec2 uvMin = ndcMin.xy * 0.5 + 0.5;
+    vec2 uvMax = ndcMax.xy * 0.5 + 0.5;
+    float nearestDepth = ndcMin.z * 0.5 + 0.5;
+
+    // pick the level where the rectangle spans at most 2x2 texels
+    vec2 extent = (uvMax - uvMin) * hiZSize;
+    float level = ceil(log2(max(max(extent.x, extent.y), 1.0)));
+    level = clamp(level, 0.0, float(hiZLevels - 1));
+
+    float farthest = max(max(textureLod(hiZ, uvMin, level).r, textureLod(hiZ, vec2(uvMax.x, uvMin.y), level).r),
+                         max(textureLod(hiZ, vec2(uvMin.x, uvMax.y), level).r, textureLod(hiZ, uvMax, level).r));
+    return nearestDepth <= farthest;
+}
+
+uint SelectLod(vec3 worldMin, vec3 worldMax, float scale, uint current)
+{
+    float distance = length((worldMin + worldMax) * 0.5 - cameraPosition) - length((worldMax - worldMin) * 0.5);
+    // inside the bounds everything is too close for anything but the full mesh
+    if (distance <= 0.0)
+        return 0u;
+    float pixels = pixelsPerUnit * scale / distance;
+    uint within = 0u;
+    uint withinMargin = 0u;
+    for (int level = 0; level < lodLevels; level++) {
+        float error = lodErrors[level] * pixels;
+        if (error <= lodThreshold)
+            within = uint(level);
+        if (error <= lodThreshold * (1.0 - lodHysteresis))
+            withinMargin = uint(level);
+    }
+    if (current >= uint(lodLevels) || lodErrors[current] * pixels > lodThreshold)
+        return within;
+    return max(current, withinMargin);
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uint(instanceCount))
+        return;
+    atomicAdd(tested, 1u);
+    if (useClusters) {
+        int cluster = instanceClusters[index];
+        // its proxy is drawn instead, the level starts over once the cluster comes back
+        if (cluster >= 0 && replacedClusters[cluster] != 0u) {
+            instanceLevels[index] = ~0u;
+            return;
+        }
+    }
+
+    mat4 model = instances[index];
+    // world space bounds of the transformed box
+    vec3 worldMin = model[3].xyz;
+    vec3 worldMax = model[3].xyz;
+    for (int column = 0; column < 3; column++) {
+        vec3 a = model[column].xyz * boundsMin[column];
+        vec3 b = model[column].xyz * boundsMax[column];
+        worldMin += min(a, b);
+        worldMax += max(a, b);
+    }
+
+    if (!FrustumVisible(worldMin, worldMax))
+        return;
+    if (useHiZ && !HiZVisible(worldMin, worldMax))
+        return;
+
+    float scale = max(max(length(model[0].xyz), length(model[1].xyz)), length(model[2].xyz));
+    uint level = SelectLod(worldMin, worldMax, scale, instanceLevels[index]);
+    instanceLevels[index] = level;
+
+    // every level has a list of instanceCount slots
+    atomicAdd(visible, 1u);
+    uint slot = atomicAdd(levelVisible[level], 1u);
+    visibleInstances[level * uint(instanceCount) + slot] = model;
+}
@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+#ifdef INSTANCED
+layout (location = 5) in mat4 instanceModel;
+#endif
+
+#ifndef INSTANCED
+uniform mat4 model;
+#endif
+uniform mat4 view;
+uniform mat4 projection;
+
+// the main pass tests against this depth with GL_EQUAL, both compute the position the same way
+invariant gl_Position;
+
+void main()
+{
+#ifdef INSTANCED
+    vec3 FragPos = vec3(instanceModel * vec4(aPos, 1.0));
+#else
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+#endif
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -13,10 +13,17 @@ struct DirectionalLight {
 struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
-    vec3 specular;
+};
 
+// per-material parameters, written once into a uniform buffer by rg::MaterialLibrary
+layout (std140) uniform MaterialBlock {
+    vec4 specular;
     float shininess;
-};
+    float alpha;
+    float emissiveStrength;
+    float parallaxScale;
+} materialParameters;
+
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
@@ -33,11 +40,11 @@ vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
     // combine results
     vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
     vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * material.specular;
+    vec3 specular = light.specular * spec * materialParameters.specular.rgb;
     return (ambient + diffuse + specular);
 }
 
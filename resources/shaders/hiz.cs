@@ -0,0 +1,42 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// level 0 is copied from the depth buffer, every other level keeps the farthest depth of the
+// texels it covers so that a rectangle test against it is conservative
+layout (binding = 0, r32f) uniform readonly image2D srcLevel;
+layout (binding = 1, r32f) uniform writeonly image2D dstLevel;
+
+uniform sampler2D depthTexture;
+uniform bool copyDepth;
+
+void main()
+{
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dstSize = imageSize(dstLevel);
+    if (dst.x >= dstSize.x || dst.y >= dstSize.y)
+        return;
+
+    if (copyDepth) {
+        imageStore(dstLevel, dst, vec4(texelFetch(depthTexture, dst, 0).r));
+        return;
+    }
+
+    ivec2 srcSize = imageSize(srcLevel);
+    ivec2 src = dst * 2;
+    float depth = max(max(imageLoad(srcLevel, src).r, imageLoad(srcLevel, src + ivec2(1, 0)).r),
+                      max(imageLoad(srcLevel, src + ivec2(0, 1)).r, imageLoad(srcLevel, src + ivec2(1, 1)).r));
+    // odd source sizes leave a row/column that the last texel has to cover as well
+    bool extraColumn = (srcSize.x & 1) != 0 && dst.x == dstSize.x - 1;
+    bool extraRow = (srcSize.y & 1) != 0 && dst.y == dstSize.y - 1;
+    if (extraColumn) {
+        depth = max(depth, imageLoad(srcLevel, src + ivec2(2, 0)).r);
+        depth = max(depth, imageLoad(srcLevel, src + ivec2(2, 1)).r);
+    }
+    if (extraRow) {
+        depth = max(depth, imageLoad(srcLevel, src + ivec2(0, 2)).r);
+        depth = max(depth, imageLoad(srcLevel, src + ivec2(1, 2)).r);
+    }
+    if (extraColumn && extraRow)
+        depth = max(depth, imageLoad(srcLevel, src + ivec2(2, 2)).r);
+    imageStore(dstLevel, dst, vec4(depth));
+}
@@ -0,0 +1,56 @@
+#version 330 core
+out vec4 FragColor;
+
+struct DirectionalLight {
+    vec3 direction;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+};
+
+// per-material parameters, written once into a uniform buffer by rg::MaterialLibrary
+layout (std140) uniform MaterialBlock {
+    vec4 specular;
+    float shininess;
+    float alpha;
+    float emissiveStrength;
+    float parallaxScale;
+} materialParameters;
+
+// the diffuse textures of every source model in one atlas, see rg::HlodClusters
+struct Material {
+    sampler2D texture_diffuse1;
+};
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+
+uniform DirectionalLight directionalLight;
+uniform Material material;
+uniform vec3 viewPosition;
+
+vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
+    // combine results
+    vec3 albedo = vec3(texture(material.texture_diffuse1, TexCoords));
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * materialParameters.specular.rgb;
+    return (ambient + diffuse + specular);
+}
+
+void main()
+{
+    vec3 normal = normalize(Normal);
+    vec3 viewDir = normalize(viewPosition - FragPos);
+    vec3 result = CalcDirectionalLight(directionalLight, normal, FragPos, viewDir);
+    FragColor = vec4(result, 1.0);
+}
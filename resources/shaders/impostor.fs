@@ -0,0 +1,89 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+struct DirectionalLight {
+    vec3 direction;
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+};
+
+// per-material parameters, written once into a uniform buffer by rg::MaterialLibrary
+layout (std140) uniform MaterialBlock {
+    vec4 specular;
+    float shininess;
+    float alpha;
+    float emissiveStrength;
+    float parallaxScale;
+} materialParameters;
+
+in vec2 QuadCoords;
+in vec3 FragPos;
+flat in ivec2 FrameCell;
+flat in vec2 FrameBlend;
+flat in mat3 NormalMatrix;
+flat in vec3 ToCamera;
+flat in float Radius;
+
+uniform DirectionalLight directionalLight;
+uniform vec3 viewPosition;
+uniform mat4 view;
+uniform mat4 projection;
+
+// rg::Impostor atlases, premultiplied by the coverage in the albedo's alpha
+uniform sampler2D impostorAlbedo;
+uniform sampler2D impostorNormalDepth;
+uniform int impostorFrames;
+
+// the four frames around the view direction, weighted bilinearly
+void SampleFrames(out vec4 albedo, out vec4 normalDepth)
+{
+    albedo = vec4(0.0);
+    normalDepth = vec4(0.0);
+    for (int corner = 0; corner < 4; corner++) {
+        ivec2 offset = ivec2(corner & 1, corner >> 1);
+        vec2 weights = mix(1.0 - FrameBlend, FrameBlend, vec2(offset));
+        vec2 uv = (vec2(FrameCell + offset) + QuadCoords) / float(impostorFrames);
+        albedo += weights.x * weights.y * texture(impostorAlbedo, uv);
+        normalDepth += weights.x * weights.y * texture(impostorNormalDepth, uv);
+    }
+}
+
+vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 albedo, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * materialParameters.specular.rgb;
+    return (ambient + diffuse + specular);
+}
+
+void main()
+{
+    vec4 albedo, normalDepth;
+    SampleFrames(albedo, normalDepth);
+    if (albedo.a < 0.5)
+        discard;
+    // undo the premultiplication by the coverage
+    albedo.rgb /= albedo.a;
+    normalDepth /= albedo.a;
+    vec3 normal = normalize(NormalMatrix * (normalDepth.rgb * 2.0 - 1.0));
+
+    // the baked surface sits in front of or behind the quad
+    vec3 surface = FragPos + ToCamera * (normalDepth.a * 2.0 - 1.0) * Radius;
+    vec4 clip = projection * view * vec4(surface, 1.0);
+    gl_FragDepth = clamp(clip.z / clip.w * 0.5 + 0.5, 0.0, 1.0);
+
+    vec3 viewDir = normalize(viewPosition - surface);
+    vec3 result = CalcDirectionalLight(directionalLight, normal, albedo.rgb, viewDir);
+    FragColor = vec4(result, materialParameters.alpha);
+    float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
+    BrightColor = brightness > 1.0 ? vec4(result, 1.0) : vec4(0.0, 0.0, 0.0, 1.0);
+}
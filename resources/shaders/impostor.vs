@@ -0,0 +1,57 @@
+#version 330 core
+// the quad's corners come from gl_VertexID, only the instance matrix is streamed
+layout (location = 5) in mat4 instanceModel;
+
+out vec2 QuadCoords;
+out vec3 FragPos;
+// the frame cell the view direction falls into and the bilinear weights of its four frames
+flat out ivec2 FrameCell;
+flat out vec2 FrameBlend;
+flat out mat3 NormalMatrix;
+flat out vec3 ToCamera;
+flat out float Radius;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPosition;
+
+// rg::Impostor: bounding sphere of the baked model and frames along each side of the atlas
+uniform vec3 impostorCenter;
+uniform float impostorRadius;
+uniform int impostorFrames;
+
+// the octahedral map around the Y axis, the same as rg::Impostor::OctahedronDecode inverted
+vec2 OctahedronEncode(vec3 direction)
+{
+    direction /= abs(direction.x) + abs(direction.y) + abs(direction.z);
+    vec2 p = direction.xz;
+    if (direction.y < 0.0)
+        p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    return p * 0.5 + 0.5;
+}
+
+void main()
+{
+    vec3 center = vec3(instanceModel * vec4(impostorCenter, 1.0));
+    mat3 rotationScale = mat3(instanceModel);
+    float scale = max(max(length(rotationScale[0]), length(rotationScale[1])), length(rotationScale[2]));
+    Radius = impostorRadius * scale;
+    ToCamera = normalize(viewPosition - center);
+    NormalMatrix = rotationScale / scale;
+
+    // the frames were rendered in object space, uniformly scaled instances undo their rotation
+    // with the transpose
+    vec3 objectDirection = normalize(transpose(NormalMatrix) * ToCamera);
+    vec2 grid = OctahedronEncode(objectDirection) * float(impostorFrames - 1);
+    FrameCell = ivec2(min(floor(grid), vec2(impostorFrames - 2)));
+    FrameBlend = clamp(grid - vec2(FrameCell), 0.0, 1.0);
+
+    // a quad facing the camera, with the basis rg::Impostor::FrameUp gives the frames
+    vec3 up = abs(ToCamera.y) > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(up, ToCamera));
+    up = cross(ToCamera, right);
+    QuadCoords = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 corner = QuadCoords * 2.0 - 1.0;
+    FragPos = center + (corner.x * right + corner.y * up) * Radius;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
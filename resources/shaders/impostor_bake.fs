@@ -0,0 +1,27 @@
+#version 330 core
+// rg::Impostor atlases: albedo with coverage, object space normal with the depth in front of the center
+layout (location = 0) out vec4 Albedo;
+layout (location = 1) out vec4 NormalDepth;
+
+in vec2 TexCoords;
+in vec3 Normal;
+in float ViewDepth;
+
+// the diffuse texture, or its layer of a texture array when albedoLayer isn't negative
+uniform bool useAlbedoTexture;
+uniform sampler2D albedoTexture;
+uniform sampler2DArray albedoArray;
+uniform int albedoLayer;
+uniform vec3 albedoColor;
+// the frame camera sits two radii from the center
+uniform float impostorRadius;
+
+void main()
+{
+    vec3 albedo = albedoColor;
+    if (useAlbedoTexture)
+        albedo = albedoLayer >= 0 ? texture(albedoArray, vec3(TexCoords, albedoLayer)).rgb : texture(albedoTexture, TexCoords).rgb;
+    float depth = (2.0 * impostorRadius - ViewDepth) / impostorRadius;
+    Albedo = vec4(albedo, 1.0);
+    NormalDepth = vec4(normalize(Normal) * 0.5 + 0.5, clamp(depth * 0.5 + 0.5, 0.0, 1.0));
+}
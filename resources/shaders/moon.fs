@@ -12,19 +12,21 @@ struct DirectionalLight {
 
 };
 
-struct Material {
+// per-material parameters, written once into a uniform buffer by rg::MaterialLibrary
+layout (std140) uniform MaterialBlock {
+    vec4 specular;
     float shininess;
-    vec3 specular;
-};
+    float alpha;
+    float emissiveStrength;
+    float parallaxScale;
+} materialParameters;
 
 
 in vec3 Normal;
 in vec3 FragPos;
 
 uniform DirectionalLight directionalLight;
-uniform Material material;
 uniform vec3 viewPosition;
-uniform float alpha;
 vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
     vec3 lightDir = normalize(-light.direction);
@@ -32,11 +34,11 @@ vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
     // combine results
     vec3 ambient = light.ambient;
     vec3 diffuse = light.diffuse * diff;
-    vec3 specular = light.specular * spec * material.specular;
+    vec3 specular = light.specular * spec * materialParameters.specular.rgb;
     return (ambient + diffuse + specular);
 }
 void main() {
@@ -47,7 +49,7 @@ void main() {
     vec3 yellowColor = vec3(0.9f,1.0f,0.6f);
     vec3 finalColor = mix(whiteColor,yellowColor,0.7);
     vec3 result = finalColor * lighting;
-    FragColor = vec4(result, alpha);
+    FragColor = vec4(result, materialParameters.alpha);
     float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
     if (brightness > 1.0) {
         BrightColor = vec4(result, 1.0f);
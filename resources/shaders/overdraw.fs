@@ -0,0 +1,22 @@
+#version 330 core
+// one more fragment for the counter target, the material of the fragment for the other one
+layout (location = 0) out float Count;
+layout (location = 1) out float Material;
+
+uniform float materialId;
+// the same LOD cross-fade dither as the material shaders, a level drops the same pixels here
+uniform float lodFade;
+
+void main()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 cell = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[cell.y * 4 + cell.x] + 0.5) / 16.0;
+    if (lodFade > 0.0 && threshold >= lodFade)
+        discard;
+    if (lodFade < 0.0 && threshold < -lodFade)
+        discard;
+    Count = 1.0;
+    Material = materialId;
+}
@@ -0,0 +1,45 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D overdrawCounts;
+uniform sampler2D overdrawMaterials;
+// 0 shows the fragment counts as a heatmap, 1 the material of the last fragment
+uniform int mode;
+// count at the hot end of the heatmap
+uniform float heatmapMax;
+
+// dark blue through green and yellow to red, white past the end
+vec3 Heatmap(float t)
+{
+    if (t > 1.0)
+        return vec3(1.0);
+    vec3 cold = vec3(0.0, 0.0, 0.5);
+    vec3 colors[4] = vec3[4](vec3(0.0, 0.3, 1.0), vec3(0.0, 0.9, 0.2), vec3(1.0, 0.9, 0.0), vec3(1.0, 0.0, 0.0));
+    float scaled = t * 4.0;
+    int index = min(int(scaled), 3);
+    vec3 from = index == 0 ? cold : colors[index - 1];
+    return mix(from, colors[index], scaled - float(index));
+}
+
+// rg::OverdrawView::MaterialColor()
+vec3 MaterialColor(float id)
+{
+    float hue = fract((id + 1.0) * 0.618034);
+    vec3 rgb = vec3(abs(hue * 6.0 - 3.0) - 1.0, 2.0 - abs(hue * 6.0 - 2.0), 2.0 - abs(hue * 6.0 - 4.0));
+    return clamp(rgb, 0.0, 1.0) * 0.8 + 0.2;
+}
+
+void main()
+{
+    float count = texture(overdrawCounts, TexCoords).r;
+    if (count <= 0.0) {
+        FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    if (mode == 0)
+        FragColor = vec4(Heatmap(count / heatmapMax), 1.0);
+    else
+        FragColor = vec4(MaterialColor(texture(overdrawMaterials, TexCoords).r), 1.0);
+}
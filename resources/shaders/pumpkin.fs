@@ -9,16 +9,36 @@ struct DirectionalLight {
     vec3 ambient;
 };
 
-struct Material {
-    sampler2D texture_diffuse1;
-    sampler2D texture_emissive1;
-    sampler2D texture_normal1;
-
+// the TEXTURE_ARRAYS variant samples layers of texture arrays, see Mesh::BindTextures
+#ifdef TEXTURE_ARRAYS
+#define MATERIAL_SAMPLER sampler2DArray
+flat in int MaterialLayers[5];
+#define MATERIAL_TEXTURE(sampler, slot, uv) texture(sampler, vec3(uv, MaterialLayers[slot]))
+#else
+#define MATERIAL_SAMPLER sampler2D
+#define MATERIAL_TEXTURE(sampler, slot, uv) texture(sampler, uv)
+#endif
+#define DIFFUSE_LAYER 0
+#define SPECULAR_LAYER 1
+#define NORMAL_LAYER 2
+#define HEIGHT_LAYER 3
+#define EMISSIVE_LAYER 4
 
-    vec3 specular;
+struct Material {
+    MATERIAL_SAMPLER texture_diffuse1;
+    MATERIAL_SAMPLER texture_emissive1;
+    MATERIAL_SAMPLER texture_normal1;
+};
 
+// per-material parameters, written once into a uniform buffer by rg::MaterialLibrary
+layout (std140) uniform MaterialBlock {
+    vec4 specular;
     float shininess;
-};
+    float alpha;
+    float emissiveStrength;
+    float parallaxScale;
+} materialParameters;
+
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
@@ -28,6 +48,23 @@ uniform Material material;
 
 uniform vec3 viewPosition;
 
+// LOD cross-fade, 0 draws every pixel. A positive fade keeps that fraction of a 4x4 ordered
+// dither pattern, a negative one the pixels the same positive fade drops, so two levels
+// drawn with fade and -fade cover the screen exactly once.
+uniform float lodFade;
+
+void LodFadeDiscard()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 cell = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[cell.y * 4 + cell.x] + 0.5) / 16.0;
+    if (lodFade > 0.0 && threshold >= lodFade)
+        discard;
+    if (lodFade < 0.0 && threshold < -lodFade)
+        discard;
+}
+
 vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
     vec3 lightDir = normalize(-light.direction);
@@ -35,20 +72,21 @@ vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * material.specular;
+    vec3 ambient = light.ambient * vec3(MATERIAL_TEXTURE(material.texture_diffuse1, DIFFUSE_LAYER, TexCoords));
+    vec3 diffuse = light.diffuse * diff * vec3(MATERIAL_TEXTURE(material.texture_diffuse1, DIFFUSE_LAYER, TexCoords));
+    vec3 specular = light.specular * spec * materialParameters.specular.rgb;
     return (ambient + diffuse + specular);
 }
 
 void main()
 {
-    vec3 normal = texture(material.texture_normal1, TexCoords).rgb;
+    LodFadeDiscard();
+    vec3 normal = MATERIAL_TEXTURE(material.texture_normal1, NORMAL_LAYER, TexCoords).rgb;
     normal = normalize(Normal);
     vec3 viewDir = normalize(viewPosition - FragPos);
     vec3 result = CalcDirectionalLight(directionalLight, normal, FragPos, viewDir);
-    vec3 emissive = vec3(texture(material.texture_emissive1, TexCoords))*0.1;
+    vec3 emissive = vec3(MATERIAL_TEXTURE(material.texture_emissive1, EMISSIVE_LAYER, TexCoords))*materialParameters.emissiveStrength;
     FragColor = vec4(result+emissive, 1.0f);
 }
\ No newline at end of file
@@ -8,14 +8,43 @@ struct DirectionalLight {
     vec3 ambient;
 };
 
+// the glow of a pumpkin, fades out at its radius
+struct PointLight {
+    vec3 position;
+    vec3 color;
+    float radius;
+};
+
+// the TEXTURE_ARRAYS variant samples layers of texture arrays, see Mesh::BindTextures
+#ifdef TEXTURE_ARRAYS
+#define MATERIAL_SAMPLER sampler2DArray
+flat in int MaterialLayers[5];
+#define MATERIAL_TEXTURE(sampler, slot, uv) texture(sampler, vec3(uv, MaterialLayers[slot]))
+#else
+#define MATERIAL_SAMPLER sampler2D
+#define MATERIAL_TEXTURE(sampler, slot, uv) texture(sampler, uv)
+#endif
+#define DIFFUSE_LAYER 0
+#define SPECULAR_LAYER 1
+#define NORMAL_LAYER 2
+#define HEIGHT_LAYER 3
+#define EMISSIVE_LAYER 4
+
 struct Material {
-    sampler2D texture_diffuse1;
-    sampler2D texture_height1;
-    sampler2D texture_normal1;
-    vec3 specular;
-    float shininess;
+    MATERIAL_SAMPLER texture_diffuse1;
+    MATERIAL_SAMPLER texture_height1;
+    MATERIAL_SAMPLER texture_normal1;
 };
 
+// per-material parameters, written once into a uniform buffer by rg::MaterialLibrary
+layout (std140) uniform MaterialBlock {
+    vec4 specular;
+    float shininess;
+    float alpha;
+    float emissiveStrength;
+    float parallaxScale;
+} materialParameters;
+
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
@@ -25,13 +54,32 @@ in vec3 Bitangent;
 uniform DirectionalLight directionalLight;
 uniform Material material;
 uniform vec3 viewPosition;
+uniform PointLight pumpkinLights[2];
+// per draw, whether the scene BVH found the object within reach of each pumpkin
+uniform bool pumpkinLightEnabled[2];
+
+// LOD cross-fade, 0 draws every pixel. A positive fade keeps that fraction of a 4x4 ordered
+// dither pattern, a negative one the pixels the same positive fade drops, so two levels
+// drawn with fade and -fade cover the screen exactly once.
+uniform float lodFade;
+
+void LodFadeDiscard()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 cell = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[cell.y * 4 + cell.x] + 0.5) / 16.0;
+    if (lodFade > 0.0 && threshold >= lodFade)
+        discard;
+    if (lodFade < 0.0 && threshold < -lodFade)
+        discard;
+}
 
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir) {
     // Obtain height from the height map
-    float height = texture(material.texture_height1, texCoords).r;
-    // Scale and bias to create the displacement effect
-    float parallaxScale = 0.05;  // Adjust this value to control the strength of the effect
-    vec2 p = viewDir.xy * (height * parallaxScale);
+    float height = MATERIAL_TEXTURE(material.texture_height1, HEIGHT_LAYER, texCoords).r;
+    // Scale and bias to create the displacement effect, the material sets its strength
+    vec2 p = viewDir.xy * (height * materialParameters.parallaxScale);
     return texCoords - p;
 }
 
@@ -41,16 +89,31 @@ vec3 CalcDirectionalLight(DirectionalLight light, vec3 normal, vec3 fragPos, vec
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * material.specular;
+    vec3 ambient = light.ambient * vec3(MATERIAL_TEXTURE(material.texture_diffuse1, DIFFUSE_LAYER, TexCoords));
+    vec3 diffuse = light.diffuse * diff * vec3(MATERIAL_TEXTURE(material.texture_diffuse1, DIFFUSE_LAYER, TexCoords));
+    vec3 specular = light.specular * spec * materialParameters.specular.rgb;
     return (ambient + diffuse + specular);
 }
 
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
+    vec3 toLight = light.position - fragPos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / max(distance, 0.0001);
+    float falloff = clamp(1.0 - distance / light.radius, 0.0, 1.0);
+    float attenuation = falloff * falloff;
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialParameters.shininess);
+    vec3 diffuse = light.color * diff * vec3(MATERIAL_TEXTURE(material.texture_diffuse1, DIFFUSE_LAYER, TexCoords));
+    vec3 specular = light.color * spec * materialParameters.specular.rgb;
+    return attenuation * (diffuse + specular);
+}
+
 void main()
 {
+    LodFadeDiscard();
     // Adjust the texture coordinates using parallax mapping
     vec3 viewDir = normalize(viewPosition - FragPos);
     vec2 parallaxTexCoords = ParallaxMapping(TexCoords, viewDir);
@@ -63,9 +126,13 @@ void main()
     mat3 TBN = mat3(T, B, N);
 
     // Fetch normal and diffuse texture after parallax mapping adjustment
-    vec3 normal = texture(material.texture_normal1, parallaxTexCoords).rgb;
-    normal = normalize(normal * 2.0 - 1.0);  // Convert to [-1, 1] range
+    // only XY are read, Z is rebuilt so BC5 normal maps (two channels) work as well
+    vec2 normalXY = MATERIAL_TEXTURE(material.texture_normal1, NORMAL_LAYER, parallaxTexCoords).rg * 2.0 - 1.0;  // Convert to [-1, 1] range
+    vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
     normal = normalize(TBN * normal); // Transform normal to world space
     vec3 result = CalcDirectionalLight(directionalLight, normal, FragPos, viewDir);
+    for (int i = 0; i < 2; i++)
+        if (pumpkinLightEnabled[i])
+            result += CalcPointLight(pumpkinLights[i], normal, FragPos, viewDir);
     FragColor = vec4(result, 1.0);
 }
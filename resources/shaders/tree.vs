@@ -11,10 +11,19 @@ out vec3 FragPos;
 out vec3 Tangent;
 out vec3 Bitangent;
 
+#ifdef TEXTURE_ARRAYS
+// layer of each material texture in its array: diffuse, specular, normal, height, emissive
+layout (location = 9) in int aMaterialLayers[5];
+flat out int MaterialLayers[5];
+#endif
+
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// matches depth_prepass.vs, the main pass tests against its depth with GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
@@ -22,5 +31,8 @@ void main()
     TexCoords = aTexCoords;
     Tangent = aTangent;
     Bitangent = aBitangent;
+#ifdef TEXTURE_ARRAYS
+    MaterialLayers = aMaterialLayers;
+#endif
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
@@ -0,0 +1,38 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec3 aTangent;
+layout (location = 4) in vec3 aBitangent;
+layout (location = 5) in mat4 instanceModel;
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 FragPos;
+out vec3 Tangent;
+out vec3 Bitangent;
+
+#ifdef TEXTURE_ARRAYS
+// layer of each material texture in its array: diffuse, specular, normal, height, emissive
+layout (location = 9) in int aMaterialLayers[5];
+flat out int MaterialLayers[5];
+#endif
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// matches depth_prepass.vs, the main pass tests against its depth with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    FragPos = vec3(instanceModel * vec4(aPos, 1.0));
+    Normal = aNormal;
+    TexCoords = aTexCoords;
+    Tangent = aTangent;
+    Bitangent = aBitangent;
+#ifdef TEXTURE_ARRAYS
+    MaterialLayers = aMaterialLayers;
+#endif
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -13,8 +13,31 @@
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
-
+#include <rg/GLExt.h>
+#include <rg/GpuCulling.h>
+#include <rg/GpuMemory.h>
+#include <rg/GpuProfiler.h>
+#include <rg/HlodClusters.h>
+#include <rg/Impostors.h>
+#include <rg/LodSelection.h>
+#include <rg/Material.h>
+#include <rg/Benchmark.h>
+#include <rg/MeshProcessing.h>
+#include <rg/ObjLoader.h>
+#include <rg/OcclusionQueries.h>
+#include <rg/OverdrawView.h>
+#include <rg/SceneBVH.h>
+#include <rg/SoftwareOcclusion.h>
+#include <rg/StaticBatching.h>
+#include <rg/TextureStreaming.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <initializer_list>
 #include <iostream>
+#include <random>
+#include <thread>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 
@@ -26,6 +49,8 @@ void processInput(GLFWwindow *window);
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
@@ -94,6 +119,28 @@ struct ProgramState {
     float moonScale = 2.0f;
     glm::vec3 groundPosition = glm::vec3(0.0,-16.0,0.0);
     float groundScale = 10.0f;
+    // scattered tree and pumpkin instances, culled on the GPU when compute shaders are available
+    int propCount = 500;
+    bool gpuCulling = true;
+    bool hiZCulling = true;
+    // ground, trees and pumpkins merged into world space batches, one draw per material
+    bool staticBatching = true;
+    // far clusters of scattered props drawn as their merged proxies
+    bool hlod = true;
+    // the hand-placed props at full detail drawn meshlet by meshlet, without the backfacing,
+    // off-screen and occluded ones
+    bool meshletCulling = true;
+    // the materials marked for it draw into a depth prepass first, see rg::Material::depthPrepass
+    bool depthPrepass = true;
+    // fragments per pixel or the last material drawn shown instead of the shaded frame
+    bool overdrawView = false;
+    // rg::texture::Quality the textures are loaded at, takes effect on the next start
+    int textureQuality = 0;
+    // material textures packed into texture arrays, takes effect on the next start
+    bool textureArrays = false;
+    // rg::LodSettings::bias of the prop LODs, positive values draw coarser levels
+    float lodBias = 0.0f;
+    bool lodCrossFade = true;
     DirectionalLight directionalLight;
     ProgramState()
             : camera(glm::vec3(0.0f, 0.0f, 3.0f)) {}
@@ -114,7 +161,11 @@ void ProgramState::SaveToFile(std::string filename) {
         << camera.Position.z << '\n'
         << camera.Front.x << '\n'
         << camera.Front.y << '\n'
-        << camera.Front.z << '\n';
+        << camera.Front.z << '\n'
+        << textureQuality << '\n'
+        << textureArrays << '\n'
+        << lodBias << '\n'
+        << lodCrossFade << '\n';
 }
 
 void ProgramState::LoadFromFile(std::string filename) {
@@ -129,29 +180,465 @@ void ProgramState::LoadFromFile(std::string filename) {
            >> camera.Position.z
            >> camera.Front.x
            >> camera.Front.y
-           >> camera.Front.z;
+           >> camera.Front.z
+           >> textureQuality
+           >> textureArrays
+           >> lodBias
+           >> lodCrossFade;
+        textureQuality = std::min(std::max(textureQuality, 0), (int) rg::texture::Quality::Quarter);
+    }
+}
+
+// one of the material textures set up by hand, a 2D texture or a layer of the texture arrays
+struct HandTexture {
+    rg::GLTexture texture;
+    rg::TextureArrayPool::Layer layer;
+
+    explicit HandTexture(rg::GLTexture texture) : texture(std::move(texture)) {}
+
+    GLuint Get() const {
+        return texture.Get();
+    }
+
+    // switches to the texture's layer in a built pool and lets go of the 2D texture
+    void MoveTo(const rg::TextureArrayPool &pool) {
+        layer = pool.Find(texture.Get());
+        if (layer.Valid())
+            texture.Reset();
+    }
+
+    // the texture in a material's texture set, its layer once it moved to a pool
+    rg::Material::Texture ForMaterial(const std::string &sampler, MaterialLayerSlot slot) const {
+        return rg::Material::Texture(sampler, texture.Get(), layer, slot);
+    }
+};
+
+// individually drawn objects, kept in a BVH for culling, picking and light assignment
+struct SceneState {
+    rg::SceneBVH bvh;
+    std::vector<std::string> names;
+    std::vector<const Model *> models;
+    std::vector<glm::mat4> transforms;
+    std::vector<char> visible;
+    int picked = -1;
+    ModelHit pickedHit;
+    bool pickRequested = false;
+    glm::vec2 pickCursor = glm::vec2(0.0f);
+    // objects within reach of each pumpkin's glow, only they shade its point light
+    float pumpkinLightRadius = 20.0f;
+    glm::vec3 pumpkinLightColor = glm::vec3(1.0f, 0.45f, 0.1f);
+    std::vector<int> litByPumpkin[2];
+
+    int Add(const std::string &name, const Model &model) {
+        names.push_back(name);
+        models.push_back(&model);
+        transforms.push_back(glm::mat4(1.0f));
+        visible.push_back(1);
+        // real bounds come with the first Update(), the tree is built on the first Commit()
+        return bvh.Insert(rg::AABB());
+    }
+
+    void Update(int object, const glm::mat4 &transform) {
+        transforms[object] = transform;
+        bvh.Update(object, models[object]->bounds.Transformed(transform));
+    }
+};
+
+// batch ray throughput against a model's triangle BVHs
+void benchmarkRaycasts(Model &model, const std::string &name)
+{
+    rg::bench::Timer buildTimer;
+    for (Mesh &mesh : model.meshes)
+        mesh.BuildBVH();
+    size_t triangles = 0;
+    for (const Mesh &mesh : model.meshes)
+        triangles += mesh.indices.size() / 3;
+    rg::bench::Report(name + " BVH build (" + std::to_string(triangles) + " triangles)", buildTimer.ElapsedMs(), "ms");
+
+    // rays from a sphere around the model towards random points inside its bounds
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    glm::vec3 center = model.bounds.Center();
+    float radius = glm::length(model.bounds.Extent()) * 2.0f;
+    std::vector<rg::Ray> rays(200000);
+    for (rg::Ray &ray : rays) {
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f);
+        glm::vec3 target = model.bounds.min + (model.bounds.max - model.bounds.min) *
+                                              glm::vec3(unit(random), unit(random), unit(random));
+        ray.origin = center + direction * radius;
+        ray.direction = glm::normalize(target - ray.origin);
+    }
+
+    rg::bench::Timer rayTimer;
+    size_t hits = 0;
+    for (const rg::Ray &ray : rays)
+        hits += model.Raycast(ray).Hit();
+    double ms = rayTimer.ElapsedMs();
+    rg::bench::Report(name + " raycast", rays.size() / (ms * 1000.0), "Mrays/s");
+    rg::bench::Report(name + " raycast hit rate", 100.0 * hits / rays.size(), "%");
+}
+
+// OBJ import throughput for growing thread counts against the Assimp import model.h used before
+void benchmarkObjImport(const std::string &path, const std::string &name)
+{
+    rg::MappedFile file(path);
+    double megabytes = file.Size() / (1024.0 * 1024.0);
+    auto bestOf = [](int runs, const std::function<void()> &load) {
+        double best = 1e30;
+        for (int i = 0; i < runs; i++) {
+            rg::bench::Timer timer;
+            load();
+            best = std::min(best, timer.ElapsedMs());
+        }
+        return best;
+    };
+
+    double assimpMs = bestOf(3, [&]() {
+        Assimp::Importer importer;
+        importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    });
+    rg::bench::Report(name + " Assimp import", megabytes / (assimpMs / 1000.0), "MB/s");
+
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < rg::ThreadPool::DefaultThreadCount(); threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(rg::ThreadPool::DefaultThreadCount());
+    double singleThreadMs = 0.0;
+    for (unsigned int threads : threadCounts) {
+        rg::ThreadPool pool(threads);
+        double ms = bestOf(5, [&]() {
+            rg::obj::Scene scene;
+            rg::obj::Load(path, scene, rg::obj::AllSteps, pool);
+        });
+        if (threads == 1)
+            singleThreadMs = ms;
+        std::string label = name + " OBJ import " + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+        rg::bench::Report(label, megabytes / (ms / 1000.0), "MB/s");
+        rg::bench::Report(label + " speedup", singleThreadMs / ms, "x");
+        rg::bench::Report(label + " speedup over Assimp", assimpMs / ms, "x");
+    }
+}
+
+// compares the OBJ importer against Assimp: topology and vertex data have to match exactly,
+// tangents only up to the summation order of the smoothing
+void checkObjImport(const std::string &path, const std::string &name)
+{
+    Assimp::Importer importer;
+    const aiScene *reference = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    rg::obj::Scene scene;
+    if (!reference || !rg::obj::Load(path, scene)) {
+        cout << "OBJ import check of " << path << " failed to load" << endl;
+        return;
+    }
+    size_t mismatches = std::abs((int) reference->mNumMeshes - (int) scene.meshes.size());
+    float tangentError = 0.0f;
+    for (unsigned int m = 0; m < std::min<size_t>(reference->mNumMeshes, scene.meshes.size()); m++) {
+        const aiMesh *expected = reference->mMeshes[m];
+        const rg::obj::Mesh &mesh = scene.meshes[m];
+        if (expected->mNumVertices != mesh.positions.size() || expected->mNumFaces * 3 != mesh.indices.size()) {
+            mismatches++;
+            continue;
+        }
+        for (unsigned int f = 0; f < expected->mNumFaces; f++)
+            for (unsigned int k = 0; k < 3; k++)
+                mismatches += expected->mFaces[f].mIndices[k] != mesh.indices[3 * f + k];
+        auto same = [](const aiVector3D &a, const glm::vec3 &b) {
+            return a.x == b.x && a.y == b.y && a.z == b.z;
+        };
+        for (unsigned int v = 0; v < expected->mNumVertices; v++) {
+            mismatches += !same(expected->mVertices[v], mesh.positions[v]);
+            mismatches += expected->mNormals && !same(expected->mNormals[v], mesh.normals[v]);
+            if (!expected->mTextureCoords[0] || mesh.texCoords.empty()) {
+                mismatches += (expected->mTextureCoords[0] != nullptr) != !mesh.texCoords.empty();
+                continue;
+            }
+            mismatches += expected->mTextureCoords[0][v].x != mesh.texCoords[v].x || expected->mTextureCoords[0][v].y != mesh.texCoords[v].y;
+            glm::vec3 tangent(expected->mTangents[v].x, expected->mTangents[v].y, expected->mTangents[v].z);
+            glm::vec3 bitangent(expected->mBitangents[v].x, expected->mBitangents[v].y, expected->mBitangents[v].z);
+            tangentError = std::max(tangentError, glm::length(tangent - mesh.tangents[v]));
+            tangentError = std::max(tangentError, glm::length(bitangent - mesh.bitangents[v]));
+        }
     }
+    rg::bench::Report(name + " OBJ import mismatches against Assimp", mismatches, "");
+    rg::bench::Report(name + " OBJ import max tangent difference", tangentError, "");
+}
+
+// Normal and tangent kernels against Assimp's GenSmoothNormals and CalcTangentSpace. The angle
+// weighting and the MikkTSpace style frames differ from Assimp by design, so the report is the
+// angular deviation rather than a mismatch count, plus the time of both on the same meshes.
+void checkVertexKernels(const std::string &path, const std::string &name)
+{
+    Assimp::Importer importer;
+    rg::bench::Timer plainTimer;
+    importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    double plainMs = plainTimer.ElapsedMs();
+    rg::bench::Timer fullTimer;
+    const aiScene *reference = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    double assimpMs = std::max(0.0, fullTimer.ElapsedMs() - plainMs);
+    rg::obj::Scene scene;
+    if (!reference || !rg::obj::Load(path, scene, 0) || reference->mNumMeshes != scene.meshes.size()) {
+        cout << "vertex kernel check of " << path << " failed to load" << endl;
+        return;
+    }
+
+    auto angle = [](const aiVector3D &a, const glm::vec3 &b) {
+        glm::vec3 expected(a.x, a.y, a.z);
+        if (glm::length(expected) == 0.0f || glm::length(b) == 0.0f)
+            return 0.0f;
+        return glm::degrees(std::acos(glm::clamp(glm::dot(glm::normalize(expected), glm::normalize(b)), -1.0f, 1.0f)));
+    };
+    double kernelMs = 0.0, normalSum = 0.0, tangentSum = 0.0;
+    float normalMax = 0.0f;
+    size_t normalCount = 0, normalsClose = 0, tangentCount = 0, tangentsClose = 0, triangles = 0;
+    for (unsigned int m = 0; m < reference->mNumMeshes; m++) {
+        const aiMesh *expected = reference->mMeshes[m];
+        const rg::obj::Mesh &mesh = scene.meshes[m];
+        if (expected->mNumVertices != mesh.positions.size())
+            continue;
+        triangles += mesh.indices.size() / 3;
+        rg::Arena arena(rg::geometry::ArenaBytes(mesh.positions.size(), mesh.indices.size() / 3));
+        rg::geometry::VertexStreams streams(arena, mesh.positions.size());
+        for (size_t i = 0; i < mesh.positions.size(); i++) {
+            streams.px[i] = mesh.positions[i].x;
+            streams.py[i] = mesh.positions[i].y;
+            streams.pz[i] = mesh.positions[i].z;
+            if (!mesh.texCoords.empty()) {
+                streams.u[i] = mesh.texCoords[i].x;
+                streams.v[i] = mesh.texCoords[i].y;
+            }
+        }
+
+        // normals are always generated here, Assimp only generates them for meshes without any
+        rg::bench::Timer timer;
+        rg::geometry::GenerateNormals(streams, mesh.indices, arena);
+        kernelMs += timer.ElapsedMs();
+        if (mesh.normals.empty()) {
+            for (size_t i = 0; i < mesh.positions.size(); i++) {
+                float difference = angle(expected->mNormals[i], glm::vec3(streams.nx[i], streams.ny[i], streams.nz[i]));
+                normalSum += difference;
+                normalMax = std::max(normalMax, difference);
+                normalsClose += difference < 5.0f;
+                normalCount++;
+            }
+        }
+
+        if (mesh.texCoords.empty() || !expected->mTangents)
+            continue;
+        // tangents are compared over the normals both sides used
+        for (size_t i = 0; i < mesh.positions.size(); i++) {
+            streams.nx[i] = expected->mNormals[i].x;
+            streams.ny[i] = expected->mNormals[i].y;
+            streams.nz[i] = expected->mNormals[i].z;
+        }
+        timer = rg::bench::Timer();
+        rg::geometry::GenerateTangents(streams, mesh.indices, arena);
+        kernelMs += timer.ElapsedMs();
+        for (size_t i = 0; i < mesh.positions.size(); i++) {
+            float difference = angle(expected->mTangents[i], glm::vec3(streams.tx[i], streams.ty[i], streams.tz[i]));
+            tangentSum += difference;
+            tangentsClose += difference < 10.0f;
+            tangentCount++;
+        }
+    }
+
+    std::string label = name + " vertex kernels (" + rg::geometry::SimdPath() + ")";
+    rg::bench::Report(label, triangles / (kernelMs * 1000.0), "Mtris/s");
+    rg::bench::Report(label + " speedup over Assimp", assimpMs / kernelMs, "x");
+    if (normalCount > 0) {
+        rg::bench::Report(name + " generated normals mean deviation", normalSum / normalCount, "deg");
+        rg::bench::Report(name + " generated normals max deviation", normalMax, "deg");
+        rg::bench::Report(name + " generated normals within 5 deg", 100.0 * normalsClose / normalCount, "%");
+    }
+    if (tangentCount > 0) {
+        rg::bench::Report(name + " tangents mean deviation", tangentSum / tangentCount, "deg");
+        rg::bench::Report(name + " tangents within 10 deg", 100.0 * tangentsClose / tangentCount, "%");
+    }
+}
+
+// offline block compression of a texture: encoder throughput, size and error against the source,
+// and the upload of the baked mip chain against uploading RGBA8 and generating the mips at runtime
+void benchmarkTextureCompression(const std::string &path, const std::string &name, rg::texture::Usage usage)
+{
+    int width, height, channels;
+    unsigned char *pixels = stbi_load(path.c_str(), &width, &height, &channels, 0);
+    if (!pixels)
+        return;
+    double encodeMs = 1e30;
+    rg::texture::CompressedImage compressed;
+    for (int run = 0; run < 3; run++) {
+        rg::bench::Timer timer;
+        compressed = rg::texture::Compress(pixels, width, height, channels, usage);
+        encodeMs = std::min(encodeMs, timer.ElapsedMs());
+    }
+    rg::bench::Report(name + " BC encode", width * height / (encodeMs * 1000.0), "Mpixels/s");
+
+    // the uncompressed chain as the driver stores it, RGB padded to 4 bytes
+    size_t uncompressedBytes = 0;
+    for (int w = width, h = height; ; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+        uncompressedBytes += (size_t) w * h * (channels == 3 ? 4 : channels);
+        if (w == 1 && h == 1)
+            break;
+    }
+    rg::bench::Report(name + " BC size reduction", (double) uncompressedBytes / compressed.Bytes(), "x");
+
+    std::vector<unsigned char> decoded = rg::texture::Decompress(compressed, 0);
+    int compared = usage == rg::texture::Usage::NormalMap ? 2 : channels;
+    double squaredError = 0.0;
+    for (size_t i = 0; i < (size_t) width * height; i++)
+        for (int k = 0; k < compared; k++) {
+            double difference = decoded[4 * i + k] - pixels[i * channels + k];
+            squaredError += difference * difference;
+        }
+    double meanSquaredError = std::max(1e-10, squaredError / ((double) width * height * compared));
+    rg::bench::Report(name + " BC PSNR", 10.0 * std::log10(255.0 * 255.0 / meanSquaredError), "dB");
+
+    GLenum format = channels == 1 ? GL_RED : (channels == 3 ? GL_RGB : GL_RGBA);
+    glFinish();
+    rg::bench::Timer uncompressedTimer;
+    {
+        rg::GLTexture texture = rg::GLTexture::Create();
+        glBindTexture(GL_TEXTURE_2D, texture.Get());
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFinish();
+    }
+    double uncompressedMs = uncompressedTimer.ElapsedMs();
+    rg::bench::Report(name + " RGBA8 upload with glGenerateMipmap", uncompressedMs, "ms");
+    if (rg::texture::Supported(compressed.internalFormat)) {
+        rg::bench::Timer compressedTimer;
+        {
+            rg::GLTexture texture = rg::GLTexture::Create();
+            glBindTexture(GL_TEXTURE_2D, texture.Get());
+            rg::texture::Upload(compressed);
+            glFinish();
+        }
+        double compressedMs = compressedTimer.ElapsedMs();
+        rg::bench::Report(name + " BC upload with baked mips", compressedMs, "ms");
+        rg::bench::Report(name + " BC upload speedup", uncompressedMs / compressedMs, "x");
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    stbi_image_free(pixels);
+}
+
+// mip chain of a texture generated on the CPU, by itself and including the upload, against the
+// upload with glGenerateMipmap (slow on software rasterizers like llvmpipe)
+void benchmarkMipGeneration(const std::string &path, const std::string &name, rg::texture::Usage usage)
+{
+    int width, height, channels;
+    unsigned char *pixels = stbi_load(path.c_str(), &width, &height, &channels, 0);
+    if (!pixels)
+        return;
+    auto bestOf = [](int runs, const std::function<void()> &run) {
+        double best = 1e30;
+        for (int i = 0; i < runs; i++) {
+            rg::bench::Timer timer;
+            run();
+            best = std::min(best, timer.ElapsedMs());
+        }
+        return best;
+    };
+    std::vector<unsigned int> threadCounts = {1};
+    if (rg::ThreadPool::DefaultThreadCount() > 1)
+        threadCounts.push_back(rg::ThreadPool::DefaultThreadCount());
+    for (unsigned int threads : threadCounts) {
+        rg::ThreadPool pool(threads);
+        double ms = bestOf(3, [&]() { rg::texture::GenerateMips(pixels, width, height, channels, usage, pool); });
+        rg::bench::Report(name + " CPU mips " + std::to_string(threads) + (threads == 1 ? " thread" : " threads"),
+                          width * height / (ms * 1000.0), "Mpixels/s");
+    }
+
+    GLenum format = channels == 1 ? GL_RED : (channels == 3 ? GL_RGB : GL_RGBA);
+    auto upload = [&](bool cpuMipmaps) {
+        glFinish();
+        rg::bench::Timer timer;
+        rg::GLTexture texture = rg::GLTexture::Create();
+        glBindTexture(GL_TEXTURE_2D, texture.Get());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        if (cpuMipmaps) {
+            std::vector<std::vector<unsigned char>> mips = rg::texture::GenerateMips(pixels, width, height, channels, usage);
+            for (size_t level = 0; level < mips.size(); level++)
+                glTexImage2D(GL_TEXTURE_2D, level + 1, format, std::max(1, width >> (level + 1)),
+                             std::max(1, height >> (level + 1)), 0, format, GL_UNSIGNED_BYTE, mips[level].data());
+        } else {
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glFinish();
+        return timer.ElapsedMs();
+    };
+    double driverMs = 1e30, cpuMs = 1e30;
+    for (int run = 0; run < 3; run++) {
+        driverMs = std::min(driverMs, upload(false));
+        cpuMs = std::min(cpuMs, upload(true));
+    }
+    rg::bench::Report(name + " upload with glGenerateMipmap", driverMs, "ms");
+    rg::bench::Report(name + " upload with CPU mips", cpuMs, "ms");
+    rg::bench::Report(name + " CPU mips speedup over glGenerateMipmap", driverMs / cpuMs, "x");
+    glBindTexture(GL_TEXTURE_2D, 0);
+    stbi_image_free(pixels);
 }
 
 ProgramState *programState;
+SceneState *sceneState;
+rg::InstanceCuller *treeCuller = nullptr;
+rg::InstanceCuller *pumpkinCuller = nullptr;
+rg::HlodClusters *hlodClusters = nullptr;
+// meshlets of the hand-placed props tested in the last frame
+rg::geometry::MeshletStats meshletStats;
+// materials the render loop draws in the depth prepass when they are marked for it
+std::vector<uint16_t> depthPrepassMaterials;
+// the overdraw debug view and the counts it read back last
+rg::OverdrawView *overdrawView = nullptr;
+rg::OverdrawView::Stats overdrawStats;
+rg::OcclusionQueries *occlusionQueries = nullptr;
+rg::SoftwareOcclusion *softwareOcclusion = nullptr;
+// owned by main, set while the render loop runs
+rg::TextureArrayPool *textureArrayPool = nullptr;
+rg::MaterialLibrary *materialLibrary = nullptr;
 void DrawImGui(ProgramState *programState);
 void renderQuad();
+rg::GLVertexArray quadVAO;
+rg::GLBuffer quadVBO;
 
-unsigned int loadCubemap(std::vector<std::string> faces)
+// deterministic random placement of props around the scene
+std::vector<glm::mat4> scatterProps(int count, float height, float minScale, float maxScale, unsigned int seed)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> position(-90.0f, 90.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+    std::uniform_real_distribution<float> scale(minScale, maxScale);
+
+    std::vector<glm::mat4> transforms;
+    transforms.reserve(count);
+    for (int i = 0; i < count; i++) {
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, glm::vec3(position(random), height, position(random)));
+        model = glm::rotate(model, glm::radians(angle(random)), glm::vec3(0.0f, 1.0f, 0.0f));
+        model = glm::scale(model, glm::vec3(scale(random)));
+        transforms.push_back(model);
+    }
+    return transforms;
+}
+
+rg::GLTexture loadCubemap(std::vector<std::string> faces)
+{
+    rg::GLTexture texture = rg::GLTexture::Create();
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture.Get());
 
     int width, height, nrChannels;
+    size_t bytes = 0;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
         unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
         if (data)
         {
+            // the faces are all the same size, so they're reduced the same way
+            std::vector<unsigned char> reduced = rg::texture::Reduce(data, width, height, nrChannels, rg::texture::Usage::Color);
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                         0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
+                         0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, reduced.empty() ? data : reduced.data()
             );
+            bytes += (size_t) width * height * 4;
             stbi_image_free(data);
         }
         else
@@ -165,16 +652,527 @@ unsigned int loadCubemap(std::vector<std::string> faces)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    rg::GpuMemory::Instance().TrackTexture(texture.Get(), rg::GpuMemory::MaterialTexture, bytes);
+
+    return texture;
+}
+
+
+
+// the scene's hand set up textures, loaded again by the texture benchmarks
+struct BenchTexture {
+    const char *name;
+    const char *directory;
+    rg::texture::Usage usage;
+};
+static const BenchTexture benchTextures[] = {
+        {"gr_diffuse.jpg", "resources/objects/ground", rg::texture::Usage::Color},
+        {"specular.png", "resources/objects/ground", rg::texture::Usage::Data},
+        {"tree_diff.jpg", "resources/objects/tree", rg::texture::Usage::Color},
+        {"tree_height.jpg", "resources/objects/tree", rg::texture::Usage::Data},
+        {"tree_normal.jpg", "resources/objects/tree", rg::texture::Usage::NormalMap},
+        {"Pumpkin_diff_sketfab.jpg", "resources/objects/bundeva", rg::texture::Usage::Color},
+        {"Pumpkin_lum_Sketchfab.jpg", "resources/objects/bundeva", rg::texture::Usage::Color},
+        {"Pumpkin_nrml.jpg", "resources/objects/bundeva", rg::texture::Usage::NormalMap}};
+
+// load time and texture memory of the hand set up textures and the skybox at every quality tier
+void benchmarkTextureQuality(const std::vector<std::string> &skyBoxSides)
+{
+    rg::texture::Quality configured = rg::texture::GlobalQuality();
+    rg::GpuMemory &gpuMemory = rg::GpuMemory::Instance();
+    for (int tier = 0; tier <= (int) rg::texture::Quality::Quarter; tier++) {
+        rg::texture::GlobalQuality() = (rg::texture::Quality) tier;
+        size_t bytesBefore = gpuMemory.Total(rg::GpuMemory::MaterialTexture);
+        glFinish();
+        rg::bench::Timer timer;
+        std::vector<rg::GLTexture> loaded;
+        for (const BenchTexture &texture : benchTextures)
+            loaded.push_back(TextureFromFile(texture.name, texture.directory, false, texture.usage));
+        loaded.push_back(loadCubemap(skyBoxSides));
+        glFinish();
+        double ms = timer.ElapsedMs();
+        std::string label = std::string("textures at ") + rg::texture::QualityName((rg::texture::Quality) tier) + " quality";
+        rg::bench::Report(label + " load", ms, "ms");
+        rg::bench::Report(label + " GPU memory", (gpuMemory.Total(rg::GpuMemory::MaterialTexture) - bytesBefore) / (1024.0 * 1024.0), "MB");
+    }
+    rg::texture::GlobalQuality() = configured;
+}
+
+// streamed loading of the same textures: load time and memory with only the small mips, then how
+// long it takes until a close up view of all of them is sharp, with Update() running once per
+// 60 Hz frame. Last the pool is halved and has to hold while everything is still asked for.
+void benchmarkTextureStreaming()
+{
+    rg::TextureStreamer &streamer = rg::TextureStreamer::Instance();
+    bool enabled = streamer.enabled;
+    int poolMB = streamer.poolMB;
+    streamer.enabled = true;
+    glFinish();
+    rg::bench::Timer loadTimer;
+    std::vector<rg::GLTexture> loaded;
+    for (const BenchTexture &texture : benchTextures)
+        loaded.push_back(TextureFromFile(texture.name, texture.directory, false, texture.usage));
+    glFinish();
+    rg::bench::Report("streamed textures load", loadTimer.ElapsedMs(), "ms");
+    rg::bench::Report("streamed textures initial GPU memory", streamer.ResidentBytes() / (1024.0 * 1024.0), "MB");
+
+    auto runFrames = [&](int maxFrames) {
+        int frames = 0;
+        do {
+            for (const rg::GLTexture &texture : loaded)
+                streamer.Request(texture.Get(), FLT_MAX);
+            streamer.Update();
+            glFinish();
+            frames++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(16));
+        } while (frames < maxFrames && !streamer.Settled());
+        return frames;
+    };
+    rg::bench::Timer streamTimer;
+    int frames = runFrames(2000);
+    rg::bench::Report("streamed textures time to full residency", streamTimer.ElapsedMs(), "ms");
+    rg::bench::Report("streamed textures frames to full residency", frames, "frames");
+    size_t fullBytes = streamer.ResidentBytes();
+    rg::bench::Report("streamed textures full GPU memory", fullBytes / (1024.0 * 1024.0), "MB");
+
+    streamer.poolMB = std::max<int>(1, (int) (fullBytes >> 21));
+    runFrames(120);
+    rg::bench::Report("streamed textures half pool size", streamer.poolMB, "MB");
+    rg::bench::Report("streamed textures half pool GPU memory", streamer.ResidentBytes() / (1024.0 * 1024.0), "MB");
+
+    loaded.clear();
+    streamer.enabled = enabled;
+    streamer.poolMB = poolMB;
+}
+
+// packs the textures of the scene's models into texture arrays and counts the texture binds of
+// one frame's worth of their draws, one 2D texture per mesh texture against the arrays the pool
+// actually has to bind
+void benchmarkTextureArrays(const std::vector<std::pair<const Model *, int>> &draws)
+{
+    rg::TextureArrayPool pool;
+    glFinish();
+    rg::bench::Timer timer;
+    size_t textures = 0;
+    for (const auto &draw : draws)
+        for (const Texture &texture : draw.first->textures_loaded)
+            textures += pool.Add(texture.id) ? 1 : 0;
+    pool.Build();
+    glFinish();
+    rg::bench::Report("texture arrays build (" + std::to_string(textures) + " textures)", timer.ElapsedMs(), "ms");
+    rg::bench::Report("texture arrays", pool.ArrayCount(), "arrays");
+    rg::bench::Report("texture arrays GPU memory", pool.Bytes() / (1024.0 * 1024.0), "MB");
+
+    size_t binds2D = 0;
+    pool.EndFrame();
+    for (const auto &draw : draws)
+        for (int i = 0; i < draw.second; i++)
+            for (const Mesh &mesh : draw.first->meshes)
+                for (size_t unit = 0; unit < mesh.textures.size(); unit++) {
+                    binds2D++;
+                    rg::TextureArrayPool::Layer layer = pool.Find(mesh.textures[unit].id);
+                    if (layer.Valid())
+                        pool.Bind(unit, layer.array);
+                }
+    pool.EndFrame();
+    glActiveTexture(GL_TEXTURE0);
+    rg::bench::Report("material texture binds per frame, 2D textures", binds2D, "binds");
+    rg::bench::Report("material texture binds per frame, texture arrays", pool.BindsLastFrame(), "binds");
+}
+
+// batches the scene's two trees and two pumpkins and counts the draw calls with and without batching
+void benchmarkStaticBatching(const Model &tree, const Model &pumpkin)
+{
+    std::vector<rg::StaticBatch::Instance> instances = {
+            {&tree, glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(20.0f, -13.0f, 8.0f)), glm::vec3(5.5f))},
+            {&tree, glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(-29.0f, -12.0f, 6.0f)), glm::vec3(4.5f))},
+            {&pumpkin, glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(8.0f, -10.0f, 14.0f)), glm::vec3(0.04f))},
+            {&pumpkin, glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(-34.0f, -8.0f, 10.0f)), glm::vec3(0.04f))}};
+    rg::StaticBatch batch;
+    glFinish();
+    rg::bench::Timer timer;
+    batch.Update(instances);
+    glFinish();
+    rg::bench::Report("static batch build (2 trees, 2 pumpkins)", timer.ElapsedMs(), "ms");
+    rg::bench::Report("static batch draws, separate meshes", batch.SeparateDrawCount(), "draws");
+    rg::bench::Report("static batch draws, batched", batch.meshes.size(), "draws");
+    rg::bench::Report("static batch culling ranges", batch.RangeCount(), "ranges");
+}
 
-    return textureID;
+// simplifies every mesh of a model without the cache and reports the triangles and error of each LOD
+void benchmarkLods(const Model &model, const std::string &name)
+{
+    std::vector<size_t> triangles(Model::LodErrors().size() + 1, 0);
+    std::vector<float> maxErrors(Model::LodErrors().size(), 0.0f);
+    rg::bench::Timer timer;
+    for (const Mesh &mesh : model.meshes) {
+        std::vector<std::vector<unsigned int>> levels;
+        std::vector<float> errors;
+        Model::SimplifyMesh(mesh, levels, errors);
+        triangles[0] += mesh.indices.size() / 3;
+        for (size_t level = 0; level < levels.size(); level++) {
+            triangles[level + 1] += levels[level].size() / 3;
+            maxErrors[level] = std::max(maxErrors[level], errors[level]);
+        }
+    }
+    rg::bench::Report(name + " LOD generation", timer.ElapsedMs(), "ms");
+    rg::bench::Report(name + " LOD0 triangles", triangles[0], "triangles");
+    for (size_t level = 1; level < triangles.size(); level++) {
+        std::string label = name + " LOD" + std::to_string(level);
+        rg::bench::Report(label + " triangles", triangles[level], "triangles");
+        rg::bench::Report(label + " triangle ratio", 100.0 * triangles[level] / std::max<size_t>(triangles[0], 1), "%");
+        // relative to the diagonal of the mesh bounds
+        rg::bench::Report(label + " error", 100.0 * maxErrors[level - 1], "% of diagonal");
+    }
 }
 
+// meshlets of a model and what their tests reject from views all around it, from outside the
+// bounds and from up close where the frustum only sees a part of it
+void benchmarkMeshlets(const Model &model, const std::string &name)
+{
+    size_t meshlets = 0, triangles = 0;
+    rg::bench::Timer timer;
+    for (const Mesh &mesh : model.meshes) {
+        std::vector<unsigned int> ordered;
+        meshlets += rg::geometry::BuildMeshlets(mesh.vertices.data(), mesh.vertices.size(), sizeof(Vertex),
+                                                mesh.indices, ordered).size();
+        triangles += mesh.indices.size() / 3;
+    }
+    rg::bench::Report(name + " meshlet build", timer.ElapsedMs(), "ms");
+    rg::bench::Report(name + " meshlets", meshlets, "meshlets");
+    rg::bench::Report(name + " triangles per meshlet", (double) triangles / std::max<size_t>(meshlets, 1), "triangles");
+
+    glm::vec3 center = model.bounds.Center();
+    float radius = glm::length(model.bounds.Extent());
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f * radius);
+    const int directions = 16;
+    for (float distance : {3.0f, 0.6f}) {
+        std::string label = name + (distance > 1.0f ? " meshlets, outside view" : " meshlets, close view");
+        rg::geometry::MeshletStats stats;
+        rg::bench::Timer cullTimer;
+        for (int i = 0; i < directions; i++) {
+            // around the model and slightly from above
+            float angle = 6.2831853f * i / directions;
+            glm::vec3 camera = center + distance * radius * glm::normalize(glm::vec3(std::sin(angle), 0.3f, std::cos(angle)));
+            glm::mat4 view = glm::lookAt(camera, center, glm::vec3(0.0f, 1.0f, 0.0f));
+            rg::geometry::MeshletView meshletView(projection * view, glm::mat4(1.0f), camera);
+            for (const Mesh &mesh : model.meshes)
+                for (const rg::geometry::Meshlet &meshlet : mesh.meshlets)
+                    rg::geometry::MeshletVisible(meshlet, meshletView, stats, [](const rg::AABB &) { return true; });
+        }
+        rg::bench::Report(label + ", cull time per view", cullTimer.ElapsedMs() * 1000.0 / directions, "us");
+        rg::bench::Report(label + ", backfacing", 100.0 * stats.backfacing / std::max<size_t>(stats.meshlets, 1), "% of meshlets");
+        rg::bench::Report(label + ", outside the frustum", 100.0 * stats.outside / std::max<size_t>(stats.meshlets, 1), "% of meshlets");
+        rg::bench::Report(label + ", triangles drawn", 100.0 * stats.drawnTriangles / std::max<size_t>(stats.triangles, 1), "% of triangles");
+    }
+}
+
+// trees scattered over a wedge in front of a camera at the origin looking down -Z, at the same
+// density everywhere so more trees only reach further out
+std::vector<glm::mat4> benchmarkTreeField(int count)
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float nearRadius = 10.0f, farRadius = std::sqrt(nearRadius * nearRadius + 2.0f * count);
+    std::vector<glm::mat4> transforms;
+    for (int i = 0; i < count; i++) {
+        float radius = std::sqrt(nearRadius * nearRadius + unit(random) * (farRadius * farRadius - nearRadius * nearRadius));
+        float angle = (unit(random) - 0.5f) * 0.6f;
+        glm::vec3 position(radius * std::sin(angle), -13.0f, -radius * std::cos(angle));
+        transforms.push_back(glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(4.5f)));
+    }
+    return transforms;
+}
+
+// scatters more and more trees over a growing area in front of the camera and counts the triangles
+// the CPU culling path submits for them, with and without LOD selection
+void benchmarkLodSelection(Model &tree)
+{
+    rg::InstanceCuller culler(tree, nullptr);
+    culler.SetUseGpu(false);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 1000.0f);
+    glm::mat4 viewProjection = projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    rg::LodView view(glm::vec3(0.0f), 45.0f, SCR_HEIGHT, 0.0f);
+    rg::LodSettings &settings = rg::GlobalLodSettings();
+    rg::LodSettings configured = settings;
+    for (int count : {1000, 4000, 16000}) {
+        culler.SetInstances(benchmarkTreeField(count));
+        std::string label = "LOD selection " + std::to_string(count) + " trees";
+        rg::bench::Timer timer;
+        culler.Cull(viewProjection, nullptr, viewProjection, view);
+        double ms = timer.ElapsedMs();
+        rg::bench::Report(label + ", triangles with LODs", culler.Stats().triangles, "triangles");
+        rg::bench::Report(label + ", CPU cull and select", ms, "ms");
+        // no pixel error leaves every instance at level 0
+        settings.pixelError = 0.0f;
+        culler.Cull(viewProjection, nullptr, viewProjection, view);
+        rg::bench::Report(label + ", triangles without LODs", culler.Stats().triangles, "triangles");
+        settings.pixelError = configured.pixelError;
+    }
+    settings = configured;
+}
+
+// renders 10k trees in front of the camera, once with the mesh LODs only and once with the far
+// ones as impostors, and times whole frames including the CPU culling
+void benchmarkImpostors(Model &tree, const rg::Impostor &impostor, Shader &treeShader, Shader &impostorShader,
+                        rg::MaterialLibrary &materials, uint16_t treeMaterial, uint16_t impostorMaterial)
+{
+    const int count = 10000, frames = 20;
+    rg::InstanceCuller culler(tree, nullptr);
+    culler.SetUseGpu(false);
+    culler.SetImpostor(&impostor);
+    culler.SetInstances(benchmarkTreeField(count));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    rg::LodView lodView(glm::vec3(0.0f), 45.0f, SCR_HEIGHT, 0.0f);
+    rg::LodSettings &settings = rg::GlobalLodSettings();
+    bool configured = settings.impostors;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+    for (bool impostors : {false, true}) {
+        settings.impostors = impostors;
+        std::string label = "impostors " + std::to_string(count) + " trees, " + (impostors ? "with" : "without") + " impostors";
+        double ms = 0.0;
+        // the first frames settle the LOD hysteresis and warm up the driver
+        for (int frame = -3; frame < frames; frame++) {
+            glFinish();
+            rg::bench::Timer timer;
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            culler.Cull(projection * view, nullptr, projection * view, lodView);
+            for (int pass = 0; pass < 2; pass++) {
+                Shader &shader = pass == 0 ? treeShader : impostorShader;
+                materials.Bind(pass == 0 ? treeMaterial : impostorMaterial);
+                shader.setVec3("directionalLight.direction", glm::vec3(-1.0f, -0.5f, -1.0f));
+                shader.setVec3("directionalLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
+                shader.setVec3("directionalLight.diffuse", glm::vec3(0.9f, 0.7f, 0.5f));
+                shader.setVec3("directionalLight.specular", glm::vec3(0.05f, 0.05f, 0.05f));
+                shader.setVec3("viewPosition", glm::vec3(0.0f));
+                shader.setMat4("projection", projection);
+                shader.setMat4("view", view);
+                if (pass == 0)
+                    culler.Draw(shader);
+                else
+                    culler.DrawImpostors(shader);
+            }
+            glFinish();
+            if (frame >= 0)
+                ms += timer.ElapsedMs();
+        }
+        rg::bench::Report(label + ", frame time", ms / frames, "ms");
+        rg::bench::Report(label + ", triangles", culler.Stats().triangles, "triangles");
+        rg::bench::Report(label + ", instances as impostors", culler.Stats().impostors, "instances");
+    }
+    settings.impostors = configured;
+}
+
+// renders 4k trees in front of the camera with and without the depth prepass and compares whole
+// frame times with the fragments tree.fs shades per pixel, the overdraw the prepass removes
+void benchmarkDepthPrepass(Model &tree, Shader &treeShader, Shader &prepassShader, rg::MaterialLibrary &materials,
+                           uint16_t treeMaterial)
+{
+    const int count = 4000, frames = 20;
+    rg::InstanceCuller culler(tree, nullptr);
+    culler.SetUseGpu(false);
+    culler.SetInstances(benchmarkTreeField(count));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    rg::LodView lodView(glm::vec3(0.0f), 45.0f, SCR_HEIGHT, 0.0f);
+    GLuint samplesQuery;
+    glGenQueries(1, &samplesQuery);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+    for (bool prepass : {false, true}) {
+        std::string label = "depth prepass " + std::to_string(count) + " trees, " + (prepass ? "with" : "without") + " prepass";
+        double ms = 0.0;
+        GLuint64 samples = 0;
+        for (int frame = -3; frame < frames; frame++) {
+            glFinish();
+            rg::bench::Timer timer;
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            culler.Cull(projection * view, nullptr, projection * view, lodView);
+            if (prepass) {
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                prepassShader.use();
+                prepassShader.setMat4("projection", projection);
+                prepassShader.setMat4("view", view);
+                culler.Draw(prepassShader);
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+            }
+            materials.Bind(treeMaterial);
+            treeShader.setVec3("directionalLight.direction", glm::vec3(-1.0f, -0.5f, -1.0f));
+            treeShader.setVec3("directionalLight.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
+            treeShader.setVec3("directionalLight.diffuse", glm::vec3(0.9f, 0.7f, 0.5f));
+            treeShader.setVec3("directionalLight.specular", glm::vec3(0.05f, 0.05f, 0.05f));
+            treeShader.setVec3("viewPosition", glm::vec3(0.0f));
+            treeShader.setMat4("projection", projection);
+            treeShader.setMat4("view", view);
+            glBeginQuery(GL_SAMPLES_PASSED, samplesQuery);
+            culler.Draw(treeShader);
+            glEndQuery(GL_SAMPLES_PASSED);
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+            glFinish();
+            if (frame >= 0)
+                ms += timer.ElapsedMs();
+            glGetQueryObjectui64v(samplesQuery, GL_QUERY_RESULT, &samples);
+        }
+        rg::bench::Report(label + ", frame time", ms / frames, "ms");
+        rg::bench::Report(label + ", shaded fragments per pixel", (double) samples / (SCR_WIDTH * SCR_HEIGHT), "fragments");
+    }
+    glDeleteQueries(1, &samplesQuery);
+}
+
+// draws the trees of the depth prepass benchmark through the overdraw view and exports the fragments
+// per pixel, once all the rasterized ones and once the ones passing the depth test in draw order
+void benchmarkOverdraw(Model &tree, rg::OverdrawView &overdraw, uint16_t treeMaterial)
+{
+    const int count = 4000;
+    rg::InstanceCuller culler(tree, nullptr);
+    culler.SetUseGpu(false);
+    culler.SetInstances(benchmarkTreeField(count));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    rg::LodView lodView(glm::vec3(0.0f), 45.0f, SCR_HEIGHT, 0.0f);
+    // a few rounds settle the LOD hysteresis
+    for (int frame = 0; frame < 3; frame++)
+        culler.Cull(projection * view, nullptr, projection * view, lodView);
+    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    bool depthTest = overdraw.depthTest;
+    for (bool tested : {false, true}) {
+        overdraw.depthTest = tested;
+        std::string label = "overdraw " + std::to_string(count) + " trees, " + (tested ? "depth tested" : "all fragments");
+        overdraw.Begin(SCR_WIDTH, SCR_HEIGHT, view, projection);
+        culler.Draw(overdraw.Use(treeMaterial, true));
+        overdraw.End();
+        rg::OverdrawView::Stats stats = overdraw.ReadStats();
+        rg::bench::Report(label + ", average per pixel", stats.average, "fragments");
+        rg::bench::Report(label + ", average per covered pixel", stats.averageCovered, "fragments");
+        rg::bench::Report(label + ", max per pixel", stats.max, "fragments");
+    }
+    overdraw.depthTest = depthTest;
+}
+
+// bakes the HLOD proxies for growing prop counts and compares what the props cost from the middle
+// of the scene as separate instances and with the far clusters replaced by their proxies. The draw
+// calls are counted as the cullers and the proxies issue them, the cullers draw every mesh at every
+// level on the GPU path whatever number of instances is left.
+void benchmarkHlod(Model &tree, Model &pumpkin, const HandTexture &treeDiffuse, const HandTexture &pumpkinDiffuse,
+                   Shader *cullShader, Shader &treeShader, Shader &pumpkinShader, Shader &hlodShader)
+{
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 1000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 viewProjection = projection * view;
+    rg::Frustum frustum(viewProjection);
+    rg::LodView lodView(glm::vec3(0.0f), 45.0f, SCR_HEIGHT, 0.0f);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    for (int count : {500, 2000, 8000}) {
+        rg::HlodClusters clusters;
+        std::string label = "HLOD " + std::to_string(count) + " trees and pumpkins";
+        std::vector<glm::mat4> transforms[2] = {scatterProps(count, -13.0f, 3.5f, 5.5f, 1),
+                                                scatterProps(count, -10.0f, 0.03f, 0.05f, 2)};
+        rg::bench::Timer timer;
+        clusters.Build({{&tree, transforms[0], treeDiffuse.Get(), treeDiffuse.layer},
+                        {&pumpkin, transforms[1], pumpkinDiffuse.Get(), pumpkinDiffuse.layer}});
+        rg::bench::Report(label + ", build", timer.ElapsedMs(), "ms");
+        clusters.Update(glm::vec3(0.0f));
+        rg::bench::Report(label + ", clusters", clusters.ClusterCount(), "clusters");
+        rg::bench::Report(label + ", far-field instances", clusters.ClusteredInstances(true), "instances");
+        rg::bench::Report(label + ", far-field triangles without HLOD", clusters.SourceTriangles(true), "triangles");
+        rg::bench::Report(label + ", far-field triangles with HLOD", clusters.ProxyTriangles(true), "triangles");
+        rg::bench::Report(label + ", far-field proxy vertices", clusters.ProxyVertices(true), "vertices");
+
+        rg::InstanceCuller treeCuller(tree, cullShader), pumpkinCuller(pumpkin, cullShader);
+        rg::InstanceCuller *cullers[2] = {&treeCuller, &pumpkinCuller};
+        Shader *shaders[2] = {&treeShader, &pumpkinShader};
+        for (bool hlod : {false, true}) {
+            rg::DrawCalls() = 0;
+            for (int source = 0; source < 2; source++) {
+                cullers[source]->SetInstances(transforms[source]);
+                if (hlod) {
+                    cullers[source]->SetClusters(clusters.InstanceClusters(source));
+                    cullers[source]->SetReplacedClusters(clusters.Replaced());
+                }
+                cullers[source]->Cull(viewProjection, nullptr, viewProjection, lodView);
+                shaders[source]->use();
+                shaders[source]->setMat4("projection", projection);
+                shaders[source]->setMat4("view", view);
+                cullers[source]->Draw(*shaders[source]);
+            }
+            if (hlod) {
+                hlodShader.use();
+                hlodShader.setMat4("projection", projection);
+                hlodShader.setMat4("view", view);
+                hlodShader.setMat4("model", glm::mat4(1.0f));
+                clusters.Draw(hlodShader, [&](const rg::AABB &bounds) { return frustum.Intersects(bounds); });
+            }
+            rg::bench::Report(label + ", prop draws " + (hlod ? "with" : "without") + " HLOD", rg::DrawCalls(), "draws");
+        }
+    }
+}
+
+// times a frame's worth of material setup, the uniforms the render loop used to set by name for each
+// shader against binding the materials with their parameter blocks
+void benchmarkMaterials(rg::MaterialLibrary &materials)
+{
+    const int frames = 1000;
+    size_t namedCalls = 0, blockCalls = 0;
+    glFinish();
+    rg::bench::Timer namedTimer;
+    for (int frame = 0; frame < frames; frame++)
+        for (uint16_t id = 0; id < materials.Count(); id++) {
+            const rg::Material &material = materials.Get(id);
+            material.shader->use();
+            material.shader->setFloat("material.shininess", material.parameters.shininess);
+            material.shader->setVec3("material.specular", glm::vec3(material.parameters.specular));
+            material.shader->setFloat("alpha", material.parameters.alpha);
+            for (size_t unit = 0; unit < material.textures.size(); unit++) {
+                glActiveTexture(GL_TEXTURE0 + unit);
+                glBindTexture(GL_TEXTURE_2D, material.textures[unit].texture);
+                rg::GpuMemory::Instance().Touch(material.textures[unit].texture);
+                material.shader->setInt(material.textures[unit].sampler, unit);
+            }
+            namedCalls += 3 + material.textures.size();
+        }
+    glFinish();
+    double namedMs = namedTimer.ElapsedMs() / frames;
+
+    rg::bench::Timer blockTimer;
+    for (int frame = 0; frame < frames; frame++)
+        for (uint16_t id = 0; id < materials.Count(); id++) {
+            materials.Bind(id);
+            blockCalls += 1 + materials.Get(id).textures.size();
+        }
+    glFinish();
+    double blockMs = blockTimer.ElapsedMs() / frames;
+    materials.EndFrame();
+    glActiveTexture(GL_TEXTURE0);
+
+    rg::bench::Report("material setup per frame, uniforms by name", namedMs, "ms");
+    rg::bench::Report("material setup per frame, parameter blocks", blockMs, "ms");
+    rg::bench::Report("material uniform calls per frame, uniforms by name", namedCalls / frames, "calls");
+    rg::bench::Report("material uniform calls per frame, parameter blocks", blockCalls / frames, "calls");
+}
 
+int main(int argc, char **argv) {
+    // --bench runs the micro-benchmarks after loading and writes bench_output.json
+    bool benchmarkMode = argc > 1 && strcmp(argv[1], "--bench") == 0;
+    // --compress-textures converts the material textures to block compressed KTX files in resources/cache
+    bool compressTextures = argc > 1 && strcmp(argv[1], "--compress-textures") == 0;
+    rg::texture::CompressOnLoad() = compressTextures;
 
-int main() {
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
+    // terminates GLFW when main returns, declared first so the GL objects owned by main's locals
+    // are deleted while the context still exists
+    struct GlfwSession {
+        ~GlfwSession() { glfwTerminate(); }
+    } glfwSession;
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -188,7 +1186,6 @@ int main() {
     GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
         return -1;
     }
     glfwMakeContextCurrent(window);
@@ -196,6 +1193,7 @@ int main() {
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
     glfwSetKeyCallback(window, key_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
     // tell GLFW to capture our mouse
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -205,12 +1203,31 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    if (!rg::gl43::load((GLADloadproc) glfwGetProcAddress))
+        std::cout << "OpenGL 4.3 not available, culling falls back to the CPU" << std::endl;
 
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(true);
 
     programState = new ProgramState;
     programState->LoadFromFile("resources/program_state.txt");
+    // --texture-quality full|half|quarter overrides the saved tier for this run
+    rg::texture::Quality textureQuality = (rg::texture::Quality) programState->textureQuality;
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], "--texture-quality") == 0 && !rg::texture::ParseQuality(argv[i + 1], textureQuality))
+            std::cout << "Unknown texture quality " << argv[i + 1] << ", expected full, half or quarter" << std::endl;
+    rg::texture::GlobalQuality() = textureQuality;
+    // --lod-bias <levels> overrides the saved LOD bias for this run
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], "--lod-bias") == 0)
+            programState->lodBias = std::strtof(argv[i + 1], nullptr);
+    // material textures stream their large mips in as objects come close, --no-texture-streaming
+    // loads them whole. The converter and the benchmarks want every level right away.
+    // Texture arrays hold whole mip chains, so the textures going there aren't streamed.
+    rg::TextureStreamer::Instance().enabled = !benchmarkMode && !compressTextures && !programState->textureArrays;
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--no-texture-streaming") == 0)
+            rg::TextureStreamer::Instance().enabled = false;
     if (programState->ImGuiEnabled) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
@@ -284,12 +1301,12 @@ int main() {
             1.0f, -1.0f,  1.0f
     };
 
-    unsigned int skyboxVAO, skyboxVBO;
-    glGenVertexArrays(1, &skyboxVAO);
-    glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+    rg::GLVertexArray skyboxVAO = rg::GLVertexArray::Create();
+    rg::GLBuffer skyboxVBO = rg::GLBuffer::Create();
+    glBindVertexArray(skyboxVAO.Get());
+    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO.Get());
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    rg::GpuMemory::Instance().TrackBuffer(skyboxVBO.Get(), rg::GpuMemory::ModelGeometry, sizeof(skyboxVertices));
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 
@@ -301,39 +1318,69 @@ int main() {
             FileSystem::getPath("resources/textures/skybox/front.jpg"),
             FileSystem::getPath("resources/textures/skybox/back.jpg")
     };
-    unsigned int cubemapTexture = loadCubemap(skyBoxSides);
+    rg::GLTexture cubemapTexture = loadCubemap(skyBoxSides);
 
     // build and compile shaders
     // -------------------------
-    Shader treeShader("resources/shaders/tree.vs", "resources/shaders/tree.fs");
-    Shader batShader("resources/shaders/bat.vs", "resources/shaders/bat.fs");
+    // the shaders of the textured models sample texture arrays when those are on
+    std::vector<std::string> materialDefines;
+    if (programState->textureArrays)
+        materialDefines.push_back("TEXTURE_ARRAYS");
+    Shader treeShader("resources/shaders/tree.vs", "resources/shaders/tree.fs", nullptr, materialDefines);
+    Shader batShader("resources/shaders/bat.vs", "resources/shaders/bat.fs", nullptr, materialDefines);
     Shader moonShader("resources/shaders/moon.vs", "resources/shaders/moon.fs");
-    Shader pumpkinShader("resources/shaders/pumpkin.vs", "resources/shaders/pumpkin.fs");
+    Shader pumpkinShader("resources/shaders/pumpkin.vs", "resources/shaders/pumpkin.fs", nullptr, materialDefines);
     Shader groundShader("resources/shaders/ground.vs", "resources/shaders/ground.fs");
     Shader screenShader("resources/shaders/screen.vs", "resources/shaders/screen.fs");
     Shader hdrShader("resources/shaders/hdr.vs", "resources/shaders/hdr.fs");
     Shader skyBoxShader("resources/shaders/skybox.vs", "resources/shaders/skybox.fs");
+    Shader treeInstancedShader("resources/shaders/tree_instanced.vs", "resources/shaders/tree.fs", nullptr, materialDefines);
+    Shader pumpkinInstancedShader("resources/shaders/pumpkin_instanced.vs", "resources/shaders/pumpkin.fs", nullptr,
+                                  materialDefines);
+    // HLOD proxies are baked in world space with the atlas as their only texture
+    Shader hlodShader("resources/shaders/hlod.vs", "resources/shaders/hlod.fs");
+    // octahedral impostors, baked at load and drawn as camera facing quads
+    Shader impostorBakeShader("resources/shaders/impostor_bake.vs", "resources/shaders/impostor_bake.fs");
+    Shader impostorShader("resources/shaders/impostor.vs", "resources/shaders/impostor.fs");
+    Shader occlusionBoxShader("resources/shaders/occlusion_box.vs", "resources/shaders/occlusion_box.fs");
+    // positions only, for the depth prepass of the materials with expensive fragment shaders
+    Shader depthPrepassShader("resources/shaders/depth_prepass.vs", "resources/shaders/depth_prepass.fs");
+    Shader depthPrepassInstancedShader("resources/shaders/depth_prepass.vs", "resources/shaders/depth_prepass.fs", nullptr,
+                                       {"INSTANCED"});
+    // the overdraw view counts fragments with the prepass' vertex shader
+    Shader overdrawShader("resources/shaders/depth_prepass.vs", "resources/shaders/overdraw.fs");
+    Shader overdrawInstancedShader("resources/shaders/depth_prepass.vs", "resources/shaders/overdraw.fs", nullptr,
+                                   {"INSTANCED"});
+    Shader overdrawViewShader("resources/shaders/hdr.vs", "resources/shaders/overdraw_view.fs");
+    rg::OverdrawView overdraw(overdrawShader, overdrawInstancedShader, overdrawViewShader);
+    Shader *cullShader = nullptr;
+    Shader *hiZShader = nullptr;
+    if (rg::gl43::available()) {
+        cullShader = new Shader("resources/shaders/cull.cs");
+        hiZShader = new Shader("resources/shaders/hiz.cs");
+    }
 
     // configure floating point framebuffer
     // ------------------------------------
-    unsigned int hdrFBO;
-    glGenFramebuffers(1, &hdrFBO);
+    rg::GLFramebuffer hdrFBO = rg::GLFramebuffer::Create();
     // create floating point color buffer
-    unsigned int colorBuffer;
-    glGenTextures(1, &colorBuffer);
-    glBindTexture(GL_TEXTURE_2D, colorBuffer);
+    rg::GLTexture colorBuffer = rg::GLTexture::Create();
+    glBindTexture(GL_TEXTURE_2D, colorBuffer.Get());
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+    rg::GpuMemory::Instance().TrackTexture(colorBuffer.Get(), rg::GpuMemory::RenderTarget, (size_t) SCR_WIDTH * SCR_HEIGHT * 8);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // create depth buffer (renderbuffer)
-    unsigned int rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
+    // create depth buffer (texture, so the Hi-Z pyramid can be built from it)
+    rg::GLTexture depthTexture = rg::GLTexture::Create();
+    glBindTexture(GL_TEXTURE_2D, depthTexture.Get());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SCR_WIDTH, SCR_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    rg::GpuMemory::Instance().TrackTexture(depthTexture.Get(), rg::GpuMemory::RenderTarget, (size_t) SCR_WIDTH * SCR_HEIGHT * 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     // attach buffers
-    glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffer, 0);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+    glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO.Get());
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffer.Get(), 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture.Get(), 0);
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "Framebuffer not complete!" << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -341,21 +1388,209 @@ int main() {
 
     // load models
     // -----------
+    rg::bench::Timer modelLoadTimer;
+    // declared before the models, whose meshes point at it once they use its layers
+    rg::TextureArrayPool textureArrays;
     Model treeModel("resources/objects/tree/uploads_files_855516_Tree.obj");
     treeModel.SetShaderTextureNamePrefix("material.");
 
     Model pumpkinModel("resources/objects/bundeva/Pumpkin.obj");
     pumpkinModel.SetShaderTextureNamePrefix("material.");
 
-    Model batModel("resources/objects/bat/Bat.obj");
+    // only picked and drawn one by one, their vertices don't need to stay in memory
+    Model batModel("resources/objects/bat/Bat.obj", false, GeometryPolicy::ReleaseAfterUpload);
     batModel.SetShaderTextureNamePrefix("material.");
 
     Model groundModel("resources/objects/ground/terrain.obj");
     groundModel.SetShaderTextureNamePrefix("material.");
 
-    Model moonModel("resources/objects/moon/Moon.obj");
+    Model moonModel("resources/objects/moon/Moon.obj", false, GeometryPolicy::ReleaseAfterUpload);
     moonModel.SetShaderTextureNamePrefix("material.");
 
+    // textures of the materials set up by hand below, loaded once instead of every frame
+    rg::GLTexture groundDiffuseTexture = TextureFromFile("gr_diffuse.jpg", "resources/objects/ground");
+    rg::GLTexture groundSpecularTexture = TextureFromFile("specular.png", "resources/objects/ground", false,
+                                                          rg::texture::Usage::Data);
+    HandTexture treeDiffuseTexture(TextureFromFile("tree_diff.jpg", "resources/objects/tree"));
+    HandTexture treeHeightTexture(TextureFromFile("tree_height.jpg", "resources/objects/tree", false, rg::texture::Usage::Data));
+    HandTexture treeNormalTexture(TextureFromFile("tree_normal.jpg", "resources/objects/tree", false,
+                                                  rg::texture::Usage::NormalMap));
+    HandTexture pumpkinDiffuseTexture(TextureFromFile("Pumpkin_diff_sketfab.jpg", "resources/objects/bundeva"));
+    HandTexture pumpkinEmissiveTexture(TextureFromFile("Pumpkin_lum_Sketchfab.jpg", "resources/objects/bundeva"));
+    HandTexture pumpkinNormalTexture(TextureFromFile("Pumpkin_nrml.jpg", "resources/objects/bundeva", false,
+                                                     rg::texture::Usage::NormalMap));
+    // the textured models and their hand set up textures go into a few texture arrays, the shaders
+    // drawing them are built as their TEXTURE_ARRAYS variants
+    HandTexture *handTextures[] = {&treeDiffuseTexture, &treeHeightTexture, &treeNormalTexture,
+                                   &pumpkinDiffuseTexture, &pumpkinEmissiveTexture, &pumpkinNormalTexture};
+    if (programState->textureArrays) {
+        for (Model *model : {&treeModel, &pumpkinModel, &batModel})
+            model->AddTextures(textureArrays);
+        for (HandTexture *texture : handTextures)
+            textureArrays.Add(texture->Get());
+        textureArrays.Build();
+        for (Model *model : {&treeModel, &pumpkinModel, &batModel})
+            model->UseTextureArrays(textureArrays);
+        for (HandTexture *texture : handTextures)
+            texture->MoveTo(textureArrays);
+    }
+
+    // every shader variant with its textures and parameters is a material, the parameter blocks go
+    // into one uniform buffer here and are only bound from then on
+    rg::MaterialLibrary materials(textureArrays);
+    rg::MaterialParameters parameters;
+    uint16_t groundMaterial = materials.Add("ground", groundShader, parameters, {
+            rg::Material::Texture("material.texture_diffuse1", groundDiffuseTexture.Get(), rg::TextureArrayPool::Layer(), DiffuseLayer),
+            rg::Material::Texture("material.texture_specular1", groundSpecularTexture.Get(), rg::TextureArrayPool::Layer(), SpecularLayer)});
+    uint16_t batMaterial = materials.Add("bat", batShader, parameters);
+    parameters.parallaxScale = 0.05f;
+    uint16_t treeMaterial = materials.Add("tree", treeShader, parameters, {
+            treeDiffuseTexture.ForMaterial("material.texture_diffuse1", DiffuseLayer),
+            treeHeightTexture.ForMaterial("material.texture_height1", HeightLayer),
+            treeNormalTexture.ForMaterial("material.texture_normal1", NormalLayer)});
+    uint16_t treeInstancedMaterial = materials.Add("tree instanced", treeInstancedShader, parameters);
+    uint16_t treeImpostorMaterial = materials.Add("tree impostors", impostorShader, parameters);
+    parameters = rg::MaterialParameters();
+    parameters.alpha = 0.9f;
+    parameters.emissiveStrength = 0.1f;
+    uint16_t pumpkinMaterial = materials.Add("pumpkin", pumpkinShader, parameters, {
+            pumpkinDiffuseTexture.ForMaterial("material.texture_diffuse1", DiffuseLayer),
+            pumpkinEmissiveTexture.ForMaterial("material.texture_emissive1", EmissiveLayer),
+            pumpkinNormalTexture.ForMaterial("material.texture_normal1", NormalLayer)});
+    uint16_t pumpkinInstancedMaterial = materials.Add("pumpkin instanced", pumpkinInstancedShader, parameters);
+    parameters = rg::MaterialParameters();
+    parameters.shininess = 256.0f;
+    parameters.specular = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    parameters.alpha = 0.5f;
+    uint16_t moonMaterial = materials.Add("moon", moonShader, parameters);
+    uint16_t moonImpostorMaterial = materials.Add("moon impostor", impostorShader, parameters);
+    parameters = rg::MaterialParameters();
+    uint16_t hlodMaterial = materials.Add("hlod proxies", hlodShader, parameters);
+    materials.Upload();
+    // impostor.fs writes its own depth, a position-only prepass can't reproduce it
+    materials.SetDepthPrepass(treeImpostorMaterial, false);
+    depthPrepassMaterials = {treeMaterial, treeInstancedMaterial};
+
+    // the static props in world space, rebuilt when their transforms change
+    rg::StaticBatch groundBatch, treeBatch, pumpkinBatch;
+    // levels of detail of the two trees and pumpkins, shared by the batched and the separate draws
+    rg::LodSelector treeLods, pumpkinLods;
+    // the moon has no mesh levels, level 1 is its impostor
+    rg::LodSelector moonLods;
+    double modelLoadMs = modelLoadTimer.ElapsedMs();
+    double loadedResidentMB = rg::bench::ProcessMemoryMB("VmRSS"), loadedPeakMB = rg::bench::ProcessMemoryMB("VmHWM");
+    if (compressTextures) {
+        std::cout << "Compressed textures written to " << rg::cache::Directory() << std::endl;
+        glfwSetWindowShouldClose(window, true);
+    }
+
+    // meshlets reorder the indices, so they come before everything cached by the geometry hash
+    treeModel.GenerateMeshlets();
+    pumpkinModel.GenerateMeshlets();
+    // triangle BVHs for exact picking, loaded from resources/cache after the first run
+    treeModel.BuildBVH();
+    pumpkinModel.BuildBVH();
+    batModel.BuildBVH();
+    moonModel.BuildBVH();
+    // simplified levels of the props, cached next to the BVHs
+    treeModel.GenerateLods();
+    pumpkinModel.GenerateLods();
+    // the scattered trees and the moon switch to impostors when they cover few pixels
+    rg::Impostor treeImpostor, moonImpostor;
+    treeImpostor.Bake(treeModel, impostorBakeShader, treeDiffuseTexture.Get(), treeDiffuseTexture.layer, glm::vec3(1.0f));
+    // moon.fs colors the moon without a texture
+    moonImpostor.Bake(moonModel, impostorBakeShader, 0, rg::TextureArrayPool::Layer(),
+                      glm::mix(glm::vec3(1.0f), glm::vec3(0.9f, 1.0f, 0.6f), 0.7f));
+
+    // scattered props
+    // ---------------
+    rg::HiZPyramid *hiZ = nullptr;
+    if (hiZShader)
+        hiZ = new rg::HiZPyramid(*hiZShader, SCR_WIDTH, SCR_HEIGHT);
+    bool hiZValid = false;
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+
+    treeCuller = new rg::InstanceCuller(treeModel, cullShader);
+    treeCuller->SetImpostor(&treeImpostor);
+    pumpkinCuller = new rg::InstanceCuller(pumpkinModel, cullShader);
+    hlodClusters = new rg::HlodClusters;
+    int scatteredPropCount = -1;
+
+    // occlusion tested objects
+    occlusionQueries = new rg::OcclusionQueries(occlusionBoxShader);
+    int treeOcclusion = occlusionQueries->Register("tree 2");
+    int pumpkinOcclusion[2] = {occlusionQueries->Register("pumpkin 1"), occlusionQueries->Register("pumpkin 2")};
+    int batOcclusion[3] = {occlusionQueries->Register("bat 1"), occlusionQueries->Register("bat 2"),
+                           occlusionQueries->Register("bat 3")};
+    int moonOcclusion = occlusionQueries->Register("moon");
+
+    sceneState = new SceneState;
+    int treeObject[2] = {sceneState->Add("tree 1", treeModel), sceneState->Add("tree 2", treeModel)};
+    int pumpkinObject[2] = {sceneState->Add("pumpkin 1", pumpkinModel), sceneState->Add("pumpkin 2", pumpkinModel)};
+    int batObject[3] = {sceneState->Add("bat 1", batModel), sceneState->Add("bat 2", batModel),
+                        sceneState->Add("bat 3", batModel)};
+    int moonObject = sceneState->Add("moon", moonModel);
+
+    // coarse occluders rasterized on the CPU, only the terrain and the big tree are worth it
+    rg::OccluderMesh groundOccluder = rg::OccluderMesh::FromModel(groundModel, 32);
+    // of the big tree only its solid core (the trunk), the branches are too thin to hide things
+    rg::OccluderMesh treeOccluder = rg::OccluderMesh::FromModel(treeModel, 16, rg::OccluderMesh::SolidRegion(treeModel, 32));
+    softwareOcclusion = new rg::SoftwareOcclusion;
+
+    if (benchmarkMode) {
+        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
+                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+        std::vector<rg::OccluderInstance> occluders;
+        for (int i = 0; i < 8; i++) {
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3(-28.0f + 8.0f * i, -13.0f, -20.0f));
+            model = glm::scale(model, glm::vec3(programState->treeScale));
+            occluders.push_back(rg::OccluderInstance{&treeOccluder, model});
+        }
+        softwareOcclusion->Benchmark(projection * programState->camera.GetViewMatrix(), occluders, 50);
+        rg::bench::Report("model loading (" + std::to_string(rg::ThreadPool::Shared().Size()) + " threads)", modelLoadMs, "ms");
+        rg::bench::Report("resident memory after model loading", loadedResidentMB, "MB");
+        rg::bench::Report("peak resident memory after model loading", loadedPeakMB, "MB");
+        benchmarkRaycasts(pumpkinModel, "pumpkin");
+        benchmarkRaycasts(treeModel, "tree");
+        benchmarkObjImport("resources/objects/bundeva/Pumpkin.obj", "pumpkin");
+        benchmarkObjImport("resources/objects/tree/uploads_files_855516_Tree.obj", "tree");
+        for (const char *object : {"bat/Bat", "bundeva/Pumpkin", "moon/Moon", "tree/uploads_files_855516_Tree"})
+            checkObjImport(std::string("resources/objects/") + object + ".obj", object);
+        for (const char *object : {"bat/Bat", "bundeva/Pumpkin", "moon/Moon", "tree/uploads_files_855516_Tree"})
+            checkVertexKernels(std::string("resources/objects/") + object + ".obj", object);
+        benchmarkTextureCompression("resources/objects/ground/specular.png", "ground specular", rg::texture::Usage::Data);
+        benchmarkTextureCompression("resources/objects/bundeva/Pumpkin_diff_sketfab.jpg", "pumpkin diffuse", rg::texture::Usage::Color);
+        benchmarkTextureCompression("resources/objects/bundeva/Pumpkin_nrml.jpg", "pumpkin normal", rg::texture::Usage::NormalMap);
+        benchmarkMipGeneration("resources/objects/bundeva/Pumpkin_diff_sketfab.jpg", "pumpkin diffuse", rg::texture::Usage::Color);
+        benchmarkMipGeneration("resources/objects/bundeva/Pumpkin_nrml.jpg", "pumpkin normal", rg::texture::Usage::NormalMap);
+        benchmarkMipGeneration("resources/objects/bat/DefaultMaterial_Roughness.png", "bat roughness", rg::texture::Usage::Data);
+        benchmarkTextureQuality(skyBoxSides);
+        benchmarkTextureStreaming();
+        benchmarkTextureArrays({{&treeModel, 2}, {&pumpkinModel, 2}, {&batModel, 3}});
+        benchmarkMaterials(materials);
+        benchmarkStaticBatching(treeModel, pumpkinModel);
+        benchmarkLods(pumpkinModel, "pumpkin");
+        benchmarkLods(treeModel, "tree");
+        benchmarkMeshlets(pumpkinModel, "pumpkin");
+        benchmarkMeshlets(treeModel, "tree");
+        benchmarkLodSelection(treeModel);
+        benchmarkImpostors(treeModel, treeImpostor, treeInstancedShader, impostorShader, materials,
+                           treeInstancedMaterial, treeImpostorMaterial);
+        benchmarkHlod(treeModel, pumpkinModel, treeDiffuseTexture, pumpkinDiffuseTexture, cullShader, treeInstancedShader,
+                      pumpkinInstancedShader, hlodShader);
+        benchmarkDepthPrepass(treeModel, treeInstancedShader, depthPrepassInstancedShader, materials, treeInstancedMaterial);
+        benchmarkOverdraw(treeModel, overdraw, treeInstancedMaterial);
+        rg::GpuMemory &gpuMemory = rg::GpuMemory::Instance();
+        for (int category = 0; category < rg::GpuMemory::CategoryCount; category++)
+            rg::bench::Report(std::string("GPU memory ") + rg::GpuMemory::CategoryName((rg::GpuMemory::Category) category),
+                              gpuMemory.Total((rg::GpuMemory::Category) category) / (1024.0 * 1024.0), "MB");
+        rg::bench::Report("GPU memory total", gpuMemory.Total() / (1024.0 * 1024.0), "MB");
+        gpuMemory.WriteJson("gpu_memory.json");
+        rg::bench::WriteJson("bench_output.json");
+        glfwSetWindowShouldClose(window, true);
+    }
+
     DirectionalLight& directionalLight = programState->directionalLight;
     directionalLight.direction = glm::vec3(-10.0f, -5.0f, -2.0f);
     directionalLight.ambient = glm::vec3(0.2, 0.2, 0.2);
@@ -374,6 +1609,11 @@ int main() {
 
     // render loop
     // -----------
+    textureArrayPool = &textureArrays;
+    materialLibrary = &materials;
+    overdrawView = &overdraw;
+    // the overdraw stats are read back now and then, the readback stalls
+    double overdrawStatsTime = 0.0;
 
     hdrShader.use();
     hdrShader.setInt("hdrBuffer", 0);
@@ -381,8 +1621,6 @@ int main() {
     skyBoxShader.use();
     skyBoxShader.setInt("skybox", 0);
 
-    glm::vec3 lightPos(0.5f, 1.0f, 0.3f);
-
     while (!glfwWindowShouldClose(window)) {
         // per-frame time logic
         // --------------------
@@ -402,204 +1640,546 @@ int main() {
 
         // 1. render scene into floating point framebuffer
         // -----------------------------------------------
-        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO.Get());
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // don't forget to enable shader before setting uniforms
-        // bat shader
-        batShader.use();
-        batShader.setVec3("directionalLight.direction",directionalLight.direction);
-        batShader.setVec3("directionalLight.ambient",directionalLight.ambient);
-        batShader.setVec3("directionalLight.diffuse",directionalLight.diffuse);
-        batShader.setVec3("directionalLight.specular",directionalLight.specular);
-
-        batShader.setVec3("viewPosition", programState->camera.Position);
-        batShader.setFloat("material.shininess", 32.0f);
         // view/projection transformations
         glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
                                                 (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = programState->camera.GetViewMatrix();
-        batShader.setMat4("projection", projection);
-        batShader.setMat4("view", view);
-
-        //render bat models
-
         float time = glfwGetTime();
         glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3((programState->batPosition.x)*cos(time),programState->batPosition.y,(programState->batPosition.x)*sin(time)));
-        model = glm::rotate(model, glm::radians(70.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model,glm::vec3(programState->batScale));
-        batShader.setMat4("model", model);
-        batModel.Draw(batShader);
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(-20.0f*cos(time),14.0f,2.0f*sin(time)));
-        model = glm::rotate(model, glm::radians(70.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model,glm::vec3(programState->batScale));
-        batShader.setMat4("model", model);
-        batModel.Draw(batShader);
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(-35.0f*cos(time),20.0f,0.0f*sin(time)));
-        model = glm::rotate(model, glm::radians(70.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model,glm::vec3(programState->batScale));
-        batShader.setMat4("model", model);
-        batModel.Draw(batShader);
-
-        // moon shader
-        moonShader.use();
-        moonShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
-        moonShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
-        moonShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
-        moonShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
-
-        moonShader.setVec3("viewPosition", programState->camera.Position);
-        moonShader.setFloat("material.shininess", 256.0f);
-        moonShader.setFloat("material.specular", 1.0f);
-
-
-        moonShader.setMat4("projection", projection);
-        moonShader.setMat4("view", view);
-
-        moonShader.setFloat("alpha",0.5f);
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(programState->moonPosition));
-        model = glm::rotate(model, glm::radians(float(20 * (glfwGetTime()))), glm::vec3(0.0, 1.0, 0.0));
-        model = glm::scale(model,glm::vec3(programState->moonScale));
-        moonShader.setMat4("model", model);
-        moonModel.Draw(moonShader);
-
-        // tree shader
-        treeShader.use();
-        treeShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
-        treeShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
-        treeShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
-        treeShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
-
-        treeShader.setVec3("viewPosition", programState->camera.Position);
-        treeShader.setFloat("material.shininess", 32.0f);
-
-        treeShader.setMat4("projection", projection);
-        treeShader.setMat4("view", view);
-        treeShader.setVec3("lightPos", lightPos);
-
-        unsigned int diffuseTextureID = TextureFromFile("tree_diff.jpg", "resources/objects/tree");
-        unsigned int heightTextureID = TextureFromFile("tree_height.jpg", "resources/objects/tree");
-        unsigned int normalTextureID = TextureFromFile("tree_normal.jpg", "resources/objects/tree");
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseTextureID);
-        treeShader.setInt("material.texture_diffuse1", 0); 
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, heightTextureID);
-        treeShader.setInt("material.texture_height1", 1);
+        occlusionQueries->BeginFrame(projection * view, programState->camera.Position);
+
+        // object transforms for this frame
+        glm::mat4 groundTransform = glm::mat4(1.0f);
+        groundTransform = glm::translate(groundTransform, glm::vec3(programState->groundPosition));
+        groundTransform = glm::scale(groundTransform, glm::vec3(programState->groundScale));
+
+        glm::mat4 treeTransforms[2];
+        treeTransforms[0] = glm::mat4(1.0f);
+        treeTransforms[0] = glm::translate(treeTransforms[0], glm::vec3(programState->treePosition));
+        treeTransforms[0] = glm::scale(treeTransforms[0], glm::vec3(programState->treeScale));
+        treeTransforms[1] = glm::mat4(1.0f);
+        treeTransforms[1] = glm::translate(treeTransforms[1], glm::vec3(-29.0f, -12.0f, 6.0f));
+        treeTransforms[1] = glm::scale(treeTransforms[1], glm::vec3(4.5f));
+
+        glm::mat4 pumpkinTransforms[2];
+        pumpkinTransforms[0] = glm::mat4(1.0f);
+        pumpkinTransforms[0] = glm::translate(pumpkinTransforms[0], glm::vec3(programState->pumpkinPosition));
+        //pumpkinTransforms[0] = glm::rotate(pumpkinTransforms[0], glm::radians(40.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        pumpkinTransforms[0] = glm::scale(pumpkinTransforms[0], glm::vec3(programState->pumpkinScale));
+        pumpkinTransforms[1] = glm::mat4(1.0f);
+        pumpkinTransforms[1] = glm::translate(pumpkinTransforms[1], glm::vec3(-34.0f, -8.0f, 10.0f));
+        pumpkinTransforms[1] = glm::rotate(pumpkinTransforms[1], glm::radians(35.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        pumpkinTransforms[1] = glm::scale(pumpkinTransforms[1], glm::vec3(programState->pumpkinScale));
+
+        // the bats circle around, their bounds are refitted every frame
+        const glm::vec3 batPositions[3] = {
+                glm::vec3((programState->batPosition.x) * cos(time), programState->batPosition.y, (programState->batPosition.x) * sin(time)),
+                glm::vec3(-20.0f * cos(time), 14.0f, 2.0f * sin(time)),
+                glm::vec3(-35.0f * cos(time), 20.0f, 0.0f * sin(time))
+        };
+        glm::mat4 batTransforms[3];
+        for (int i = 0; i < 3; i++) {
+            batTransforms[i] = glm::mat4(1.0f);
+            batTransforms[i] = glm::translate(batTransforms[i], batPositions[i]);
+            batTransforms[i] = glm::rotate(batTransforms[i], glm::radians(70.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+            batTransforms[i] = glm::scale(batTransforms[i], glm::vec3(programState->batScale));
+        }
 
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, normalTextureID);
-        treeShader.setInt("material.texture_normal1", 2);
+        glm::mat4 moonTransform = glm::mat4(1.0f);
+        moonTransform = glm::translate(moonTransform, glm::vec3(programState->moonPosition));
+        moonTransform = glm::rotate(moonTransform, glm::radians(float(20 * (glfwGetTime()))), glm::vec3(0.0, 1.0, 0.0));
+        moonTransform = glm::scale(moonTransform, glm::vec3(programState->moonScale));
 
+        // the occluders are rasterized on the worker while the GL commands below are issued
+        softwareOcclusion->BeginFrame(projection * view, {rg::OccluderInstance{&groundOccluder, groundTransform},
+                                                          rg::OccluderInstance{&treeOccluder, treeTransforms[0]}});
 
+        // scene BVH: refit, frustum cull, picking and pumpkin light assignment
+        rg::SceneBVH &sceneBVH = sceneState->bvh;
+        for (int i = 0; i < 2; i++) {
+            sceneState->Update(treeObject[i], treeTransforms[i]);
+            sceneState->Update(pumpkinObject[i], pumpkinTransforms[i]);
+        }
+        for (int i = 0; i < 3; i++)
+            sceneState->Update(batObject[i], batTransforms[i]);
+        sceneState->Update(moonObject, moonTransform);
+        sceneBVH.Commit();
+        if (programState->staticBatching) {
+            groundBatch.Update({{&groundModel, groundTransform}});
+            treeBatch.Update({{&treeModel, treeTransforms[0]}, {&treeModel, treeTransforms[1]}});
+            pumpkinBatch.Update({{&pumpkinModel, pumpkinTransforms[0]}, {&pumpkinModel, pumpkinTransforms[1]}});
+        }
 
-        //render tree model
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(programState->treePosition));
-        model = glm::scale(model,glm::vec3(programState->treeScale));
-        treeShader.setMat4("model", model);
-        treeModel.Draw(treeShader);
+        // levels of detail from the projected error of each instance's levels
+        rg::LodSettings &lodSettings = rg::GlobalLodSettings();
+        lodSettings.bias = programState->lodBias;
+        lodSettings.crossFade = programState->lodCrossFade;
+        rg::LodView lodView(programState->camera.Position, programState->camera.Zoom, SCR_HEIGHT, time);
+        rg::LodChoice treeLod[2], pumpkinLod[2];
+        for (int i = 0; i < 2; i++) {
+            treeLod[i] = treeLods.Select(i, treeModel.lodObjectErrors, rg::MaxScale(treeTransforms[i]),
+                                         sceneBVH.Bounds(treeObject[i]), lodView);
+            pumpkinLod[i] = pumpkinLods.Select(i, pumpkinModel.lodObjectErrors, rg::MaxScale(pumpkinTransforms[i]),
+                                               sceneBVH.Bounds(pumpkinObject[i]), lodView);
+        }
+        bool moonAsImpostor = false;
+        if (lodSettings.impostors)
+            moonAsImpostor = moonLods.Select(0, {0.0f, moonImpostor.Error(lodSettings.impostorPixels)}, rg::MaxScale(moonTransform),
+                                             sceneBVH.Bounds(moonObject), lodView).level == 1;
+
+        std::vector<char> &sceneVisible = sceneState->visible;
+        std::fill(sceneVisible.begin(), sceneVisible.end(), 0);
+        sceneBVH.QueryFrustum(rg::Frustum(projection * view), [&](int object) { sceneVisible[object] = 1; });
+
+        // texture streaming: visible objects ask for the mips their size on screen needs. The ground
+        // tiles its textures right under the camera and scattered props can be anywhere, so those
+        // want the top levels whenever they are drawn.
+        rg::TextureStreamer &textureStreamer = rg::TextureStreamer::Instance();
+        for (int object = 0; object < (int) sceneVisible.size(); object++) {
+            if (!sceneVisible[object])
+                continue;
+            float pixels = rg::TextureStreamer::ScreenPixels(sceneBVH.Bounds(object), programState->camera.Position,
+                                                             programState->camera.Zoom, SCR_HEIGHT);
+            for (const Mesh &mesh : sceneState->models[object]->meshes)
+                for (const Texture &texture : mesh.textures)
+                    textureStreamer.Request(texture.id, pixels);
+            if (sceneState->models[object] == &treeModel)
+                for (GLuint texture : {treeDiffuseTexture.Get(), treeHeightTexture.Get(), treeNormalTexture.Get()})
+                    textureStreamer.Request(texture, pixels);
+            if (sceneState->models[object] == &pumpkinModel)
+                for (GLuint texture : {pumpkinDiffuseTexture.Get(), pumpkinEmissiveTexture.Get(), pumpkinNormalTexture.Get()})
+                    textureStreamer.Request(texture, pixels);
+        }
+        for (GLuint texture : {groundDiffuseTexture.Get(), groundSpecularTexture.Get()})
+            textureStreamer.Request(texture, FLT_MAX);
+        for (const Mesh &mesh : groundModel.meshes)
+            for (const Texture &texture : mesh.textures)
+                textureStreamer.Request(texture.id, FLT_MAX);
+        if (treeCuller->Stats().visible > 0)
+            for (GLuint texture : {treeDiffuseTexture.Get(), treeHeightTexture.Get(), treeNormalTexture.Get()})
+                textureStreamer.Request(texture, FLT_MAX);
+        if (pumpkinCuller->Stats().visible > 0)
+            for (GLuint texture : {pumpkinDiffuseTexture.Get(), pumpkinEmissiveTexture.Get(), pumpkinNormalTexture.Get()})
+                textureStreamer.Request(texture, FLT_MAX);
+
+        if (sceneState->pickRequested) {
+            sceneState->pickRequested = false;
+            glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+            glm::vec2 ndc(2.0f * sceneState->pickCursor.x / SCR_WIDTH - 1.0f, 1.0f - 2.0f * sceneState->pickCursor.y / SCR_HEIGHT);
+            glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+            glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+            glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+            rg::Ray ray(origin, glm::normalize(glm::vec3(farPoint) / farPoint.w - origin));
+            // exact test against the triangles of every object whose bounds the ray enters
+            ModelHit pickedHit;
+            rg::RayHit hit = sceneBVH.Raycast(ray, FLT_MAX, [&](int object, float tEntry, float maxT) {
+                glm::mat4 toObject = glm::inverse(sceneState->transforms[object]);
+                rg::Ray objectRay(glm::vec3(toObject * glm::vec4(ray.origin, 1.0f)),
+                                  glm::vec3(toObject * glm::vec4(ray.direction, 0.0f)));
+                ModelHit modelHit = sceneState->models[object]->Raycast(objectRay, maxT);
+                if (modelHit.Hit())
+                    pickedHit = modelHit;
+                return modelHit.t;
+            });
+            sceneState->picked = hit.object;
+            sceneState->pickedHit = pickedHit;
+        }
 
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(-29.0f,-12.0f,6.0f));
-        model = glm::scale(model,glm::vec3(4.5f));
-        treeShader.setMat4("model", model);
-        treeModel.Draw(treeShader);
+        for (int i = 0; i < 2; i++) {
+            std::vector<int> &lit = sceneState->litByPumpkin[i];
+            lit.clear();
+            sceneBVH.QuerySphere(sceneBVH.Bounds(pumpkinObject[i]).Center(), sceneState->pumpkinLightRadius,
+                                 [&](int object) {
+                                     if (object != pumpkinObject[i])
+                                         lit.push_back(object);
+                                 });
+        }
 
+        // cull the scattered props, ahead of the opaque draws for the depth prepass
+        if (scatteredPropCount != programState->propCount) {
+            scatteredPropCount = programState->propCount;
+            std::vector<glm::mat4> trees = scatterProps(scatteredPropCount, -13.0f, 3.5f, 5.5f, 1);
+            std::vector<glm::mat4> pumpkins = scatterProps(scatteredPropCount, -10.0f, 0.03f, 0.05f, 2);
+            treeCuller->SetInstances(trees);
+            pumpkinCuller->SetInstances(pumpkins);
+            hlodClusters->Build({{&treeModel, trees, treeDiffuseTexture.Get(), treeDiffuseTexture.layer},
+                                 {&pumpkinModel, pumpkins, pumpkinDiffuseTexture.Get(), pumpkinDiffuseTexture.layer}});
+            treeCuller->SetClusters(hlodClusters->InstanceClusters(0));
+            pumpkinCuller->SetClusters(hlodClusters->InstanceClusters(1));
+        }
+        glm::mat4 viewProjection = projection * view;
+        const rg::HiZPyramid *occluders = (hiZValid && programState->hiZCulling) ? hiZ : nullptr;
+        treeCuller->SetUseGpu(programState->gpuCulling);
+        pumpkinCuller->SetUseGpu(programState->gpuCulling);
+        // far clusters draw as one proxy, their instances are left out of the culling
+        hlodClusters->enabled = programState->hlod;
+        hlodClusters->Update(programState->camera.Position);
+        treeCuller->SetReplacedClusters(hlodClusters->Replaced());
+        pumpkinCuller->SetReplacedClusters(hlodClusters->Replaced());
+        treeCuller->Cull(viewProjection, occluders, previousViewProjection, lodView);
+        pumpkinCuller->Cull(viewProjection, occluders, previousViewProjection, lodView);
+
+        // the terrain and the big tree go first as occluders, everything else is occlusion tested
+        // don't forget to enable shader before setting uniforms
         //ground shader
-        groundShader.use();
+        materials.Bind(groundMaterial);
         groundShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
         groundShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
         groundShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
         groundShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
 
         groundShader.setVec3("viewPosition", programState->camera.Position);
-        groundShader.setFloat("material.shininess", 32.0f);
 
         groundShader.setMat4("projection", projection);
         groundShader.setMat4("view", view);
 
-        diffuseTextureID = TextureFromFile("gr_diffuse.jpg", "resources/objects/ground");
-        unsigned int specularTextureID = TextureFromFile("specular.png", "resources/objects/ground");
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseTextureID);
-        groundShader.setInt("material.texture_diffuse1", 0);
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, specularTextureID);
-        groundShader.setInt("material.texture_specular1", 1);
-
         //render ground model
 
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(programState->groundPosition));
+        model = groundTransform;
         //model = glm::rotate(model, glm::radians(45.0f), glm::vec3(1.0f, 0.0f, 0.0f));
         //model = glm::rotate(model, glm::radians(-50.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        model = glm::scale(model,glm::vec3(programState->groundScale));
-        groundShader.setMat4("model", model);
-        groundModel.Draw(moonShader);
+        if (programState->staticBatching) {
+            groundShader.setMat4("model", glm::mat4(1.0f));
+            groundBatch.Draw(moonShader, [](const MeshRange &) { return true; });
+        } else {
+            groundShader.setMat4("model", model);
+            groundModel.Draw(moonShader);
+        }
 
+        // the hand-placed props at full detail go meshlet by meshlet, without the ones facing away,
+        // off-screen or behind the software depth buffer when occlusion is set
+        auto drawProp = [&](Model &prop, Shader &shader, const glm::mat4 &transform, const rg::LodChoice &choice, bool occlusion) {
+            if (!programState->meshletCulling || choice.level != 0 || choice.Fading()) {
+                prop.DrawLod(shader, choice);
+                return;
+            }
+            rg::geometry::MeshletView meshletView(projection * view, transform, programState->camera.Position);
+            prop.DrawMeshlets(shader, [&](const rg::geometry::Meshlet &meshlet) {
+                return rg::geometry::MeshletVisible(meshlet, meshletView, meshletStats, [&](const rg::AABB &bounds) {
+                    return !occlusion || softwareOcclusion->IsVisible(bounds);
+                });
+            });
+        };
 
+        // switches each pumpkin's light on for the draw when its sphere query found one of the objects
+        auto enablePumpkinLights = [&](Shader &shader, std::initializer_list<int> objects) {
+            for (int i = 0; i < 2; i++) {
+                const std::vector<int> &lit = sceneState->litByPumpkin[i];
+                bool enabled = false;
+                for (int object : objects)
+                    enabled = enabled || std::find(lit.begin(), lit.end(), object) != lit.end();
+                shader.setBool("pumpkinLightEnabled[" + std::to_string(i) + "]", enabled);
+            }
+        };
 
-        pumpkinShader.use();
+        // the hand-placed trees, the big one is drawn unconditionally as an occluder. The depth
+        // prepass and the main pass draw the same triangles, only the main pass is occlusion queried.
+        auto drawTrees = [&](Shader &shader, bool mainPass) {
+            if (programState->staticBatching) {
+                // batched instances can't be drawn under their own occlusion queries, culling them
+                // against the frustum and the software depth buffer has to do
+                softwareOcclusion->Wait();
+                shader.setMat4("model", glm::mat4(1.0f));
+                // one draw for both trees, the lights fade out at their radius by themselves
+                enablePumpkinLights(shader, {treeObject[0], treeObject[1]});
+                auto visibleTree = [&](const MeshRange &range) {
+                    return range.source == 0 ||
+                           (sceneVisible[treeObject[range.source]] && softwareOcclusion->IsVisible(range.bounds));
+                };
+                auto chooseTree = [&](const MeshRange &range) { return treeLod[range.source]; };
+                if (programState->meshletCulling) {
+                    // the batch's meshlets are in world space already. The big tree is in the software
+                    // depth buffer as its own occluder, its meshlets only get the cone and frustum tests.
+                    rg::geometry::MeshletView meshletView(projection * view, glm::mat4(1.0f), programState->camera.Position);
+                    treeBatch.Draw(shader, visibleTree, chooseTree, [&](const MeshRange &range, const rg::geometry::Meshlet &meshlet) {
+                        return rg::geometry::MeshletVisible(meshlet, meshletView, meshletStats, [&](const rg::AABB &bounds) {
+                            return range.source == 0 || softwareOcclusion->IsVisible(bounds);
+                        });
+                    });
+                } else {
+                    treeBatch.Draw(shader, visibleTree, chooseTree);
+                }
+            } else {
+                model = treeTransforms[0];
+                shader.setMat4("model", model);
+                enablePumpkinLights(shader, {treeObject[0]});
+                // drawn before the software depth buffer is ready
+                drawProp(treeModel, shader, model, treeLod[0], false);
+                softwareOcclusion->Wait();
+
+                model = treeTransforms[1];
+                shader.setMat4("model", model);
+                enablePumpkinLights(shader, {treeObject[1]});
+                if (sceneVisible[treeObject[1]] && softwareOcclusion->IsVisible(treeModel.bounds.Transformed(model))) {
+                    if (mainPass)
+                        occlusionQueries->Begin(treeOcclusion, treeModel.bounds.Transformed(model));
+                    drawProp(treeModel, shader, model, treeLod[1], true);
+                    if (mainPass)
+                        occlusionQueries->End(treeOcclusion);
+                }
+            }
+        };
+
+        // depth prepass: materials with expensive fragment shaders lay down their depth first, so
+        // their main pass shades only the fragments that end up visible (GL_EQUAL, no depth writes)
+        rg::GpuProfiler &profiler = rg::GpuProfiler::Instance();
+        bool treePrepass = programState->depthPrepass && materials.DepthPrepass(treeMaterial);
+        bool scatteredTreePrepass = programState->depthPrepass && materials.DepthPrepass(treeInstancedMaterial);
+        if (treePrepass || scatteredTreePrepass) {
+            profiler.Begin("depth prepass");
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if (treePrepass) {
+                depthPrepassShader.use();
+                depthPrepassShader.setMat4("projection", projection);
+                depthPrepassShader.setMat4("view", view);
+                drawTrees(depthPrepassShader, false);
+            }
+            if (scatteredTreePrepass) {
+                depthPrepassInstancedShader.use();
+                depthPrepassInstancedShader.setMat4("projection", projection);
+                depthPrepassInstancedShader.setMat4("view", view);
+                treeCuller->Draw(depthPrepassInstancedShader);
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            profiler.End();
+        }
+        // what the prepass drew again is not counted twice
+        meshletStats = rg::geometry::MeshletStats();
+
+        // tree shader
+        materials.Bind(treeMaterial);
+        treeShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
+        treeShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
+        treeShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
+        treeShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
+
+        treeShader.setVec3("viewPosition", programState->camera.Position);
+
+        treeShader.setMat4("projection", projection);
+        treeShader.setMat4("view", view);
+        for (int i = 0; i < 2; i++) {
+            std::string light = "pumpkinLights[" + std::to_string(i) + "]";
+            treeShader.setVec3(light + ".position", sceneBVH.Bounds(pumpkinObject[i]).Center());
+            treeShader.setVec3(light + ".color", sceneState->pumpkinLightColor);
+            treeShader.setFloat(light + ".radius", sceneState->pumpkinLightRadius);
+        }
+
+        // the separate trees' fragments can't be counted under their occlusion queries
+        profiler.Begin("trees", programState->staticBatching);
+        if (treePrepass) {
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        drawTrees(treeShader, true);
+        if (treePrepass) {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+        profiler.End();
+
+        materials.Bind(pumpkinMaterial);
         pumpkinShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
         pumpkinShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
         pumpkinShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
         pumpkinShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
-        pumpkinShader.setInt("material.texture_diffuse1", 0);
-        pumpkinShader.setInt("material.texture_specular1", 1);
-        pumpkinShader.setInt("material.texture_normal1", 2);
-        pumpkinShader.setInt("material.texture_emissive1", 3);
-
-        pumpkinShader.setFloat("alpha",0.9f);
-
 
         pumpkinShader.setVec3("viewPosition", programState->camera.Position);
-        pumpkinShader.setFloat("material.shininess", 32.0f);
 
         pumpkinShader.setMat4("projection", projection);
         pumpkinShader.setMat4("view", view);
 
-        diffuseTextureID = TextureFromFile("Pumpkin_diff_sketfab.jpg", "resources/objects/bundeva");
-        unsigned int emissiveTextureID = TextureFromFile("Pumpkin_lum_Sketchfab.jpg", "resources/objects/bundeva");
-        normalTextureID = TextureFromFile("Pumpkin_nrml.jpg", "resources/objects/bundeva");
+        //render pumpkin model
+        // like drawTrees, only the main pass is occlusion queried
+        auto drawPumpkins = [&](Shader &shader, bool mainPass) {
+            if (programState->staticBatching) {
+                shader.setMat4("model", glm::mat4(1.0f));
+                auto visiblePumpkin = [&](const MeshRange &range) {
+                    return sceneVisible[pumpkinObject[range.source]] && softwareOcclusion->IsVisible(range.bounds);
+                };
+                auto choosePumpkin = [&](const MeshRange &range) { return pumpkinLod[range.source]; };
+                if (programState->meshletCulling) {
+                    rg::geometry::MeshletView meshletView(projection * view, glm::mat4(1.0f), programState->camera.Position);
+                    pumpkinBatch.Draw(shader, visiblePumpkin, choosePumpkin, [&](const MeshRange &, const rg::geometry::Meshlet &meshlet) {
+                        return rg::geometry::MeshletVisible(meshlet, meshletView, meshletStats, [&](const rg::AABB &bounds) {
+                            return softwareOcclusion->IsVisible(bounds);
+                        });
+                    });
+                } else {
+                    pumpkinBatch.Draw(shader, visiblePumpkin, choosePumpkin);
+                }
+            } else {
+                for (int i = 0; i < 2; i++) {
+                    model = pumpkinTransforms[i];
+                    shader.setMat4("model", model);
+                    if (sceneVisible[pumpkinObject[i]] && softwareOcclusion->IsVisible(pumpkinModel.bounds.Transformed(model))) {
+                        if (mainPass)
+                            occlusionQueries->Begin(pumpkinOcclusion[i], pumpkinModel.bounds.Transformed(model));
+                        drawProp(pumpkinModel, shader, model, pumpkinLod[i], true);
+                        if (mainPass)
+                            occlusionQueries->End(pumpkinOcclusion[i]);
+                    }
+                }
+            }
+        };
+        drawPumpkins(pumpkinShader, true);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, diffuseTextureID);
-        pumpkinShader.setInt("material.texture_diffuse1", 0);
+        // bat shader
+        materials.Bind(batMaterial);
+        batShader.setVec3("directionalLight.direction",directionalLight.direction);
+        batShader.setVec3("directionalLight.ambient",directionalLight.ambient);
+        batShader.setVec3("directionalLight.diffuse",directionalLight.diffuse);
+        batShader.setVec3("directionalLight.specular",directionalLight.specular);
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, emissiveTextureID);
-        pumpkinShader.setInt("material.texture_emissive1", 1);
+        batShader.setVec3("viewPosition", programState->camera.Position);
+        batShader.setMat4("projection", projection);
+        batShader.setMat4("view", view);
 
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, normalTextureID);
-        pumpkinShader.setInt("normal.texture_height1", 2);
+        //render bat models
 
+        model = batTransforms[0];
+        batShader.setMat4("model", model);
+        if (sceneVisible[batObject[0]] && softwareOcclusion->IsVisible(batModel.bounds.Transformed(model))) {
+            occlusionQueries->Begin(batOcclusion[0], batModel.bounds.Transformed(model));
+            batModel.Draw(batShader);
+            occlusionQueries->End(batOcclusion[0]);
+        }
 
-        //render pumpkin model
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(programState->pumpkinPosition));
-        //model = glm::rotate(model, glm::radians(40.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model,glm::vec3(programState->pumpkinScale));
-        pumpkinShader.setMat4("model", model);
-        pumpkinModel.Draw(pumpkinShader);
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model,glm::vec3(-34.0f,-8.0f,10.0f));
-        model = glm::rotate(model, glm::radians(35.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model,glm::vec3(programState->pumpkinScale));
-        pumpkinShader.setMat4("model", model);
-        pumpkinModel.Draw(pumpkinShader);
+        model = batTransforms[1];
+        batShader.setMat4("model", model);
+        if (sceneVisible[batObject[1]] && softwareOcclusion->IsVisible(batModel.bounds.Transformed(model))) {
+            occlusionQueries->Begin(batOcclusion[1], batModel.bounds.Transformed(model));
+            batModel.Draw(batShader);
+            occlusionQueries->End(batOcclusion[1]);
+        }
+
+        model = batTransforms[2];
+        batShader.setMat4("model", model);
+        if (sceneVisible[batObject[2]] && softwareOcclusion->IsVisible(batModel.bounds.Transformed(model))) {
+            occlusionQueries->Begin(batOcclusion[2], batModel.bounds.Transformed(model));
+            batModel.Draw(batShader);
+            occlusionQueries->End(batOcclusion[2]);
+        }
+
+        // moon shader, or the impostor's when the moon is small on screen
+        Shader &moonDrawShader = moonAsImpostor ? impostorShader : moonShader;
+        materials.Bind(moonAsImpostor ? moonImpostorMaterial : moonMaterial);
+        moonDrawShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
+        moonDrawShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
+        moonDrawShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
+        moonDrawShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
+
+        moonDrawShader.setVec3("viewPosition", programState->camera.Position);
+
+        moonDrawShader.setMat4("projection", projection);
+        moonDrawShader.setMat4("view", view);
+
+        model = moonTransform;
+        moonDrawShader.setMat4("model", model);
+        if (sceneVisible[moonObject] && softwareOcclusion->IsVisible(moonModel.bounds.Transformed(model))) {
+            occlusionQueries->Begin(moonOcclusion, moonModel.bounds.Transformed(model));
+            if (moonAsImpostor)
+                moonImpostor.Draw(impostorShader, model);
+            else
+                moonModel.Draw(moonShader);
+            occlusionQueries->End(moonOcclusion);
+        }
+
+
+        materials.Bind(treeInstancedMaterial);
+        treeInstancedShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
+        treeInstancedShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
+        treeInstancedShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
+        treeInstancedShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
+        treeInstancedShader.setVec3("viewPosition", programState->camera.Position);
+        treeInstancedShader.setMat4("projection", projection);
+        treeInstancedShader.setMat4("view", view);
+        profiler.Begin("scattered trees");
+        if (scatteredTreePrepass) {
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        treeCuller->Draw(treeInstancedShader);
+        if (scatteredTreePrepass) {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+        profiler.End();
+
+        materials.Bind(treeImpostorMaterial);
+        impostorShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
+        impostorShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
+        impostorShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
+        impostorShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
+        impostorShader.setVec3("viewPosition", programState->camera.Position);
+        impostorShader.setMat4("projection", projection);
+        impostorShader.setMat4("view", view);
+        treeCuller->DrawImpostors(impostorShader);
+
+        materials.Bind(pumpkinInstancedMaterial);
+        pumpkinInstancedShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
+        pumpkinInstancedShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
+        pumpkinInstancedShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
+        pumpkinInstancedShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
+        pumpkinInstancedShader.setVec3("viewPosition", programState->camera.Position);
+        pumpkinInstancedShader.setMat4("projection", projection);
+        pumpkinInstancedShader.setMat4("view", view);
+        pumpkinCuller->Draw(pumpkinInstancedShader);
+
+        if (hlodClusters->ReplacedCount() > 0) {
+            materials.Bind(hlodMaterial);
+            hlodShader.setVec3("directionalLight.direction",glm::vec3(-1.0f,-0.5f,-1.0f));
+            hlodShader.setVec3("directionalLight.ambient",glm::vec3(0.1f,0.1f,0.1f));
+            hlodShader.setVec3("directionalLight.diffuse",glm::vec3(0.9f,0.7f,0.5f));
+            hlodShader.setVec3("directionalLight.specular",glm::vec3(0.05f,0.05f,0.05f));
+            hlodShader.setVec3("viewPosition", programState->camera.Position);
+            hlodShader.setMat4("projection", projection);
+            hlodShader.setMat4("view", view);
+            rg::Frustum frustum(viewProjection);
+            hlodClusters->Draw(hlodShader, [&](const rg::AABB &bounds) { return frustum.Intersects(bounds); });
+        }
+
+        // overdraw view: the geometry again, into the fragment counters. The impostors build their
+        // quads in impostor.vs and are left out, and the hardware occlusion queries aren't applied.
+        if (programState->overdrawView) {
+            // the meshlet stats stay the main pass' ones
+            rg::geometry::MeshletStats frameMeshletStats = meshletStats;
+            overdraw.Begin(SCR_WIDTH, SCR_HEIGHT, view, projection);
+            Shader &groundCount = overdraw.Use(groundMaterial);
+            if (programState->staticBatching) {
+                groundCount.setMat4("model", glm::mat4(1.0f));
+                groundBatch.Draw(groundCount, [](const MeshRange &) { return true; });
+            } else {
+                groundCount.setMat4("model", groundTransform);
+                groundModel.Draw(groundCount);
+            }
+            drawTrees(overdraw.Use(treeMaterial), false);
+            drawPumpkins(overdraw.Use(pumpkinMaterial), false);
+            Shader &batCount = overdraw.Use(batMaterial);
+            for (int i = 0; i < 3; i++) {
+                batCount.setMat4("model", batTransforms[i]);
+                if (sceneVisible[batObject[i]] && softwareOcclusion->IsVisible(batModel.bounds.Transformed(batTransforms[i])))
+                    batModel.Draw(batCount);
+            }
+            if (!moonAsImpostor && sceneVisible[moonObject] &&
+                softwareOcclusion->IsVisible(moonModel.bounds.Transformed(moonTransform))) {
+                Shader &moonCount = overdraw.Use(moonMaterial);
+                moonCount.setMat4("model", moonTransform);
+                moonModel.Draw(moonCount);
+            }
+            treeCuller->Draw(overdraw.Use(treeInstancedMaterial, true));
+            pumpkinCuller->Draw(overdraw.Use(pumpkinInstancedMaterial, true));
+            if (hlodClusters->ReplacedCount() > 0) {
+                // the proxies are baked in world space
+                Shader &hlodCount = overdraw.Use(hlodMaterial);
+                hlodCount.setMat4("model", glm::mat4(1.0f));
+                rg::Frustum frustum(viewProjection);
+                hlodClusters->Draw(hlodCount, [&](const rg::AABB &bounds) { return frustum.Intersects(bounds); });
+            }
+            overdraw.End();
+            meshletStats = frameMeshletStats;
+        }
 
         // draw skyboxa
         glDepthMask(GL_FALSE);
@@ -609,9 +2189,10 @@ int main() {
         skyBoxShader.setMat4("view", view);
         skyBoxShader.setMat4("projection", projection);
         // skybox cube
-        glBindVertexArray(skyboxVAO);
+        glBindVertexArray(skyboxVAO.Get());
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture.Get());
+        rg::GpuMemory::Instance().Touch(cubemapTexture.Get());
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glBindVertexArray(0);
         glDepthFunc(GL_LESS);
@@ -620,15 +2201,29 @@ int main() {
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+        // occluder depth for the next frame's culling
+        if (hiZ) {
+            hiZ->Build(depthTexture.Get());
+            hiZValid = true;
+        }
+        previousViewProjection = viewProjection;
+
         // 2. now render floating point color buffer to 2D quad and tonemap HDR colors to default framebuffer's (clamped) color range
         // --------------------------------------------------------------------------------------------------------------------------
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         hdrShader.use();
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, colorBuffer);
+        glBindTexture(GL_TEXTURE_2D, colorBuffer.Get());
         hdrShader.setInt("hdr", hdr);
         hdrShader.setFloat("exposure", exposure);
         renderQuad();
+        if (programState->overdrawView) {
+            overdraw.Display([] { renderQuad(); });
+            if (programState->ImGuiEnabled && overdraw.StatsOutdated() && glfwGetTime() - overdrawStatsTime > 0.5) {
+                overdrawStats = overdraw.ReadStats();
+                overdrawStatsTime = glfwGetTime();
+            }
+        }
 
 
         if (programState->ImGuiEnabled)
@@ -636,18 +2231,38 @@ int main() {
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
+        rg::TextureStreamer::Instance().Update();
+        textureArrays.EndFrame();
+        materials.EndFrame();
+        rg::GpuMemory::Instance().EndFrame();
+        rg::GpuProfiler::Instance().EndFrame(SCR_WIDTH * SCR_HEIGHT);
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
     programState->SaveToFile("resources/program_state.txt");
+    textureArrayPool = nullptr;
+    materialLibrary = nullptr;
+    overdrawView = nullptr;
+    delete treeCuller;
+    delete pumpkinCuller;
+    delete hlodClusters;
+    delete occlusionQueries;
+    rg::GpuProfiler::Instance().Release();
+    delete softwareOcclusion;
+    delete sceneState;
+    delete hiZ;
+    delete cullShader;
+    delete hiZShader;
     delete programState;
+    // the quad lives in globals, which would otherwise outlive the context
+    quadVAO.Reset();
+    quadVBO.Reset();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
-    // glfw: terminate, clearing all previously allocated GLFW resources.
-    // ------------------------------------------------------------------
-    glfwTerminate();
+    // glfw: terminate, clearing all previously allocated GLFW resources, once the locals are gone.
+    // -------------------------------------------------------------------------------------------
     return 0;
 }
 
@@ -688,11 +2303,9 @@ void processInput(GLFWwindow *window) {
         exposure += 0.001f;
     }
 }
-unsigned int quadVAO = 0;
-unsigned int quadVBO;
 void renderQuad()
 {
-    if (quadVAO == 0)
+    if (!quadVAO)
     {
         float quadVertices[] = {
                 // positions        // texture Coords
@@ -702,18 +2315,19 @@ void renderQuad()
                 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
         };
         // setup plane VAO
-        glGenVertexArrays(1, &quadVAO);
-        glGenBuffers(1, &quadVBO);
-        glBindVertexArray(quadVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        quadVAO = rg::GLVertexArray::Create();
+        quadVBO = rg::GLBuffer::Create();
+        glBindVertexArray(quadVAO.Get());
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO.Get());
         glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+        rg::GpuMemory::Instance().TrackBuffer(quadVBO.Get(), rg::GpuMemory::ModelGeometry, sizeof(quadVertices));
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     }
 
-    glBindVertexArray(quadVAO);
+    glBindVertexArray(quadVAO.Get());
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     glBindVertexArray(0);
 }
@@ -759,6 +2373,109 @@ void DrawImGui(ProgramState *programState) {
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
+    {
+        ImGui::Begin("Culling");
+        ImGui::SliderInt("Props per model", &programState->propCount, 0, 10000);
+        ImGui::Checkbox("Static batching", &programState->staticBatching);
+        if (rg::gl43::available()) {
+            ImGui::Checkbox("GPU culling", &programState->gpuCulling);
+            ImGui::Checkbox("Hi-Z occlusion", &programState->hiZCulling);
+        } else {
+            ImGui::Text("Compute shaders unavailable, culling on the CPU");
+        }
+        const rg::CullStats &trees = treeCuller->Stats();
+        const rg::CullStats &pumpkins = pumpkinCuller->Stats();
+        ImGui::Text("Trees: %u / %u visible (%s)", trees.visible, trees.tested, trees.gpu ? "GPU" : "CPU");
+        ImGui::Text("Pumpkins: %u / %u visible (%s)", pumpkins.visible, pumpkins.tested, pumpkins.gpu ? "GPU" : "CPU");
+        rg::LodSettings &lodSettings = rg::GlobalLodSettings();
+        ImGui::SliderFloat("LOD bias", &programState->lodBias, -2.0f, 4.0f);
+        ImGui::SliderFloat("LOD pixel error", &lodSettings.pixelError, 0.25f, 8.0f);
+        ImGui::SliderFloat("LOD hysteresis", &lodSettings.hysteresis, 0.0f, 0.9f);
+        ImGui::Checkbox("LOD cross-fade", &programState->lodCrossFade);
+        for (const rg::CullStats *props : {&trees, &pumpkins})
+            ImGui::Text("%s per LOD: %u %u %u %u %u, %zu triangles", props == &trees ? "Trees" : "Pumpkins", props->levels[0],
+                        props->levels[1], props->levels[2], props->levels[3], props->levels[4], props->triangles);
+        ImGui::Checkbox("Impostors", &lodSettings.impostors);
+        ImGui::SliderFloat("Impostor size (pixels)", &lodSettings.impostorPixels, 8.0f, 256.0f);
+        ImGui::Text("Trees as impostors: %u", trees.impostors);
+        ImGui::Checkbox("Depth prepass", &programState->depthPrepass);
+        for (uint16_t id : depthPrepassMaterials) {
+            if (!materialLibrary)
+                break;
+            bool prepass = materialLibrary->DepthPrepass(id);
+            if (ImGui::Checkbox(("Prepass " + materialLibrary->Get(id).name).c_str(), &prepass))
+                materialLibrary->SetDepthPrepass(id, prepass);
+        }
+        ImGui::Checkbox("Meshlet culling", &programState->meshletCulling);
+        ImGui::Text("Meshlets: %zu tested, %zu backfacing, %zu outside, %zu occluded", meshletStats.meshlets,
+                    meshletStats.backfacing, meshletStats.outside, meshletStats.occluded);
+        ImGui::Text("Meshlet triangles: %zu / %zu drawn", meshletStats.drawnTriangles, meshletStats.triangles);
+        ImGui::Checkbox("HLOD proxies", &programState->hlod);
+        ImGui::SliderFloat("HLOD distance", &hlodClusters->switchDistance, 20.0f, 200.0f);
+        ImGui::Text("HLOD: %zu / %zu clusters replaced, %zu proxy triangles for %zu source triangles",
+                    hlodClusters->ReplacedCount(), hlodClusters->ClusterCount(), hlodClusters->ProxyTriangles(),
+                    hlodClusters->SourceTriangles());
+        ImGui::End();
+    }
+    occlusionQueries->DrawImGui();
+    softwareOcclusion->DrawImGui();
+    rg::GpuMemory::Instance().DrawImGui();
+    rg::GpuProfiler::Instance().DrawImGui();
+
+    {
+        ImGui::Begin("Overdraw");
+        ImGui::Checkbox("Overdraw view", &programState->overdrawView);
+        if (overdrawView) {
+            int mode = overdrawView->mode;
+            if (ImGui::Combo("Show", &mode, "Fragments per pixel\0Last material\0"))
+                overdrawView->mode = (rg::OverdrawView::Mode) mode;
+            ImGui::Checkbox("Depth test", &overdrawView->depthTest);
+            ImGui::SliderFloat("Heatmap max", &overdrawView->heatmapMax, 1.0f, 32.0f);
+            ImGui::Text("Fragments per pixel: %.2f average, %.2f where covered, %.0f max", overdrawStats.average,
+                        overdrawStats.averageCovered, overdrawStats.max);
+            if (overdrawView->mode == rg::OverdrawView::LastMaterial && materialLibrary)
+                for (size_t id = 0; id < materialLibrary->Count(); id++) {
+                    glm::vec3 color = rg::OverdrawView::MaterialColor(id);
+                    ImGui::TextColored(ImVec4(color.r, color.g, color.b, 1.0f), "%s", materialLibrary->Get(id).name.c_str());
+                }
+        }
+        ImGui::End();
+    }
+    rg::TextureStreamer::Instance().DrawImGui();
+
+    {
+        ImGui::Begin("Scene");
+        const rg::SceneBVH &bvh = sceneState->bvh;
+        int visible = std::count(sceneState->visible.begin(), sceneState->visible.end(), 1);
+        ImGui::Text("BVH: %zu objects, %zu nodes", bvh.ObjectCount(), bvh.Nodes().size());
+        ImGui::Text("In frustum: %d", visible);
+        ImGui::Text("Picked: %s", sceneState->picked >= 0 ? sceneState->names[sceneState->picked].c_str() : "nothing");
+        if (sceneState->picked >= 0) {
+            const ModelHit &hit = sceneState->pickedHit;
+            ImGui::Text("Mesh %d, triangle %d at distance %.2f", hit.mesh, hit.triangle, hit.t);
+            ImGui::Text("Barycentrics (%.3f, %.3f, %.3f), UV (%.3f, %.3f)", hit.barycentrics.x, hit.barycentrics.y,
+                        hit.barycentrics.z, hit.uv.x, hit.uv.y);
+        }
+        ImGui::DragFloat("Pumpkin light radius", &sceneState->pumpkinLightRadius, 0.5f, 0.0f, 100.0f);
+        ImGui::Combo("Texture quality (next start)", &programState->textureQuality, "Full\0Half\0Quarter\0");
+        ImGui::Checkbox("Texture arrays (next start)", &programState->textureArrays);
+        if (textureArrayPool && textureArrayPool->LayerCount() > 0)
+            ImGui::Text("%zu textures in %zu arrays (%.1f MB), %zu binds last frame, %zu skipped",
+                        textureArrayPool->LayerCount(), textureArrayPool->ArrayCount(), textureArrayPool->Bytes() / (1024.0 * 1024.0),
+                        textureArrayPool->BindsLastFrame(), textureArrayPool->SkippedBindsLastFrame());
+        if (materialLibrary)
+            ImGui::Text("%zu materials (%zu bytes of parameter blocks), %zu block binds last frame, %zu skipped",
+                        materialLibrary->Count(), materialLibrary->Bytes(), materialLibrary->BindsLastFrame(),
+                        materialLibrary->SkippedBindsLastFrame());
+        for (int i = 0; i < 2; i++) {
+            std::string lit;
+            for (int object : sceneState->litByPumpkin[i])
+                lit += (lit.empty() ? "" : ", ") + sceneState->names[object];
+            ImGui::Text("Pumpkin %d lights: %s", i + 1, lit.empty() ? "-" : lit.c_str());
+        }
+        ImGui::End();
+    }
+
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
@@ -774,3 +2491,14 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
         }
     }
 }
+
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods) {
+    // left click picks an object while the cursor is free
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && programState->ImGuiEnabled &&
+        !ImGui::GetIO().WantCaptureMouse) {
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        sceneState->pickRequested = true;
+        sceneState->pickCursor = glm::vec2(x, y);
+    }
+}